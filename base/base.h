@@ -611,6 +611,16 @@ isize buffer_read(Bytes_Buffer* bb, byte* dest, isize size);
 // Push bytes to the end of builder, returns success status
 bool buffer_write(Bytes_Buffer* bb, byte const* b, isize len);
 
+// Reserve n bytes at the end of the buffer, returns a pointer to write them or
+// NULL on failure. Bytes are only added to the buffer by buffer_commit.
+byte* buffer_reserve(Bytes_Buffer* bb, isize n);
+
+// Add n bytes previously written to the memory returned by buffer_reserve
+static inline
+void buffer_commit(Bytes_Buffer* bb, isize n){
+	bb->len += n;
+}
+
 // Current unread bytes, this pointer becomes invalid as soon as the buffer is modified.
 byte* buffer_bytes(Bytes_Buffer* bb);
 
@@ -678,12 +688,19 @@ isize buffer_read(Bytes_Buffer* bb, byte* dest, isize size){
 	return n;
 }
 
-bool buffer_write(Bytes_Buffer* bb, byte const* bytes, isize len){
-	if(bb->len + bb->last_read + len > bb->cap){
-		bool status = buffer_resize(bb, bb->cap * 2);
-		if(!status){ return false; }
+byte* buffer_reserve(Bytes_Buffer* bb, isize n){
+	isize required = bb->last_read + bb->len + n;
+	if(required > bb->cap){
+		bool status = buffer_resize(bb, Max(bb->cap * 2, required));
+		if(!status){ return NULL; }
 	}
-	mem_copy(&bb->data[bb->last_read + bb->len], bytes, len);
+	return &bb->data[bb->last_read + bb->len];
+}
+
+bool buffer_write(Bytes_Buffer* bb, byte const* bytes, isize len){
+	byte* dest = buffer_reserve(bb, len);
+	if(dest == NULL){ return false; }
+	mem_copy(dest, bytes, len);
 	bb->len += len;
 	return true;
 }
@@ -692,7 +709,7 @@ bool buffer_resize(Bytes_Buffer* bb, isize new_size){
 	byte* new_data = New(byte, new_size, bb->allocator);
 	if(new_data == NULL){ return false; }
 
-	mem_copy(new_data, bb->data, Min(new_size, bb->len));
+	mem_copy(new_data, bb->data, Min(new_size, bb->last_read + bb->len));
 	mem_free(bb->allocator, bb->data);
 	bb->data = new_data;
 	bb->cap = new_size;
@@ -715,6 +732,483 @@ IO_Stream buffer_stream(Bytes_Buffer* bb){
 
 #endif
 
+// Longest text written by fmt_u64 and fmt_i64
+#define FMT_INT_MAX_LEN 20
+
+// Longest text written by fmt_f64
+#define FMT_F64_MAX_LEN 24
+
+// Write v in decimal to buf, which must have room for FMT_INT_MAX_LEN bytes.
+// Returns number of bytes written.
+isize fmt_u64(byte* buf, u64 v);
+
+// Write v in decimal to buf, which must have room for FMT_INT_MAX_LEN bytes.
+// Returns number of bytes written.
+isize fmt_i64(byte* buf, i64 v);
+
+// Write the shortest decimal that reads back as exactly v to buf, which must
+// have room for FMT_F64_MAX_LEN bytes. Returns number of bytes written. The
+// result always has a '.' or an exponent ("2.0", "0.001", "1e+300", "-5e-324"),
+// infinities and NaNs are written as "inf", "-inf" and "nan". Does not depend
+// on the locale.
+isize fmt_f64(byte* buf, f64 v);
+
+// Append v in decimal to buffer, returns success status
+bool buffer_write_u64(Bytes_Buffer* bb, u64 v);
+
+// Append v in decimal to buffer, returns success status
+bool buffer_write_i64(Bytes_Buffer* bb, i64 v);
+
+// Append v to buffer as written by fmt_f64, returns success status
+bool buffer_write_f64(Bytes_Buffer* bb, f64 v);
+
+// Write v in decimal, returns the result of io_write
+isize io_write_u64(IO_Writer w, u64 v);
+
+// Write v in decimal, returns the result of io_write
+isize io_write_i64(IO_Writer w, i64 v);
+
+// Write v as written by fmt_f64, returns the result of io_write
+isize io_write_f64(IO_Writer w, f64 v);
+
+#ifdef BASE_C_IMPLEMENTATION
+
+static const char fmt_digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const u64 fmt_pow10[20] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+	100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+	10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+	100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+};
+
+// Number of decimal digits of v
+static inline
+isize fmt_u64_len(u64 v){
+	// Digits of 2^bits, one too many when v is below the matching power of ten.
+	// Powers of ten are even, so or-ing 1 in (to count 1 digit for 0) changes nothing.
+	v |= 1;
+	isize t = ((64 - __builtin_clzll(v)) * 1233) >> 12;
+	return t + 1 - (v < fmt_pow10[t]);
+}
+
+// Write the len digits of v ending at end, two at a time
+static inline
+void fmt_digits(byte* end, u64 v){
+	while(v >= 100){
+		u64 q = v / 100;
+		u32 r = (u32)(v - q * 100);
+		end -= 2;
+		mem_copy(end, &fmt_digit_pairs[r * 2], 2);
+		v = q;
+	}
+	if(v >= 10){
+		mem_copy(end - 2, &fmt_digit_pairs[v * 2], 2);
+	} else {
+		end[-1] = (byte)('0' + v);
+	}
+}
+
+isize fmt_u64(byte* buf, u64 v){
+	isize len = fmt_u64_len(v);
+	fmt_digits(buf + len, v);
+	return len;
+}
+
+isize fmt_i64(byte* buf, i64 v){
+	if(v >= 0){ return fmt_u64(buf, (u64)v); }
+	buf[0] = '-';
+	return 1 + fmt_u64(buf + 1, 0 - (u64)v);
+}
+
+// Shortest float to decimal conversion is Ryu (Ulf Adams, "Ryu: Fast
+// Float-to-String Conversion", PLDI 2018), with its small tables: 128-bit
+// approximations of 5^i and 5^-i are computed from every 26th power, plus a
+// per-power correction of 0 to 3 stored in 2 bits.
+typedef unsigned __int128 Fmt_U128;
+
+#define FMT_POW5_BITCOUNT     125
+#define FMT_POW5_INV_BITCOUNT 125
+#define FMT_POW5_TABLE_SIZE   26
+
+// 5^i, for i up to FMT_POW5_TABLE_SIZE
+static const u64 fmt_pow5[FMT_POW5_TABLE_SIZE] = {
+	1ull, 5ull, 25ull, 125ull, 625ull, 3125ull, 15625ull, 78125ull, 390625ull,
+	1953125ull, 9765625ull, 48828125ull, 244140625ull, 1220703125ull, 6103515625ull,
+	30517578125ull, 152587890625ull, 762939453125ull, 3814697265625ull,
+	19073486328125ull, 95367431640625ull, 476837158203125ull, 2384185791015625ull,
+	11920928955078125ull, 59604644775390625ull, 298023223876953125ull,
+};
+
+// 5^(26*i) with its 125 top bits, low word first
+static const u64 fmt_pow5_split[13][2] = {
+	{ 0x0000000000000000ull, 0x1000000000000000ull },
+	{ 0x0000000000000000ull, 0x14adf4b7320334b9ull },
+	{ 0x0e549208b31adb10ull, 0x1aba4714957d300dull },
+	{ 0x6dc6ad264d8f0866ull, 0x1145b7e285bf98f5ull },
+	{ 0xeb1dbd923d8596caull, 0x1652efdc6018a1fcull },
+	{ 0xb4c1b80b22ae923cull, 0x1cda62055b2d9d83ull },
+	{ 0x5bb28b4e8f7e4c30ull, 0x12a5568b9f52f416ull },
+	{ 0xf08aed437682d4fbull, 0x1819651531f9e78full },
+	{ 0xb4ee134ad99bf150ull, 0x1f25c186a6f04c28ull },
+	{ 0x16499ecb70c25f03ull, 0x1420eb449c8842e6ull },
+	{ 0x85a56ead360865b0ull, 0x1a03fde214caf085ull },
+	{ 0x093db1d57999890bull, 0x10cfeb353a97dad8ull },
+	{ 0xcf38bb735e3f36acull, 0x15baaf44fa52673eull },
+};
+
+// Corrections of the computed 5^i, 2 bits each
+static const u32 fmt_pow5_offsets[21] = {
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x40000000, 0x59695995,
+	0x55545555, 0x56555515, 0x41150504, 0x40555410, 0x44555145, 0x44504540,
+	0x45555550, 0x40004000, 0x96440440, 0x55565565, 0x54454045, 0x40154151,
+	0x55559155, 0x51405555, 0x00000105,
+};
+
+// 2^(bits(5^(26*i)) - 1 + 125) / 5^(26*i), rounded up, low word first
+static const u64 fmt_pow5_inv_split[13][2] = {
+	{ 0x0000000000000001ull, 0x2000000000000000ull },
+	{ 0x52a6c95fc0655034ull, 0x18c240c4aecb13bbull },
+	{ 0x7ca8d50071dfc806ull, 0x1327fc58da0f6ff5ull },
+	{ 0x6520247d3556476eull, 0x1da48ce468e7c702ull },
+	{ 0x6139cdd76802e6e9ull, 0x16ef5b40c2fc7779ull },
+	{ 0xf951a7ff43de8c79ull, 0x11bebdf578b2f391ull },
+	{ 0x7be8bee8d6e957e8ull, 0x1b758d848fac54b0ull },
+	{ 0x8bd3f9e999a423eaull, 0x153eda614071a3b7ull },
+	{ 0x0848f973cb3ee3ceull, 0x10701bd527b4978cull },
+	{ 0x153285ebb9efbfa2ull, 0x196fbb9bb44db44dull },
+	{ 0xadeee7f86c07b696ull, 0x13ae3591f5b4d936ull },
+	{ 0x4d686a4eaf182222ull, 0x1e74404f3daada91ull },
+	{ 0x98c0a106e09ebd9full, 0x17900ea4fda7c257ull },
+};
+
+// Corrections of the computed 5^-i, 2 bits each
+static const u32 fmt_pow5_inv_offsets[19] = {
+	0x54544554, 0x04055545, 0x10041000, 0x00400414, 0x40010000, 0x41155555,
+	0x00000454, 0x00010044, 0x40000000, 0x44000041, 0x50454450, 0x55550054,
+	0x51655554, 0x40004000, 0x01000001, 0x00010500, 0x51515411, 0x05555554,
+	0x00000000,
+};
+
+// Bits of 5^e (1 for e = 0), for e up to 3528
+static inline
+i32 fmt_pow5_bits(i32 e){
+	return (i32)(((u32)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)), for e up to 1650
+static inline
+u32 fmt_log10_pow2(i32 e){
+	return ((u32)e * 78913) >> 18;
+}
+
+// floor(log10(5^e)), for e up to 2620
+static inline
+u32 fmt_log10_pow5(i32 e){
+	return ((u32)e * 732923) >> 20;
+}
+
+static inline
+bool fmt_multiple_of_pow5(u64 v, u32 p){
+	u32 count = 0;
+	for(; v % 5 == 0; v /= 5){ count += 1; }
+	return count >= p;
+}
+
+static inline
+bool fmt_multiple_of_pow2(u64 v, u32 p){
+	return (v & ((1ull << p) - 1)) == 0;
+}
+
+// 5^i with its 125 top bits
+static
+Fmt_U128 fmt_compute_pow5(u32 i){
+	u32 base = i / FMT_POW5_TABLE_SIZE;
+	u32 base2 = base * FMT_POW5_TABLE_SIZE;
+	u64 const* mul = fmt_pow5_split[base];
+	if(i == base2){ return ((Fmt_U128)mul[1] << 64) | mul[0]; }
+
+	u64 m = fmt_pow5[i - base2];
+	Fmt_U128 b0 = (Fmt_U128)m * mul[0];
+	Fmt_U128 b2 = (Fmt_U128)m * mul[1];
+	u32 delta = fmt_pow5_bits(i) - fmt_pow5_bits(base2);
+	return (b0 >> delta) + (b2 << (64 - delta)) + ((fmt_pow5_offsets[i / 16] >> ((i % 16) << 1)) & 3);
+}
+
+// 2^(bits(5^i) - 1 + 125) / 5^i, rounded up
+static
+Fmt_U128 fmt_compute_pow5_inv(u32 i){
+	u32 base = (i + FMT_POW5_TABLE_SIZE - 1) / FMT_POW5_TABLE_SIZE;
+	u32 base2 = base * FMT_POW5_TABLE_SIZE;
+	u64 const* mul = fmt_pow5_inv_split[base];
+	if(i == base2){ return ((Fmt_U128)mul[1] << 64) | mul[0]; }
+
+	u64 m = fmt_pow5[base2 - i];
+	Fmt_U128 b0 = (Fmt_U128)m * (mul[0] - 1);
+	Fmt_U128 b2 = (Fmt_U128)m * mul[1];
+	u32 delta = fmt_pow5_bits(base2) - fmt_pow5_bits(i);
+	return (b0 >> delta) + (b2 << (64 - delta)) + 1 + ((fmt_pow5_inv_offsets[i / 16] >> ((i % 16) << 1)) & 3);
+}
+
+// (m * mul) >> j, for j >= 64
+static inline
+u64 fmt_mul_shift(u64 m, Fmt_U128 mul, i32 j){
+	Fmt_U128 b0 = (Fmt_U128)m * (u64)mul;
+	Fmt_U128 b2 = (Fmt_U128)m * (u64)(mul >> 64);
+	return (u64)(((b0 >> 64) + b2) >> (j - 64));
+}
+
+// Shortest decimal mantissa * 10^exponent within the rounding interval of a
+// finite, non-zero double, given its raw fields
+static
+u64 fmt_f64_shortest(u64 ieee_mantissa, u32 ieee_exponent, i32* exponent){
+	i32 e2;
+	u64 m2;
+	if(ieee_exponent == 0){
+		e2 = 1 - 1023 - 52 - 2;
+		m2 = ieee_mantissa;
+	} else {
+		e2 = (i32)ieee_exponent - 1023 - 52 - 2;
+		m2 = (1ull << 52) | ieee_mantissa;
+	}
+	// Bounds are part of the interval when ties round to v (even mantissa)
+	bool accept_bounds = (m2 & 1) == 0;
+
+	// Interval [mm, mp] around mv = 4 * m2, its lower half is narrower at
+	// powers of two
+	u64 mv = 4 * m2;
+	u32 mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+	// Scale the interval to a decimal power, vr, vp and vm are the scaled mv, mp and mm
+	u64 vr, vp, vm;
+	i32 e10;
+	bool vm_trailing_zeros = false;
+	bool vr_trailing_zeros = false;
+	if(e2 >= 0){
+		u32 q = fmt_log10_pow2(e2) - (e2 > 3);
+		e10 = (i32)q;
+		i32 k = FMT_POW5_INV_BITCOUNT + fmt_pow5_bits(q) - 1;
+		i32 i = -e2 + (i32)q + k;
+		Fmt_U128 mul = fmt_compute_pow5_inv(q);
+		vr = fmt_mul_shift(4 * m2, mul, i);
+		vp = fmt_mul_shift(4 * m2 + 2, mul, i);
+		vm = fmt_mul_shift(4 * m2 - 1 - mm_shift, mul, i);
+		if(q <= 21){
+			// Only one of mp, mv and mm can be a multiple of 5, if any
+			if(mv % 5 == 0){
+				vr_trailing_zeros = fmt_multiple_of_pow5(mv, q);
+			} else if(accept_bounds){
+				vm_trailing_zeros = fmt_multiple_of_pow5(mv - 1 - mm_shift, q);
+			} else {
+				vp -= fmt_multiple_of_pow5(mv + 2, q);
+			}
+		}
+	} else {
+		u32 q = fmt_log10_pow5(-e2) - (-e2 > 1);
+		e10 = (i32)q + e2;
+		i32 i = -e2 - (i32)q;
+		i32 k = fmt_pow5_bits(i) - FMT_POW5_BITCOUNT;
+		i32 j = (i32)q - k;
+		Fmt_U128 mul = fmt_compute_pow5((u32)i);
+		vr = fmt_mul_shift(4 * m2, mul, j);
+		vp = fmt_mul_shift(4 * m2 + 2, mul, j);
+		vm = fmt_mul_shift(4 * m2 - 1 - mm_shift, mul, j);
+		if(q <= 1){
+			// mv has at least q trailing zeros as it is a multiple of 4
+			vr_trailing_zeros = true;
+			if(accept_bounds){
+				vm_trailing_zeros = mm_shift == 1;
+			} else {
+				vp -= 1;
+			}
+		} else if(q < 63){
+			vr_trailing_zeros = fmt_multiple_of_pow2(mv, q);
+		}
+	}
+
+	// Drop digits while the interval still holds a shorter decimal
+	i32 removed = 0;
+	u8 last_removed = 0;
+	u64 output;
+	if(vm_trailing_zeros || vr_trailing_zeros){
+		// Exact ties, rare
+		while(vp / 10 > vm / 10){
+			vm_trailing_zeros &= vm % 10 == 0;
+			vr_trailing_zeros &= last_removed == 0;
+			last_removed = (u8)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed += 1;
+		}
+		if(vm_trailing_zeros){
+			while(vm % 10 == 0){
+				vr_trailing_zeros &= last_removed == 0;
+				last_removed = (u8)(vr % 10);
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed += 1;
+			}
+		}
+		// Exactly halfway: round to even
+		if(vr_trailing_zeros && last_removed == 5 && vr % 2 == 0){ last_removed = 4; }
+		output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+	} else {
+		bool round_up = false;
+		if(vp / 100 > vm / 100){
+			u32 r = (u32)(vr % 100);
+			round_up = r >= 50;
+			vr /= 100;
+			vp /= 100;
+			vm /= 100;
+			removed += 2;
+		}
+		while(vp / 10 > vm / 10){
+			round_up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed += 1;
+		}
+		output = vr + (vr == vm || round_up);
+	}
+
+	*exponent = e10 + removed;
+	return output;
+}
+
+isize fmt_f64(byte* buf, f64 v){
+	u64 bits;
+	mem_copy(&bits, &v, sizeof(bits));
+	u64 ieee_mantissa = bits & ((1ull << 52) - 1);
+	u32 ieee_exponent = (u32)(bits >> 52) & 0x7ff;
+	bool negative = (bits >> 63) != 0;
+
+	if(ieee_exponent == 0x7ff && ieee_mantissa != 0){
+		mem_copy(buf, "nan", 3);
+		return 3;
+	}
+
+	byte* p = buf;
+	if(negative){ *p++ = '-'; }
+	if(ieee_exponent == 0x7ff){
+		mem_copy(p, "inf", 3);
+		return p + 3 - buf;
+	}
+	if(ieee_exponent == 0 && ieee_mantissa == 0){
+		mem_copy(p, "0.0", 3);
+		return p + 3 - buf;
+	}
+
+	i32 exponent;
+	u64 mantissa = fmt_f64_shortest(ieee_mantissa, ieee_exponent, &exponent);
+	// Rounding up may have left trailing zeros
+	while(mantissa % 10 == 0){
+		mantissa /= 10;
+		exponent += 1;
+	}
+
+	// Value is d.ddd * 10^point
+	isize len = fmt_u64_len(mantissa);
+	i32 point = exponent + (i32)len - 1;
+
+	if(point >= 0 && point < 16){
+		if(len <= point + 1){
+			// Integer, padded with zeros
+			fmt_digits(p + len, mantissa);
+			p += len;
+			mem_set(p, '0', point + 1 - len);
+			p += point + 1 - len;
+			mem_copy(p, ".0", 2);
+			p += 2;
+		} else {
+			// Fraction has no trailing zeros, but may have leading ones
+			isize fraction_len = len - point - 1;
+			u64 scale = fmt_pow10[fraction_len];
+			fmt_digits(p + point + 1, mantissa / scale);
+			p[point + 1] = '.';
+			mem_set(p + point + 2, '0', fraction_len);
+			fmt_digits(p + len + 1, mantissa % scale);
+			p += len + 1;
+		}
+	}
+	else if(point < 0 && point >= -5){
+		isize zeros = -point - 1;
+		mem_copy(p, "0.", 2);
+		mem_set(p + 2, '0', zeros);
+		p += 2 + zeros;
+		fmt_digits(p + len, mantissa);
+		p += len;
+	}
+	else {
+		fmt_digits(p + len + 1, mantissa);
+		p[0] = p[1];
+		if(len > 1){
+			p[1] = '.';
+			p += len + 1;
+		} else {
+			p += 1;
+		}
+		*p++ = 'e';
+		*p++ = point < 0 ? '-' : '+';
+		p += fmt_u64(p, (u64)(point < 0 ? -point : point));
+	}
+	return p - buf;
+}
+
+bool buffer_write_u64(Bytes_Buffer* bb, u64 v){
+	byte* dest = buffer_reserve(bb, FMT_INT_MAX_LEN);
+	if(dest == NULL){ return false; }
+	buffer_commit(bb, fmt_u64(dest, v));
+	return true;
+}
+
+bool buffer_write_i64(Bytes_Buffer* bb, i64 v){
+	byte* dest = buffer_reserve(bb, FMT_INT_MAX_LEN);
+	if(dest == NULL){ return false; }
+	buffer_commit(bb, fmt_i64(dest, v));
+	return true;
+}
+
+bool buffer_write_f64(Bytes_Buffer* bb, f64 v){
+	byte* dest = buffer_reserve(bb, FMT_F64_MAX_LEN);
+	if(dest == NULL){ return false; }
+	buffer_commit(bb, fmt_f64(dest, v));
+	return true;
+}
+
+isize io_write_u64(IO_Writer w, u64 v){
+	byte buf[FMT_INT_MAX_LEN];
+	return io_write(w, buf, fmt_u64(buf, v));
+}
+
+isize io_write_i64(IO_Writer w, i64 v){
+	byte buf[FMT_INT_MAX_LEN];
+	return io_write(w, buf, fmt_i64(buf, v));
+}
+
+isize io_write_f64(IO_Writer w, f64 v){
+	byte buf[FMT_F64_MAX_LEN];
+	return io_write(w, buf, fmt_f64(buf, v));
+}
+
+#undef FMT_POW5_BITCOUNT
+#undef FMT_POW5_INV_BITCOUNT
+#undef FMT_POW5_TABLE_SIZE
+
+#endif
+
 typedef struct {
 	isize offset;
 	isize capacity;
@@ -812,6 +1306,165 @@ void arena_destroy(Mem_Arena* a){
 }
 #endif
 
+#include <stdatomic.h>
+
+// Arena that can be shared by many threads. Threads carve private chunks out
+// of it with an atomic bump and then allocate from their chunk without any
+// synchronization. Freeing all memory must not race with allocations.
+typedef struct {
+	atomic_intptr_t offset;
+	atomic_uint_least64_t generation; // Changes on free all, invalidating thread chunks
+	isize capacity;
+	isize chunk_size;
+	byte* data;
+} Mem_Concurrent_Arena;
+
+#define CONCURRENT_ARENA_DEFAULT_CHUNK (64 * 1024)
+
+void concurrent_arena_init(Mem_Concurrent_Arena* a, byte* data, isize len, isize chunk_size);
+void concurrent_arena_destroy(Mem_Concurrent_Arena* a);
+Mem_Allocator concurrent_arena_allocator(Mem_Concurrent_Arena* a);
+
+#ifdef BASE_C_IMPLEMENTATION
+
+#define CONCURRENT_ARENA_THREAD_SLOTS 4
+
+// Generations are unique across all arenas, so a thread never reuses a chunk
+// of a destroyed arena that happened to live at the same address
+static atomic_uint_least64_t concurrent_arena_generation_counter = 1;
+
+typedef struct {
+	u64 generation;
+	uintptr current;
+	uintptr end;
+} Concurrent_Arena_Chunk;
+
+static _Thread_local Concurrent_Arena_Chunk concurrent_arena_chunks[CONCURRENT_ARENA_THREAD_SLOTS];
+
+// Atomically bump the shared offset, returns the start of the block or 0 when out of memory
+static
+uintptr concurrent_arena_bump(Mem_Concurrent_Arena* a, isize nbytes){
+	isize offset = atomic_fetch_add_explicit(&a->offset, nbytes, memory_order_relaxed);
+	if(offset + nbytes > a->capacity){ return 0; }
+	return (uintptr)&a->data[offset];
+}
+
+static
+void* concurrent_arena_alloc(Mem_Concurrent_Arena* a, isize size, isize align){
+	debug_assert(mem_valid_alignment(align), "Alignment must be a power of 2");
+
+	// Big allocations go straight to the shared arena
+	if(size + align > a->chunk_size / 4){
+		uintptr block = concurrent_arena_bump(a, size + align - 1);
+		if(block == 0){ return NULL; }
+		return (void*)align_forward_ptr(block, align);
+	}
+
+	u64 generation = atomic_load_explicit(&a->generation, memory_order_acquire);
+	Concurrent_Arena_Chunk* chunk = NULL;
+	for(isize i = 0; i < CONCURRENT_ARENA_THREAD_SLOTS; i += 1){
+		if(concurrent_arena_chunks[i].generation == generation){
+			chunk = &concurrent_arena_chunks[i];
+			break;
+		}
+	}
+
+	if(chunk != NULL){
+		uintptr aligned = align_forward_ptr(chunk->current, align);
+		if(aligned + size <= chunk->end){
+			chunk->current = aligned + size;
+			return (void*)aligned;
+		}
+	}
+	else {
+		// Slots are in the order their arenas were first cached, evict the
+		// oldest one. Refilling the chunk of a cached arena keeps its slot.
+		mem_copy(&concurrent_arena_chunks[0], &concurrent_arena_chunks[1],
+			sizeof(Concurrent_Arena_Chunk) * (CONCURRENT_ARENA_THREAD_SLOTS - 1));
+		chunk = &concurrent_arena_chunks[CONCURRENT_ARENA_THREAD_SLOTS - 1];
+	}
+
+	uintptr block = concurrent_arena_bump(a, a->chunk_size);
+	if(block == 0){
+		*chunk = (Concurrent_Arena_Chunk){0};
+		return NULL;
+	}
+	*chunk = (Concurrent_Arena_Chunk){
+		.generation = generation,
+		.current = block,
+		.end = block + a->chunk_size,
+	};
+
+	uintptr aligned = align_forward_ptr(chunk->current, align);
+	chunk->current = aligned + size;
+	return (void*)aligned;
+}
+
+static
+void concurrent_arena_free_all(Mem_Concurrent_Arena* a){
+	u64 generation = atomic_fetch_add(&concurrent_arena_generation_counter, 1);
+	atomic_store_explicit(&a->offset, 0, memory_order_relaxed);
+	atomic_store_explicit(&a->generation, generation, memory_order_release);
+}
+
+static
+void* concurrent_arena_allocator_func(
+	void* impl,
+	enum Allocator_Op op,
+	void* old_ptr,
+	isize size,
+	isize align,
+	i32* capabilities)
+{
+	Mem_Concurrent_Arena* a = impl;
+	(void)old_ptr;
+
+	switch(op){
+		case Mem_Op_Alloc: {
+			return concurrent_arena_alloc(a, size, align);
+		} break;
+
+		case Mem_Op_Free_All: {
+			concurrent_arena_free_all(a);
+		} break;
+
+		case Mem_Op_Resize: {} break;
+
+		case Mem_Op_Free: {} break;
+
+		case Mem_Op_Query: {
+			*capabilities = Allocator_Alloc_Any | Allocator_Free_All | Allocator_Align_Any;
+		} break;
+	}
+
+	return NULL;
+}
+
+Mem_Allocator concurrent_arena_allocator(Mem_Concurrent_Arena* a){
+	Mem_Allocator allocator = {
+		.data = a,
+		.func = concurrent_arena_allocator_func,
+	};
+	return allocator;
+}
+
+void concurrent_arena_init(Mem_Concurrent_Arena* a, byte* data, isize len, isize chunk_size){
+	a->capacity = len;
+	a->data = data;
+	a->chunk_size = chunk_size > 0 ? chunk_size : CONCURRENT_ARENA_DEFAULT_CHUNK;
+	atomic_init(&a->offset, 0);
+	atomic_init(&a->generation, atomic_fetch_add(&concurrent_arena_generation_counter, 1));
+}
+
+void concurrent_arena_destroy(Mem_Concurrent_Arena* a){
+	concurrent_arena_free_all(a);
+	a->capacity = 0;
+	a->data = NULL;
+}
+
+#undef CONCURRENT_ARENA_THREAD_SLOTS
+#endif
+
 
 Mem_Allocator heap_allocator();
 
@@ -882,6 +1535,9 @@ isize file_write(String path, byte const* data, isize n);
 // (negative means error).
 isize file_append(String path, byte const* data, isize n);
 
+// Create a stream over an open C file, closing the file is up to the caller
+IO_Stream file_stream(FILE* f);
+
 #ifdef BASE_C_IMPLEMENTATION
 
 #include <stdio.h>
@@ -910,6 +1566,38 @@ isize file_append(String path, byte const* data, isize n){
 	return _file_add_content(path_buf, "ab", data, n);
 }
 
+static
+isize file_io_func(void* impl, IO_Operation op, byte* data, isize len){
+	FILE* f = (FILE*)(impl);
+	switch(op){
+	case IO_Op_Query: {
+		return IO_Op_Read | IO_Op_Write;
+	} break;
+
+	case IO_Op_Read: {
+		isize n = fread(data, 1, len, f);
+		if(n == 0 && len > 0){ return feof(f) ? IO_Err_End : IO_Err_Unknown; }
+		return n;
+	} break;
+
+	case IO_Op_Write: {
+		isize n = fwrite(data, 1, len, f);
+		if(n < len){ return IO_Err_Unknown; }
+		return n;
+	} break;
+	}
+
+	return 0;
+}
+
+IO_Stream file_stream(FILE* f){
+	IO_Stream s = {
+		.impl = f,
+		.func = file_io_func,
+	};
+	return s;
+}
+
 Bytes file_read_all(String path, Mem_Allocator allocator){
 	static const Bytes error = {0, 0};
 
@@ -0,0 +1,92 @@
+// Allocation throughput of the concurrent arena at 1 to 32 threads, against a
+// plain Mem_Arena behind a mutex, which is what sharing one needed before.
+// Every thread makes the same number of small allocations (8 to 128 bytes);
+// the arena is reset with mem_free_all between runs.
+#include "bench.h"
+
+#include <pthread.h>
+
+#define ALLOCS_PER_THREAD 200000
+#define BUFFER_SIZE ((isize)1 << 30)
+
+typedef struct {
+	pthread_mutex_t lock;
+	Mem_Allocator inner;
+} Locked_Allocator;
+
+static
+void* locked_allocator_func(void* impl, enum Allocator_Op op, void* old_ptr, isize size, isize align, i32* capabilities){
+	Locked_Allocator* l = impl;
+	pthread_mutex_lock(&l->lock);
+	void* p = l->inner.func(l->inner.data, op, old_ptr, size, align, capabilities);
+	pthread_mutex_unlock(&l->lock);
+	return p;
+}
+
+typedef struct {
+	Mem_Allocator allocator;
+	pthread_barrier_t* start;
+	u64 seed;
+} Worker;
+
+static
+void* worker(void* arg){
+	Worker* w = arg;
+	u64 state = w->seed;
+	pthread_barrier_wait(w->start);
+	for(isize i = 0; i < ALLOCS_PER_THREAD; i += 1){
+		isize size = 8 + (isize)(bench_random(&state) & 120);
+		byte* p = mem_alloc(w->allocator, size, 8);
+		if(p == NULL){ abort(); }
+		p[0] = 1;
+	}
+	return NULL;
+}
+
+// Wall time for every thread to finish its allocations
+static
+i64 run(Mem_Allocator allocator, int threads){
+	pthread_t ids[32];
+	Worker workers[32];
+	pthread_barrier_t start;
+	i64 best = INT64_MAX;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		pthread_barrier_init(&start, NULL, threads + 1);
+		for(int t = 0; t < threads; t += 1){
+			workers[t] = (Worker){ .allocator = allocator, .start = &start, .seed = 0x9e3779b97f4a7c15ull * (t + 1) };
+			pthread_create(&ids[t], NULL, worker, &workers[t]);
+		}
+		i64 begin = bench_now_ns();
+		pthread_barrier_wait(&start);
+		for(int t = 0; t < threads; t += 1){ pthread_join(ids[t], NULL); }
+		best = Min(best, bench_now_ns() - begin);
+		pthread_barrier_destroy(&start);
+		mem_free_all(allocator);
+	}
+	return best;
+}
+
+int main(void){
+	byte* buffer = malloc(BUFFER_SIZE);
+	if(buffer == NULL){ return 1; }
+
+	Mem_Concurrent_Arena concurrent;
+	concurrent_arena_init(&concurrent, buffer, BUFFER_SIZE, CONCURRENT_ARENA_DEFAULT_CHUNK);
+	Mem_Arena arena;
+	arena_init(&arena, buffer, BUFFER_SIZE);
+	Locked_Allocator locked = { .lock = PTHREAD_MUTEX_INITIALIZER, .inner = arena_allocator(&arena) };
+	Mem_Allocator locked_allocator = { .func = locked_allocator_func, .data = &locked };
+
+	printf("  %d allocations per thread, ns per allocation of all threads together\n", ALLOCS_PER_THREAD);
+	printf("  %-8s %12s %12s\n", "threads", "concurrent", "mutex");
+	for(int threads = 1; threads <= 32; threads *= 2){
+		i64 ops = (i64)threads * ALLOCS_PER_THREAD;
+		i64 c = run(concurrent_arena_allocator(&concurrent), threads);
+		i64 m = run(locked_allocator, threads);
+		printf("  %-8d %12.2f %12.2f\n", threads, (double)c / ops, (double)m / ops);
+	}
+
+	concurrent_arena_destroy(&concurrent);
+	free(buffer);
+	return 0;
+}
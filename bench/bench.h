@@ -0,0 +1,47 @@
+#pragma once
+
+// Helpers shared by the drivers in bench/. Each driver is a standalone program
+// linked against bin/kuuru_c.o and bin/base.o; `make bench` builds and runs
+// all of them from the repository root.
+
+#define _DEFAULT_SOURCE 1
+
+#include "base.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Times each measurement is repeated, the fastest run is reported
+#define BENCH_REPEAT 5
+
+// Monotonic clock in nanoseconds
+static inline
+i64 bench_now_ns(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (i64)t.tv_sec * 1000000000ll + t.tv_nsec;
+}
+
+// Xorshift64, so every run sees the same inputs
+static inline
+u64 bench_random(u64* state){
+	u64 x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+// Stop the optimizer from dropping a result that is never used
+static inline
+void bench_keep(void const* p){
+	__asm__ volatile("" : : "r"(p) : "memory");
+}
+
+// Print "name: <ns> ns/op" with ns the time per op
+static inline
+void bench_report(cstring name, i64 ns, i64 ops){
+	printf("  %-28s %10.2f ns/op\n", name, (double)ns / (double)Max(ops, 1));
+}
@@ -0,0 +1,122 @@
+// Generated C against the bytecode interpreter. Each program is lowered to
+// IR with int parameters, optimized, written out by codegen_c_module and
+// built with $CC -O2 (gcc if unset). The compiled program is timed as a whole
+// process, start up included, and has to print what the VM returns.
+#include "bench.h"
+#include "kuuru_c/vm.h"
+#include "kuuru_c/ir.h"
+#include "kuuru_c/codegen_c.h"
+
+#define SOURCE_PATH "bin/bench_codegen_c_gen.c"
+#define BINARY_PATH "bin/bench_codegen_c_gen"
+
+// The loop of bench/vm.c
+static
+isize add_loop(Vm_Program* p){
+	isize f = vm_program_add_function(p, str_from("loop"), 1, 8);
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 1, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 2, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 3, 0x7fff));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 4, 5));
+	vm_emit(p, f, vm_encode_abc(Op_Lte_Branch, 0, 2, 1));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, 8));
+	vm_emit(p, f, vm_encode_abc(Op_Add, 5, 1, 2));
+	vm_emit(p, f, vm_encode_abc(Op_Bit_And, 5, 5, 3));
+	vm_emit(p, f, vm_encode_abc(Op_Bit_Xor, 1, 5, 4));
+	vm_emit(p, f, vm_encode_abc(Op_Lt, 6, 1, 2));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump_If_Not, 6, 1));
+	vm_emit(p, f, vm_encode_abc(Op_Add_Imm, 1, 1, 1));
+	vm_emit(p, f, vm_encode_abc(Op_For_Loop, 2, 0, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, -8));
+	vm_emit(p, f, vm_encode_abc(Op_Return, 1, 0, 0));
+	return f;
+}
+
+// fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2)
+static
+isize add_fib(Vm_Program* p){
+	isize f = vm_program_add_function(p, str_from("fib"), 1, 3);
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 1, 2));
+	vm_emit(p, f, vm_encode_abc(Op_Lt_Branch, 0, 1, 1));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, 6));
+	vm_emit(p, f, vm_encode_abc(Op_Add_Imm, 1, 0, (u8)-1));
+	vm_emit(p, f, vm_encode_abx(Op_Call, 1, (u16)f));
+	vm_emit(p, f, vm_encode_abc(Op_Add_Imm, 2, 0, (u8)-2));
+	vm_emit(p, f, vm_encode_abx(Op_Call, 2, (u16)f));
+	vm_emit(p, f, vm_encode_abc(Op_Add, 0, 1, 2));
+	vm_emit(p, f, vm_encode_abc(Op_Return, 0, 0, 0));
+	vm_emit(p, f, vm_encode_abc(Op_Return, 0, 0, 0));
+	return f;
+}
+
+static
+bool generate(Vm_Program const* p, isize entry){
+	Mem_Allocator a = heap_allocator();
+	Ir_Module m;
+	ir_module_init(&m, a);
+	Ir_Type params[1] = { Ir_Int };
+	bool ok = ir_lower_program(&m, p, entry, params, a);
+	for(isize i = 0; ok && i < m.len; i += 1){ ok = ir_optimize(&m.functions[i], a); }
+
+	FILE* out = fopen(SOURCE_PATH, "wb");
+	ok = ok && out != NULL && codegen_c_module(&m, entry, io_to_writer(file_stream(out)), a);
+	if(out != NULL){ fclose(out); }
+	ir_module_destroy(&m);
+	if(!ok){ return false; }
+
+	char const* cc = getenv("CC");
+	char command[512];
+	snprintf(command, sizeof(command), "%s -O2 -std=c11 -I base %s -o %s", cc != NULL ? cc : "gcc", SOURCE_PATH, BINARY_PATH);
+	return system(command) == 0;
+}
+
+static
+void measure(cstring name, Vm_Program const* p, isize entry, i64 arg){
+	Mem_Allocator a = heap_allocator();
+	i64 vm_best = INT64_MAX, expected = 0;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		Vm vm;
+		if(!vm_init(&vm, p, a, 1 << 16, 1024)){ abort(); }
+		Value in = value_small_int(arg), res;
+		i64 start = bench_now_ns();
+		if(vm_call(&vm, entry, &in, 1, &res) != Vm_Ok){ abort(); }
+		vm_best = Min(vm_best, bench_now_ns() - start);
+		expected = value_as_int(res);
+		vm_destroy(&vm);
+	}
+
+	if(!generate(p, entry)){
+		printf("  %s: could not generate or build C\n", name);
+		return;
+	}
+	char command[256];
+	snprintf(command, sizeof(command), "./%s %lld", BINARY_PATH, (long long)arg);
+	i64 c_best = INT64_MAX;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		i64 start = bench_now_ns();
+		FILE* run = popen(command, "r");
+		long long got = 0;
+		bool read = run != NULL && fscanf(run, "%lld", &got) == 1;
+		bool exited = run != NULL && pclose(run) == 0;
+		c_best = Min(c_best, bench_now_ns() - start);
+		if(!read || !exited || got != expected){
+			printf("  %s: generated C printed %lld, the VM returned %lld\n", name, got, (long long)expected);
+			return;
+		}
+	}
+	printf("  %-10s interpreter %8.2f ms, generated C %8.2f ms, %5.1fx\n",
+		name, vm_best / 1e6, c_best / 1e6, (double)vm_best / (double)c_best);
+}
+
+int main(void){
+	Vm_Program p;
+	vm_program_init(&p, heap_allocator());
+	isize loop = add_loop(&p);
+	isize fib = add_fib(&p);
+	measure("loop(20M)", &p, loop, 20000000);
+	measure("fib(32)", &p, fib, 32);
+	vm_program_destroy(&p);
+	remove(SOURCE_PATH);
+	remove(BINARY_PATH);
+	return 0;
+}
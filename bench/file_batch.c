@@ -0,0 +1,70 @@
+// Loading many small source files through File_Batch against file_read_all
+// one at a time. The files (0 to 8KiB) are written to a temporary directory
+// first, so the page cache is warm; the cold case the batch is meant for needs
+// the cache dropped (echo 1 > /proc/sys/vm/drop_caches as root) between runs.
+#include "bench.h"
+#include "kuuru_c/file_batch.h"
+
+#include <unistd.h>
+
+#define FILE_COUNT 3000
+
+int main(void){
+	char dir[] = "/tmp/kuuru_bench_XXXXXX";
+	if(mkdtemp(dir) == NULL){ return 1; }
+
+	static char path_text[FILE_COUNT][64];
+	static String paths[FILE_COUNT];
+	static byte content[8192];
+	u64 state = 0xda942042e4dd58b5ull;
+	for(isize i = 0; i < (isize)sizeof(content); i += 1){ content[i] = 'a' + i % 26; }
+	for(isize i = 0; i < FILE_COUNT; i += 1){
+		int len = snprintf(path_text[i], sizeof(path_text[i]), "%s/%td.ku", dir, i);
+		paths[i] = str_from_bytes((byte const*)path_text[i], len);
+		FILE* f = fopen(path_text[i], "wb");
+		if(f == NULL){ return 1; }
+		fwrite(content, 1, bench_random(&state) % sizeof(content), f);
+		fclose(f);
+	}
+
+	Mem_Allocator a = heap_allocator();
+	i64 batch_best = INT64_MAX, single_best = INT64_MAX;
+	isize batch_bytes = 0, single_bytes = 0;
+	bool uring = false;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		batch_bytes = 0;
+		i64 start = bench_now_ns();
+		File_Batch b;
+		if(!file_batch_init(&b, paths, FILE_COUNT, a)){ return 1; }
+		uring = b.uring;
+		File_Batch_Result r;
+		while(file_batch_next(&b, &r)){
+			if(r.error != 0){ return 1; }
+			batch_bytes += r.data.len;
+			mem_free(a, r.data.data);
+		}
+		file_batch_destroy(&b);
+		batch_best = Min(batch_best, bench_now_ns() - start);
+
+		single_bytes = 0;
+		start = bench_now_ns();
+		for(isize i = 0; i < FILE_COUNT; i += 1){
+			Bytes data = file_read_all(paths[i], a);
+			single_bytes += data.len;
+			mem_free(a, data.data);
+		}
+		single_best = Min(single_best, bench_now_ns() - start);
+	}
+
+	for(isize i = 0; i < FILE_COUNT; i += 1){ unlink(path_text[i]); }
+	rmdir(dir);
+
+	if(batch_bytes != single_bytes){
+		printf("  the batch loaded %td bytes, file_read_all %td\n", batch_bytes, single_bytes);
+		return 1;
+	}
+	printf("  %d files, %.1f MiB, warm page cache\n", FILE_COUNT, batch_bytes / (1024.0 * 1024.0));
+	printf("  %-28s %10.2f ms\n", uring ? "file_batch (io_uring)" : "file_batch (thread pool)", batch_best / 1e6);
+	printf("  %-28s %10.2f ms\n", "file_read_all", single_best / 1e6);
+	return 0;
+}
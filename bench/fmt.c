@@ -0,0 +1,64 @@
+// Number formatting in base against snprintf: integers of every length, and
+// doubles from random bit patterns and short decimals. snprintf("%.17g") is
+// the comparison that round trips like fmt_f64 does, "%g" is the cheaper one
+// that does not.
+#include "bench.h"
+
+#define COUNT 1000000
+
+static i64 ints[COUNT];
+static f64 reals[COUNT];
+
+typedef enum {
+	Fmt_I64,
+	Fmt_F64,
+	Snprintf_Lld,
+	Snprintf_17g,
+	Snprintf_G,
+} Formatter;
+
+static
+i64 run(Formatter which){
+	char buf[64];
+	i64 best = INT64_MAX;
+	isize total = 0;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		i64 start = bench_now_ns();
+		for(isize i = 0; i < COUNT; i += 1){
+			switch(which){
+				case Fmt_I64:      total += fmt_i64((byte*)buf, ints[i]); break;
+				case Fmt_F64:      total += fmt_f64((byte*)buf, reals[i]); break;
+				case Snprintf_Lld: total += snprintf(buf, sizeof(buf), "%lld", (long long)ints[i]); break;
+				case Snprintf_17g: total += snprintf(buf, sizeof(buf), "%.17g", reals[i]); break;
+				case Snprintf_G:   total += snprintf(buf, sizeof(buf), "%g", reals[i]); break;
+			}
+			bench_keep(buf);
+		}
+		best = Min(best, bench_now_ns() - start);
+	}
+	bench_keep(&total);
+	return best;
+}
+
+int main(void){
+	u64 state = 0x106689d45497fdb5ull;
+	for(isize i = 0; i < COUNT; i += 1){
+		u64 r = bench_random(&state);
+		ints[i] = (i64)r >> (r % 64);
+		if(i % 2 == 0){
+			u64 bits = bench_random(&state) & ~((u64)0x7ff << 52);
+			bits |= (u64)(1 + r % 2046) << 52;
+			mem_copy(&reals[i], &bits, sizeof(bits));
+		} else {
+			reals[i] = (f64)(i64)(r % 1000000) / 1000.0;
+		}
+	}
+
+	printf("  %d values each\n", COUNT);
+	bench_report("fmt_i64", run(Fmt_I64), COUNT);
+	bench_report("snprintf(\"%lld\")", run(Snprintf_Lld), COUNT);
+	bench_report("fmt_f64", run(Fmt_F64), COUNT);
+	bench_report("snprintf(\"%.17g\")", run(Snprintf_17g), COUNT);
+	bench_report("snprintf(\"%g\")", run(Snprintf_G), COUNT);
+	return 0;
+}
@@ -0,0 +1,68 @@
+// GC pause times and throughput under a request-like load. Most objects are
+// short lived strings, concatenations and small arrays; some are kept in 64
+// rooted slots or stored into a 4096 element old array through the write
+// barrier, and one in a thousand is a 10000 element array. The target is a
+// p99 pause under 1ms.
+#include "bench.h"
+#include "kuuru_c/value.h"
+#include "kuuru_c/gc.h"
+
+#define ITERATIONS 4000000
+#define ROOTS 64
+#define OLD_SLOTS 4096
+
+int main(void){
+	Gc_Heap h;
+	if(!gc_init(&h, GC_DEFAULT_NURSERY_SIZE, heap_allocator())){ return 1; }
+
+	static Value roots[ROOTS];
+	for(int i = 0; i < ROOTS; i += 1){
+		roots[i] = value_nil();
+		gc_push_root(&h, &roots[i]);
+	}
+	Gc_Array* old = gc_new_array(&h, OLD_SLOTS);
+	Value old_value = value_object(&old->header);
+	gc_push_root(&h, &old_value);
+
+	u64 state = 0x9e3779b97f4a7c15ull;
+	i64 start = bench_now_ns();
+	for(isize it = 0; it < ITERATIONS; it += 1){
+		u64 r = bench_random(&state);
+		Value v = value_nil();
+		switch(r % 4){
+			case 0: {
+				char text[40];
+				isize len = 1 + (isize)(r >> 8) % 40;
+				mem_set(text, 'a' + (int)(r % 26), len);
+				v = value_object(&gc_new_string(&h, str_from_bytes((byte const*)text, len))->header);
+			} break;
+			case 1: {
+				isize len = 1 + (isize)(r >> 8) % 6;
+				if(r % 1000 == 1){ len = 10000; }
+				Gc_Array* a = gc_new_array(&h, len);
+				v = value_object(&a->header);
+				for(isize i = 0; i < Min(len, 6); i += 1){
+					gc_store(&h, &a->header, &a->items[i], roots[bench_random(&state) % ROOTS]);
+				}
+			} break;
+			case 2: {
+				Value x = roots[r % ROOTS], y = roots[(r >> 16) % ROOTS];
+				if(gc_is_kind(x, Gc_Kind_String) && gc_is_kind(y, Gc_Kind_String) &&
+					gc_string((Gc_String*)value_as_object(x)).len + gc_string((Gc_String*)value_as_object(y)).len < 200){
+					v = value_object(&gc_concat(&h, x, y)->header);
+				}
+			} break;
+			default: break;
+		}
+		old = (Gc_Array*)value_as_object(old_value);
+		if((r >> 20) % 2){ roots[(r >> 24) % ROOTS] = v; }
+		else { gc_store(&h, &old->header, &old->items[(r >> 24) % OLD_SLOTS], v); }
+	}
+	i64 elapsed = bench_now_ns() - start;
+
+	printf("  %d iterations in %.1f ms\n", ITERATIONS, elapsed / 1e6);
+	gc_stats_print(&h, io_to_writer(file_stream(stdout)));
+	fflush(stdout);
+	gc_destroy(&h);
+	return 0;
+}
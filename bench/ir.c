@@ -0,0 +1,106 @@
+// IR instructions per second through lowering from bytecode plus the full
+// optimization pipeline. The input is a set of generated functions: integer
+// arithmetic and compares, forward branches nested two deep, and counted
+// loops, which give the passes phis, redundant expressions, dead values and
+// loop invariants to work on.
+#include "bench.h"
+#include "kuuru_c/vm.h"
+#include "kuuru_c/ir.h"
+
+#define FUNCTION_COUNT 2000
+#define REGISTERS 8 // The last two hold loop counters
+
+typedef struct {
+	Vm_Program* p;
+	isize fn;
+	u64 state;
+} Generator;
+
+static
+u32 pick(Generator* g, u32 n){
+	return (u32)(bench_random(&g->state) % n);
+}
+
+static
+u8 reg(Generator* g){
+	return (u8)pick(g, REGISTERS - 2);
+}
+
+static
+void gen_block(Generator* g, int count, int depth){
+	static const Opcode binary[] = { Op_Add, Op_Sub, Op_Mul, Op_Bit_And, Op_Bit_Or, Op_Bit_Xor, Op_Lt, Op_Eq };
+	for(int k = 0; k < count; k += 1){
+		u32 r = pick(g, 16);
+		if(r < 8){ vm_emit(g->p, g->fn, vm_encode_abc(binary[pick(g, 8)], reg(g), reg(g), reg(g))); }
+		else if(r < 10){ vm_emit(g->p, g->fn, vm_encode_abc(Op_Add_Imm, reg(g), reg(g), (u8)(i8)(pick(g, 64) - 32))); }
+		else if(r < 12){ vm_emit(g->p, g->fn, vm_encode_asbx(Op_Load_Int, reg(g), (i16)(pick(g, 2000) - 1000))); }
+		else if(r < 13){ vm_emit(g->p, g->fn, vm_encode_abc(Op_Move, reg(g), reg(g), 0)); }
+		else if(depth < 2){
+			static const Opcode branch[] = { Op_Eq_Branch, Op_Lt_Branch, Op_Lte_Branch };
+			vm_emit(g->p, g->fn, vm_encode_abc(branch[pick(g, 3)], reg(g), reg(g), (u8)pick(g, 2)));
+			isize at = vm_emit(g->p, g->fn, vm_encode_asbx(Op_Jump, 0, 0));
+			gen_block(g, 2 + pick(g, 6), depth + 1);
+			isize end = vm_emit(g->p, g->fn, vm_encode_abc(Op_Nop, 0, 0, 0));
+			vm_patch_jump(g->p, g->fn, at, end);
+		}
+	}
+}
+
+static
+isize gen_function(Vm_Program* p, u64 seed){
+	Generator g = { .p = p, .state = seed };
+	g.fn = vm_program_add_function(p, str_from("f"), 2, REGISTERS);
+	for(u8 r = 2; r < REGISTERS - 2; r += 1){ vm_emit(p, g.fn, vm_encode_asbx(Op_Load_Int, r, (i16)r)); }
+	gen_block(&g, 8 + pick(&g, 16), 0);
+	u32 loops = 1 + pick(&g, 2);
+	for(u32 l = 0; l < loops; l += 1){
+		vm_emit(p, g.fn, vm_encode_asbx(Op_Load_Int, REGISTERS - 2, 0));
+		vm_emit(p, g.fn, vm_encode_asbx(Op_Load_Int, REGISTERS - 1, (i16)(4 + pick(&g, 60))));
+		isize start = vm_emit(p, g.fn, vm_encode_abc(Op_Nop, 0, 0, 0));
+		gen_block(&g, 6 + pick(&g, 12), 0);
+		vm_emit(p, g.fn, vm_encode_abc(Op_For_Loop, REGISTERS - 2, REGISTERS - 1, 0));
+		isize back = vm_emit(p, g.fn, vm_encode_asbx(Op_Jump, 0, 0));
+		vm_patch_jump(p, g.fn, back, start);
+	}
+	vm_emit(p, g.fn, vm_encode_abc(Op_Return, reg(&g), 0, 0));
+	return g.fn;
+}
+
+int main(void){
+	Mem_Allocator a = heap_allocator();
+	Vm_Program p;
+	vm_program_init(&p, a);
+	u64 seed = 0x853c49e6748fea9bull;
+	for(int i = 0; i < FUNCTION_COUNT; i += 1){ gen_function(&p, bench_random(&seed)); }
+	if(vm_verify(&p) != Vm_Ok){ printf("  generated program does not verify\n"); return 1; }
+
+	Ir_Type params[2] = { Ir_Int, Ir_Int };
+	i64 best = INT64_MAX, lower_best = INT64_MAX;
+	isize lowered = 0, remaining = 0;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		lowered = 0;
+		remaining = 0;
+		i64 lower_ns;
+		i64 start = bench_now_ns();
+		Ir_Module m;
+		ir_module_init(&m, a);
+		if(!ir_lower_program(&m, &p, 0, params, a)){ printf("  lowering failed\n"); return 1; }
+		lower_ns = bench_now_ns() - start;
+		for(isize i = 0; i < m.len; i += 1){
+			lowered += m.functions[i].inst_count;
+			if(!ir_optimize(&m.functions[i], a)){ printf("  optimization failed\n"); return 1; }
+			for(isize k = 0; k < m.functions[i].inst_count; k += 1){
+				remaining += m.functions[i].insts[k].op != Ir_Op_Nop;
+			}
+		}
+		ir_module_destroy(&m);
+		best = Min(best, bench_now_ns() - start);
+		lower_best = Min(lower_best, lower_ns);
+	}
+	vm_program_destroy(&p);
+
+	printf("  %d functions, %td IR instructions lowered, %td left after optimizing\n", FUNCTION_COUNT, lowered, remaining);
+	printf("  lowering only           %10.2f M instructions/s\n", lowered / (lower_best / 1e3));
+	printf("  lowering and passes     %10.2f M instructions/s\n", lowered / (best / 1e3));
+	return 0;
+}
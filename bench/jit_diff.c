@@ -0,0 +1,232 @@
+// Differential test of the baseline JIT against the interpreter. Random
+// functions mix integer arithmetic near the inline int limits, compares,
+// branches, a counted loop, calls, division (which exits to the interpreter)
+// and constants that are reals or boxed ints, so guards fail and compiled code
+// hands back mid-function. Every program is run:
+//   - interpreted, as the reference
+//   - with the JIT at each threshold, calling until the function has been
+//     compiled and then twice more
+//   - after vm_fold_constants, interpreted and with the JIT at threshold 1
+// and every status and result must match the reference. Run with
+// `make jit-diff`, or bin/bench_jit_diff <programs> <seed>.
+#include "bench.h"
+#include "kuuru_c/vm.h"
+#include "kuuru_c/jit.h"
+#include "kuuru_c/optimizer.h"
+
+#define DEFAULT_PROGRAMS 5000
+#define REGISTERS 10 // 0-5 general, 6 and 7 loop counter and limit, 8 call argument
+
+static u32 thresholds[] = { 1, 2, 10, 100, JIT_DEFAULT_THRESHOLD };
+
+static u64 state;
+
+static
+u32 pick(u32 n){
+	return (u32)(bench_random(&state) % n);
+}
+
+static
+i64 pick_int(void){
+	switch(pick(5)){
+		case 0:  return (i64)pick(20) - 10;
+		case 1:  return VALUE_INT_MAX - (i64)pick(4);
+		case 2:  return VALUE_INT_MIN + (i64)pick(4);
+		case 3:  return (i64)bench_random(&state) >> 17;
+		default: return (i64)pick(3000) - 1500;
+	}
+}
+
+static
+Value pick_arg(Vm_Program* p){
+	Value v;
+	switch(pick(24)){
+		case 0:  return value_nil();
+		case 1:  return value_real((f64)pick(100) / 4);
+		case 2:  return value_bool(pick(2));
+		default: if(!vm_program_int(p, pick_int(), &v)){ abort(); } return v;
+	}
+}
+
+static
+void emit_body(Vm_Program* p, isize f, isize g, u32 len){
+	static const Opcode binary[] = { Op_Add, Op_Sub, Op_Mul, Op_Bit_And, Op_Bit_Or, Op_Bit_Xor, Op_Lt, Op_Lte, Op_Eq };
+	static const Opcode unary[] = { Op_Move, Op_Neg, Op_Bit_Not, Op_Not };
+	for(u32 i = 0; i < len; i += 1){
+		u8 a = (u8)pick(6), b = (u8)pick(6), c = (u8)pick(6);
+		switch(pick(12)){
+			case 0: case 1: case 2: case 3: {
+				// Mostly integer ops, so guards pass often enough to stay compiled
+				vm_emit(p, f, vm_encode_abc(binary[pick(pick(4) ? 6 : 9)], a, b, c));
+			} break;
+			case 4: vm_emit(p, f, vm_encode_abc(Op_Add_Imm, a, b, (u8)pick(256))); break;
+			case 5: vm_emit(p, f, vm_encode_abc(unary[pick(4)], a, b, 0)); break;
+			case 6: vm_emit(p, f, vm_encode_asbx(Op_Load_Int, a, (i16)((i16)pick(64) - 32))); break;
+			case 7: {
+				if(pick(2)){ vm_emit(p, f, vm_encode_abx(Op_Load_Const, a, 0)); }
+				else if(pick(2)){ vm_emit(p, f, vm_encode_abc(Op_Load_Nil, a, 0, 0)); }
+				else { vm_emit(p, f, vm_encode_abc(Op_Load_Bool, a, (u8)pick(2), 0)); }
+			} break;
+			case 8: {
+				// No template, exits to the interpreter
+				vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 5, 3));
+				vm_emit(p, f, vm_encode_abc(Op_Div, a % 5, b, 5));
+			} break;
+			case 9: {
+				vm_emit(p, f, vm_encode_asbx(pick(2) ? Op_Jump_If : Op_Jump_If_Not, a, 1));
+				vm_emit(p, f, vm_encode_abc(Op_Add_Imm, b, b, 1));
+			} break;
+			case 10: {
+				static const Opcode branch[] = { Op_Eq_Branch, Op_Lt_Branch, Op_Lte_Branch };
+				vm_emit(p, f, vm_encode_abc(branch[pick(3)], a, b, (u8)pick(2)));
+				vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, 1));
+				vm_emit(p, f, vm_encode_abc(Op_Add, c, c, a));
+			} break;
+			default: {
+				vm_emit(p, f, vm_encode_abc(Op_Move, 8, a, 0));
+				vm_emit(p, f, vm_encode_abx(Op_Call, 8, (u16)g));
+				vm_emit(p, f, vm_encode_abc(Op_Move, b, 8, 0));
+			} break;
+		}
+	}
+}
+
+// f(r0, r1, r2, r3): straight code, a counted loop, straight code. g(x) = x + 1.
+static
+isize generate(Vm_Program* p){
+	isize g = vm_program_add_function(p, str_from("g"), 1, 2);
+	vm_emit(p, g, vm_encode_abc(Op_Add_Imm, 0, 0, 1));
+	vm_emit(p, g, vm_encode_abc(Op_Return, 0, 0, 0));
+
+	isize f = vm_program_add_function(p, str_from("f"), 4, REGISTERS);
+	Value k;
+	if(pick(3) == 0){ k = value_real(2.5); }
+	else if(!vm_program_int(p, pick_int(), &k)){ abort(); }
+	vm_add_constant(p, f, k);
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 4, 7));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 5, -3));
+	// Parameters overwritten with constants give the constant folder work
+	for(u8 r = 0; r < 4; r += 1){
+		if(pick(3) == 0){ vm_emit(p, f, vm_encode_asbx(Op_Load_Int, r, (i16)pick(65536))); }
+	}
+	emit_body(p, f, g, pick(4));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 6, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 7, (i16)(1 + pick(20))));
+	isize head = p->functions[f].code_len;
+	emit_body(p, f, g, 1 + pick(8));
+	vm_emit(p, f, vm_encode_abc(Op_For_Loop, 6, 7, 0));
+	isize back = vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, 0));
+	vm_patch_jump(p, f, back, head);
+	emit_body(p, f, g, pick(3));
+	vm_emit(p, f, vm_encode_abc(Op_Return, (u8)pick(6), 0, 0));
+	return f;
+}
+
+static
+bool same(Vm_Result s1, Value r1, Vm_Result s2, Value r2){
+	if(s1 != s2){ return false; }
+	if(s1 != Vm_Ok){ return true; }
+	if(value_kind(r1) == Val_Int && value_kind(r2) == Val_Int){ return value_as_int(r1) == value_as_int(r2); }
+	return r1.bits == r2.bits;
+}
+
+static cstring const opcode_names[] = {
+	#define X(Name) #Name,
+	KUURU_OPCODE_TABLE
+	#undef X
+};
+
+static
+void dump(Vm_Program const* p, isize f){
+	Vm_Function const* fn = &p->functions[f];
+	for(isize i = 0; i < fn->code_len; i += 1){
+		Instruction in = fn->code[i];
+		printf("    %3td %-14s a=%d b=%d c=%d sbx=%d\n", i, opcode_names[vm_op(in)], vm_a(in), vm_b(in), vm_c(in), vm_sbx(in));
+	}
+}
+
+int main(int argc, char** argv){
+	if(!jit_available()){
+		printf("  baseline jit not available on this platform\n");
+		return 0;
+	}
+	isize programs = argc > 1 ? atol(argv[1]) : DEFAULT_PROGRAMS;
+	state = argc > 2 ? strtoull(argv[2], NULL, 10) : 0x9e3779b97f4a7c15ull;
+
+	enum { THRESHOLD_COUNT = sizeof(thresholds) / sizeof(thresholds[0]) };
+	Mem_Allocator a = heap_allocator();
+	isize compiled[THRESHOLD_COUNT + 1] = {0};
+	isize trapped = 0, folded = 0, calls = 0, skipped = 0;
+	for(isize it = 0; it < programs; it += 1){
+		Vm_Program p;
+		vm_program_init(&p, a);
+		isize f = generate(&p);
+		if(vm_verify(&p) != Vm_Ok){
+			skipped += 1;
+			vm_program_destroy(&p);
+			continue;
+		}
+		Value args[4];
+		for(int i = 0; i < 4; i += 1){ args[i] = pick_arg(&p); }
+
+		Vm vm;
+		vm_init(&vm, &p, a, 1 << 12, 64);
+		Value want = value_nil();
+		Vm_Result want_status = vm_call(&vm, f, args, 4, &want);
+		vm_destroy(&vm);
+		trapped += want_status != Vm_Ok;
+
+		for(int t = 0; t <= THRESHOLD_COUNT; t += 1){
+			// The last round runs the folded program at threshold 1
+			if(t == THRESHOLD_COUNT){
+				isize removed = vm_fold_constants(&p, f, a);
+				if(removed < 0 || vm_verify(&p) != Vm_Ok){
+					printf("  program %td (seed %llu): folding failed\n", it, (unsigned long long)state);
+					return 1;
+				}
+				folded += removed > 0;
+
+				vm_init(&vm, &p, a, 1 << 12, 64);
+				Value got = value_nil();
+				Vm_Result status = vm_call(&vm, f, args, 4, &got);
+				vm_destroy(&vm);
+				if(!same(want_status, want, status, got)){
+					printf("  program %td, folded and interpreted: before %d/%llx, after %d/%llx\n",
+						it, want_status, (unsigned long long)want.bits, status, (unsigned long long)got.bits);
+					dump(&p, f);
+					return 1;
+				}
+			}
+			u32 threshold = t < THRESHOLD_COUNT ? thresholds[t] : 1;
+
+			vm_init(&vm, &p, a, 1 << 12, 64);
+			jit_attach(&vm, threshold);
+			isize extra = 2;
+			for(isize call = 0; extra > 0 && call <= (isize)threshold + 2; call += 1){
+				Value got = value_nil();
+				Vm_Result status = vm_call(&vm, f, args, 4, &got);
+				calls += 1;
+				if(!same(want_status, want, status, got)){
+					printf("  program %td, %s threshold %u, call %td: interpreter %d/%llx, jit %d/%llx\n",
+						it, t < THRESHOLD_COUNT ? "jit" : "folded, jit", threshold, call,
+						want_status, (unsigned long long)want.bits, status, (unsigned long long)got.bits);
+					dump(&p, f);
+					return 1;
+				}
+				if(vm.jit_entries[f] != NULL){ extra -= 1; }
+			}
+			compiled[t] += vm.jit_entries[f] != NULL;
+			jit_detach(&vm);
+			vm_destroy(&vm);
+		}
+		vm_program_destroy(&p);
+	}
+
+	printf("  %td programs (%td trapped, %td changed by folding, %td rejected by vm_verify), %td calls compared\n",
+		programs - skipped, trapped, folded, skipped, calls);
+	for(int t = 0; t <= THRESHOLD_COUNT; t += 1){
+		printf("  %-8s threshold %4u: %td compiled\n", t < THRESHOLD_COUNT ? "jit" : "folded", t < THRESHOLD_COUNT ? thresholds[t] : 1, compiled[t]);
+	}
+	printf("  no mismatches\n");
+	return 0;
+}
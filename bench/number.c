@@ -0,0 +1,106 @@
+// Numeric literal parsing against strtod and strtoull. Reals are the shortest
+// round trip form of random doubles, ints have 1 to 19 digits. The literals
+// are stored NUL terminated so the libc parsers need no copies, which the
+// lexer could not give them.
+#include "bench.h"
+#include "kuuru_c/number.h"
+
+#define COUNT 1000000
+
+typedef struct {
+	char* text;
+	String* items;
+	isize bytes;
+} Literals;
+
+static
+Literals make_literals(bool reals){
+	Literals l = {
+		.text = malloc(COUNT * (FMT_F64_MAX_LEN + 1)),
+		.items = malloc(COUNT * sizeof(String)),
+	};
+	if(l.text == NULL || l.items == NULL){ abort(); }
+	u64 state = reals ? 0x5851f42d4c957f2dull : 0x14057b7ef767814full;
+	char* at = l.text;
+	for(isize i = 0; i < COUNT; i += 1){
+		u64 r = bench_random(&state);
+		isize len;
+		if(reals){
+			len = fmt_f64((byte*)at, (f64)(r >> 11) / (f64)((u64)1 << 53) * 1000.0);
+		} else {
+			u64 limit = 10;
+			for(u64 d = r % 19; d > 0; d -= 1){ limit *= 10; }
+			len = fmt_u64((byte*)at, bench_random(&state) % limit);
+		}
+		l.items[i] = str_from_bytes((byte const*)at, len);
+		at[len] = 0;
+		at += len + 1;
+		l.bytes += len;
+	}
+	return l;
+}
+
+static
+void report(cstring name, i64 ns, isize bytes){
+	printf("  %-28s %10.2f ns/op %8.1f MB/s\n", name, (double)ns / COUNT, bytes / (ns / 1e3));
+}
+
+int main(void){
+	Literals reals = make_literals(true);
+	Literals ints = make_literals(false);
+	for(isize i = 0; i < COUNT; i += 1){
+		f64 real;
+		u64 integer;
+		if(number_parse_f64(reals.items[i], &real) != Number_Ok || real != strtod((char const*)reals.items[i].data, NULL) ||
+			number_parse_u64(ints.items[i], &integer) != Number_Ok || integer != strtoull((char const*)ints.items[i].data, NULL, 10)){
+			printf("  results differ from strtod and strtoull\n");
+			return 1;
+		}
+	}
+
+	f64 real_sum = 0;
+	u64 int_sum = 0;
+
+	i64 best[4] = { INT64_MAX, INT64_MAX, INT64_MAX, INT64_MAX };
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		i64 start = bench_now_ns();
+		for(isize i = 0; i < COUNT; i += 1){
+			f64 v;
+			if(number_parse_f64(reals.items[i], &v) != Number_Ok){ abort(); }
+			real_sum += v;
+		}
+		i64 t1 = bench_now_ns();
+		for(isize i = 0; i < COUNT; i += 1){
+			real_sum += strtod((char const*)reals.items[i].data, NULL);
+		}
+		i64 t2 = bench_now_ns();
+		for(isize i = 0; i < COUNT; i += 1){
+			u64 v;
+			if(number_parse_u64(ints.items[i], &v) != Number_Ok){ abort(); }
+			int_sum += v;
+		}
+		i64 t3 = bench_now_ns();
+		for(isize i = 0; i < COUNT; i += 1){
+			int_sum += strtoull((char const*)ints.items[i].data, NULL, 10);
+		}
+		i64 t4 = bench_now_ns();
+		best[0] = Min(best[0], t1 - start);
+		best[1] = Min(best[1], t2 - t1);
+		best[2] = Min(best[2], t3 - t2);
+		best[3] = Min(best[3], t4 - t3);
+	}
+	bench_keep(&real_sum);
+	bench_keep(&int_sum);
+
+	printf("  %d literals each\n", COUNT);
+	report("number_parse_f64", best[0], reals.bytes);
+	report("strtod", best[1], reals.bytes);
+	report("number_parse_u64", best[2], ints.bytes);
+	report("strtoull", best[3], ints.bytes);
+
+	free(reals.text);
+	free(reals.items);
+	free(ints.text);
+	free(ints.items);
+	return 0;
+}
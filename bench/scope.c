@@ -0,0 +1,78 @@
+// Name resolution on deeply nested blocks, as in nested func/for/if bodies.
+// Each level opens a scope, declares 4 names and looks up 16 from a pool of
+// 256, so lookups see shadowed names, names from far out and undeclared
+// ones. All levels are then closed again. Interning the same names from
+// their strings is measured on its own.
+#include "bench.h"
+#include "kuuru_c/symbol_table.h"
+
+#define DEPTH 500
+#define DECLS_PER_LEVEL 4
+#define LOOKUPS_PER_LEVEL 16
+#define NAME_COUNT 256
+#define ROUNDS 1000
+
+int main(void){
+	Mem_Allocator a = heap_allocator();
+	Interner in;
+	Scope_Table t;
+	if(!interner_init(&in, a) || !scope_table_init(&t, a)){ return 1; }
+
+	static char text[NAME_COUNT][8];
+	String names[NAME_COUNT];
+	Symbol symbols[NAME_COUNT];
+	for(int i = 0; i < NAME_COUNT; i += 1){
+		int len = snprintf(text[i], sizeof(text[i]), "n%d", i);
+		names[i] = str_from_bytes((byte const*)text[i], len);
+		symbols[i] = intern(&in, names[i]);
+	}
+
+	// Same picks every round, so the rounds are comparable
+	static u8 picks[DEPTH][DECLS_PER_LEVEL + LOOKUPS_PER_LEVEL];
+	u64 state = 0x2545f4914f6cdd1dull;
+	for(int d = 0; d < DEPTH; d += 1){
+		for(int i = 0; i < DECLS_PER_LEVEL + LOOKUPS_PER_LEVEL; i += 1){ picks[d][i] = (u8)bench_random(&state); }
+	}
+
+	i64 best = INT64_MAX;
+	isize found = 0;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		found = 0;
+		i64 start = bench_now_ns();
+		for(int round = 0; round < ROUNDS; round += 1){
+			for(int d = 0; d < DEPTH; d += 1){
+				if(!scope_push(&t)){ return 1; }
+				for(int i = 0; i < DECLS_PER_LEVEL; i += 1){
+					if(scope_declare(&t, symbols[picks[d][i]], (u32)d) == Scope_Out_Of_Memory){ return 1; }
+				}
+				for(int i = DECLS_PER_LEVEL; i < DECLS_PER_LEVEL + LOOKUPS_PER_LEVEL; i += 1){
+					found += scope_lookup(&t, symbols[picks[d][i]]) != NULL;
+				}
+			}
+			for(int d = 0; d < DEPTH; d += 1){ scope_pop(&t); }
+		}
+		best = Min(best, bench_now_ns() - start);
+	}
+	bench_keep(&found);
+
+	i64 intern_best = INT64_MAX;
+	Symbol sum = 0;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		i64 start = bench_now_ns();
+		for(int round = 0; round < ROUNDS; round += 1){
+			for(int d = 0; d < DEPTH; d += 1){ sum += intern(&in, names[picks[d][0]]); }
+		}
+		intern_best = Min(intern_best, bench_now_ns() - start);
+	}
+	bench_keep(&sum);
+
+	i64 ops = (i64)ROUNDS * DEPTH * (1 + DECLS_PER_LEVEL + LOOKUPS_PER_LEVEL + 1);
+	printf("  %d levels, %d declarations and %d lookups per level, %.0f%% of lookups found\n",
+		DEPTH, DECLS_PER_LEVEL, LOOKUPS_PER_LEVEL, 100.0 * found / ((f64)ROUNDS * DEPTH * LOOKUPS_PER_LEVEL));
+	bench_report("push, declare, lookup, pop", best, ops);
+	bench_report("intern (existing name)", intern_best, (i64)ROUNDS * DEPTH);
+
+	scope_table_destroy(&t);
+	interner_destroy(&in);
+	return 0;
+}
@@ -0,0 +1,176 @@
+// Bytecode VM against a tree walking interpreter and the baseline JIT.
+//
+// All three run the same loop over small ints (add, and, xor, compare and
+// branch), which is also the value representation microbenchmark:
+//
+//	acc = 0; i = 0
+//	while i < n { t = (acc + i) & 0x7fff; acc = t ~ 5; if acc < i { acc = acc + 1 }; i = i + 1 }
+//	return acc
+//
+// The tree walker is written here, over Values, since the compiler has no AST
+// evaluator to compare against.
+#include "bench.h"
+#include "kuuru_c/vm.h"
+#include "kuuru_c/jit.h"
+
+#define ITERATIONS 20000000
+
+typedef enum {
+	Node_Int,
+	Node_Var,
+	Node_Assign,
+	Node_Add,
+	Node_Bit_And,
+	Node_Bit_Xor,
+	Node_Lt,
+	Node_If,
+	Node_While,
+} Node_Kind;
+
+typedef struct Node Node;
+struct Node {
+	Node_Kind kind;
+	i64 value;  // Of Node_Int, the slot of Node_Var and Node_Assign
+	Node* a;    // Operand, condition or assigned expression
+	Node* b;    // Operand or first statement of a body
+	Node* next; // Following statement
+};
+
+static Node nodes[64];
+static isize node_count;
+
+static
+Node* node(Node_Kind kind, i64 value, Node* a, Node* b){
+	Node* n = &nodes[node_count++];
+	*n = (Node){ .kind = kind, .value = value, .a = a, .b = b };
+	return n;
+}
+
+static
+Node* seq(Node* first, Node* second){
+	first->next = second;
+	return first;
+}
+
+static
+Value walk_expr(Node const* n, Value* slots){
+	switch(n->kind){
+		case Node_Int: return value_small_int(n->value);
+		case Node_Var: return slots[n->value];
+		case Node_Lt: {
+			Value a = walk_expr(n->a, slots), b = walk_expr(n->b, slots);
+			if(!value_both_small_ints(a, b)){ abort(); }
+			return value_bool(value_as_small_int(a) < value_as_small_int(b));
+		}
+		default: {
+			Value a = walk_expr(n->a, slots), b = walk_expr(n->b, slots);
+			if(!value_both_small_ints(a, b)){ abort(); }
+			i64 x = value_as_small_int(a), y = value_as_small_int(b);
+			i64 r = n->kind == Node_Add ? x + y : (n->kind == Node_Bit_And ? x & y : x ^ y);
+			if(!value_int_fits(r)){ abort(); }
+			return value_small_int(r);
+		}
+	}
+}
+
+static
+void walk(Node const* n, Value* slots){
+	for(; n != NULL; n = n->next){
+		switch(n->kind){
+			case Node_Assign: slots[n->value] = walk_expr(n->a, slots); break;
+			case Node_If: if(value_truthy(walk_expr(n->a, slots))){ walk(n->b, slots); } break;
+			case Node_While: while(value_truthy(walk_expr(n->a, slots))){ walk(n->b, slots); } break;
+			default: walk_expr(n, slots); break;
+		}
+	}
+}
+
+// Slots: 0 n, 1 acc, 2 i, 3 t
+static
+Node* build_tree(void){
+	Node* n = node(Node_Var, 0, NULL, NULL);
+	Node* acc = node(Node_Var, 1, NULL, NULL);
+	Node* i = node(Node_Var, 2, NULL, NULL);
+	Node* t = node(Node_Var, 3, NULL, NULL);
+
+	Node* body = seq(
+		node(Node_Assign, 3, node(Node_Bit_And, 0, node(Node_Add, 0, acc, i), node(Node_Int, 0x7fff, NULL, NULL)), NULL),
+		seq(node(Node_Assign, 1, node(Node_Bit_Xor, 0, t, node(Node_Int, 5, NULL, NULL)), NULL),
+		seq(node(Node_If, 0, node(Node_Lt, 0, acc, i), node(Node_Assign, 1, node(Node_Add, 0, acc, node(Node_Int, 1, NULL, NULL)), NULL)),
+		node(Node_Assign, 2, node(Node_Add, 0, i, node(Node_Int, 1, NULL, NULL)), NULL))));
+
+	return seq(node(Node_Assign, 1, node(Node_Int, 0, NULL, NULL), NULL),
+		seq(node(Node_Assign, 2, node(Node_Int, 0, NULL, NULL), NULL),
+		node(Node_While, 0, node(Node_Lt, 0, i, n), body)));
+}
+
+static
+isize build_program(Vm_Program* p){
+	isize f = vm_program_add_function(p, str_from("loop"), 1, 8);
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 1, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 2, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 3, 0x7fff));
+	vm_emit(p, f, vm_encode_asbx(Op_Load_Int, 4, 5));
+	vm_emit(p, f, vm_encode_abc(Op_Lte_Branch, 0, 2, 1));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, 8));
+	vm_emit(p, f, vm_encode_abc(Op_Add, 5, 1, 2));
+	vm_emit(p, f, vm_encode_abc(Op_Bit_And, 5, 5, 3));
+	vm_emit(p, f, vm_encode_abc(Op_Bit_Xor, 1, 5, 4));
+	vm_emit(p, f, vm_encode_abc(Op_Lt, 6, 1, 2));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump_If_Not, 6, 1));
+	vm_emit(p, f, vm_encode_abc(Op_Add_Imm, 1, 1, 1));
+	vm_emit(p, f, vm_encode_abc(Op_For_Loop, 2, 0, 0));
+	vm_emit(p, f, vm_encode_asbx(Op_Jump, 0, -8));
+	vm_emit(p, f, vm_encode_abc(Op_Return, 1, 0, 0));
+	return f;
+}
+
+static
+i64 run_vm(Vm_Program const* p, isize f, bool jit, i64* result){
+	Mem_Allocator a = heap_allocator();
+	i64 best = INT64_MAX;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		Vm vm;
+		if(!vm_init(&vm, p, a, 1 << 16, 1024)){ abort(); }
+		if(jit){ jit_attach(&vm, 2); }
+		Value arg = value_small_int(ITERATIONS), res;
+		i64 start = bench_now_ns();
+		if(vm_call(&vm, f, &arg, 1, &res) != Vm_Ok){ abort(); }
+		best = Min(best, bench_now_ns() - start);
+		*result = value_as_int(res);
+		if(jit){ jit_detach(&vm); }
+		vm_destroy(&vm);
+	}
+	return best;
+}
+
+int main(void){
+	Node* tree = build_tree();
+	i64 walked = 0, walk_ns = INT64_MAX;
+	for(int rep = 0; rep < BENCH_REPEAT; rep += 1){
+		Value slots[4] = { value_small_int(ITERATIONS) };
+		i64 start = bench_now_ns();
+		walk(tree, slots);
+		walk_ns = Min(walk_ns, bench_now_ns() - start);
+		walked = value_as_small_int(slots[1]);
+	}
+
+	Vm_Program p;
+	vm_program_init(&p, heap_allocator());
+	isize f = build_program(&p);
+	i64 interpreted = 0, compiled = walked;
+	i64 vm_ns = run_vm(&p, f, false, &interpreted);
+	i64 jit_ns = jit_available() ? run_vm(&p, f, true, &compiled) : -1;
+	vm_program_destroy(&p);
+
+	if(interpreted != walked || compiled != walked){
+		printf("  results differ: tree %lld, vm %lld, jit %lld\n", (long long)walked, (long long)interpreted, (long long)compiled);
+		return 1;
+	}
+	printf("  loop of %d iterations, sizeof(Value) = %zu\n", ITERATIONS, sizeof(Value));
+	bench_report("tree walker", walk_ns, ITERATIONS);
+	bench_report("bytecode vm", vm_ns, ITERATIONS);
+	if(jit_ns >= 0){ bench_report("baseline jit", jit_ns, ITERATIONS); }
+	else { printf("  baseline jit not available on this platform\n"); }
+	return 0;
+}
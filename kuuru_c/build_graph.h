@@ -0,0 +1,586 @@
+#pragma once
+
+#include "base.h"
+#include "lexer.h"
+#include "hash.h"
+#include "cache.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Build_Symbol Build_Symbol;
+typedef struct Build_File Build_File;
+typedef struct Build_Graph Build_Graph;
+
+#define KUURU_BUILD_GRAPH_VERSION 4
+
+// Top level declaration of a file, names are identified by their hash
+struct Build_Symbol {
+	u64 name;
+	u64 signature; // Hash of the declaration's interface tokens
+};
+
+struct Build_File {
+	String path;
+	Hash128 content_hash;
+	Hash128 interface_hash; // Fingerprint of all exports
+	i64 mtime_ns;
+	i64 size;
+
+	Build_Symbol* exports; // Sorted by name
+	isize export_count;
+	u64* imports;          // Sorted names used but not declared by the file
+	isize import_count;
+
+	bool dirty;  // Must be re-lexed, re-parsed and re-checked
+	bool failed; // Set by the owner when building it failed, it and its importers stay dirty
+};
+
+struct Build_Graph {
+	Build_File* files;
+	isize len;
+	isize cap;
+	Mem_Allocator allocator;
+};
+
+// Initialize an empty graph
+void build_graph_init(Build_Graph* g, Mem_Allocator allocator);
+
+// Destroy graph and everything it owns
+void build_graph_destroy(Build_Graph* g);
+
+// Load a graph persisted with build_graph_save. Returns false if it is
+// missing, corrupt or from another compiler version, the graph is empty then.
+bool build_graph_load(Build_Graph* g, String path);
+
+// Persist graph to path, returns success status
+bool build_graph_save(Build_Graph const* g, String path);
+
+// Bring the graph up to date with the given set of source files. Files whose
+// content changed, or whose last build failed, are marked dirty, as are the
+// unchanged files importing a symbol whose interface changed (every symbol of
+// a failed file counts as changed). Files that did not change on disk (same
+// mtime and size) are not read. Returns number of dirty files, or -1 on failure.
+isize build_graph_update(Build_Graph* g, String const* paths, isize count);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define BUILD_GRAPH_MAGIC 0x4742554bu /* "KUBG" */
+#define BUILD_GRAPH_PATH_MAX 4096
+
+typedef struct {
+	u32 magic;
+	u32 version;
+	Hash128 compiler;
+	i64 file_count;
+} Build_Graph_Header;
+
+static
+Hash128 build_graph_compiler_hash(){
+	static const char version[] = BASE_C_VERSION ":" KUURU_VERSION;
+	return hash128((byte const*)version, sizeof(version) - 1, KUURU_BUILD_GRAPH_VERSION);
+}
+
+static
+void build_file_release(Mem_Allocator allocator, Build_File* f){
+	mem_free(allocator, (void*)f->path.data);
+	mem_free(allocator, f->exports);
+	mem_free(allocator, f->imports);
+	*f = (Build_File){0};
+}
+
+static
+bool build_graph_push(Build_Graph* g, Build_File f){
+	if(g->len >= g->cap){
+		isize new_cap = Max(g->cap * 2, 16);
+		Build_File* files = New(Build_File, new_cap, g->allocator);
+		if(files == NULL){ return false; }
+		mem_copy(files, g->files, g->len * sizeof(Build_File));
+		mem_free(g->allocator, g->files);
+		g->files = files;
+		g->cap = new_cap;
+	}
+	g->files[g->len] = f;
+	g->len += 1;
+	return true;
+}
+
+void build_graph_init(Build_Graph* g, Mem_Allocator allocator){
+	*g = (Build_Graph){ .allocator = allocator };
+}
+
+void build_graph_destroy(Build_Graph* g){
+	for(isize i = 0; i < g->len; i += 1){
+		build_file_release(g->allocator, &g->files[i]);
+	}
+	mem_free(g->allocator, g->files);
+	*g = (Build_Graph){0};
+}
+
+static
+int build_symbol_cmp(void const* a, void const* b){
+	u64 x = ((Build_Symbol const*)a)->name, y = ((Build_Symbol const*)b)->name;
+	return (x > y) - (x < y);
+}
+
+static
+int build_u64_cmp(void const* a, void const* b){
+	u64 x = *(u64 const*)a, y = *(u64 const*)b;
+	return (x > y) - (x < y);
+}
+
+static
+bool build_symbols_has(Build_Symbol const* syms, isize count, u64 name, u64* signature){
+	isize lo = 0, hi = count;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(syms[mid].name == name){
+			if(signature){ *signature = syms[mid].signature; }
+			return true;
+		}
+		if(syms[mid].name < name){ lo = mid + 1; } else { hi = mid; }
+	}
+	return false;
+}
+
+static
+bool build_u64_has(u64 const* xs, isize count, u64 x){
+	isize lo = 0, hi = count;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(xs[mid] == x){ return true; }
+		if(xs[mid] < x){ lo = mid + 1; } else { hi = mid; }
+	}
+	return false;
+}
+
+static inline
+u64 build_name_hash(String name){
+	return hash128(name.data, name.len, 0).lo;
+}
+
+// Lex source and collect its top level declarations and the names it uses
+static
+bool build_file_scan(Build_File* f, String source, Mem_Allocator allocator){
+	isize export_cap = 16, import_cap = 64;
+	Build_Symbol* exports = New(Build_Symbol, export_cap, allocator);
+	u64* imports = New(u64, import_cap, allocator);
+	isize export_count = 0, import_count = 0;
+	if(exports == NULL || imports == NULL){ goto error_exit; }
+
+	Lexer lexer = lexer_make(source);
+	isize depth = 0;
+	Build_Symbol* current = NULL; // Declaration whose signature is being hashed
+	TokenKind decl_kind = Tk_Unknown;
+	Hash128 sig = {0};
+
+	for(;;){
+		Token tk = lexer_next(&lexer);
+		if(tk.kind == Tk_EOF){ break; }
+
+		// A top level func or let followed by its name, `func(` in an
+		// initializer is a function literal
+		Lexer peek = lexer;
+		Token name = {0};
+		if(depth == 0 && (tk.kind == Tk_Func || tk.kind == Tk_Let)){ name = lexer_next(&peek); }
+		bool declaration = name.kind == Tk_Identifier;
+
+		// A function's signature ends at its body. A let's ends at its `;`, so
+		// that a changed initializer also changes the inferred type importers see
+		if(current != NULL){
+			bool end = (decl_kind == Tk_Func && tk.kind == Tk_Curly_Open) ||
+				(decl_kind == Tk_Let && depth == 0 && tk.kind == Tk_Semicolon) ||
+				declaration;
+			if(end){
+				current->signature = sig.lo ^ sig.hi;
+				current = NULL;
+			} else {
+				String text = lexer_text(&lexer, tk);
+				sig = hash128(text.data, text.len, sig.lo ^ ((u64)tk.kind << 32));
+			}
+		}
+
+		if(tk.kind == Tk_Curly_Open){ depth += 1; }
+		if(tk.kind == Tk_Curly_Close && depth > 0){ depth -= 1; }
+
+		if(declaration){
+			if(export_count >= export_cap){
+				Build_Symbol* grown = New(Build_Symbol, export_cap * 2, allocator);
+				if(grown == NULL){ goto error_exit; }
+				mem_copy(grown, exports, export_count * sizeof(Build_Symbol));
+				mem_free(allocator, exports);
+				exports = grown;
+				export_cap *= 2;
+			}
+			lexer = peek;
+			current = &exports[export_count];
+			String text = lexer_text(&lexer, name);
+			*current = (Build_Symbol){ .name = build_name_hash(text) };
+			export_count += 1;
+			decl_kind = tk.kind;
+			sig = hash128(text.data, text.len, tk.kind);
+		}
+		else if(tk.kind == Tk_Identifier){
+			if(import_count >= import_cap){
+				u64* grown = New(u64, import_cap * 2, allocator);
+				if(grown == NULL){ goto error_exit; }
+				mem_copy(grown, imports, import_count * sizeof(u64));
+				mem_free(allocator, imports);
+				imports = grown;
+				import_cap *= 2;
+			}
+			imports[import_count] = build_name_hash(lexer_text(&lexer, tk));
+			import_count += 1;
+		}
+	}
+	if(current != NULL){ current->signature = sig.lo ^ sig.hi; }
+
+	qsort(exports, export_count, sizeof(Build_Symbol), build_symbol_cmp);
+	qsort(imports, import_count, sizeof(u64), build_u64_cmp);
+
+	// Deduplicate and drop names the file declares itself
+	isize n = 0;
+	for(isize i = 0; i < import_count; i += 1){
+		if(n > 0 && imports[n - 1] == imports[i]){ continue; }
+		if(build_symbols_has(exports, export_count, imports[i], NULL)){ continue; }
+		imports[n++] = imports[i];
+	}
+	import_count = n;
+
+	f->interface_hash = hash128((byte const*)exports, export_count * sizeof(Build_Symbol), 0);
+	f->exports = exports;
+	f->export_count = export_count;
+	f->imports = imports;
+	f->import_count = import_count;
+	return true;
+
+error_exit:
+	mem_free(allocator, exports);
+	mem_free(allocator, imports);
+	return false;
+}
+
+// Appends names whose signature differs between a and b (including added
+// or removed ones) to changed, returns false on allocation failure
+static
+bool build_symbols_diff(Build_Symbol const* a, isize a_len, Build_Symbol const* b, isize b_len,
+	u64** changed, isize* len, isize* cap, Mem_Allocator allocator)
+{
+	for(int pass = 0; pass < 2; pass += 1){
+		Build_Symbol const* xs = pass == 0 ? a : b;
+		isize xs_len = pass == 0 ? a_len : b_len;
+		Build_Symbol const* ys = pass == 0 ? b : a;
+		isize ys_len = pass == 0 ? b_len : a_len;
+
+		for(isize i = 0; i < xs_len; i += 1){
+			u64 sig;
+			bool found = build_symbols_has(ys, ys_len, xs[i].name, &sig);
+			if(found && sig == xs[i].signature){ continue; }
+
+			if(*len >= *cap){
+				isize new_cap = Max(*cap * 2, 64);
+				u64* grown = New(u64, new_cap, allocator);
+				if(grown == NULL){ return false; }
+				mem_copy(grown, *changed, *len * sizeof(u64));
+				mem_free(allocator, *changed);
+				*changed = grown;
+				*cap = new_cap;
+			}
+			(*changed)[*len] = xs[i].name;
+			*len += 1;
+		}
+	}
+	return true;
+}
+
+static inline
+u64 build_path_hash(String path){
+	return hash128(path.data, path.len, 0x9e3779b97f4a7c15ull).lo;
+}
+
+isize build_graph_update(Build_Graph* g, String const* paths, isize count){
+	Mem_Allocator allocator = g->allocator;
+	Build_Graph old = *g;
+	build_graph_init(g, allocator);
+
+	// Index of old files by path (open addressing, -1 is empty)
+	isize index_cap = 16;
+	while(index_cap < old.len * 2){ index_cap *= 2; }
+	isize* index = New(isize, index_cap, allocator);
+	bool* matched = New(bool, old.len + 1, allocator);
+	u64* changed = NULL;
+	isize changed_len = 0, changed_cap = 0;
+	isize dirty_count = 0;
+
+	if(index == NULL || matched == NULL){ goto error_exit; }
+	mem_set(index, 0xff, index_cap * sizeof(isize));
+	for(isize i = 0; i < old.len; i += 1){
+		isize slot = build_path_hash(old.files[i].path) & (index_cap - 1);
+		while(index[slot] >= 0){ slot = (slot + 1) & (index_cap - 1); }
+		index[slot] = i;
+	}
+
+	for(isize i = 0; i < count; i += 1){
+		String path = paths[i];
+		char path_buf[BUILD_GRAPH_PATH_MAX] = {0};
+		mem_copy(path_buf, path.data, Min(path.len, BUILD_GRAPH_PATH_MAX - 1));
+
+		Build_File* prev = NULL;
+		isize slot = build_path_hash(path) & (index_cap - 1);
+		while(index[slot] >= 0){
+			Build_File* candidate = &old.files[index[slot]];
+			if(!matched[index[slot]] && str_eq(candidate->path, path)){
+				prev = candidate;
+				matched[index[slot]] = true;
+				break;
+			}
+			slot = (slot + 1) & (index_cap - 1);
+		}
+
+		struct stat st;
+		bool exists = stat(path_buf, &st) == 0;
+		i64 mtime_ns = exists ? (i64)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec : 0;
+		i64 size = exists ? st.st_size : 0;
+
+		// Fast path: untouched on disk
+		if(prev != NULL && !prev->failed && exists && prev->mtime_ns == mtime_ns && prev->size == size){
+			Build_File f = *prev;
+			f.dirty = false;
+			*prev = (Build_File){0};
+			if(!build_graph_push(g, f)){ goto error_exit; }
+			continue;
+		}
+
+		Bytes source = exists ? file_read_all(path, allocator) : (Bytes){0};
+		Hash128 content = hash128(source.data, source.len, 0);
+
+		if(prev != NULL && !prev->failed && hash128_eq(prev->content_hash, content)){
+			Build_File f = *prev;
+			f.mtime_ns = mtime_ns;
+			f.size = size;
+			f.dirty = false;
+			*prev = (Build_File){0};
+			mem_free(allocator, source.data);
+			if(!build_graph_push(g, f)){ goto error_exit; }
+			continue;
+		}
+
+		byte* path_copy = New(byte, Max(path.len, 1), allocator);
+		Build_File f = {
+			.path = { .data = path_copy, .len = path.len },
+			.content_hash = content,
+			.mtime_ns = mtime_ns,
+			.size = size,
+			.dirty = true,
+		};
+		bool ok = path_copy != NULL;
+		if(ok){ mem_copy(path_copy, path.data, path.len); }
+		ok = ok && build_file_scan(&f, str_from_bytes(source.data, source.len), allocator);
+		mem_free(allocator, source.data);
+		if(!ok){
+			build_file_release(allocator, &f);
+			goto error_exit;
+		}
+
+		if(prev != NULL && prev->failed){
+			// Importers may have been built against a file that did not build
+			ok = build_symbols_diff(prev->exports, prev->export_count, NULL, 0, &changed, &changed_len, &changed_cap, allocator) &&
+				build_symbols_diff(NULL, 0, f.exports, f.export_count, &changed, &changed_len, &changed_cap, allocator);
+		} else {
+			ok = prev != NULL
+				? build_symbols_diff(prev->exports, prev->export_count, f.exports, f.export_count, &changed, &changed_len, &changed_cap, allocator)
+				: build_symbols_diff(NULL, 0, f.exports, f.export_count, &changed, &changed_len, &changed_cap, allocator);
+		}
+		if(prev != NULL){ build_file_release(allocator, prev); }
+		if(!ok || !build_graph_push(g, f)){
+			build_file_release(allocator, &f);
+			goto error_exit;
+		}
+		dirty_count += 1;
+	}
+
+	// Files that are gone take their symbols with them
+	for(isize i = 0; i < old.len; i += 1){
+		Build_File* f = &old.files[i];
+		if(matched[i] || f->path.data == NULL){ continue; }
+		if(!build_symbols_diff(f->exports, f->export_count, NULL, 0, &changed, &changed_len, &changed_cap, allocator)){
+			goto error_exit;
+		}
+	}
+
+	qsort(changed, changed_len, sizeof(u64), build_u64_cmp);
+
+	for(isize i = 0; i < g->len && changed_len > 0; i += 1){
+		Build_File* f = &g->files[i];
+		if(f->dirty){ continue; }
+		for(isize j = 0; j < f->import_count; j += 1){
+			if(build_u64_has(changed, changed_len, f->imports[j])){
+				f->dirty = true;
+				dirty_count += 1;
+				break;
+			}
+		}
+	}
+
+	mem_free(allocator, index);
+	mem_free(allocator, matched);
+	mem_free(allocator, changed);
+	build_graph_destroy(&old);
+	return dirty_count;
+
+error_exit:
+	mem_free(allocator, index);
+	mem_free(allocator, matched);
+	mem_free(allocator, changed);
+	build_graph_destroy(&old);
+	build_graph_destroy(g);
+	build_graph_init(g, allocator);
+	return -1;
+}
+
+// Append 8 byte aligned data to buffer
+static
+bool build_graph_write(Bytes_Buffer* bb, void const* data, isize len){
+	isize padded = (len + 7) & ~7;
+	byte* dest = buffer_reserve(bb, padded);
+	if(dest == NULL){ return false; }
+	mem_copy(dest, data, len);
+	mem_set(&dest[len], 0, padded - len);
+	buffer_commit(bb, padded);
+	return true;
+}
+
+bool build_graph_save(Build_Graph const* g, String path){
+	Bytes_Buffer bb;
+	if(!buffer_init(&bb, g->allocator, 4096)){ return false; }
+
+	Build_Graph_Header h = {
+		.magic = BUILD_GRAPH_MAGIC,
+		.version = KUURU_BUILD_GRAPH_VERSION,
+		.compiler = build_graph_compiler_hash(),
+		.file_count = g->len,
+	};
+	bool ok = build_graph_write(&bb, &h, sizeof(h));
+
+	for(isize i = 0; i < g->len && ok; i += 1){
+		Build_File const* f = &g->files[i];
+		i64 counts[3] = { f->path.len, f->export_count, f->import_count };
+		i64 stamps[3] = { f->mtime_ns, f->size, f->failed };
+		ok = ok && build_graph_write(&bb, counts, sizeof(counts));
+		ok = ok && build_graph_write(&bb, stamps, sizeof(stamps));
+		ok = ok && build_graph_write(&bb, &f->content_hash, sizeof(Hash128));
+		ok = ok && build_graph_write(&bb, &f->interface_hash, sizeof(Hash128));
+		ok = ok && build_graph_write(&bb, f->path.data, f->path.len);
+		ok = ok && build_graph_write(&bb, f->exports, f->export_count * sizeof(Build_Symbol));
+		ok = ok && build_graph_write(&bb, f->imports, f->import_count * sizeof(u64));
+	}
+
+	if(ok){
+		char tmp_path[BUILD_GRAPH_PATH_MAX + 8] = {0};
+		char final_path[BUILD_GRAPH_PATH_MAX] = {0};
+		isize n = Min(path.len, BUILD_GRAPH_PATH_MAX - 1);
+		mem_copy(final_path, path.data, n);
+		mem_copy(tmp_path, path.data, n);
+		mem_copy(&tmp_path[n], ".tmp", 4);
+
+		ok = file_write(str_from(tmp_path), buffer_bytes(&bb), bb.len) == bb.len;
+		ok = ok && rename(tmp_path, final_path) == 0;
+		if(!ok){ remove(tmp_path); }
+	}
+
+	buffer_destroy(&bb);
+	return ok;
+}
+
+typedef struct {
+	byte const* data;
+	isize len;
+	isize offset;
+} Build_Graph_Reader;
+
+// Read 8 byte aligned data, returns pointer to it or NULL if out of bounds
+static
+byte const* build_graph_read(Build_Graph_Reader* r, isize len){
+	isize padded = (len + 7) & ~7;
+	if(len < 0 || padded > r->len - r->offset){ return NULL; }
+	byte const* p = &r->data[r->offset];
+	r->offset += padded;
+	return p;
+}
+
+bool build_graph_load(Build_Graph* g, String path){
+	Mem_Allocator allocator = g->allocator;
+	build_graph_destroy(g);
+	build_graph_init(g, allocator);
+
+	Bytes data = file_read_all(path, allocator);
+	if(data.data == NULL){ return false; }
+	Build_Graph_Reader r = { .data = data.data, .len = data.len };
+
+	Build_Graph_Header h;
+	byte const* p = build_graph_read(&r, sizeof(h));
+	if(p == NULL){ goto error_exit; }
+	mem_copy(&h, p, sizeof(h));
+	if(h.magic != BUILD_GRAPH_MAGIC || h.version != KUURU_BUILD_GRAPH_VERSION ||
+	   !hash128_eq(h.compiler, build_graph_compiler_hash()) || h.file_count < 0)
+	{
+		goto error_exit;
+	}
+
+	for(i64 i = 0; i < h.file_count; i += 1){
+		i64 counts[3], stamps[3];
+		Build_File f = {0};
+
+		if((p = build_graph_read(&r, sizeof(counts))) == NULL){ goto error_exit; }
+		mem_copy(counts, p, sizeof(counts));
+		if((p = build_graph_read(&r, sizeof(stamps))) == NULL){ goto error_exit; }
+		mem_copy(stamps, p, sizeof(stamps));
+		if((p = build_graph_read(&r, sizeof(Hash128))) == NULL){ goto error_exit; }
+		mem_copy(&f.content_hash, p, sizeof(Hash128));
+		if((p = build_graph_read(&r, sizeof(Hash128))) == NULL){ goto error_exit; }
+		mem_copy(&f.interface_hash, p, sizeof(Hash128));
+		f.mtime_ns = stamps[0];
+		f.size = stamps[1];
+		f.failed = stamps[2] != 0;
+
+		if(counts[1] < 0 || counts[2] < 0 || counts[1] > r.len || counts[2] > r.len){ goto error_exit; }
+		byte const* path_data = build_graph_read(&r, counts[0]);
+		byte const* exports_data = build_graph_read(&r, counts[1] * sizeof(Build_Symbol));
+		byte const* imports_data = build_graph_read(&r, counts[2] * sizeof(u64));
+		if(path_data == NULL || exports_data == NULL || imports_data == NULL){ goto error_exit; }
+
+		byte* path_copy = New(byte, Max(counts[0], 1), allocator);
+		f.exports = New(Build_Symbol, Max(counts[1], 1), allocator);
+		f.imports = New(u64, Max(counts[2], 1), allocator);
+		f.path = (String){ .data = path_copy, .len = counts[0] };
+		f.export_count = counts[1];
+		f.import_count = counts[2];
+		if(path_copy == NULL || f.exports == NULL || f.imports == NULL){
+			build_file_release(allocator, &f);
+			goto error_exit;
+		}
+		mem_copy(path_copy, path_data, counts[0]);
+		mem_copy(f.exports, exports_data, counts[1] * sizeof(Build_Symbol));
+		mem_copy(f.imports, imports_data, counts[2] * sizeof(u64));
+
+		if(!build_graph_push(g, f)){
+			build_file_release(allocator, &f);
+			goto error_exit;
+		}
+	}
+
+	mem_free(allocator, data.data);
+	return true;
+
+error_exit:
+	mem_free(allocator, data.data);
+	build_graph_destroy(g);
+	build_graph_init(g, allocator);
+	return false;
+}
+
+#undef BUILD_GRAPH_MAGIC
+#undef BUILD_GRAPH_PATH_MAX
+#endif
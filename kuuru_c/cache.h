@@ -0,0 +1,262 @@
+#pragma once
+
+#include "base.h"
+#include "lexer.h"
+#include "hash.h"
+
+///- Interface -----------------------------------------------------------------
+#define KUURU_VERSION "0.1.0"
+
+// Bump whenever the layout of the cache files or the meaning of token kinds changes
+#define KUURU_CACHE_FORMAT_VERSION 7
+
+typedef struct Packed_Token Packed_Token;
+typedef struct Token_Cache_Header Token_Cache_Header;
+typedef struct Token_Stream Token_Stream;
+
+// Position independent token, lexeme is a (offset, len) pair into the source
+struct Packed_Token {
+	u32 kind;
+	u32 len;
+	u32 offset;
+};
+
+struct Token_Cache_Header {
+	u32 magic;
+	u32 format_version;
+	Hash128 key;
+	i64 source_len;
+	i64 token_count;
+	i64 tokens_offset; // In bytes, from the start of the file
+};
+
+struct Token_Stream {
+	String source;
+	Source_Loc base; // Location of the first byte of source, 0 unless set by the owner
+	Packed_Token const* tokens;
+	isize len;
+
+	Bytes backing;   // Memory holding `tokens`
+	bool mapped;     // Was backing mmap'd from a cache file?
+	Mem_Allocator allocator;
+};
+
+// Cache key of a source, includes the compiler version so stale entries never match
+Hash128 token_cache_key(String source);
+
+// Try to map cached tokens of source from the cache directory. Returns false on a miss.
+bool token_cache_load(String dir, String source, Token_Stream* out);
+
+// Store tokens of source into cache directory, returns success status
+bool token_cache_store(String dir, String source, Packed_Token const* tokens, isize len, Mem_Allocator allocator);
+
+// Get tokens of source, from the cache when possible, otherwise lex it and
+// store the result. If dir is empty the cache is not used. Sources must be
+// smaller than 4 GiB. Returns success status.
+bool token_stream_lex(Token_Stream* s, String dir, String source, Mem_Allocator allocator);
+
+// Release the memory of a token stream
+void token_stream_destroy(Token_Stream* s);
+
+// Get i-th token of stream
+static inline
+Token token_stream_at(Token_Stream const* s, isize i){
+	Packed_Token pt = s->tokens[i];
+	Token tk = {
+		.kind = (TokenKind)pt.kind,
+		.len = pt.len,
+		.loc = s->base + pt.offset,
+	};
+	return tk;
+}
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define TOKEN_CACHE_MAGIC 0x4354554bu /* "KUTC" */
+#define TOKEN_CACHE_PATH_MAX 4096
+
+Hash128 token_cache_key(String source){
+	static const char version[] = BASE_C_VERSION ":" KUURU_VERSION;
+	Hash128 vh = hash128((byte const*)version, sizeof(version) - 1, KUURU_CACHE_FORMAT_VERSION);
+	return hash128(source.data, source.len, vh.lo ^ vh.hi);
+}
+
+// Writes "<dir>/<key>.tok" as a cstring into buf, returns false if it does not fit
+static
+bool token_cache_path(char* buf, isize bufsize, String dir, Hash128 key, cstring suffix){
+	isize suffix_len = cstring_len(suffix);
+	if(dir.len + 1 + 32 + suffix_len + 1 > bufsize){ return false; }
+
+	isize n = 0;
+	mem_copy(&buf[n], dir.data, dir.len); n += dir.len;
+	buf[n] = '/'; n += 1;
+	hash128_hex(key, (byte*)&buf[n]); n += 32;
+	mem_copy(&buf[n], suffix, suffix_len); n += suffix_len;
+	buf[n] = 0;
+	return true;
+}
+
+static
+bool token_cache_validate(Token_Cache_Header const* h, isize file_size, String source, Hash128 key){
+	if(file_size < (isize)sizeof(*h)){ return false; }
+	if(h->magic != TOKEN_CACHE_MAGIC || h->format_version != KUURU_CACHE_FORMAT_VERSION){ return false; }
+	if(!hash128_eq(h->key, key) || h->source_len != source.len){ return false; }
+	if(h->token_count < 0 || h->tokens_offset < (i64)sizeof(*h)){ return false; }
+	if(h->tokens_offset % alignof(Packed_Token) != 0){ return false; }
+	// Divided rather than multiplied, a corrupt count must not overflow
+	if(h->tokens_offset > file_size){ return false; }
+	if(h->token_count > (file_size - h->tokens_offset) / (i64)sizeof(Packed_Token)){ return false; }
+
+	// Every lexeme must lie within the source, lexer_text trusts them
+	Packed_Token const* tokens = (Packed_Token const*)((byte const*)h + h->tokens_offset);
+	for(i64 i = 0; i < h->token_count; i += 1){
+		if((u64)tokens[i].offset + tokens[i].len > (u64)source.len){ return false; }
+	}
+	return true;
+}
+
+bool token_cache_load(String dir, String source, Token_Stream* out){
+	char path[TOKEN_CACHE_PATH_MAX];
+	Hash128 key = token_cache_key(source);
+	if(!token_cache_path(path, sizeof(path), dir, key, ".tok")){ return false; }
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){ return false; }
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size <= 0){
+		close(fd);
+		return false;
+	}
+
+	isize size = st.st_size;
+	void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED){ return false; }
+
+	Token_Cache_Header const* h = data;
+	if(!token_cache_validate(h, size, source, key)){
+		munmap(data, size);
+		return false;
+	}
+
+	*out = (Token_Stream){
+		.source = source,
+		.tokens = (Packed_Token const*)((byte const*)data + h->tokens_offset),
+		.len = h->token_count,
+		.backing = { .data = data, .len = size },
+		.mapped = true,
+	};
+	return true;
+}
+
+bool token_cache_store(String dir, String source, Packed_Token const* tokens, isize len, Mem_Allocator allocator){
+	char path[TOKEN_CACHE_PATH_MAX];
+	char tmp_path[TOKEN_CACHE_PATH_MAX];
+	Hash128 key = token_cache_key(source);
+	if(!token_cache_path(path, sizeof(path), dir, key, ".tok")){ return false; }
+	if(!token_cache_path(tmp_path, sizeof(tmp_path), dir, key, ".tmp")){ return false; }
+
+	isize size = sizeof(Token_Cache_Header) + len * sizeof(Packed_Token);
+	byte* data = New(byte, size, allocator);
+	if(data == NULL){ return false; }
+
+	Token_Cache_Header h = {
+		.magic = TOKEN_CACHE_MAGIC,
+		.format_version = KUURU_CACHE_FORMAT_VERSION,
+		.key = key,
+		.source_len = source.len,
+		.token_count = len,
+		.tokens_offset = sizeof(Token_Cache_Header),
+	};
+	mem_copy(data, &h, sizeof(h));
+	mem_copy(&data[sizeof(h)], tokens, len * sizeof(Packed_Token));
+
+	// Directory may already exist, errors are caught when writing
+	char dir_buf[TOKEN_CACHE_PATH_MAX] = {0};
+	mem_copy(dir_buf, dir.data, Min(dir.len, TOKEN_CACHE_PATH_MAX - 1));
+	mkdir(dir_buf, 0755);
+
+	// Write to a temporary and rename it, so concurrent readers never see a partial file
+	isize written = file_write(str_from(tmp_path), data, size);
+	mem_free(allocator, data);
+	if(written != size){
+		remove(tmp_path);
+		return false;
+	}
+	return rename(tmp_path, path) == 0;
+}
+
+bool token_stream_lex(Token_Stream* s, String dir, String source, Mem_Allocator allocator){
+	if(source.len >= (isize)UINT32_MAX){ return false; }
+
+	bool use_cache = dir.len > 0;
+	if(use_cache && token_cache_load(dir, source, s)){
+		s->allocator = allocator;
+		return true;
+	}
+
+	isize cap = 64;
+	Packed_Token* tokens = New(Packed_Token, cap, allocator);
+	if(tokens == NULL){ return false; }
+	isize len = 0;
+
+	Lexer lexer = lexer_make(source);
+	for(;;){
+		Token tk = lexer_next(&lexer);
+		if(tk.kind == Tk_EOF){ break; }
+
+		if(len >= cap){
+			Packed_Token* new_tokens = New(Packed_Token, cap * 2, allocator);
+			if(new_tokens == NULL){
+				mem_free(allocator, tokens);
+				return false;
+			}
+			mem_copy(new_tokens, tokens, len * sizeof(Packed_Token));
+			mem_free(allocator, tokens);
+			tokens = new_tokens;
+			cap *= 2;
+		}
+
+		tokens[len] = (Packed_Token){
+			.kind = tk.kind,
+			.len = tk.len,
+			.offset = tk.loc,
+		};
+		len += 1;
+	}
+
+	if(use_cache){
+		token_cache_store(dir, source, tokens, len, allocator);
+	}
+
+	*s = (Token_Stream){
+		.source = source,
+		.tokens = tokens,
+		.len = len,
+		.backing = { .data = (byte*)tokens, .len = cap * sizeof(Packed_Token) },
+		.mapped = false,
+		.allocator = allocator,
+	};
+	return true;
+}
+
+void token_stream_destroy(Token_Stream* s){
+	if(s->mapped){
+		munmap(s->backing.data, s->backing.len);
+	} else {
+		mem_free(s->allocator, s->backing.data);
+	}
+	*s = (Token_Stream){0};
+}
+
+#undef TOKEN_CACHE_MAGIC
+#undef TOKEN_CACHE_PATH_MAX
+#endif
@@ -0,0 +1,549 @@
+#pragma once
+
+#include "base.h"
+#include "ir.h"
+#include "cache.h"
+
+///- Interface -----------------------------------------------------------------
+
+// Output is accumulated and handed to the writer in batches of this size
+#define CODEGEN_C_FLUSH_SIZE (64 * 1024)
+
+// Emit a standalone C11 translation unit for every function of module. Values
+// with a known type use native i64/f64/bool arithmetic, everything else is a
+// tagged Kr_Value handled by a small runtime emitted with the code. Traps
+// print a message and exit. If `entry` is not negative a main() is emitted
+// that parses its parameters from the command line and prints the result.
+// The output needs base.h on the include path. Returns success status.
+bool codegen_c_module(Ir_Module const* m, isize entry, IO_Writer out, Mem_Allocator allocator);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <stdarg.h>
+
+typedef struct Codegen_C Codegen_C;
+
+struct Codegen_C {
+	Ir_Module const* module;
+	Bytes_Buffer buf;
+	IO_Writer out;
+	bool ok;
+};
+
+static const char codegen_c_prelude[] =
+	"// Generated by kuuru " KUURU_VERSION ", do not edit\n"
+	"#include \"base.h\"\n"
+	"#include <errno.h>\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"enum { KR_NIL, KR_BOOL, KR_INT, KR_REAL };\n"
+	"typedef struct { u8 kind; union { bool boolean; i64 integer; f64 real; }; } Kr_Value;\n"
+	"\n"
+	"static void kr_trap(char const* what){ fprintf(stderr, \"kuuru: %s\\n\", what); exit(1); }\n"
+	"static inline Kr_Value kr_nil(void){ return (Kr_Value){ .kind = KR_NIL }; }\n"
+	"static inline Kr_Value kr_from_bool(bool v){ return (Kr_Value){ .kind = KR_BOOL, .boolean = v }; }\n"
+	"static inline Kr_Value kr_from_int(i64 v){ return (Kr_Value){ .kind = KR_INT, .integer = v }; }\n"
+	"static inline Kr_Value kr_from_real(f64 v){ return (Kr_Value){ .kind = KR_REAL, .real = v }; }\n"
+	"static inline bool kr_as_bool(Kr_Value v){ if(v.kind != KR_BOOL){ kr_trap(\"type error\"); } return v.boolean; }\n"
+	"static inline i64 kr_as_int(Kr_Value v){ if(v.kind != KR_INT){ kr_trap(\"type error\"); } return v.integer; }\n"
+	"static inline f64 kr_as_real(Kr_Value v){ if(v.kind != KR_REAL){ kr_trap(\"type error\"); } return v.real; }\n"
+	"static inline f64 kr_real_from_bits(u64 bits){ f64 v; memcpy(&v, &bits, sizeof(v)); return v; }\n"
+	"static inline bool kr_truthy(Kr_Value v){ return !(v.kind == KR_NIL || (v.kind == KR_BOOL && !v.boolean)); }\n"
+	"\n"
+	"// Integer arithmetic wraps around on overflow\n"
+	"static inline i64 kr_int_add(i64 x, i64 y){ return (i64)((u64)x + (u64)y); }\n"
+	"static inline i64 kr_int_sub(i64 x, i64 y){ return (i64)((u64)x - (u64)y); }\n"
+	"static inline i64 kr_int_mul(i64 x, i64 y){ return (i64)((u64)x * (u64)y); }\n"
+	"static inline i64 kr_int_div(i64 x, i64 y){ if(y == 0){ kr_trap(\"division by zero\"); } return y == -1 ? kr_int_sub(0, x) : x / y; }\n"
+	"static inline i64 kr_int_mod(i64 x, i64 y){ if(y == 0){ kr_trap(\"division by zero\"); } return y == -1 ? 0 : x % y; }\n"
+	"static inline f64 kr_real_add(f64 x, f64 y){ return x + y; }\n"
+	"static inline f64 kr_real_sub(f64 x, f64 y){ return x - y; }\n"
+	"static inline f64 kr_real_mul(f64 x, f64 y){ return x * y; }\n"
+	"static inline f64 kr_real_div(f64 x, f64 y){ return x / y; }\n"
+	"\n"
+	"#define KR_ARITH(name_) \\\n"
+	"	static inline Kr_Value kr_##name_(Kr_Value a, Kr_Value b){ \\\n"
+	"		if(a.kind == KR_INT && b.kind == KR_INT){ return kr_from_int(kr_int_##name_(a.integer, b.integer)); } \\\n"
+	"		if(a.kind == KR_REAL && b.kind == KR_REAL){ return kr_from_real(kr_real_##name_(a.real, b.real)); } \\\n"
+	"		kr_trap(\"type error\"); return kr_nil(); \\\n"
+	"	}\n"
+	"KR_ARITH(add) KR_ARITH(sub) KR_ARITH(mul) KR_ARITH(div)\n"
+	"#define KR_INTEGER(name_, expr_) \\\n"
+	"	static inline Kr_Value kr_##name_(Kr_Value a, Kr_Value b){ \\\n"
+	"		i64 x = kr_as_int(a), y = kr_as_int(b); return kr_from_int(expr_); \\\n"
+	"	}\n"
+	"KR_INTEGER(mod, kr_int_mod(x, y)) KR_INTEGER(bit_and, x & y) KR_INTEGER(bit_or, x | y) KR_INTEGER(bit_xor, x ^ y)\n"
+	"#define KR_COMPARE(name_, op_) \\\n"
+	"	static inline bool kr_##name_(Kr_Value a, Kr_Value b){ \\\n"
+	"		if(a.kind == KR_INT && b.kind == KR_INT){ return a.integer op_ b.integer; } \\\n"
+	"		if(a.kind == KR_REAL && b.kind == KR_REAL){ return a.real op_ b.real; } \\\n"
+	"		kr_trap(\"type error\"); return false; \\\n"
+	"	}\n"
+	"KR_COMPARE(lt, <) KR_COMPARE(lte, <=)\n"
+	"\n"
+	"static inline Kr_Value kr_add_imm(Kr_Value a, i64 imm){ return a.kind == KR_REAL ? kr_from_real(a.real + (f64)imm) : kr_from_int(kr_int_add(kr_as_int(a), imm)); }\n"
+	"static inline Kr_Value kr_neg(Kr_Value a){ return a.kind == KR_REAL ? kr_from_real(-a.real) : kr_from_int(kr_int_sub(0, kr_as_int(a))); }\n"
+	"static inline Kr_Value kr_bit_not(Kr_Value a){ return kr_from_int(~kr_as_int(a)); }\n"
+	"static inline bool kr_eq(Kr_Value a, Kr_Value b){\n"
+	"	if(a.kind != b.kind){ return false; }\n"
+	"	switch(a.kind){\n"
+	"		case KR_BOOL: return a.boolean == b.boolean;\n"
+	"		case KR_INT:  return a.integer == b.integer;\n"
+	"		case KR_REAL: return a.real == b.real;\n"
+	"	}\n"
+	"	return true;\n"
+	"}\n"
+	"\n"
+	"static void kr_print(Kr_Value v){\n"
+	"	switch(v.kind){\n"
+	"		case KR_NIL:  printf(\"nil\\n\"); break;\n"
+	"		case KR_BOOL: printf(\"%s\\n\", v.boolean ? \"true\" : \"false\"); break;\n"
+	"		case KR_INT:  printf(\"%lld\\n\", (long long)v.integer); break;\n"
+	"		case KR_REAL: printf(\"%.17g\\n\", v.real); break;\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"// Arguments follow the rules of Kuuru literals, with an optional sign:\n"
+	"// decimal unless prefixed by 0x, 0o or 0b, single '_' between digits, and\n"
+	"// reals with a fraction or an exponent. Anything else, or a value out of\n"
+	"// range, is an error.\n"
+	"static int kr_digit(char c){ c |= 0x20; return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : 16; }\n"
+	"static Kr_Value kr_parse(char const* s){\n"
+	"	if(strcmp(s, \"nil\") == 0){ return kr_nil(); }\n"
+	"	if(strcmp(s, \"true\") == 0 || strcmp(s, \"false\") == 0){ return kr_from_bool(s[0] == 't'); }\n"
+	"	bool negative = s[0] == '-';\n"
+	"	char const* p = s + (s[0] == '-' || s[0] == '+');\n"
+	"	int base = 10;\n"
+	"	if(p[0] == '0' && p[1] != 0 && p[2] != 0){\n"
+	"		char prefix = p[1] | 0x20;\n"
+	"		base = prefix == 'x' ? 16 : prefix == 'o' ? 8 : prefix == 'b' ? 2 : 10;\n"
+	"		if(base != 10){ p += 2; }\n"
+	"	}\n"
+	"	if(kr_digit(p[0]) >= base){ kr_trap(\"bad number argument\"); }\n"
+	"\n"
+	"	// Drop the separators, strtoull and strtod do not know them\n"
+	"	char digits[512];\n"
+	"	size_t n = 0;\n"
+	"	bool real = false;\n"
+	"	for(size_t i = 0; p[i] != 0; i += 1){\n"
+	"		if(p[i] == '_' && kr_digit(p[i - 1]) < base && kr_digit(p[i + 1]) < base){ continue; }\n"
+	"		bool exponent_sign = (p[i] == '+' || p[i] == '-') && (p[i - 1] | 0x20) == 'e';\n"
+	"		if(p[i] == '.' && kr_digit(p[i + 1]) >= 10){ kr_trap(\"bad number argument\"); }\n"
+	"		if(kr_digit(p[i]) >= base && !(base == 10 && (p[i] == '.' || (p[i] | 0x20) == 'e' || exponent_sign))){\n"
+	"			kr_trap(\"bad number argument\");\n"
+	"		}\n"
+	"		real = real || kr_digit(p[i]) >= base;\n"
+	"		if(n + 1 >= sizeof(digits)){ kr_trap(\"bad number argument\"); }\n"
+	"		digits[n++] = p[i];\n"
+	"	}\n"
+	"	digits[n] = 0;\n"
+	"\n"
+	"	char* end;\n"
+	"	errno = 0;\n"
+	"	if(!real){\n"
+	"		unsigned long long u = strtoull(digits, &end, base);\n"
+	"		unsigned long long limit = negative ? 0ull - (unsigned long long)INT64_MIN : (unsigned long long)INT64_MAX;\n"
+	"		if(errno == ERANGE || u > limit){ kr_trap(\"number argument out of range\"); }\n"
+	"		return kr_from_int(negative ? (i64)(0ull - u) : (i64)u);\n"
+	"	}\n"
+	"	f64 v = strtod(digits, &end);\n"
+	"	if(*end != 0){ kr_trap(\"bad number argument\"); }\n"
+	"	// Underflow becomes 0 as for literals, overflow is an error\n"
+	"	if(errno == ERANGE && (v > 1 || v < -1)){ kr_trap(\"number argument out of range\"); }\n"
+	"	return kr_from_real(negative ? -v : v);\n"
+	"}\n"
+	"\n";
+
+static
+void codegen_c_flush(Codegen_C* cg){
+	if(cg->buf.len == 0){ return; }
+	if(io_write(cg->out, buffer_bytes(&cg->buf), cg->buf.len) < 0){ cg->ok = false; }
+	cg->buf.len = 0;
+	cg->buf.last_read = 0;
+}
+
+static
+void codegen_c_write(Codegen_C* cg, char const* data, isize len){
+	if(!cg->ok){ return; }
+	if(!buffer_write(&cg->buf, (byte const*)data, len)){ cg->ok = false; }
+	if(cg->buf.len >= CODEGEN_C_FLUSH_SIZE){ codegen_c_flush(cg); }
+}
+
+static
+void codegen_c_hex(Codegen_C* cg, u64 v){
+	char digits[16];
+	isize n = 0;
+	do {
+		digits[15 - n] = "0123456789abcdef"[v & 15];
+		v >>= 4;
+		n += 1;
+	} while(v != 0);
+	codegen_c_write(cg, &digits[16 - n], n);
+}
+
+// Understands only what the emitter uses: %s, %u, %td, %lld, %llx and %%.
+// Numbers are written by the base formatters, so the output does not depend
+// on the locale and needs no scratch space.
+__attribute__((format(printf, 2, 3)))
+static
+void codegen_c_printf(Codegen_C* cg, char const* fmt, ...){
+	va_list args;
+	va_start(args, fmt);
+	char const* run = fmt;
+	for(char const* p = fmt; cg->ok; p += 1){
+		if(*p != '%' && *p != 0){ continue; }
+		codegen_c_write(cg, run, p - run);
+		if(*p == 0){ break; }
+
+		p += 1;
+		bool ok = true;
+		if(p[0] == 's'){
+			char const* s = va_arg(args, char const*);
+			codegen_c_write(cg, s, cstring_len(s));
+		}
+		else if(p[0] == 'u'){ ok = buffer_write_u64(&cg->buf, va_arg(args, unsigned)); }
+		else if(p[0] == 't' && p[1] == 'd'){ p += 1; ok = buffer_write_i64(&cg->buf, va_arg(args, ptrdiff_t)); }
+		else if(p[0] == 'l' && p[1] == 'l' && p[2] == 'd'){ p += 2; ok = buffer_write_i64(&cg->buf, va_arg(args, long long)); }
+		else if(p[0] == 'l' && p[1] == 'l' && p[2] == 'x'){ p += 2; codegen_c_hex(cg, va_arg(args, unsigned long long)); }
+		else if(p[0] == '%'){ codegen_c_write(cg, "%", 1); }
+		else { ok = false; }
+		if(!ok){ cg->ok = false; }
+		run = p + 1;
+	}
+	va_end(args);
+	if(cg->buf.len >= CODEGEN_C_FLUSH_SIZE){ codegen_c_flush(cg); }
+}
+
+// An i64 literal. The one for INT64_MIN is spelled as a difference, since
+// INT64_C(-9223372036854775808) negates a constant that does not fit.
+static
+void codegen_c_int(Codegen_C* cg, i64 v){
+	if(v == INT64_MIN){ codegen_c_write(cg, "(-INT64_C(9223372036854775807)-1)", 33); }
+	else { codegen_c_printf(cg, "INT64_C(%lld)", (long long)v); }
+}
+
+static inline
+bool codegen_c_is_native(Ir_Type t){
+	return t == Ir_Bool || t == Ir_Int || t == Ir_Real;
+}
+
+static
+cstring codegen_c_type(Ir_Type t){
+	switch(t){
+		case Ir_Bool: return "bool";
+		case Ir_Int:  return "i64";
+		case Ir_Real: return "f64";
+		default:      return "Kr_Value";
+	}
+}
+
+// Write value `ref` converted to the representation of type `want`
+static
+void codegen_c_value(Codegen_C* cg, Ir_Function const* f, Ir_Ref ref, Ir_Type want){
+	Ir_Type have = f->insts[ref].type;
+	bool native_have = codegen_c_is_native(have);
+	bool native_want = codegen_c_is_native(want);
+
+	if(have == want || (!native_have && !native_want)){
+		codegen_c_printf(cg, "v%u", ref);
+	}
+	else if(native_have && !native_want){
+		codegen_c_printf(cg, "kr_from_%s(v%u)", have == Ir_Bool ? "bool" : (have == Ir_Int ? "int" : "real"), ref);
+	}
+	else if(!native_have){
+		codegen_c_printf(cg, "kr_as_%s(v%u)", want == Ir_Bool ? "bool" : (want == Ir_Int ? "int" : "real"), ref);
+	}
+	else {
+		// Different native types never meet after type inference, go through a box to trap
+		codegen_c_printf(cg, "kr_as_%s(kr_from_%s(v%u))",
+			want == Ir_Bool ? "bool" : (want == Ir_Int ? "int" : "real"),
+			have == Ir_Bool ? "bool" : (have == Ir_Int ? "int" : "real"), ref);
+	}
+}
+
+static
+void codegen_c_function_name(Codegen_C* cg, Ir_Function const* f, isize index){
+	codegen_c_printf(cg, "kr_fn%td_", index);
+	char name[64];
+	isize len = 0;
+	for(isize i = 0; i < f->name.len && len < (isize)sizeof(name) - 1; i += 1){
+		byte c = f->name.data[i];
+		bool alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+		name[len++] = alnum ? c : '_';
+	}
+	codegen_c_write(cg, name, len);
+}
+
+static
+void codegen_c_signature(Codegen_C* cg, Ir_Function const* f, isize index){
+	codegen_c_printf(cg, "static %s ", codegen_c_type(f->return_type));
+	codegen_c_function_name(cg, f, index);
+	codegen_c_write(cg, "(", 1);
+	for(u32 i = 0; i < f->param_count; i += 1){
+		codegen_c_printf(cg, "%s%s p%u", i > 0 ? ", " : "", codegen_c_type(f->param_types[i]), i);
+	}
+	if(f->param_count == 0){ codegen_c_write(cg, "void", 4); }
+	codegen_c_write(cg, ")", 1);
+}
+
+// Assign the phis of `to` for the edge coming from `from`, then jump
+static
+void codegen_c_edge(Codegen_C* cg, Ir_Function const* f, u32 from, u32 to){
+	Ir_Block const* target = &f->blocks[to];
+	u32 pred = 0;
+	while(pred < target->pred_count && f->preds[target->preds + pred] != from){ pred += 1; }
+
+	// Phis copy in parallel, so read every operand before writing any of them
+	codegen_c_write(cg, "{ ", 2);
+	for(Ir_Ref r = target->first; r != IR_REF_NONE && f->insts[r].op == Ir_Op_Phi; r = f->insts[r].next){
+		codegen_c_printf(cg, "%s t%u = ", codegen_c_type(f->insts[r].type), r);
+		codegen_c_value(cg, f, ir_operands(f, r)[pred], f->insts[r].type);
+		codegen_c_write(cg, "; ", 2);
+	}
+	for(Ir_Ref r = target->first; r != IR_REF_NONE && f->insts[r].op == Ir_Op_Phi; r = f->insts[r].next){
+		codegen_c_printf(cg, "v%u = t%u; ", r, r);
+	}
+	codegen_c_printf(cg, "goto b%u; }", to);
+}
+
+static
+void codegen_c_binary(Codegen_C* cg, Ir_Function const* f, Ir_Ref r, cstring name, cstring op){
+	Ir_Inst const* inst = &f->insts[r];
+	Ir_Ref const* ops = ir_operands(f, r);
+	Ir_Type t = inst->type;
+
+	if(t == Ir_Int && op == NULL){
+		codegen_c_printf(cg, "kr_int_%s(", name);
+	} else if(codegen_c_is_native(t)){
+		codegen_c_write(cg, "(", 1);
+	} else {
+		codegen_c_printf(cg, "kr_%s(", name);
+		t = Ir_Dynamic;
+	}
+
+	codegen_c_value(cg, f, ops[0], t);
+	if(op != NULL && codegen_c_is_native(t)){ codegen_c_printf(cg, " %s ", op); }
+	else { codegen_c_write(cg, ", ", 2); }
+	codegen_c_value(cg, f, ops[1], t);
+	codegen_c_write(cg, ")", 1);
+}
+
+static
+void codegen_c_compare(Codegen_C* cg, Ir_Function const* f, Ir_Ref r, cstring name, cstring op){
+	Ir_Ref const* ops = ir_operands(f, r);
+	Ir_Type a = f->insts[ops[0]].type;
+	Ir_Type b = f->insts[ops[1]].type;
+
+	if(a == b && codegen_c_is_native(a) && !(a == Ir_Bool && op[0] == '<')){
+		codegen_c_printf(cg, "(v%u %s v%u)", ops[0], op, ops[1]);
+	}
+	else if(op[0] == '=' && codegen_c_is_native(a) && codegen_c_is_native(b)){
+		codegen_c_write(cg, "false", 5); // Values of different kinds are never equal
+	}
+	else {
+		codegen_c_printf(cg, "kr_%s(", name);
+		codegen_c_value(cg, f, ops[0], Ir_Dynamic);
+		codegen_c_write(cg, ", ", 2);
+		codegen_c_value(cg, f, ops[1], Ir_Dynamic);
+		codegen_c_write(cg, ")", 1);
+	}
+}
+
+static
+void codegen_c_inst(Codegen_C* cg, Ir_Module const* m, Ir_Function const* f, Ir_Ref r){
+	Ir_Inst const* inst = &f->insts[r];
+	Ir_Ref const* ops = ir_operands(f, r);
+	Ir_Type t = inst->type;
+	Ir_Type a = inst->operand_count > 0 ? f->insts[ops[0]].type : Ir_Unknown;
+
+	if(ir_op_flags[inst->op] & Ir_Flag_Terminator){ return; }
+	if(inst->op == Ir_Op_Phi || inst->op == Ir_Op_Nop){ return; }
+	codegen_c_printf(cg, "\tv%u = ", r);
+
+	switch((Ir_Op)inst->op){
+		case Ir_Op_Param: codegen_c_printf(cg, "p%u", (u32)inst->imm); break;
+		case Ir_Op_Copy:  codegen_c_value(cg, f, ops[0], t); break;
+
+		case Ir_Op_Const: {
+			if(t == Ir_Int){ codegen_c_int(cg, inst->imm); }
+			else if(t == Ir_Bool){ codegen_c_printf(cg, "%s", inst->imm ? "true" : "false"); }
+			else if(t == Ir_Real){ codegen_c_printf(cg, "kr_real_from_bits(UINT64_C(0x%llx))", (unsigned long long)inst->imm); }
+			else { codegen_c_write(cg, "kr_nil()", 8); }
+		} break;
+
+		case Ir_Op_Add: codegen_c_binary(cg, f, r, "add", t == Ir_Real ? "+" : NULL); break;
+		case Ir_Op_Sub: codegen_c_binary(cg, f, r, "sub", t == Ir_Real ? "-" : NULL); break;
+		case Ir_Op_Mul: codegen_c_binary(cg, f, r, "mul", t == Ir_Real ? "*" : NULL); break;
+		case Ir_Op_Div: codegen_c_binary(cg, f, r, "div", t == Ir_Real ? "/" : NULL); break;
+		case Ir_Op_Mod: codegen_c_binary(cg, f, r, "mod", NULL); break;
+		case Ir_Op_Bit_And: codegen_c_binary(cg, f, r, "bit_and", "&"); break;
+		case Ir_Op_Bit_Or:  codegen_c_binary(cg, f, r, "bit_or", "|"); break;
+		case Ir_Op_Bit_Xor: codegen_c_binary(cg, f, r, "bit_xor", "^"); break;
+
+		case Ir_Op_Add_Imm: {
+			if(t == Ir_Int){
+				codegen_c_printf(cg, "kr_int_add(v%u, ", ops[0]);
+				codegen_c_int(cg, inst->imm);
+				codegen_c_write(cg, ")", 1);
+			}
+			else if(t == Ir_Real){ codegen_c_printf(cg, "(v%u + %lld.0)", ops[0], (long long)inst->imm); }
+			else {
+				codegen_c_write(cg, "kr_add_imm(", 11);
+				codegen_c_value(cg, f, ops[0], Ir_Dynamic);
+				codegen_c_write(cg, ", ", 2);
+				codegen_c_int(cg, inst->imm);
+				codegen_c_write(cg, ")", 1);
+			}
+		} break;
+
+		case Ir_Op_Neg: case Ir_Op_Bit_Not: {
+			bool neg = inst->op == Ir_Op_Neg;
+			if(t == Ir_Int){ codegen_c_printf(cg, neg ? "kr_int_sub(0, v%u)" : "(~v%u)", ops[0]); }
+			else if(t == Ir_Real){ codegen_c_printf(cg, "(-v%u)", ops[0]); }
+			else {
+				codegen_c_write(cg, neg ? "kr_neg(" : "kr_bit_not(", neg ? 7 : 11);
+				codegen_c_value(cg, f, ops[0], Ir_Dynamic);
+				codegen_c_write(cg, ")", 1);
+			}
+		} break;
+
+		case Ir_Op_Not: {
+			if(a == Ir_Bool){ codegen_c_printf(cg, "(!v%u)", ops[0]); }
+			else if(codegen_c_is_native(a)){ codegen_c_write(cg, "false", 5); }
+			else { codegen_c_printf(cg, "(!kr_truthy(v%u))", ops[0]); }
+		} break;
+
+		case Ir_Op_Eq:  codegen_c_compare(cg, f, r, "eq", "=="); break;
+		case Ir_Op_Lt:  codegen_c_compare(cg, f, r, "lt", "<"); break;
+		case Ir_Op_Lte: codegen_c_compare(cg, f, r, "lte", "<="); break;
+
+		case Ir_Op_Call: {
+			Ir_Function const* callee = &m->functions[inst->imm];
+			codegen_c_function_name(cg, callee, inst->imm);
+			codegen_c_write(cg, "(", 1);
+			for(u32 i = 0; i < inst->operand_count; i += 1){
+				if(i > 0){ codegen_c_write(cg, ", ", 2); }
+				codegen_c_value(cg, f, ops[i], callee->param_types[i]);
+			}
+			codegen_c_write(cg, ")", 1);
+		} break;
+
+		default: break;
+	}
+	codegen_c_write(cg, ";\n", 2);
+}
+
+static
+void codegen_c_function(Codegen_C* cg, Ir_Module const* m, isize index){
+	Ir_Function const* f = &m->functions[index];
+	codegen_c_signature(cg, f, index);
+	codegen_c_write(cg, "{\n", 2);
+
+	// Every value is declared up front, so jumps never cross an initialization
+	for(isize b = 0; b < f->block_count; b += 1){
+		for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+			if(ir_op_flags[f->insts[r].op] & Ir_Flag_Terminator){ continue; }
+			codegen_c_printf(cg, "\t%s v%u;\n", codegen_c_type(f->insts[r].type), r);
+		}
+	}
+
+	for(isize b = 0; b < f->block_count; b += 1){
+		Ir_Block const* blk = &f->blocks[b];
+		if(blk->first == IR_REF_NONE){ continue; }
+		if(blk->pred_count > 0){ codegen_c_printf(cg, "b%td:;\n", b); }
+
+		for(Ir_Ref r = blk->first; r != IR_REF_NONE; r = f->insts[r].next){
+			codegen_c_inst(cg, m, f, r);
+		}
+
+		Ir_Ref term = blk->last;
+		Ir_Inst const* inst = &f->insts[term];
+		Ir_Ref const* ops = ir_operands(f, term);
+		switch(inst->op){
+			case Ir_Op_Return: {
+				codegen_c_write(cg, "\treturn ", 8);
+				codegen_c_value(cg, f, ops[0], f->return_type);
+				codegen_c_write(cg, ";\n", 2);
+			} break;
+
+			case Ir_Op_Jump: {
+				codegen_c_write(cg, "\t", 1);
+				codegen_c_edge(cg, f, b, blk->succs[0]);
+				codegen_c_write(cg, "\n", 1);
+			} break;
+
+			case Ir_Op_Branch: {
+				Ir_Type ct = f->insts[ops[0]].type;
+				if(ct == Ir_Bool){ codegen_c_printf(cg, "\tif(v%u)", ops[0]); }
+				else if(codegen_c_is_native(ct)){ codegen_c_write(cg, "\tif(true)", 9); }
+				else { codegen_c_printf(cg, "\tif(kr_truthy(v%u))", ops[0]); }
+				codegen_c_edge(cg, f, b, blk->succs[0]);
+				codegen_c_write(cg, " else ", 6);
+				codegen_c_edge(cg, f, b, blk->succs[1]);
+				codegen_c_write(cg, "\n", 1);
+			} break;
+
+			default: {
+				codegen_c_write(cg, "\tkr_trap(\"missing terminator\");\n", 32);
+			} break;
+		}
+	}
+	codegen_c_write(cg, "}\n\n", 3);
+}
+
+static
+void codegen_c_main(Codegen_C* cg, Ir_Module const* m, isize entry){
+	Ir_Function const* f = &m->functions[entry];
+	codegen_c_printf(cg,
+		"int main(int argc, char** argv){\n"
+		"\tif(argc != %u){\n"
+		"\t\tfprintf(stderr, \"Usage: %%s <%u arguments>\\n\", argv[0]);\n"
+		"\t\treturn 2;\n"
+		"\t}\n", f->param_count + 1, f->param_count);
+
+	codegen_c_printf(cg, "\t%s result = ", codegen_c_type(f->return_type));
+	codegen_c_function_name(cg, f, entry);
+	codegen_c_write(cg, "(", 1);
+	for(u32 i = 0; i < f->param_count; i += 1){
+		Ir_Type t = f->param_types[i];
+		cstring conv = t == Ir_Bool ? "kr_as_bool" : (t == Ir_Int ? "kr_as_int" : (t == Ir_Real ? "kr_as_real" : ""));
+		codegen_c_printf(cg, "%s%s(kr_parse(argv[%u]))", i > 0 ? ", " : "", conv, i + 1);
+	}
+	codegen_c_write(cg, ");\n", 3);
+
+	Ir_Type rt = f->return_type;
+	cstring box = rt == Ir_Bool ? "kr_from_bool" : (rt == Ir_Int ? "kr_from_int" : (rt == Ir_Real ? "kr_from_real" : ""));
+	codegen_c_printf(cg, "\tkr_print(%s(result));\n\treturn 0;\n}\n", box);
+}
+
+bool codegen_c_module(Ir_Module const* m, isize entry, IO_Writer out, Mem_Allocator allocator){
+	Codegen_C cg = {
+		.module = m,
+		.out = out,
+		.ok = true,
+	};
+	if(!buffer_init(&cg.buf, allocator, CODEGEN_C_FLUSH_SIZE * 2)){ return false; }
+
+	codegen_c_write(&cg, codegen_c_prelude, sizeof(codegen_c_prelude) - 1);
+	for(isize i = 0; i < m->len; i += 1){
+		codegen_c_signature(&cg, &m->functions[i], i);
+		codegen_c_write(&cg, ";\n", 2);
+	}
+	codegen_c_write(&cg, "\n", 1);
+
+	for(isize i = 0; i < m->len; i += 1){
+		codegen_c_function(&cg, m, i);
+	}
+	if(entry >= 0 && entry < m->len){
+		codegen_c_main(&cg, m, entry);
+	}
+
+	if(cg.ok){ codegen_c_flush(&cg); }
+	buffer_destroy(&cg.buf);
+	return cg.ok;
+}
+
+#endif
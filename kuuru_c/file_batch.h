@@ -0,0 +1,580 @@
+#pragma once
+
+#include "base.h"
+
+#include <pthread.h>
+
+///- Interface -----------------------------------------------------------------
+typedef struct File_Batch File_Batch;
+typedef struct File_Batch_Result File_Batch_Result;
+typedef struct File_Batch_Load File_Batch_Load;
+typedef struct File_Batch_Ring File_Batch_Ring;
+
+// Files being loaded at the same time
+#define FILE_BATCH_IN_FLIGHT 64
+
+// Threads of the fallback when io_uring is unavailable
+#define FILE_BATCH_MAX_THREADS 8
+
+// A loaded file
+struct File_Batch_Result {
+	isize index; // Of its path, in the paths given to file_batch_init
+	Bytes data;  // Allocates one extra 0 byte past the end, like file_read_all
+	int error;   // errno of the failure, data is empty then
+};
+
+// Progress of a file through the io_uring
+struct File_Batch_Load {
+	int fd;
+	int error;
+	i32 slot;    // Of the statx buffer
+	u32 pending; // Open and statx operations not yet complete
+	isize size;
+	isize offset;
+	byte* data;
+};
+
+// Submission and completion queues shared with the kernel, see io_uring(7)
+struct File_Batch_Ring {
+	int fd;
+	u32 entries;
+	u32* sq_head;
+	u32* sq_tail;
+	u32* sq_array;
+	u32 sq_mask;
+	u32 sq_pending; // Written but not yet submitted
+	void* sqes;
+	u32* cq_head;
+	u32* cq_tail;
+	u32 cq_mask;
+	void* cqes;
+
+	void* sq_map;
+	isize sq_map_len;
+	void* cq_map;
+	isize cq_map_len;
+	isize sqes_len;
+};
+
+// Loads many files at once, in the order they finish, so their processing can
+// start as soon as the first one arrives. Opening, sizing and reading up to
+// FILE_BATCH_IN_FLIGHT files are submitted to the kernel together through an
+// io_uring. When io_uring is unavailable (old kernels, seccomp filters), a pool
+// of threads loads files with blocking reads instead.
+struct File_Batch {
+	Mem_Allocator allocator; // Only used by one thread at a time
+	isize count;
+	char* paths;             // As C strings, back to back
+	isize* path_offsets;
+	File_Batch_Result* results;
+	isize* ready;            // Indices of the files loaded, in the order they were
+	isize ready_len;
+	isize delivered;
+	isize next_file;         // Next file to start loading
+
+	bool uring;
+	File_Batch_Ring ring;
+	File_Batch_Load* loads;
+	void* statx_bufs;
+	i32 free_slots[FILE_BATCH_IN_FLIGHT];
+	isize free_slots_len;
+	isize in_flight;         // Started and not yet loaded
+	isize ops_pending;       // Submitted and not yet complete, closes included
+
+	pthread_t threads[FILE_BATCH_MAX_THREADS];
+	int thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t loaded;
+};
+
+// Start loading count files. Their contents are allocated with allocator, which
+// becomes owned by the caller once delivered. Returns false if out of memory.
+bool file_batch_init(File_Batch* b, String const* paths, isize count, Mem_Allocator allocator);
+
+// Wait for the next loaded file. Returns false once every file was delivered.
+bool file_batch_next(File_Batch* b, File_Batch_Result* result);
+
+// Stop loading, freeing the files that were not delivered
+void file_batch_destroy(File_Batch* b);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+	#include <linux/io_uring.h>
+	#include <linux/stat.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+	#define FILE_BATCH_URING 1
+#else
+	#define FILE_BATCH_URING 0
+#endif
+
+static
+void file_batch_finish(File_Batch* b, isize index, Bytes data, int error){
+	b->results[index] = (File_Batch_Result){
+		.index = index,
+		.data = error == 0 ? data : (Bytes){0},
+		.error = error,
+	};
+	b->ready[b->ready_len] = index;
+	b->ready_len += 1;
+}
+
+static inline
+char const* file_batch_path(File_Batch const* b, isize index){
+	return &b->paths[b->path_offsets[index]];
+}
+
+///- io_uring
+#if FILE_BATCH_URING
+
+// Kinds of operations, in the low bits of their user_data
+enum {
+	File_Batch_Op_Open = 0,
+	File_Batch_Op_Statx,
+	File_Batch_Op_Read,
+	File_Batch_Op_Close,
+};
+
+static
+bool file_batch_ring_init(File_Batch_Ring* r, u32 entries){
+	struct io_uring_params params = {0};
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if(fd < 0){ return false; }
+
+	// Are all the operations used supported? (Linux 5.6 and later)
+	enum { probe_ops = 64 };
+	alignas(struct io_uring_probe) byte probe_buf[sizeof(struct io_uring_probe) + probe_ops * sizeof(struct io_uring_probe_op)] = {0};
+	struct io_uring_probe* probe = (struct io_uring_probe*)probe_buf;
+	if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, probe_ops) < 0){
+		close(fd);
+		return false;
+	}
+	static const u8 needed[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+	for(isize i = 0; i < (isize)sizeof(needed); i += 1){
+		if(needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)){
+			close(fd);
+			return false;
+		}
+	}
+
+	*r = (File_Batch_Ring){ .fd = fd, .entries = params.sq_entries };
+	r->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(u32);
+	r->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		r->sq_map_len = Max(r->sq_map_len, r->cq_map_len);
+	}
+
+	r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(r->sq_map == MAP_FAILED){ goto error_exit; }
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		r->cq_map = r->sq_map;
+	} else {
+		r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(r->cq_map == MAP_FAILED){ r->cq_map = NULL; goto error_exit; }
+	}
+	r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED){ r->sqes = NULL; goto error_exit; }
+
+	byte* sq = r->sq_map;
+	r->sq_head = (u32*)(sq + params.sq_off.head);
+	r->sq_tail = (u32*)(sq + params.sq_off.tail);
+	r->sq_mask = *(u32*)(sq + params.sq_off.ring_mask);
+	r->sq_array = (u32*)(sq + params.sq_off.array);
+	byte* cq = r->cq_map;
+	r->cq_head = (u32*)(cq + params.cq_off.head);
+	r->cq_tail = (u32*)(cq + params.cq_off.tail);
+	r->cq_mask = *(u32*)(cq + params.cq_off.ring_mask);
+	r->cqes = cq + params.cq_off.cqes;
+	return true;
+
+error_exit:
+	if(r->sq_map != MAP_FAILED && r->sq_map != NULL){ munmap(r->sq_map, r->sq_map_len); }
+	if(r->cq_map != NULL && r->cq_map != r->sq_map){ munmap(r->cq_map, r->cq_map_len); }
+	close(fd);
+	return false;
+}
+
+static
+void file_batch_ring_destroy(File_Batch_Ring* r){
+	munmap(r->sqes, r->sqes_len);
+	if(r->cq_map != r->sq_map){ munmap(r->cq_map, r->cq_map_len); }
+	munmap(r->sq_map, r->sq_map_len);
+	close(r->fd);
+}
+
+// Submit the queued operations, waiting for at least one completion if wait is set
+static
+bool file_batch_ring_enter(File_Batch_Ring* r, bool wait){
+	for(;;){
+		long res = syscall(__NR_io_uring_enter, r->fd, r->sq_pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if(res >= 0){
+			r->sq_pending -= (u32)res;
+			if(r->sq_pending == 0 || wait){ return true; }
+		}
+		else if(errno != EINTR){
+			return false;
+		}
+	}
+}
+
+// Next free submission entry, submitting the queue when full
+static
+struct io_uring_sqe* file_batch_ring_sqe(File_Batch_Ring* r){
+	u32 tail = *r->sq_tail;
+	if(tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries){
+		file_batch_ring_enter(r, false);
+	}
+	u32 index = tail & r->sq_mask;
+	struct io_uring_sqe* sqe = &((struct io_uring_sqe*)r->sqes)[index];
+	mem_set(sqe, 0, sizeof(*sqe));
+	r->sq_array[index] = index;
+	return sqe;
+}
+
+// Make the entry from file_batch_ring_sqe visible to the kernel
+static inline
+void file_batch_ring_push(File_Batch_Ring* r){
+	__atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+	r->sq_pending += 1;
+}
+
+static
+void file_batch_submit(File_Batch* b, isize index, u8 op){
+	File_Batch_Load* load = &b->loads[index];
+	struct io_uring_sqe* sqe = file_batch_ring_sqe(&b->ring);
+	sqe->opcode = op == File_Batch_Op_Open ? IORING_OP_OPENAT
+		: op == File_Batch_Op_Statx ? IORING_OP_STATX
+		: op == File_Batch_Op_Read ? IORING_OP_READ
+		: IORING_OP_CLOSE;
+	sqe->user_data = ((u64)index << 2) | op;
+	switch(op){
+		case File_Batch_Op_Open: {
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (u64)(uintptr)file_batch_path(b, index);
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		} break;
+		case File_Batch_Op_Statx: {
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (u64)(uintptr)file_batch_path(b, index);
+			sqe->len = STATX_SIZE;
+			sqe->off = (u64)(uintptr)&((struct statx*)b->statx_bufs)[load->slot];
+		} break;
+		case File_Batch_Op_Read: {
+			sqe->fd = load->fd;
+			sqe->addr = (u64)(uintptr)(load->data + load->offset);
+			sqe->len = (u32)Min(load->size - load->offset, 1 << 30);
+			sqe->off = load->offset;
+		} break;
+		case File_Batch_Op_Close: {
+			sqe->fd = load->fd;
+		} break;
+	}
+	file_batch_ring_push(&b->ring);
+	b->ops_pending += 1;
+}
+
+// Done with a file, its statx slot and descriptor are given back
+static
+void file_batch_uring_finish(File_Batch* b, isize index){
+	File_Batch_Load* load = &b->loads[index];
+	if(load->fd >= 0){ file_batch_submit(b, index, File_Batch_Op_Close); }
+	b->free_slots[b->free_slots_len] = load->slot;
+	b->free_slots_len += 1;
+	b->in_flight -= 1;
+	load->slot = -1;
+
+	if(load->error != 0 && load->data != NULL){
+		mem_free(b->allocator, load->data);
+		load->data = NULL;
+	}
+	file_batch_finish(b, index, (Bytes){ .data = load->data, .len = load->offset }, load->error);
+}
+
+static
+void file_batch_complete(File_Batch* b, u64 user_data, i32 res){
+	isize index = (isize)(user_data >> 2);
+	u8 op = user_data & 3;
+	File_Batch_Load* load = &b->loads[index];
+	b->ops_pending -= 1;
+
+	switch(op){
+		case File_Batch_Op_Open:
+		case File_Batch_Op_Statx: {
+			if(res < 0){
+				if(load->error == 0){ load->error = -res; }
+			}
+			else if(op == File_Batch_Op_Open){
+				load->fd = res;
+			}
+			else {
+				load->size = (isize)((struct statx*)b->statx_bufs)[load->slot].stx_size;
+			}
+
+			load->pending -= 1;
+			if(load->pending > 0){ return; }
+			if(load->error == 0){
+				load->data = New(byte, load->size + 1, b->allocator);
+				if(load->data == NULL){ load->error = ENOMEM; }
+			}
+			if(load->error == 0 && load->size > 0){
+				file_batch_submit(b, index, File_Batch_Op_Read);
+			} else {
+				file_batch_uring_finish(b, index);
+			}
+		} break;
+
+		case File_Batch_Op_Read: {
+			if(res == -EINTR || res == -EAGAIN){
+				file_batch_submit(b, index, File_Batch_Op_Read);
+				return;
+			}
+			if(res < 0){
+				load->error = -res;
+			} else {
+				load->offset += res;
+			}
+			// Stop early when the file shrunk since its statx
+			if(res > 0 && load->offset < load->size){
+				file_batch_submit(b, index, File_Batch_Op_Read);
+			} else {
+				load->data[load->offset] = 0;
+				file_batch_uring_finish(b, index);
+			}
+		} break;
+
+		case File_Batch_Op_Close: {} break;
+	}
+}
+
+// Start files while there is room, then handle at least one completion
+static
+bool file_batch_uring_step(File_Batch* b, bool start){
+	while(start && b->next_file < b->count && b->in_flight < FILE_BATCH_IN_FLIGHT){
+		isize index = b->next_file;
+		b->next_file += 1;
+		b->in_flight += 1;
+		b->free_slots_len -= 1;
+		b->loads[index] = (File_Batch_Load){
+			.fd = -1,
+			.slot = b->free_slots[b->free_slots_len],
+			.pending = 2,
+		};
+		file_batch_submit(b, index, File_Batch_Op_Open);
+		file_batch_submit(b, index, File_Batch_Op_Statx);
+	}
+
+	if(!file_batch_ring_enter(&b->ring, true)){ return false; }
+
+	File_Batch_Ring* r = &b->ring;
+	u32 head = *r->cq_head;
+	u32 tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head += 1){
+		struct io_uring_cqe const* cqe = &((struct io_uring_cqe*)r->cqes)[head & r->cq_mask];
+		u64 user_data = cqe->user_data;
+		i32 res = cqe->res;
+		// Release the entry first, handling it may submit more
+		__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+		file_batch_complete(b, user_data, res);
+	}
+	return true;
+}
+
+#endif
+
+///- Thread pool
+// Load the next file with blocking calls, returns false when there is none left
+static
+bool file_batch_load_next(File_Batch* b){
+	pthread_mutex_lock(&b->lock);
+	isize index = b->next_file;
+	if(index < b->count){ b->next_file += 1; }
+	pthread_mutex_unlock(&b->lock);
+	if(index >= b->count){ return false; }
+
+	byte* data = NULL;
+	isize len = 0;
+	int error = 0;
+	int fd = open(file_batch_path(b, index), O_RDONLY | O_CLOEXEC);
+	struct stat st = {0};
+	if(fd < 0 || fstat(fd, &st) < 0){
+		error = errno;
+	} else {
+		pthread_mutex_lock(&b->lock);
+		data = New(byte, st.st_size + 1, b->allocator);
+		pthread_mutex_unlock(&b->lock);
+		if(data == NULL){ error = ENOMEM; }
+	}
+	while(error == 0 && len < st.st_size){
+		ssize_t n = pread(fd, data + len, st.st_size - len, len);
+		if(n < 0 && errno == EINTR){ continue; }
+		if(n < 0){ error = errno; }
+		if(n <= 0){ break; }
+		len += n;
+	}
+	if(fd >= 0){ close(fd); }
+
+	pthread_mutex_lock(&b->lock);
+	if(error != 0 && data != NULL){
+		mem_free(b->allocator, data);
+	}
+	else if(data != NULL){
+		data[len] = 0;
+	}
+	file_batch_finish(b, index, (Bytes){ .data = data, .len = len }, error);
+	pthread_cond_signal(&b->loaded);
+	pthread_mutex_unlock(&b->lock);
+	return true;
+}
+
+static
+void* file_batch_worker(void* arg){
+	File_Batch* b = arg;
+	while(file_batch_load_next(b)){}
+	return NULL;
+}
+
+///- Batch
+bool file_batch_init(File_Batch* b, String const* paths, isize count, Mem_Allocator allocator){
+	*b = (File_Batch){ .allocator = allocator, .count = count };
+
+	isize paths_size = 0;
+	for(isize i = 0; i < count; i += 1){
+		paths_size += paths[i].len + 1;
+	}
+	b->paths = New(char, Max(paths_size, 1), allocator);
+	b->path_offsets = New(isize, Max(count, 1), allocator);
+	b->results = New(File_Batch_Result, Max(count, 1), allocator);
+	b->ready = New(isize, Max(count, 1), allocator);
+	if(!b->paths || !b->path_offsets || !b->results || !b->ready){ goto error_exit; }
+
+	isize offset = 0;
+	for(isize i = 0; i < count; i += 1){
+		b->path_offsets[i] = offset;
+		mem_copy(&b->paths[offset], paths[i].data, paths[i].len);
+		offset += paths[i].len + 1;
+	}
+
+	#if FILE_BATCH_URING
+	if(count > 1 && file_batch_ring_init(&b->ring, 2 * FILE_BATCH_IN_FLIGHT)){
+		b->loads = New(File_Batch_Load, count, allocator);
+		b->statx_bufs = New(struct statx, FILE_BATCH_IN_FLIGHT, allocator);
+		if(b->loads != NULL && b->statx_bufs != NULL){
+			for(i32 i = 0; i < FILE_BATCH_IN_FLIGHT; i += 1){
+				b->free_slots[i] = i;
+			}
+			b->free_slots_len = FILE_BATCH_IN_FLIGHT;
+			b->uring = true;
+			return true;
+		}
+		mem_free(allocator, b->loads);
+		mem_free(allocator, b->statx_bufs);
+		b->loads = NULL;
+		b->statx_bufs = NULL;
+		file_batch_ring_destroy(&b->ring);
+	}
+	#endif
+
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->loaded, NULL);
+	// A single file is loaded by file_batch_next itself, as are all of them
+	// if no thread could be started
+	int threads = (int)Min(count, FILE_BATCH_MAX_THREADS);
+	for(int i = 0; i < threads && count > 1; i += 1){
+		if(pthread_create(&b->threads[b->thread_count], NULL, file_batch_worker, b) != 0){ break; }
+		b->thread_count += 1;
+	}
+	return true;
+
+error_exit:
+	mem_free(allocator, b->paths);
+	mem_free(allocator, b->path_offsets);
+	mem_free(allocator, b->results);
+	mem_free(allocator, b->ready);
+	*b = (File_Batch){0};
+	return false;
+}
+
+bool file_batch_next(File_Batch* b, File_Batch_Result* result){
+	if(b->delivered >= b->count){ return false; }
+
+	if(b->uring){
+		#if FILE_BATCH_URING
+		while(b->delivered == b->ready_len){
+			if(!file_batch_uring_step(b, true)){
+				// The ring broke, fail every file not loaded yet. Buffers of
+				// the files in flight are leaked, the kernel may still use them.
+				for(isize i = 0; i < b->count; i += 1){
+					if(i >= b->next_file || b->loads[i].slot >= 0){
+						b->loads[i].slot = -1;
+						file_batch_finish(b, i, (Bytes){0}, EIO);
+					}
+				}
+				b->next_file = b->count;
+				b->ops_pending = 0;
+			}
+		}
+		#endif
+		*result = b->results[b->ready[b->delivered]];
+		b->delivered += 1;
+		return true;
+	}
+
+	if(b->thread_count == 0){
+		file_batch_load_next(b);
+	}
+	pthread_mutex_lock(&b->lock);
+	while(b->delivered == b->ready_len){
+		pthread_cond_wait(&b->loaded, &b->lock);
+	}
+	*result = b->results[b->ready[b->delivered]];
+	b->delivered += 1;
+	pthread_mutex_unlock(&b->lock);
+	return true;
+}
+
+void file_batch_destroy(File_Batch* b){
+	if(b->paths == NULL){ return; }
+
+	if(b->uring){
+		#if FILE_BATCH_URING
+		// The kernel may still write to the buffers of the files in flight
+		while(b->ops_pending > 0 && file_batch_uring_step(b, false)){}
+		file_batch_ring_destroy(&b->ring);
+		mem_free(b->allocator, b->loads);
+		mem_free(b->allocator, b->statx_bufs);
+		#endif
+	}
+	else {
+		pthread_mutex_lock(&b->lock);
+		b->next_file = b->count;
+		pthread_mutex_unlock(&b->lock);
+		for(int i = 0; i < b->thread_count; i += 1){
+			pthread_join(b->threads[i], NULL);
+		}
+		pthread_mutex_destroy(&b->lock);
+		pthread_cond_destroy(&b->loaded);
+	}
+
+	for(isize i = b->delivered; i < b->ready_len; i += 1){
+		mem_free(b->allocator, b->results[b->ready[i]].data.data);
+	}
+	mem_free(b->allocator, b->paths);
+	mem_free(b->allocator, b->path_offsets);
+	mem_free(b->allocator, b->results);
+	mem_free(b->allocator, b->ready);
+	*b = (File_Batch){0};
+}
+
+#undef FILE_BATCH_URING
+#endif
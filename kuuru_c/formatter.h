@@ -0,0 +1,134 @@
+#pragma once
+
+#include "base.h"
+#include "lexer.h"
+#include "utilities.h"
+
+///- Interface -----------------------------------------------------------------
+
+// Output is accumulated and handed to the writer in batches of this size
+#define FORMATTER_FLUSH_SIZE (64 * 1024)
+
+// Reformat source, streaming the result to `out`. Line breaks are kept (runs
+// of blank lines collapse to one), lines are indented with one tab per open
+// curly brace, whitespace inside a line becomes a single space and is dropped
+// after opening and before closing brackets. String and rune literals and
+// `//` comments are copied byte for byte. Fails, having written part of the
+// output, on text the lexer does not know (an unterminated literal, a stray
+// character, a NUL byte), which formatting could lose. Returns success status.
+bool format_source(String source, IO_Writer out, Mem_Allocator allocator);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+static
+bool formatter_flush(Bytes_Buffer* bb, IO_Writer out){
+	if(bb->len == 0){ return true; }
+	isize written = io_write(out, buffer_bytes(bb), bb->len);
+	bb->len = 0;
+	bb->last_read = 0;
+	return written >= 0;
+}
+
+// Length of the `//` comment or quoted literal at source[at], which the lexer
+// does not know about, up to the end of the line or the closing quote. 0 if
+// there is none there, -1 if a literal is not terminated.
+static
+isize formatter_verbatim_len(String source, isize at){
+	byte const* data = source.data;
+	isize i = at;
+	if(data[i] == '/' && i + 1 < source.len && data[i + 1] == '/'){
+		while(i < source.len && data[i] != '\n'){ i += 1; }
+		return i - at;
+	}
+	if(data[i] != '"' && data[i] != '\''){ return 0; }
+
+	byte quote = data[i];
+	for(i += 1; i < source.len; i += 1){
+		if(data[i] == '\\'){ i += 1; }
+		else if(data[i] == quote){ return i + 1 - at; }
+	}
+	return -1;
+}
+
+bool format_source(String source, IO_Writer out, Mem_Allocator allocator){
+	Bytes_Buffer bb;
+	if(!buffer_init(&bb, allocator, FORMATTER_FLUSH_SIZE * 2)){ return false; }
+
+	Lexer lexer = lexer_make(source);
+	isize depth = 0;
+	isize prev_end = 0;
+	u8 prev_class = Token_Class_No_Space_After; // No space before the first token
+	bool first = true;
+	bool ok = true;
+
+	for(;;){
+		Token tk = lexer_next(&lexer);
+		if(tk.kind == Tk_EOF){
+			// Stopped early on a NUL byte, the rest of the source would be lost
+			ok = lexer.iter.current >= source.len;
+			break;
+		}
+
+		isize verbatim = formatter_verbatim_len(source, tk.loc);
+		bool comment = verbatim > 0 && source.data[tk.loc] == '/';
+		if(verbatim > 0){
+			tk.kind = comment ? Tk_Unknown : (source.data[tk.loc] == '"' ? Tk_String : Tk_Rune);
+			tk.len = (u32)verbatim;
+			lexer.iter.current = tk.loc + verbatim;
+		}
+		else if(verbatim < 0 || tk.kind == Tk_Unknown){
+			ok = false;
+			break;
+		}
+		u8 class = token_class(tk.kind);
+
+		isize newlines = 0;
+		for(isize i = prev_end; i < tk.loc; i += 1){
+			newlines += source.data[i] == '\n';
+		}
+		bool spaced = tk.loc > prev_end;
+
+		if(tk.kind == Tk_Curly_Close && depth > 0){ depth -= 1; }
+
+		// Worst case: 2 line breaks, indentation, a space and the token
+		isize indent = newlines > 0 && !first ? depth : 0;
+		byte* dest = buffer_reserve(&bb, 3 + indent + tk.len);
+		if(dest == NULL){ ok = false; break; }
+
+		isize n = 0;
+		if(newlines > 0 && !first){
+			dest[n++] = '\n';
+			if(newlines > 1){ dest[n++] = '\n'; }
+			mem_set(&dest[n], '\t', indent);
+			n += indent;
+		}
+		else if(spaced && !first && (comment || (!(prev_class & Token_Class_No_Space_After) && !(class & Token_Class_No_Space_Before)))){
+			dest[n++] = ' ';
+		}
+		mem_copy(&dest[n], &source.data[tk.loc], tk.len);
+		n += tk.len;
+		buffer_commit(&bb, n);
+
+		if(tk.kind == Tk_Curly_Open){ depth += 1; }
+		prev_end = tk.loc + tk.len;
+		prev_class = class;
+		first = false;
+
+		if(bb.len >= FORMATTER_FLUSH_SIZE){
+			if(!formatter_flush(&bb, out)){ ok = false; break; }
+		}
+	}
+
+	if(ok && !first){
+		ok = buffer_write(&bb, (byte const*)"\n", 1);
+	}
+	if(ok){
+		ok = formatter_flush(&bb, out);
+	}
+
+	buffer_destroy(&bb);
+	return ok;
+}
+
+#endif
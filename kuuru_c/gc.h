@@ -0,0 +1,781 @@
+#pragma once
+
+#include "base.h"
+#include "value.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Gc_String Gc_String;
+typedef struct Gc_Array Gc_Array;
+typedef struct Gc_Closure Gc_Closure;
+typedef struct Gc_Shape Gc_Shape;
+typedef struct Gc_Record Gc_Record;
+typedef struct Gc_Stats Gc_Stats;
+typedef struct Gc_Heap Gc_Heap;
+typedef enum Gc_Kind Gc_Kind;
+typedef enum Gc_Phase Gc_Phase;
+
+// Minor collections copy at most this much, keep it small enough for short pauses
+#define GC_DEFAULT_NURSERY_SIZE (256 * 1024)
+
+// Pause histogram, bucket i counts pauses shorter than 2^i microseconds
+#define GC_PAUSE_BUCKETS 16
+
+enum Gc_Kind {
+	Gc_Kind_String = 1,
+	Gc_Kind_Array,
+	Gc_Kind_Closure,
+	Gc_Kind_Int,
+	Gc_Kind_Record,
+};
+
+enum {
+	Gc_Flag_Old       = 1 << 0, // Lives in the old generation
+	Gc_Flag_Marked    = 1 << 1, // Reached by the current major cycle
+	Gc_Flag_Forwarded = 1 << 2, // Nursery object already copied, `link` is the copy
+};
+
+struct Gc_String {
+	Gc_Object header;
+	isize len;
+	byte data[];
+};
+
+struct Gc_Array {
+	Gc_Object header;
+	isize len;
+	Value items[];
+};
+
+struct Gc_Closure {
+	Gc_Object header;
+	u32 function;
+	u32 capture_count;
+	Value captures[];
+};
+
+// Hidden class of records: the names of their fields, in the order they were
+// added. Records given the same fields in the same order share a shape, so a
+// field sits at the same index in all of them. Shapes are not collected, they
+// live as long as the heap.
+struct Gc_Shape {
+	Gc_Shape* parent;   // Shape before the last field was added, NULL for the empty shape
+	Gc_Shape* children; // Shapes with one more field, linked through `sibling`
+	Gc_Shape* sibling;
+	Gc_Shape* link;     // Next of all shapes of the heap
+	u32 field;          // Name of the last field
+	u32 count;          // Number of fields
+};
+
+// Object with named fields, the first `capacity` are stored inline and the
+// rest in the overflow array
+struct Gc_Record {
+	Gc_Object header;
+	Gc_Shape* shape;
+	u32 capacity;
+	Value overflow; // Gc_Array or nil, right before the slots so both are scanned as one range
+	Value slots[];
+};
+
+struct Gc_Stats {
+	i64 minor_count;
+	i64 major_count; // Completed major cycles
+
+	i64 bytes_allocated;
+	i64 bytes_promoted;
+	i64 bytes_freed;
+
+	i64 pause_count;
+	i64 pause_total_ns;
+	i64 pause_max_ns;
+	i64 pause_histogram[GC_PAUSE_BUCKETS];
+};
+
+// Major cycles run incrementally, a step at a time after each minor collection
+enum Gc_Phase {
+	Gc_Idle = 0,
+	Gc_Marking,
+	Gc_Sweeping,
+};
+
+// Generational heap: objects are bump allocated in the nursery, survivors of a
+// minor collection are copied into the old generation, which is collected by
+// an incremental mark-sweep.
+//
+// Allocating may collect, which moves nursery objects. Pointers returned by
+// the allocation functions must be stored somewhere the collector sees (VM
+// registers, rooted slots or other objects) before allocating again.
+struct Gc_Heap {
+	Mem_Arena nursery;
+	isize large_size; // Bigger objects skip the nursery
+
+	Gc_Object* old;      // Old generation, linked through `link`
+	Gc_Object* unswept;  // Sweeping: old objects still to be visited
+	isize old_bytes;
+	isize major_threshold; // Old generation size that starts a major cycle
+	Gc_Phase phase;
+	isize step_debt; // Bytes allocated since the last major increment, paces the next one
+
+	// Slots of old objects that were given a nursery reference. Slots instead
+	// of objects, so a store into a big array does not get the whole array
+	// scanned by every minor collection.
+	Value** remembered;
+	isize remembered_len;
+	isize remembered_cap;
+
+	Gc_Object** gray; // Marked but not scanned
+	isize gray_len;
+	isize gray_cap;
+
+	Gc_Object** promoted; // Minor collection: copied but not scanned
+	isize promoted_len;
+	isize promoted_cap;
+
+	Value** roots;
+	isize roots_len;
+	isize roots_cap;
+
+	Gc_Shape* empty_shape; // Shape of new records
+	Gc_Shape* shapes;      // All shapes, linked through `link`
+
+	// Called by every collection to visit roots the heap does not know about
+	// (such as VM registers), may be NULL
+	void (*scan_roots)(Gc_Heap* h, void* data, void (*visit)(Gc_Heap* h, Value* slot));
+	void* scan_data;
+
+	Gc_Stats stats;
+	i64 start_ns;
+	Mem_Allocator allocator;
+};
+
+// Initialize heap with a nursery of nursery_size bytes, returns success status
+bool gc_init(Gc_Heap* h, isize nursery_size, Mem_Allocator allocator);
+
+// Destroy heap and every object in it
+void gc_destroy(Gc_Heap* h);
+
+// Allocate a copy of s, returns NULL on allocation failure
+Gc_String* gc_new_string(Gc_Heap* h, String s);
+
+// Concatenate two string values, returns NULL if one is not a string or on allocation failure
+Gc_String* gc_concat(Gc_Heap* h, Value a, Value b);
+
+// Allocate array of len nils, returns NULL on allocation failure
+Gc_Array* gc_new_array(Gc_Heap* h, isize len);
+
+// Allocate closure of function with capture_count nil captures, returns NULL on allocation failure
+Gc_Closure* gc_new_closure(Gc_Heap* h, u32 function, u32 capture_count);
+
+// Allocate record without fields and room for capacity of them inline, returns NULL on allocation failure
+Gc_Record* gc_new_record(Gc_Heap* h, u32 capacity);
+
+// Set field of a record value, adding the field if it is missing. Returns false on allocation failure.
+bool gc_record_set(Gc_Heap* h, Value record, u32 field, Value v);
+
+// Shape with field added after the fields of s, returns NULL on allocation failure
+Gc_Shape* gc_shape_add(Gc_Heap* h, Gc_Shape* s, u32 field);
+
+// Index of field in records of shape s, -1 if they do not have it
+isize gc_shape_find(Gc_Shape const* s, u32 field);
+
+// Make an int value, boxing it when it does not fit inline. Returns false on allocation failure.
+bool gc_int(Gc_Heap* h, i64 i, Value* out);
+
+// Add slot to the roots, returns success status
+bool gc_push_root(Gc_Heap* h, Value* slot);
+
+// Remove the count most recently pushed roots
+void gc_pop_roots(Gc_Heap* h, isize count);
+
+// Collect the nursery
+void gc_collect_minor(Gc_Heap* h);
+
+// Collect everything, finishing (or running) a whole major cycle in one pause
+void gc_collect_major(Gc_Heap* h);
+
+// Write pause and throughput statistics
+void gc_stats_print(Gc_Heap const* h, IO_Writer out);
+
+// Slow path of the write barrier
+void gc_barrier(Gc_Heap* h, Gc_Object* holder, Value* slot);
+
+static inline
+String gc_string(Gc_String const* s){
+	return (String){ .data = s->data, .len = s->len };
+}
+
+static inline
+bool gc_is_kind(Value v, Gc_Kind kind){
+	return value_tag(v) == VALUE_TAG_OBJECT && value_ref(v)->kind == kind;
+}
+
+// Slot of the field at index, which must be below the record's field count
+static inline
+Value* gc_record_slot(Gc_Record* r, isize index){
+	if(index < r->capacity){ return &r->slots[index]; }
+	return &((Gc_Array*)value_ref(r->overflow))->items[index - r->capacity];
+}
+
+// Store v in a slot of holder. Every store into a heap object goes through here.
+static inline
+void gc_store(Gc_Heap* h, Gc_Object* holder, Value* slot, Value v){
+	*slot = v;
+	if(value_is_ref(v) && (holder->flags & Gc_Flag_Old)){
+		gc_barrier(h, holder, slot);
+	}
+}
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <time.h>
+
+#define GC_MIN_MAJOR_THRESHOLD (4 * 1024 * 1024)
+// Least work per increment, increments also do twice as much work as there was
+// allocation since the previous one, so a cycle always finishes
+#define GC_MARK_STEP  (64 * 1024) // Bytes scanned
+#define GC_SWEEP_STEP 1024        // Objects visited
+
+static
+i64 gc_now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (i64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Push onto one of the pointer stacks. The collector cannot back out of a half
+// finished collection, so running out of memory here is fatal.
+static
+void gc_push(Gc_Heap* h, void*** data, isize* len, isize* cap, void* p){
+	if(*len >= *cap){
+		isize new_cap = Max(*cap * 2, 64);
+		void** new_data = New(void*, new_cap, h->allocator);
+		if(new_data == NULL){ panic("Out of memory during garbage collection"); }
+		if(*data != NULL){
+			mem_copy(new_data, *data, *len * sizeof(void*));
+			mem_free(h->allocator, *data);
+		}
+		*data = new_data;
+		*cap = new_cap;
+	}
+	(*data)[*len] = p;
+	*len += 1;
+}
+
+#define GC_PUSH(h_, stack_, o_) gc_push((h_), (void***)&(h_)->stack_, &(h_)->stack_##_len, &(h_)->stack_##_cap, (o_))
+
+bool gc_init(Gc_Heap* h, isize nursery_size, Mem_Allocator allocator){
+	nursery_size = Max(nursery_size, 4096);
+	byte* memory = New(byte, nursery_size, allocator);
+	Gc_Shape* empty = New(Gc_Shape, 1, allocator);
+	if(memory == NULL || empty == NULL){
+		mem_free(allocator, memory);
+		mem_free(allocator, empty);
+		return false;
+	}
+
+	*h = (Gc_Heap){
+		.large_size = nursery_size / 8,
+		.major_threshold = GC_MIN_MAJOR_THRESHOLD,
+		.start_ns = gc_now_ns(),
+		.empty_shape = empty,
+		.shapes = empty,
+		.allocator = allocator,
+	};
+	arena_init(&h->nursery, memory, nursery_size);
+	return true;
+}
+
+void gc_destroy(Gc_Heap* h){
+	Gc_Object* lists[2] = { h->old, h->unswept };
+	for(int i = 0; i < 2; i += 1){
+		for(Gc_Object* o = lists[i]; o != NULL;){
+			Gc_Object* next = o->link;
+			mem_free(h->allocator, o);
+			o = next;
+		}
+	}
+	for(Gc_Shape* s = h->shapes; s != NULL;){
+		Gc_Shape* next = s->link;
+		mem_free(h->allocator, s);
+		s = next;
+	}
+	mem_free(h->allocator, h->nursery.data);
+	mem_free(h->allocator, h->remembered);
+	mem_free(h->allocator, h->gray);
+	mem_free(h->allocator, h->promoted);
+	mem_free(h->allocator, h->roots);
+	*h = (Gc_Heap){0};
+}
+
+bool gc_push_root(Gc_Heap* h, Value* slot){
+	if(h->roots_len >= h->roots_cap){
+		isize new_cap = Max(h->roots_cap * 2, 32);
+		Value** roots = New(Value*, new_cap, h->allocator);
+		if(roots == NULL){ return false; }
+		if(h->roots != NULL){
+			mem_copy(roots, h->roots, h->roots_len * sizeof(Value*));
+			mem_free(h->allocator, h->roots);
+		}
+		h->roots = roots;
+		h->roots_cap = new_cap;
+	}
+	h->roots[h->roots_len] = slot;
+	h->roots_len += 1;
+	return true;
+}
+
+void gc_pop_roots(Gc_Heap* h, isize count){
+	h->roots_len = Max(h->roots_len - count, 0);
+}
+
+// Slots of an object that may hold references
+static
+Value* gc_slots(Gc_Object* o, isize* count){
+	switch((Gc_Kind)o->kind){
+		case Gc_Kind_String: case Gc_Kind_Int: break;
+		case Gc_Kind_Array: {
+			Gc_Array* a = (Gc_Array*)o;
+			*count = a->len;
+			return a->items;
+		}
+		case Gc_Kind_Closure: {
+			Gc_Closure* c = (Gc_Closure*)o;
+			*count = c->capture_count;
+			return c->captures;
+		}
+		case Gc_Kind_Record: {
+			Gc_Record* r = (Gc_Record*)o;
+			*count = (isize)r->capacity + 1;
+			return &r->overflow;
+		}
+	}
+	*count = 0;
+	return NULL;
+}
+
+static
+void gc_visit_roots(Gc_Heap* h, void (*visit)(Gc_Heap* h, Value* slot)){
+	for(isize i = 0; i < h->roots_len; i += 1){ visit(h, h->roots[i]); }
+	if(h->scan_roots != NULL){ h->scan_roots(h, h->scan_data, visit); }
+}
+
+static
+void gc_record_pause(Gc_Heap* h, i64 start_ns){
+	i64 ns = gc_now_ns() - start_ns;
+	Gc_Stats* st = &h->stats;
+	st->pause_count += 1;
+	st->pause_total_ns += ns;
+	st->pause_max_ns = Max(st->pause_max_ns, ns);
+
+	int bucket = 0;
+	for(i64 us = ns / 1000; us > 0 && bucket < GC_PAUSE_BUCKETS - 1; us >>= 1){ bucket += 1; }
+	st->pause_histogram[bucket] += 1;
+}
+
+static inline
+void gc_shade(Gc_Heap* h, Gc_Object* o){
+	if((o->flags & (Gc_Flag_Old | Gc_Flag_Marked)) == Gc_Flag_Old){
+		o->flags |= Gc_Flag_Marked;
+		GC_PUSH(h, gray, o);
+	}
+}
+
+static
+void gc_shade_slot(Gc_Heap* h, Value* slot){
+	if(value_is_ref(*slot)){ gc_shade(h, value_ref(*slot)); }
+}
+
+// Link a new object into the old generation. While marking it starts out
+// marked, and gray if it has references the marker has to see.
+static
+void gc_add_old(Gc_Heap* h, Gc_Object* o, bool scan){
+	o->flags |= Gc_Flag_Old;
+	o->link = h->old;
+	h->old = o;
+	h->old_bytes += o->size;
+	if(h->phase == Gc_Marking){
+		o->flags |= Gc_Flag_Marked;
+		if(scan){ GC_PUSH(h, gray, o); }
+	}
+}
+
+// Copy a nursery object into the old generation (once), returns where it lives now
+static
+Gc_Object* gc_promote(Gc_Heap* h, Gc_Object* o){
+	if(o->flags & Gc_Flag_Old){ return o; }
+	if(o->flags & Gc_Flag_Forwarded){ return o->link; }
+
+	Gc_Object* copy = mem_alloc(h->allocator, o->size, alignof(Value));
+	if(copy == NULL){ panic("Out of memory during garbage collection"); }
+	mem_copy(copy, o, o->size);
+	copy->flags = 0;
+	gc_add_old(h, copy, true);
+	GC_PUSH(h, promoted, copy);
+
+	h->stats.bytes_promoted += o->size;
+	o->flags |= Gc_Flag_Forwarded;
+	o->link = copy;
+	return copy;
+}
+
+static inline
+void gc_fix_slot(Gc_Heap* h, Value* slot){
+	if(value_is_ref(*slot) && !(value_ref(*slot)->flags & Gc_Flag_Old)){
+		*slot = value_with_ref(*slot, gc_promote(h, value_ref(*slot)));
+	}
+}
+
+static
+void gc_minor(Gc_Heap* h){
+	gc_visit_roots(h, gc_fix_slot);
+
+	for(isize i = 0; i < h->remembered_len; i += 1){
+		gc_fix_slot(h, h->remembered[i]);
+	}
+	h->remembered_len = 0;
+
+	// Everything copied is scanned in turn, until no nursery reference is left
+	while(h->promoted_len > 0){
+		h->promoted_len -= 1;
+		Gc_Object* o = h->promoted[h->promoted_len];
+		isize count = 0;
+		Value* slots = gc_slots(o, &count);
+		for(isize s = 0; s < count; s += 1){ gc_fix_slot(h, &slots[s]); }
+	}
+
+	h->nursery.offset = 0;
+	h->stats.minor_count += 1;
+}
+
+static
+void gc_start_major(Gc_Heap* h){
+	h->phase = Gc_Marking;
+	gc_visit_roots(h, gc_shade_slot);
+}
+
+// Scan gray objects until budget bytes were scanned (or forever when budget < 0),
+// returns true once nothing is gray
+static
+bool gc_mark(Gc_Heap* h, isize budget){
+	while(h->gray_len > 0){
+		if(budget == 0){ return false; }
+		h->gray_len -= 1;
+		Gc_Object* o = h->gray[h->gray_len];
+		isize count = 0;
+		Value* slots = gc_slots(o, &count);
+		for(isize s = 0; s < count; s += 1){
+			gc_shade_slot(h, &slots[s]);
+		}
+		if(budget > 0){ budget = Max(budget - (isize)o->size, 0); }
+	}
+	return true;
+}
+
+// Marking is done once nothing is gray after the nursery was emptied and the
+// roots (which have no barrier) were scanned again
+static
+void gc_finish_marking(Gc_Heap* h){
+	gc_minor(h);
+	gc_visit_roots(h, gc_shade_slot);
+	gc_mark(h, -1);
+
+	// The nursery is empty, so the remembered set is too, and nothing that
+	// gets freed can be referenced from it
+	h->unswept = h->old;
+	h->old = NULL;
+	h->phase = Gc_Sweeping;
+}
+
+// Visit up to budget unswept objects (all of them when budget < 0)
+static
+void gc_sweep(Gc_Heap* h, isize budget){
+	while(h->unswept != NULL && budget != 0){
+		Gc_Object* o = h->unswept;
+		h->unswept = o->link;
+		if(o->flags & Gc_Flag_Marked){
+			o->flags &= ~Gc_Flag_Marked;
+			o->link = h->old;
+			h->old = o;
+		} else {
+			h->old_bytes -= o->size;
+			h->stats.bytes_freed += o->size;
+			mem_free(h->allocator, o);
+		}
+		if(budget > 0){ budget -= 1; }
+	}
+
+	if(h->unswept == NULL){
+		h->phase = Gc_Idle;
+		h->major_threshold = Max(h->old_bytes * 2, GC_MIN_MAJOR_THRESHOLD);
+		h->stats.major_count += 1;
+	}
+}
+
+// One increment of the major cycle, started when the old generation outgrew its threshold
+static
+void gc_major_step(Gc_Heap* h){
+	isize debt = h->step_debt;
+	h->step_debt = 0;
+	switch(h->phase){
+		case Gc_Idle: {
+			if(h->old_bytes >= h->major_threshold){ gc_start_major(h); }
+		} break;
+		case Gc_Marking: {
+			if(gc_mark(h, Max(GC_MARK_STEP, debt * 2))){ gc_finish_marking(h); }
+		} break;
+		case Gc_Sweeping: {
+			gc_sweep(h, Max(GC_SWEEP_STEP, debt / 16));
+		} break;
+	}
+}
+
+void gc_collect_minor(Gc_Heap* h){
+	i64 start = gc_now_ns();
+	gc_minor(h);
+	gc_major_step(h);
+	gc_record_pause(h, start);
+}
+
+void gc_collect_major(Gc_Heap* h){
+	i64 start = gc_now_ns();
+	if(h->phase == Gc_Idle){ gc_start_major(h); }
+	if(h->phase == Gc_Marking){ gc_finish_marking(h); }
+	gc_sweep(h, -1);
+	gc_record_pause(h, start);
+}
+
+void gc_barrier(Gc_Heap* h, Gc_Object* holder, Value* slot){
+	Gc_Object* target = value_ref(*slot);
+	if(!(target->flags & Gc_Flag_Old)){
+		// Slots may be remembered more than once, that only costs a repeated check
+		GC_PUSH(h, remembered, slot);
+	} else if(h->phase == Gc_Marking && (holder->flags & Gc_Flag_Marked)){
+		// A scanned object must never point to an unmarked one
+		gc_shade(h, target);
+	}
+}
+
+// Allocate zeroed object of size bytes
+static
+Gc_Object* gc_alloc(Gc_Heap* h, Gc_Kind kind, isize size){
+	size = (isize)align_forward_ptr((uintptr)size, alignof(Value));
+	if(size > UINT32_MAX){ return NULL; }
+
+	Gc_Object* o = NULL;
+	if(size > h->large_size){
+		o = mem_alloc(h->allocator, size, alignof(Value));
+		if(o == NULL){ return NULL; }
+		mem_set(o, 0, size);
+		*o = (Gc_Object){ .kind = kind, .size = size };
+		gc_add_old(h, o, false); // Only nils yet, later stores go through the barrier
+
+		if(h->phase != Gc_Idle || h->old_bytes >= h->major_threshold){
+			i64 start = gc_now_ns();
+			gc_major_step(h);
+			gc_record_pause(h, start);
+		}
+	} else {
+		Mem_Arena* n = &h->nursery;
+		if(n->offset + size > n->capacity){ gc_collect_minor(h); }
+		o = (Gc_Object*)&n->data[n->offset];
+		n->offset += size;
+		mem_set(o, 0, size);
+		*o = (Gc_Object){ .kind = kind, .size = size };
+	}
+
+	h->stats.bytes_allocated += size;
+	h->step_debt += size;
+	return o;
+}
+
+Gc_String* gc_new_string(Gc_Heap* h, String s){
+	Gc_String* str = (Gc_String*)gc_alloc(h, Gc_Kind_String, sizeof(Gc_String) + s.len);
+	if(str == NULL){ return NULL; }
+	str->len = s.len;
+	mem_copy(str->data, s.data, s.len);
+	return str;
+}
+
+Gc_String* gc_concat(Gc_Heap* h, Value a, Value b){
+	if(!gc_is_kind(a, Gc_Kind_String) || !gc_is_kind(b, Gc_Kind_String)){ return NULL; }
+	isize a_len = ((Gc_String*)value_ref(a))->len;
+	isize b_len = ((Gc_String*)value_ref(b))->len;
+
+	// Allocating may move both
+	if(!gc_push_root(h, &a)){ return NULL; }
+	if(!gc_push_root(h, &b)){ gc_pop_roots(h, 1); return NULL; }
+	Gc_String* str = (Gc_String*)gc_alloc(h, Gc_Kind_String, sizeof(Gc_String) + a_len + b_len);
+	gc_pop_roots(h, 2);
+	if(str == NULL){ return NULL; }
+
+	str->len = a_len + b_len;
+	mem_copy(str->data, ((Gc_String*)value_ref(a))->data, a_len);
+	mem_copy(&str->data[a_len], ((Gc_String*)value_ref(b))->data, b_len);
+	return str;
+}
+
+Gc_Array* gc_new_array(Gc_Heap* h, isize len){
+	if(len < 0){ return NULL; }
+	Gc_Array* arr = (Gc_Array*)gc_alloc(h, Gc_Kind_Array, sizeof(Gc_Array) + len * sizeof(Value));
+	if(arr == NULL){ return NULL; }
+	arr->len = len;
+	for(isize i = 0; i < len; i += 1){ arr->items[i] = value_nil(); }
+	return arr;
+}
+
+Gc_Closure* gc_new_closure(Gc_Heap* h, u32 function, u32 capture_count){
+	Gc_Closure* c = (Gc_Closure*)gc_alloc(h, Gc_Kind_Closure, sizeof(Gc_Closure) + (isize)capture_count * sizeof(Value));
+	if(c == NULL){ return NULL; }
+	c->function = function;
+	c->capture_count = capture_count;
+	for(u32 i = 0; i < capture_count; i += 1){ c->captures[i] = value_nil(); }
+	return c;
+}
+
+_Static_assert(offsetof(Gc_Record, slots) == offsetof(Gc_Record, overflow) + sizeof(Value), "Record slots must follow the overflow");
+
+Gc_Record* gc_new_record(Gc_Heap* h, u32 capacity){
+	Gc_Record* r = (Gc_Record*)gc_alloc(h, Gc_Kind_Record, sizeof(Gc_Record) + (isize)capacity * sizeof(Value));
+	if(r == NULL){ return NULL; }
+	r->shape = h->empty_shape;
+	r->capacity = capacity;
+	r->overflow = value_nil();
+	for(u32 i = 0; i < capacity; i += 1){ r->slots[i] = value_nil(); }
+	return r;
+}
+
+Gc_Shape* gc_shape_add(Gc_Heap* h, Gc_Shape* s, u32 field){
+	for(Gc_Shape* child = s->children; child != NULL; child = child->sibling){
+		if(child->field == field){ return child; }
+	}
+	Gc_Shape* child = New(Gc_Shape, 1, h->allocator);
+	if(child == NULL){ return NULL; }
+	*child = (Gc_Shape){
+		.parent = s,
+		.sibling = s->children,
+		.link = h->shapes,
+		.field = field,
+		.count = s->count + 1,
+	};
+	s->children = child;
+	h->shapes = child;
+	return child;
+}
+
+isize gc_shape_find(Gc_Shape const* s, u32 field){
+	for(; s->parent != NULL; s = s->parent){
+		if(s->field == field){ return (isize)s->count - 1; }
+	}
+	return -1;
+}
+
+// Make room for count fields in a record, returns false on allocation failure
+static
+bool gc_record_reserve(Gc_Heap* h, Value* record, Value* v, isize count){
+	Gc_Record* r = (Gc_Record*)value_ref(*record);
+	isize needed = count - r->capacity;
+	isize have = value_is_ref(r->overflow) ? ((Gc_Array*)value_ref(r->overflow))->len : 0;
+	if(needed <= have){ return true; }
+
+	// Allocating may move the record and the value being stored
+	if(!gc_push_root(h, record)){ return false; }
+	if(!gc_push_root(h, v)){ gc_pop_roots(h, 1); return false; }
+	Gc_Array* arr = gc_new_array(h, Max(needed, Max(have * 2, 4)));
+	gc_pop_roots(h, 2);
+	if(arr == NULL){ return false; }
+
+	r = (Gc_Record*)value_ref(*record);
+	if(have > 0){
+		Gc_Array* old = (Gc_Array*)value_ref(r->overflow);
+		for(isize i = 0; i < have; i += 1){ gc_store(h, &arr->header, &arr->items[i], old->items[i]); }
+	}
+	gc_store(h, &r->header, &r->overflow, value_object(&arr->header));
+	return true;
+}
+
+bool gc_record_set(Gc_Heap* h, Value record, u32 field, Value v){
+	Gc_Record* r = (Gc_Record*)value_ref(record);
+	isize index = gc_shape_find(r->shape, field);
+	if(index < 0){
+		Gc_Shape* shape = gc_shape_add(h, r->shape, field);
+		if(shape == NULL){ return false; }
+		index = (isize)shape->count - 1;
+		if(!gc_record_reserve(h, &record, &v, index + 1)){ return false; }
+		r = (Gc_Record*)value_ref(record);
+		r->shape = shape;
+	}
+	gc_store(h, &r->header, gc_record_slot(r, index), v);
+	return true;
+}
+
+bool gc_int(Gc_Heap* h, i64 i, Value* out){
+	if(value_int_fits(i)){
+		*out = value_small_int(i);
+		return true;
+	}
+	Gc_Int* box = (Gc_Int*)gc_alloc(h, Gc_Kind_Int, sizeof(Gc_Int));
+	if(box == NULL){ return false; }
+	box->value = i;
+	*out = value_big_int(box);
+	return true;
+}
+
+static
+void gc_write(IO_Writer out, cstring text){
+	io_write(out, (byte const*)text, cstring_len(text));
+}
+
+// Write num / den rounded to the given number of decimals
+static
+void gc_write_ratio(IO_Writer out, u64 num, u64 den, u64 decimals){
+	u64 scale = 1;
+	for(u64 i = 0; i < decimals; i += 1){ scale *= 10; }
+	io_write_f64(out, (f64)((num * scale + den / 2) / den) / (f64)scale);
+}
+
+void gc_stats_print(Gc_Heap const* h, IO_Writer out){
+	Gc_Stats const* st = &h->stats;
+
+	// Upper bound of the bucket holding the 99th percentile
+	i64 p99_us = 0;
+	i64 seen = 0;
+	for(int i = 0; i < GC_PAUSE_BUCKETS; i += 1){
+		seen += st->pause_histogram[i];
+		if(seen * 100 >= st->pause_count * 99){
+			p99_us = (i64)1 << i;
+			break;
+		}
+	}
+
+	i64 elapsed = Max(gc_now_ns() - h->start_ns, 1);
+	u64 mib = 1024 * 1024;
+	gc_write(out, "gc: ");
+	io_write_i64(out, st->minor_count);
+	gc_write(out, " minor, ");
+	io_write_i64(out, st->major_count);
+	gc_write(out, " major, ");
+	io_write_i64(out, st->pause_count);
+	gc_write(out, " pauses (max ");
+	gc_write_ratio(out, st->pause_max_ns, 1000000, 3);
+	gc_write(out, "ms, p99 < ");
+	gc_write_ratio(out, p99_us, 1000, 3);
+	gc_write(out, "ms, total ");
+	gc_write_ratio(out, st->pause_total_ns, 1000000, 3);
+	gc_write(out, "ms)\ngc: allocated ");
+	gc_write_ratio(out, st->bytes_allocated, mib, 2);
+	gc_write(out, "MiB, promoted ");
+	gc_write_ratio(out, st->bytes_promoted, mib, 2);
+	gc_write(out, "MiB, freed ");
+	gc_write_ratio(out, st->bytes_freed, mib, 2);
+	gc_write(out, "MiB, old ");
+	gc_write_ratio(out, h->old_bytes, mib, 2);
+	gc_write(out, "MiB, throughput ");
+	gc_write_ratio(out, 100 * (u64)Max(elapsed - st->pause_total_ns, 0), elapsed, 2);
+	gc_write(out, "%\n");
+}
+
+#undef GC_PUSH
+#undef GC_MIN_MAJOR_THRESHOLD
+#undef GC_MARK_STEP
+#undef GC_SWEEP_STEP
+#endif
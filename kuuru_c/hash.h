@@ -0,0 +1,108 @@
+#pragma once
+
+#include "base.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Hash128 Hash128;
+
+struct Hash128 {
+	u64 lo;
+	u64 hi;
+};
+
+// Fast non-cryptographic 128-bit hash (MurmurHash3 x64 variant)
+Hash128 hash128(byte const* data, isize len, u64 seed);
+
+// Check if 2 hashes are equal
+static inline
+bool hash128_eq(Hash128 a, Hash128 b){
+	return a.lo == b.lo && a.hi == b.hi;
+}
+
+// Write hash as 32 lowercase hex digits into buf, buf must have at least 32 bytes
+void hash128_hex(Hash128 h, byte* buf);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+static inline
+u64 hash_rotl64(u64 x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline
+u64 hash_fmix64(u64 k){
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+static inline
+u64 hash_load64(byte const* p){
+	u64 v;
+	mem_copy(&v, p, 8);
+	return v;
+}
+
+Hash128 hash128(byte const* data, isize len, u64 seed){
+	static const u64 c1 = 0x87c37b91114253d5ull;
+	static const u64 c2 = 0x4cf5ad432745937full;
+
+	u64 h1 = seed, h2 = seed;
+	isize nblocks = len / 16;
+
+	for(isize i = 0; i < nblocks; i += 1){
+		u64 k1 = hash_load64(&data[i * 16]);
+		u64 k2 = hash_load64(&data[i * 16 + 8]);
+
+		k1 *= c1; k1 = hash_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = hash_rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = hash_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = hash_rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	byte const* tail = &data[nblocks * 16];
+	u64 k1 = 0, k2 = 0;
+	switch(len & 15){
+		case 15: k2 ^= (u64)tail[14] << 48; /* fallthrough */
+		case 14: k2 ^= (u64)tail[13] << 40; /* fallthrough */
+		case 13: k2 ^= (u64)tail[12] << 32; /* fallthrough */
+		case 12: k2 ^= (u64)tail[11] << 24; /* fallthrough */
+		case 11: k2 ^= (u64)tail[10] << 16; /* fallthrough */
+		case 10: k2 ^= (u64)tail[9] << 8;   /* fallthrough */
+		case 9:  k2 ^= (u64)tail[8] << 0;
+			k2 *= c2; k2 = hash_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+			/* fallthrough */
+		case 8: k1 ^= (u64)tail[7] << 56; /* fallthrough */
+		case 7: k1 ^= (u64)tail[6] << 48; /* fallthrough */
+		case 6: k1 ^= (u64)tail[5] << 40; /* fallthrough */
+		case 5: k1 ^= (u64)tail[4] << 32; /* fallthrough */
+		case 4: k1 ^= (u64)tail[3] << 24; /* fallthrough */
+		case 3: k1 ^= (u64)tail[2] << 16; /* fallthrough */
+		case 2: k1 ^= (u64)tail[1] << 8;  /* fallthrough */
+		case 1: k1 ^= (u64)tail[0] << 0;
+			k1 *= c1; k1 = hash_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= (u64)len; h2 ^= (u64)len;
+	h1 += h2; h2 += h1;
+	h1 = hash_fmix64(h1);
+	h2 = hash_fmix64(h2);
+	h1 += h2; h2 += h1;
+
+	return (Hash128){ .lo = h1, .hi = h2 };
+}
+
+void hash128_hex(Hash128 h, byte* buf){
+	static const char digits[] = "0123456789abcdef";
+	for(int i = 0; i < 16; i += 1){
+		buf[i]      = digits[(h.hi >> (60 - i * 4)) & 0xf];
+		buf[16 + i] = digits[(h.lo >> (60 - i * 4)) & 0xf];
+	}
+}
+
+#endif
@@ -0,0 +1,1471 @@
+#pragma once
+
+#include "base.h"
+#include "vm.h"
+
+///- Interface -----------------------------------------------------------------
+typedef u32 Ir_Ref;
+typedef enum Ir_Op Ir_Op;
+typedef enum Ir_Type Ir_Type;
+typedef struct Ir_Inst Ir_Inst;
+typedef struct Ir_Block Ir_Block;
+typedef struct Ir_Function Ir_Function;
+typedef struct Ir_Module Ir_Module;
+typedef struct Ir_Dominators Ir_Dominators;
+typedef struct Ir_Liveness Ir_Liveness;
+
+// Instruction 0 of every function is reserved, so a zero Ir_Ref means "none"
+#define IR_REF_NONE ((Ir_Ref)0)
+#define IR_BLOCK_NONE ((u32)0xffffffff)
+
+// Static type of a value. Unknown is the bottom of the lattice used by type
+// inference, Dynamic means the value may hold any kind at runtime.
+enum Ir_Type {
+	Ir_Unknown = 0,
+	Ir_Nil,
+	Ir_Bool,
+	Ir_Int,
+	Ir_Real,
+	Ir_Dynamic,
+};
+
+enum {
+	Ir_Flag_Pure       = 1 << 0, // No side effects besides a possible trap, candidate for CSE
+	Ir_Flag_Terminator = 1 << 1,
+};
+
+// Operands are values unless noted, `imm` is the immediate of the instruction
+#define KUURU_IR_OP_TABLE \
+	X(Nop,     0)                   /* */ \
+	X(Param,   0)                   /* imm: parameter index */ \
+	X(Const,   Ir_Flag_Pure)        /* imm: bits of the constant, kind given by type */ \
+	X(Copy,    0)                   /* a */ \
+	X(Phi,     0)                   /* one operand per predecessor, in order */ \
+	X(Add,     Ir_Flag_Pure)        /* a + b */ \
+	X(Sub,     Ir_Flag_Pure)        /* a - b */ \
+	X(Mul,     Ir_Flag_Pure)        /* a * b */ \
+	X(Div,     Ir_Flag_Pure)        /* a / b */ \
+	X(Mod,     Ir_Flag_Pure)        /* a % b */ \
+	X(Bit_And, Ir_Flag_Pure)        /* a & b */ \
+	X(Bit_Or,  Ir_Flag_Pure)        /* a | b */ \
+	X(Bit_Xor, Ir_Flag_Pure)        /* a ~ b */ \
+	X(Add_Imm, Ir_Flag_Pure)        /* a + imm */ \
+	X(Neg,     Ir_Flag_Pure)        /* -a */ \
+	X(Bit_Not, Ir_Flag_Pure)        /* ~a */ \
+	X(Not,     Ir_Flag_Pure)        /* !a */ \
+	X(Eq,      Ir_Flag_Pure)        /* a == b */ \
+	X(Lt,      Ir_Flag_Pure)        /* a < b */ \
+	X(Lte,     Ir_Flag_Pure)        /* a <= b */ \
+	X(Call,    0)                   /* imm: callee index, operands are the arguments */ \
+	X(Jump,    Ir_Flag_Terminator)  /* goto successor 0 */ \
+	X(Branch,  Ir_Flag_Terminator)  /* if a then successor 0 else successor 1 */ \
+	X(Return,  Ir_Flag_Terminator)  /* return a */
+
+enum Ir_Op {
+	#define X(Name, Flags) Ir_Op_##Name,
+		KUURU_IR_OP_TABLE
+	#undef X
+	Ir_Op__Count,
+};
+
+extern u8 const ir_op_flags[Ir_Op__Count];
+
+// Instructions live in one array per function and are linked into their block
+struct Ir_Inst {
+	u8 op;
+	u8 type;
+	u16 operand_count;
+	u32 block;
+	u32 operands;  // Index into Ir_Function.operands
+	Ir_Ref prev;
+	Ir_Ref next;
+	i64 imm;
+};
+
+struct Ir_Block {
+	Ir_Ref first;
+	Ir_Ref last;
+	u32 preds;      // Index into Ir_Function.preds
+	u32 pred_count;
+	u32 succs[2];
+	u32 succ_count;
+};
+
+struct Ir_Function {
+	String name;
+	u32 param_count;
+	Ir_Type* param_types;
+	Ir_Type return_type;
+
+	Ir_Inst* insts;
+	isize inst_count;
+	isize inst_cap;
+
+	Ir_Ref* operands;
+	isize operand_count;
+	isize operand_cap;
+
+	Ir_Block* blocks;
+	isize block_count;
+	isize block_cap;
+
+	u32* preds;
+	isize pred_len;
+	isize pred_cap;
+
+	Mem_Allocator allocator;
+};
+
+struct Ir_Module {
+	Ir_Function* functions;
+	isize len;
+	isize cap;
+	Mem_Allocator allocator;
+};
+
+// Dominator sets of every block as bitsets, plus the immediate dominator
+// tree and a reverse post order of the reachable blocks
+struct Ir_Dominators {
+	u64* sets;     // block_count rows of `words` words
+	isize words;
+	u32* idom;     // IR_BLOCK_NONE for the entry and unreachable blocks
+	u32* rpo;
+	isize rpo_len;
+	Mem_Allocator allocator;
+};
+
+// Live values at the entry and exit of every block, as bitsets over instruction IDs
+struct Ir_Liveness {
+	u64* live_in;
+	u64* live_out;
+	isize words;
+	Mem_Allocator allocator;
+};
+
+// Initialize an empty module
+void ir_module_init(Ir_Module* m, Mem_Allocator allocator);
+
+// Destroy module and its functions
+void ir_module_destroy(Ir_Module* m);
+
+// Add an empty function with an entry block (block 0), returns its index or -1 on failure
+isize ir_module_add_function(Ir_Module* m, String name, u32 param_count);
+
+// Add a block to f, returns its ID or IR_BLOCK_NONE on failure
+u32 ir_add_block(Ir_Function* f);
+
+// Append an instruction to a block, returns it or IR_REF_NONE on failure
+Ir_Ref ir_append(Ir_Function* f, u32 block, Ir_Op op, Ir_Type type, Ir_Ref const* operands, u32 operand_count, i64 imm);
+
+// Terminate block with a jump to target
+Ir_Ref ir_jump(Ir_Function* f, u32 block, u32 target);
+
+// Terminate block with a branch on cond
+Ir_Ref ir_branch(Ir_Function* f, u32 block, Ir_Ref cond, u32 if_true, u32 if_false);
+
+// Fill the predecessor lists of every block from their successors, must be
+// called after the CFG is complete and before adding phis. Returns success status.
+bool ir_compute_predecessors(Ir_Function* f);
+
+// Operands of an instruction
+static inline
+Ir_Ref* ir_operands(Ir_Function const* f, Ir_Ref ref){
+	return &f->operands[f->insts[ref].operands];
+}
+
+// Remove instruction from its block, it becomes a Nop
+void ir_remove(Ir_Function* f, Ir_Ref ref);
+
+// Move instruction right before the terminator of block
+void ir_move_before_terminator(Ir_Function* f, Ir_Ref ref, u32 block);
+
+// Can executing the instruction fail at runtime (type errors, division by zero)?
+bool ir_may_trap(Ir_Function const* f, Ir_Ref ref);
+
+// Compute dominators of f, returns success status
+bool ir_compute_dominators(Ir_Function const* f, Ir_Dominators* d, Mem_Allocator allocator);
+
+// Destroy dominator information
+void ir_dominators_destroy(Ir_Dominators* d);
+
+// Does block a dominate block b?
+static inline
+bool ir_dominates(Ir_Dominators const* d, u32 a, u32 b){
+	return (d->sets[b * d->words + a / 64] >> (a % 64)) & 1;
+}
+
+// Compute liveness of the values of f, returns success status
+bool ir_compute_liveness(Ir_Function const* f, Ir_Dominators const* d, Ir_Liveness* l, Mem_Allocator allocator);
+
+// Destroy liveness information
+void ir_liveness_destroy(Ir_Liveness* l);
+
+// Is value live at the exit of block?
+static inline
+bool ir_live_out(Ir_Liveness const* l, u32 block, Ir_Ref value){
+	return (l->live_out[block * l->words + value / 64] >> (value % 64)) & 1;
+}
+
+// Forward copies and trivial phis to their source. Returns number of instructions removed.
+isize ir_propagate_copies(Ir_Function* f, Mem_Allocator temp);
+
+// Replace pure instructions by an equivalent dominating one. Returns number of instructions removed, or -1 on failure.
+isize ir_eliminate_common_subexpressions(Ir_Function* f, Mem_Allocator temp);
+
+// Remove instructions whose results are unused and that cannot trap. Returns number of instructions removed.
+isize ir_eliminate_dead_code(Ir_Function* f, Mem_Allocator temp);
+
+// Hoist non trapping pure instructions out of loops that have a preheader. Returns number moved, or -1 on failure.
+isize ir_hoist_loop_invariants(Ir_Function* f, Mem_Allocator temp);
+
+// Run the standard pass pipeline on f, returns success status
+bool ir_optimize(Ir_Function* f, Mem_Allocator temp);
+
+// Remove every function not reachable through calls from one of the
+// `entry_count` functions at `entries`. Remaining functions keep their order,
+// calls and `entries` are renumbered in place. Run it before ir_infer_types,
+// so dead call sites do not widen parameter types. Returns number of
+// functions removed, or -1 on failure (the module is left unchanged).
+isize ir_eliminate_dead_functions(Ir_Module* m, isize* entries, isize entry_count, Mem_Allocator temp);
+
+// Infer value, parameter and return types of every function, parameters are
+// refined from call sites. Preset parameter types are kept as a lower bound.
+void ir_infer_types(Ir_Module* m);
+
+// Lower all functions of a bytecode program into SSA, function indices are
+// kept. Parameter types of `entry` are taken from entry_params (all Dynamic if
+// NULL), then types of the whole module are inferred. Returns success status.
+bool ir_lower_program(Ir_Module* m, Vm_Program const* p, isize entry, Ir_Type const* entry_params, Mem_Allocator temp);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+u8 const ir_op_flags[Ir_Op__Count] = {
+	#define X(Name, Flags) [Ir_Op_##Name] = (Flags),
+		KUURU_IR_OP_TABLE
+	#undef X
+};
+
+#define IR_GROW(arr_, cap_, len_, extra_, allocator_) \
+	ir_array_reserve((void**)&(arr_), &(cap_), (len_), (extra_), sizeof(*(arr_)), alignof(max_align_t), (allocator_))
+
+// Make room for `extra` more elements, returns success status
+static
+bool ir_array_reserve(void** data, isize* cap, isize len, isize extra, isize elem_size, isize align, Mem_Allocator allocator){
+	if(len + extra <= *cap){ return true; }
+
+	isize new_cap = Max(*cap * 2, Max(len + extra, 16));
+	void* new_data = mem_alloc(allocator, new_cap * elem_size, align);
+	if(new_data == NULL){ return false; }
+
+	if(*data != NULL){
+		mem_copy(new_data, *data, len * elem_size);
+		mem_free(allocator, *data);
+	}
+	*data = new_data;
+	*cap = new_cap;
+	return true;
+}
+
+static inline
+bool ir_bit_test(u64 const* set, u32 i){
+	return (set[i / 64] >> (i % 64)) & 1;
+}
+
+static inline
+void ir_bit_set(u64* set, u32 i){
+	set[i / 64] |= (u64)1 << (i % 64);
+}
+
+static inline
+isize ir_bitset_words(isize bits){
+	return (bits + 63) / 64;
+}
+
+void ir_module_init(Ir_Module* m, Mem_Allocator allocator){
+	*m = (Ir_Module){ .allocator = allocator };
+}
+
+static
+void ir_function_destroy(Ir_Function* f){
+	mem_free(f->allocator, f->param_types);
+	mem_free(f->allocator, f->insts);
+	mem_free(f->allocator, f->operands);
+	mem_free(f->allocator, f->blocks);
+	mem_free(f->allocator, f->preds);
+	*f = (Ir_Function){0};
+}
+
+void ir_module_destroy(Ir_Module* m){
+	for(isize i = 0; i < m->len; i += 1){
+		ir_function_destroy(&m->functions[i]);
+	}
+	mem_free(m->allocator, m->functions);
+	*m = (Ir_Module){0};
+}
+
+isize ir_module_add_function(Ir_Module* m, String name, u32 param_count){
+	if(!IR_GROW(m->functions, m->cap, m->len, 1, m->allocator)){ return -1; }
+
+	Ir_Function f = {
+		.name = name,
+		.param_count = param_count,
+		.param_types = New(Ir_Type, Max(param_count, 1), m->allocator),
+		.allocator = m->allocator,
+	};
+	bool ok = f.param_types != NULL && IR_GROW(f.insts, f.inst_cap, 0, 64, f.allocator);
+	if(ok){
+		f.insts[0] = (Ir_Inst){ .op = Ir_Op_Nop, .block = IR_BLOCK_NONE };
+		f.inst_count = 1;
+		ok = ir_add_block(&f) == 0;
+	}
+	if(!ok){
+		ir_function_destroy(&f);
+		return -1;
+	}
+
+	m->functions[m->len] = f;
+	m->len += 1;
+	return m->len - 1;
+}
+
+u32 ir_add_block(Ir_Function* f){
+	if(!IR_GROW(f->blocks, f->block_cap, f->block_count, 1, f->allocator)){ return IR_BLOCK_NONE; }
+	f->blocks[f->block_count] = (Ir_Block){0};
+	f->block_count += 1;
+	return f->block_count - 1;
+}
+
+Ir_Ref ir_append(Ir_Function* f, u32 block, Ir_Op op, Ir_Type type, Ir_Ref const* operands, u32 operand_count, i64 imm){
+	if(!IR_GROW(f->insts, f->inst_cap, f->inst_count, 1, f->allocator)){ return IR_REF_NONE; }
+	if(!IR_GROW(f->operands, f->operand_cap, f->operand_count, operand_count, f->allocator)){ return IR_REF_NONE; }
+
+	Ir_Ref ref = f->inst_count;
+	Ir_Block* b = &f->blocks[block];
+	f->insts[ref] = (Ir_Inst){
+		.op = op,
+		.type = type,
+		.operand_count = operand_count,
+		.block = block,
+		.operands = f->operand_count,
+		.prev = b->last,
+		.imm = imm,
+	};
+
+	if(operands != NULL){
+		mem_copy(&f->operands[f->operand_count], operands, operand_count * sizeof(Ir_Ref));
+	} else {
+		mem_set(&f->operands[f->operand_count], 0, operand_count * sizeof(Ir_Ref));
+	}
+	f->operand_count += operand_count;
+	f->inst_count += 1;
+
+	if(b->last != IR_REF_NONE){ f->insts[b->last].next = ref; }
+	else { b->first = ref; }
+	b->last = ref;
+	return ref;
+}
+
+Ir_Ref ir_jump(Ir_Function* f, u32 block, u32 target){
+	f->blocks[block].succs[0] = target;
+	f->blocks[block].succ_count = 1;
+	return ir_append(f, block, Ir_Op_Jump, Ir_Unknown, NULL, 0, 0);
+}
+
+Ir_Ref ir_branch(Ir_Function* f, u32 block, Ir_Ref cond, u32 if_true, u32 if_false){
+	f->blocks[block].succs[0] = if_true;
+	f->blocks[block].succs[1] = if_false;
+	f->blocks[block].succ_count = 2;
+	return ir_append(f, block, Ir_Op_Branch, Ir_Unknown, &cond, 1, 0);
+}
+
+bool ir_compute_predecessors(Ir_Function* f){
+	isize total = 0;
+	for(isize b = 0; b < f->block_count; b += 1){
+		f->blocks[b].pred_count = 0;
+		total += f->blocks[b].succ_count;
+	}
+	f->pred_len = 0;
+	if(!IR_GROW(f->preds, f->pred_cap, 0, total, f->allocator)){ return false; }
+
+	for(isize b = 0; b < f->block_count; b += 1){
+		for(u32 s = 0; s < f->blocks[b].succ_count; s += 1){
+			f->blocks[f->blocks[b].succs[s]].pred_count += 1;
+		}
+	}
+	u32 offset = 0;
+	for(isize b = 0; b < f->block_count; b += 1){
+		f->blocks[b].preds = offset;
+		offset += f->blocks[b].pred_count;
+		f->blocks[b].pred_count = 0;
+	}
+	for(isize b = 0; b < f->block_count; b += 1){
+		for(u32 s = 0; s < f->blocks[b].succ_count; s += 1){
+			Ir_Block* succ = &f->blocks[f->blocks[b].succs[s]];
+			f->preds[succ->preds + succ->pred_count] = b;
+			succ->pred_count += 1;
+		}
+	}
+	f->pred_len = total;
+	return true;
+}
+
+static
+void ir_unlink(Ir_Function* f, Ir_Ref ref){
+	Ir_Inst* inst = &f->insts[ref];
+	Ir_Block* b = &f->blocks[inst->block];
+	if(inst->prev != IR_REF_NONE){ f->insts[inst->prev].next = inst->next; }
+	else { b->first = inst->next; }
+	if(inst->next != IR_REF_NONE){ f->insts[inst->next].prev = inst->prev; }
+	else { b->last = inst->prev; }
+	inst->prev = IR_REF_NONE;
+	inst->next = IR_REF_NONE;
+}
+
+void ir_remove(Ir_Function* f, Ir_Ref ref){
+	if(f->insts[ref].block == IR_BLOCK_NONE){ return; }
+	ir_unlink(f, ref);
+	f->insts[ref].op = Ir_Op_Nop;
+	f->insts[ref].operand_count = 0;
+	f->insts[ref].block = IR_BLOCK_NONE;
+}
+
+void ir_move_before_terminator(Ir_Function* f, Ir_Ref ref, u32 block){
+	ir_unlink(f, ref);
+	Ir_Block* b = &f->blocks[block];
+	Ir_Ref term = b->last;
+	Ir_Inst* inst = &f->insts[ref];
+	inst->block = block;
+	inst->next = term;
+	inst->prev = f->insts[term].prev;
+	if(inst->prev != IR_REF_NONE){ f->insts[inst->prev].next = ref; }
+	else { b->first = ref; }
+	f->insts[term].prev = ref;
+}
+
+bool ir_may_trap(Ir_Function const* f, Ir_Ref ref){
+	Ir_Inst const* inst = &f->insts[ref];
+	Ir_Ref const* ops = ir_operands(f, ref);
+
+	#define TYPE(i_) ((Ir_Type)f->insts[ops[i_]].type)
+	bool both_int = inst->operand_count >= 2 && TYPE(0) == Ir_Int && TYPE(1) == Ir_Int;
+	bool both_real = inst->operand_count >= 2 && TYPE(0) == Ir_Real && TYPE(1) == Ir_Real;
+
+	switch((Ir_Op)inst->op){
+		case Ir_Op_Add: case Ir_Op_Sub: case Ir_Op_Mul: case Ir_Op_Lt: case Ir_Op_Lte:
+			return !(both_int || both_real);
+		case Ir_Op_Div: {
+			if(both_real){ return false; }
+			Ir_Inst const* rhs = &f->insts[ops[1]];
+			return !(both_int && rhs->op == Ir_Op_Const && rhs->imm != 0);
+		}
+		case Ir_Op_Mod: {
+			Ir_Inst const* rhs = &f->insts[ops[1]];
+			return !(both_int && rhs->op == Ir_Op_Const && rhs->imm != 0);
+		}
+		case Ir_Op_Bit_And: case Ir_Op_Bit_Or: case Ir_Op_Bit_Xor:
+			return !both_int;
+		case Ir_Op_Add_Imm: case Ir_Op_Neg:
+			return !(TYPE(0) == Ir_Int || TYPE(0) == Ir_Real);
+		case Ir_Op_Bit_Not:
+			return TYPE(0) != Ir_Int;
+		case Ir_Op_Call:
+			return true;
+		default:
+			return false;
+	}
+	#undef TYPE
+}
+
+///- Analysis ------------------------------------------------------------------
+
+void ir_dominators_destroy(Ir_Dominators* d){
+	mem_free(d->allocator, d->sets);
+	mem_free(d->allocator, d->idom);
+	mem_free(d->allocator, d->rpo);
+	*d = (Ir_Dominators){0};
+}
+
+// Reverse post order of the blocks reachable from the entry, returns its length
+static
+isize ir_reverse_post_order(Ir_Function const* f, u32* rpo, u32* stack, u8* state){
+	// state: 0 = unvisited, 1 = on stack, 2 = done
+	isize top = 0, n = f->block_count;
+	mem_set(state, 0, f->block_count);
+	stack[top++] = 0;
+	state[0] = 1;
+
+	while(top > 0){
+		u32 b = stack[top - 1];
+		bool pushed = false;
+		for(u32 s = 0; s < f->blocks[b].succ_count; s += 1){
+			u32 succ = f->blocks[b].succs[s];
+			if(state[succ] == 0){
+				state[succ] = 1;
+				stack[top++] = succ;
+				pushed = true;
+				break;
+			}
+		}
+		if(!pushed){
+			state[b] = 2;
+			top -= 1;
+			rpo[--n] = b;
+		}
+	}
+
+	// Move the order to the front of the array
+	isize len = f->block_count - n;
+	mem_copy(rpo, &rpo[n], len * sizeof(u32));
+	return len;
+}
+
+bool ir_compute_dominators(Ir_Function const* f, Ir_Dominators* d, Mem_Allocator allocator){
+	isize blocks = f->block_count;
+	isize words = ir_bitset_words(blocks);
+	*d = (Ir_Dominators){
+		.sets = New(u64, blocks * words, allocator),
+		.words = words,
+		.idom = New(u32, blocks, allocator),
+		.rpo = New(u32, blocks, allocator),
+		.allocator = allocator,
+	};
+	u32* stack = New(u32, blocks, allocator);
+	u8* state = New(u8, blocks, allocator);
+	u64* tmp = New(u64, words, allocator);
+
+	bool ok = d->sets != NULL && d->idom != NULL && d->rpo != NULL && stack != NULL && state != NULL && tmp != NULL;
+	if(ok){
+		d->rpo_len = ir_reverse_post_order(f, d->rpo, stack, state);
+
+		// Reachable blocks start out dominated by everything, except the entry
+		for(isize i = 1; i < d->rpo_len; i += 1){
+			mem_set(&d->sets[d->rpo[i] * words], 0xff, words * sizeof(u64));
+		}
+		ir_bit_set(&d->sets[0], 0);
+
+		for(bool changed = true; changed;){
+			changed = false;
+			for(isize i = 1; i < d->rpo_len; i += 1){
+				u32 b = d->rpo[i];
+				Ir_Block const* blk = &f->blocks[b];
+				mem_set(tmp, 0xff, words * sizeof(u64));
+				for(u32 p = 0; p < blk->pred_count; p += 1){
+					u32 pred = f->preds[blk->preds + p];
+					if(state[pred] != 2){ continue; } // Unreachable
+					u64 const* ps = &d->sets[pred * words];
+					for(isize w = 0; w < words; w += 1){ tmp[w] &= ps[w]; }
+				}
+				ir_bit_set(tmp, b);
+
+				u64* bs = &d->sets[b * words];
+				for(isize w = 0; w < words; w += 1){
+					if(bs[w] != tmp[w]){ changed = true; }
+					bs[w] = tmp[w];
+				}
+			}
+		}
+
+		// The immediate dominator is the strict dominator with the most dominators
+		for(isize b = 0; b < blocks; b += 1){
+			d->idom[b] = IR_BLOCK_NONE;
+			if(b == 0 || state[b] != 2){ continue; }
+			isize best_count = -1;
+			u64 const* bs = &d->sets[b * words];
+			for(isize w = 0; w < words; w += 1){
+				for(u64 bits = bs[w]; bits != 0; bits &= bits - 1){
+					u32 dom = w * 64 + __builtin_ctzll(bits);
+					if(dom == b){ continue; }
+					isize count = 0;
+					for(isize v = 0; v < words; v += 1){ count += __builtin_popcountll(d->sets[dom * words + v]); }
+					if(count > best_count){
+						best_count = count;
+						d->idom[b] = dom;
+					}
+				}
+			}
+		}
+	}
+
+	mem_free(allocator, stack);
+	mem_free(allocator, state);
+	mem_free(allocator, tmp);
+	if(!ok){ ir_dominators_destroy(d); }
+	return ok;
+}
+
+void ir_liveness_destroy(Ir_Liveness* l){
+	mem_free(l->allocator, l->live_in);
+	mem_free(l->allocator, l->live_out);
+	*l = (Ir_Liveness){0};
+}
+
+bool ir_compute_liveness(Ir_Function const* f, Ir_Dominators const* d, Ir_Liveness* l, Mem_Allocator allocator){
+	isize blocks = f->block_count;
+	isize words = ir_bitset_words(f->inst_count);
+	*l = (Ir_Liveness){
+		.live_in = New(u64, blocks * words, allocator),
+		.live_out = New(u64, blocks * words, allocator),
+		.words = words,
+		.allocator = allocator,
+	};
+	u64* uses = New(u64, blocks * words, allocator); // Used before defined in block, phi operands excluded
+	u64* defs = New(u64, blocks * words, allocator);
+	bool ok = l->live_in != NULL && l->live_out != NULL && uses != NULL && defs != NULL;
+
+	if(ok){
+		for(isize b = 0; b < blocks; b += 1){
+			u64* use = &uses[b * words];
+			u64* def = &defs[b * words];
+			for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+				Ir_Inst const* inst = &f->insts[r];
+				if(inst->op != Ir_Op_Phi){
+					Ir_Ref const* ops = ir_operands(f, r);
+					for(u32 i = 0; i < inst->operand_count; i += 1){
+						if(!ir_bit_test(def, ops[i])){ ir_bit_set(use, ops[i]); }
+					}
+				}
+				ir_bit_set(def, r);
+			}
+		}
+
+		// Backwards problem, so iterate in post order
+		for(bool changed = true; changed;){
+			changed = false;
+			for(isize i = d->rpo_len - 1; i >= 0; i -= 1){
+				u32 b = d->rpo[i];
+				Ir_Block const* blk = &f->blocks[b];
+				u64* out = &l->live_out[b * words];
+				u64* in = &l->live_in[b * words];
+
+				for(u32 s = 0; s < blk->succ_count; s += 1){
+					u32 succ = blk->succs[s];
+					u64 const* succ_in = &l->live_in[succ * words];
+					for(isize w = 0; w < words; w += 1){ out[w] |= succ_in[w]; }
+
+					// Phi operands are live out of the matching predecessor only
+					Ir_Block const* sb = &f->blocks[succ];
+					for(Ir_Ref r = sb->first; r != IR_REF_NONE && f->insts[r].op == Ir_Op_Phi; r = f->insts[r].next){
+						Ir_Ref const* ops = ir_operands(f, r);
+						for(u32 p = 0; p < sb->pred_count; p += 1){
+							if(f->preds[sb->preds + p] == b){ ir_bit_set(out, ops[p]); }
+						}
+					}
+				}
+
+				u64 const* use = &uses[b * words];
+				u64 const* def = &defs[b * words];
+				for(isize w = 0; w < words; w += 1){
+					u64 v = use[w] | (out[w] & ~def[w]);
+					if(v != in[w]){ changed = true; }
+					in[w] = v;
+				}
+			}
+
+		}
+	}
+
+	mem_free(allocator, uses);
+	mem_free(allocator, defs);
+	if(!ok){ ir_liveness_destroy(l); }
+	return ok;
+}
+
+///- Passes --------------------------------------------------------------------
+
+// Follow replacements to the final value, compressing the path
+static
+Ir_Ref ir_resolve(Ir_Ref* replace, Ir_Ref r){
+	Ir_Ref root = r;
+	while(replace[root] != root){ root = replace[root]; }
+	while(replace[r] != root){
+		Ir_Ref next = replace[r];
+		replace[r] = root;
+		r = next;
+	}
+	return root;
+}
+
+// Rewrite every operand through replace, then remove the replaced instructions
+static
+isize ir_apply_replacements(Ir_Function* f, Ir_Ref* replace){
+	for(isize b = 0; b < f->block_count; b += 1){
+		for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+			Ir_Ref* ops = ir_operands(f, r);
+			for(u32 i = 0; i < f->insts[r].operand_count; i += 1){
+				ops[i] = ir_resolve(replace, ops[i]);
+			}
+		}
+	}
+
+	isize removed = 0;
+	for(isize r = 1; r < f->inst_count; r += 1){
+		if(replace[r] != (Ir_Ref)r && f->insts[r].block != IR_BLOCK_NONE){
+			ir_remove(f, r);
+			removed += 1;
+		}
+	}
+	return removed;
+}
+
+static
+Ir_Ref* ir_identity_map(Ir_Function const* f, Mem_Allocator allocator){
+	Ir_Ref* map = New(Ir_Ref, f->inst_count, allocator);
+	if(map == NULL){ return NULL; }
+	for(isize i = 0; i < f->inst_count; i += 1){ map[i] = i; }
+	return map;
+}
+
+isize ir_propagate_copies(Ir_Function* f, Mem_Allocator temp){
+	Ir_Ref* replace = ir_identity_map(f, temp);
+	if(replace == NULL){ return -1; }
+
+	for(bool changed = true; changed;){
+		changed = false;
+		for(isize b = 0; b < f->block_count; b += 1){
+			for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+				Ir_Inst const* inst = &f->insts[r];
+				if(replace[r] != r){ continue; }
+				Ir_Ref const* ops = ir_operands(f, r);
+
+				if(inst->op == Ir_Op_Copy){
+					replace[r] = ir_resolve(replace, ops[0]);
+					changed = true;
+				}
+				else if(inst->op == Ir_Op_Phi){
+					// A phi merging a single value (and itself) is a copy of it
+					Ir_Ref same = IR_REF_NONE;
+					bool trivial = true;
+					for(u32 i = 0; i < inst->operand_count && trivial; i += 1){
+						Ir_Ref v = ir_resolve(replace, ops[i]);
+						if(v == r || v == same){ continue; }
+						if(same != IR_REF_NONE){ trivial = false; }
+						same = v;
+					}
+					if(trivial && same != IR_REF_NONE){
+						replace[r] = same;
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+
+	isize removed = ir_apply_replacements(f, replace);
+	mem_free(temp, replace);
+	return removed;
+}
+
+static
+u64 ir_inst_hash(Ir_Function const* f, Ir_Ref r){
+	Ir_Inst const* inst = &f->insts[r];
+	u64 h = (u64)inst->op * 0x9e3779b97f4a7c15ull ^ (u64)inst->type ^ ((u64)inst->imm * 0xff51afd7ed558ccdull);
+	Ir_Ref const* ops = ir_operands(f, r);
+	for(u32 i = 0; i < inst->operand_count; i += 1){
+		h = (h ^ ops[i]) * 0xc4ceb9fe1a85ec53ull;
+	}
+	return h ^ (h >> 29);
+}
+
+static
+bool ir_inst_equal(Ir_Function const* f, Ir_Ref a, Ir_Ref b){
+	Ir_Inst const* x = &f->insts[a];
+	Ir_Inst const* y = &f->insts[b];
+	if(x->op != y->op || x->type != y->type || x->imm != y->imm || x->operand_count != y->operand_count){
+		return false;
+	}
+	Ir_Ref const* xo = ir_operands(f, a);
+	Ir_Ref const* yo = ir_operands(f, b);
+	for(u32 i = 0; i < x->operand_count; i += 1){
+		if(xo[i] != yo[i]){ return false; }
+	}
+	return true;
+}
+
+isize ir_eliminate_common_subexpressions(Ir_Function* f, Mem_Allocator temp){
+	Ir_Dominators dom;
+	if(!ir_compute_dominators(f, &dom, temp)){ return -1; }
+
+	isize slot_cap = 64;
+	while(slot_cap < f->inst_count * 2){ slot_cap *= 2; }
+	Ir_Ref* slots = New(Ir_Ref, slot_cap, temp);
+	Ir_Ref* replace = ir_identity_map(f, temp);
+	if(slots == NULL || replace == NULL){
+		mem_free(temp, slots);
+		mem_free(temp, replace);
+		ir_dominators_destroy(&dom);
+		return -1;
+	}
+
+	// Dominators come first in reverse post order, so the surviving copy of an
+	// expression is always seen before the ones it replaces
+	for(isize i = 0; i < dom.rpo_len; i += 1){
+		u32 b = dom.rpo[i];
+		for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+			if(!(ir_op_flags[f->insts[r].op] & Ir_Flag_Pure)){ continue; }
+
+			Ir_Ref* ops = ir_operands(f, r);
+			for(u32 k = 0; k < f->insts[r].operand_count; k += 1){
+				ops[k] = ir_resolve(replace, ops[k]);
+			}
+
+			isize mask = slot_cap - 1;
+			isize s = ir_inst_hash(f, r) & mask;
+			for(; slots[s] != IR_REF_NONE; s = (s + 1) & mask){
+				Ir_Ref other = slots[s];
+				if(ir_dominates(&dom, f->insts[other].block, b) && ir_inst_equal(f, other, r)){
+					replace[r] = other;
+					break;
+				}
+			}
+			if(slots[s] == IR_REF_NONE){ slots[s] = r; }
+		}
+	}
+
+	isize removed = ir_apply_replacements(f, replace);
+	mem_free(temp, slots);
+	mem_free(temp, replace);
+	ir_dominators_destroy(&dom);
+	return removed;
+}
+
+isize ir_eliminate_dead_code(Ir_Function* f, Mem_Allocator temp){
+	u64* live = New(u64, ir_bitset_words(f->inst_count), temp);
+	Ir_Ref* work = New(Ir_Ref, f->inst_count, temp);
+	if(live == NULL || work == NULL){
+		mem_free(temp, live);
+		mem_free(temp, work);
+		return -1;
+	}
+
+	isize top = 0;
+	for(isize b = 0; b < f->block_count; b += 1){
+		for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+			Ir_Op op = f->insts[r].op;
+			if((ir_op_flags[op] & Ir_Flag_Terminator) || op == Ir_Op_Param || ir_may_trap(f, r)){
+				ir_bit_set(live, r);
+				work[top++] = r;
+			}
+		}
+	}
+
+	while(top > 0){
+		Ir_Ref r = work[--top];
+		Ir_Ref const* ops = ir_operands(f, r);
+		for(u32 i = 0; i < f->insts[r].operand_count; i += 1){
+			if(!ir_bit_test(live, ops[i])){
+				ir_bit_set(live, ops[i]);
+				work[top++] = ops[i];
+			}
+		}
+	}
+
+	isize removed = 0;
+	for(isize r = 1; r < f->inst_count; r += 1){
+		if(f->insts[r].block != IR_BLOCK_NONE && !ir_bit_test(live, r)){
+			ir_remove(f, r);
+			removed += 1;
+		}
+	}
+
+	mem_free(temp, live);
+	mem_free(temp, work);
+	return removed;
+}
+
+isize ir_hoist_loop_invariants(Ir_Function* f, Mem_Allocator temp){
+	Ir_Dominators dom;
+	if(!ir_compute_dominators(f, &dom, temp)){ return -1; }
+
+	isize words = ir_bitset_words(f->block_count);
+	u64* body = New(u64, words, temp);
+	u32* work = New(u32, f->block_count, temp);
+	isize moved = 0;
+	if(body == NULL || work == NULL){ moved = -1; goto done; }
+
+	for(isize i = 0; i < dom.rpo_len; i += 1){
+		u32 header = dom.rpo[i];
+		Ir_Block const* hb = &f->blocks[header];
+
+		// Natural loop of all back edges into header
+		mem_set(body, 0, words * sizeof(u64));
+		ir_bit_set(body, header);
+		isize top = 0;
+		for(u32 p = 0; p < hb->pred_count; p += 1){
+			u32 pred = f->preds[hb->preds + p];
+			if(ir_dominates(&dom, header, pred) && !ir_bit_test(body, pred)){
+				ir_bit_set(body, pred);
+				work[top++] = pred;
+			}
+		}
+		if(top == 0){ continue; }
+		while(top > 0){
+			Ir_Block const* b = &f->blocks[work[--top]];
+			for(u32 p = 0; p < b->pred_count; p += 1){
+				u32 pred = f->preds[b->preds + p];
+				if(!ir_bit_test(body, pred)){
+					ir_bit_set(body, pred);
+					work[top++] = pred;
+				}
+			}
+		}
+
+		// Only hoist into a preheader: the single outside predecessor, ending in a jump
+		u32 preheader = IR_BLOCK_NONE;
+		isize outside = 0;
+		for(u32 p = 0; p < hb->pred_count; p += 1){
+			u32 pred = f->preds[hb->preds + p];
+			if(!ir_bit_test(body, pred)){
+				preheader = pred;
+				outside += 1;
+			}
+		}
+		if(outside != 1 || f->blocks[preheader].succ_count != 1){ continue; }
+
+		for(bool changed = true; changed;){
+			changed = false;
+			for(isize k = i; k < dom.rpo_len; k += 1){
+				u32 b = dom.rpo[k];
+				if(!ir_bit_test(body, b)){ continue; }
+
+				for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE;){
+					Ir_Ref next = f->insts[r].next;
+					Ir_Inst const* inst = &f->insts[r];
+					bool invariant = (ir_op_flags[inst->op] & Ir_Flag_Pure) && !ir_may_trap(f, r);
+
+					Ir_Ref const* ops = ir_operands(f, r);
+					for(u32 o = 0; o < inst->operand_count && invariant; o += 1){
+						invariant = !ir_bit_test(body, f->insts[ops[o]].block);
+					}
+					if(invariant){
+						ir_move_before_terminator(f, r, preheader);
+						moved += 1;
+						changed = true;
+					}
+					r = next;
+				}
+			}
+		}
+	}
+
+done:
+	mem_free(temp, body);
+	mem_free(temp, work);
+	ir_dominators_destroy(&dom);
+	return moved;
+}
+
+bool ir_optimize(Ir_Function* f, Mem_Allocator temp){
+	if(ir_propagate_copies(f, temp) < 0){ return false; }
+	if(ir_eliminate_common_subexpressions(f, temp) < 0){ return false; }
+	if(ir_hoist_loop_invariants(f, temp) < 0){ return false; }
+	if(ir_eliminate_dead_code(f, temp) < 0){ return false; }
+	return true;
+}
+
+isize ir_eliminate_dead_functions(Ir_Module* m, isize* entries, isize entry_count, Mem_Allocator temp){
+	isize len = m->len;
+	for(isize i = 0; i < entry_count; i += 1){
+		if(entries[i] < 0 || entries[i] >= len){ return -1; }
+	}
+
+	bool* live = New(bool, Max(len, 1), temp);
+	isize* worklist = New(isize, Max(len, 1), temp);
+	isize* new_index = New(isize, Max(len, 1), temp);
+	if(live == NULL || worklist == NULL || new_index == NULL){
+		mem_free(temp, live);
+		mem_free(temp, worklist);
+		mem_free(temp, new_index);
+		return -1;
+	}
+
+	isize top = 0;
+	for(isize i = 0; i < entry_count; i += 1){
+		if(!live[entries[i]]){
+			live[entries[i]] = true;
+			worklist[top] = entries[i];
+			top += 1;
+		}
+	}
+	bool ok = true;
+	while(top > 0 && ok){
+		top -= 1;
+		Ir_Function const* f = &m->functions[worklist[top]];
+		// Removed instructions are Nops, calls in unreachable blocks are kept
+		for(Ir_Ref r = 1; r < f->inst_count; r += 1){
+			if(f->insts[r].op != Ir_Op_Call){ continue; }
+			i64 callee = f->insts[r].imm;
+			if(callee < 0 || callee >= len){
+				ok = false;
+				break;
+			}
+			if(!live[callee]){
+				live[callee] = true;
+				worklist[top] = callee;
+				top += 1;
+			}
+		}
+	}
+
+	if(!ok){
+		mem_free(temp, live);
+		mem_free(temp, worklist);
+		mem_free(temp, new_index);
+		return -1;
+	}
+
+	isize count = 0;
+	for(isize i = 0; i < len; i += 1){
+		new_index[i] = count;
+		if(live[i]){ count += 1; }
+	}
+
+	for(isize i = 0; i < len; i += 1){
+		Ir_Function* f = &m->functions[i];
+		if(!live[i]){
+			ir_function_destroy(f);
+			continue;
+		}
+		for(Ir_Ref r = 1; r < f->inst_count; r += 1){
+			if(f->insts[r].op == Ir_Op_Call){
+				f->insts[r].imm = new_index[f->insts[r].imm];
+			}
+		}
+		m->functions[new_index[i]] = *f;
+	}
+	m->len = count;
+	for(isize i = 0; i < entry_count; i += 1){
+		entries[i] = new_index[entries[i]];
+	}
+
+	mem_free(temp, live);
+	mem_free(temp, worklist);
+	mem_free(temp, new_index);
+	return len - count;
+}
+
+///- Type inference ------------------------------------------------------------
+
+static inline
+Ir_Type ir_type_join(Ir_Type a, Ir_Type b){
+	if(a == Ir_Unknown){ return b; }
+	if(b == Ir_Unknown || a == b){ return a; }
+	return Ir_Dynamic;
+}
+
+// Result type of an instruction from its operand types
+static
+Ir_Type ir_result_type(Ir_Module const* m, Ir_Function const* f, Ir_Ref r){
+	Ir_Inst const* inst = &f->insts[r];
+	Ir_Ref const* ops = ir_operands(f, r);
+	Ir_Type a = inst->operand_count > 0 ? f->insts[ops[0]].type : Ir_Unknown;
+	Ir_Type b = inst->operand_count > 1 ? f->insts[ops[1]].type : Ir_Unknown;
+
+	switch((Ir_Op)inst->op){
+		case Ir_Op_Param: return f->param_types[inst->imm];
+		case Ir_Op_Copy:  return a;
+
+		case Ir_Op_Phi: {
+			Ir_Type t = Ir_Unknown;
+			for(u32 i = 0; i < inst->operand_count; i += 1){
+				t = ir_type_join(t, f->insts[ops[i]].type);
+			}
+			return t;
+		}
+
+		case Ir_Op_Add: case Ir_Op_Sub: case Ir_Op_Mul: case Ir_Op_Div:
+			if(a == Ir_Unknown || b == Ir_Unknown){ return Ir_Unknown; }
+			if(a == b && (a == Ir_Int || a == Ir_Real)){ return a; }
+			return Ir_Dynamic;
+
+		case Ir_Op_Mod: case Ir_Op_Bit_And: case Ir_Op_Bit_Or: case Ir_Op_Bit_Xor:
+			if(a == Ir_Unknown || b == Ir_Unknown){ return Ir_Unknown; }
+			return (a == Ir_Int && b == Ir_Int) ? Ir_Int : Ir_Dynamic;
+
+		case Ir_Op_Add_Imm: case Ir_Op_Neg:
+			if(a == Ir_Unknown || a == Ir_Int || a == Ir_Real){ return a; }
+			return Ir_Dynamic;
+
+		case Ir_Op_Bit_Not:
+			return (a == Ir_Unknown || a == Ir_Int) ? a : Ir_Dynamic;
+
+		case Ir_Op_Not: case Ir_Op_Eq: case Ir_Op_Lt: case Ir_Op_Lte:
+			return Ir_Bool;
+
+		case Ir_Op_Call:
+			return m->functions[inst->imm].return_type;
+
+		default:
+			return inst->type;
+	}
+}
+
+void ir_infer_types(Ir_Module* m){
+	for(bool changed = true; changed;){
+		changed = false;
+		for(isize fi = 0; fi < m->len; fi += 1){
+			Ir_Function* f = &m->functions[fi];
+			for(isize b = 0; b < f->block_count; b += 1){
+				for(Ir_Ref r = f->blocks[b].first; r != IR_REF_NONE; r = f->insts[r].next){
+					Ir_Inst* inst = &f->insts[r];
+					Ir_Ref const* ops = ir_operands(f, r);
+
+					if(inst->op == Ir_Op_Return){
+						Ir_Type t = ir_type_join(f->return_type, f->insts[ops[0]].type);
+						if(t != f->return_type){ f->return_type = t; changed = true; }
+						continue;
+					}
+					if(ir_op_flags[inst->op] & Ir_Flag_Terminator){ continue; }
+
+					if(inst->op == Ir_Op_Call){
+						Ir_Function* callee = &m->functions[inst->imm];
+						for(u32 i = 0; i < inst->operand_count && i < callee->param_count; i += 1){
+							Ir_Type t = ir_type_join(callee->param_types[i], f->insts[ops[i]].type);
+							if(t != callee->param_types[i]){ callee->param_types[i] = t; changed = true; }
+						}
+					}
+
+					// Types only move up the lattice, so this terminates
+					Ir_Type t = ir_type_join(inst->type, ir_result_type(m, f, r));
+					if(t != inst->type){ inst->type = t; changed = true; }
+				}
+			}
+		}
+
+		// Parameters no call site reaches can hold anything
+		if(!changed){
+			for(isize fi = 0; fi < m->len; fi += 1){
+				Ir_Function* f = &m->functions[fi];
+				for(u32 i = 0; i < f->param_count; i += 1){
+					if(f->param_types[i] == Ir_Unknown){
+						f->param_types[i] = Ir_Dynamic;
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+}
+
+///- Lowering from bytecode ----------------------------------------------------
+
+static inline
+bool ir_vm_is_super_branch(Opcode op){
+	return op == Op_Eq_Branch || op == Op_Lt_Branch || op == Op_Lte_Branch || op == Op_For_Loop;
+}
+
+static inline
+isize ir_vm_jump_target(Vm_Function const* vf, isize pc){
+	return pc + 1 + vm_sbx(vf->code[pc]);
+}
+
+// Successor pcs of the block starting at pc `start`, sets `end` to one past its
+// last instruction. Returns the successor count, or -1 on malformed code.
+static
+int ir_vm_block_successors(Vm_Function const* vf, u8 const* leader, isize start, isize succs[2], isize* end){
+	isize n = vf->code_len;
+	int count = 0;
+	isize pc = start;
+	for(; pc < n; pc += 1){
+		Opcode op = vm_op(vf->code[pc]);
+		if(ir_vm_is_super_branch(op)){
+			if(pc + 1 >= n){ return -1; }
+			pc += 1;
+			succs[count++] = ir_vm_jump_target(vf, pc);
+			succs[count++] = pc + 1;
+			break;
+		}
+		if(op == Op_Jump_If || op == Op_Jump_If_Not){
+			succs[count++] = ir_vm_jump_target(vf, pc);
+			succs[count++] = pc + 1;
+			break;
+		}
+		if(op == Op_Jump){
+			succs[count++] = ir_vm_jump_target(vf, pc);
+			break;
+		}
+		if(op == Op_Return){ break; }
+		if(leader[pc + 1]){
+			succs[count++] = pc + 1;
+			break;
+		}
+	}
+	*end = Min(pc + 1, n);
+
+	for(int i = 0; i < count; i += 1){
+		if(succs[i] < 0 || succs[i] > n){ return -1; }
+	}
+	return count;
+}
+
+static
+Ir_Type ir_type_of_value(Value v, i64* bits){
+	switch(value_kind(v)){
+		case Val_Nil:  *bits = 0; return Ir_Nil;
+		case Val_Bool: *bits = value_as_bool(v); return Ir_Bool;
+		case Val_Int:  *bits = value_as_int(v); return Ir_Int;
+		case Val_Real: *bits = (i64)v.bits; return Ir_Real;
+		case Val_Object: break; // Heap addresses mean nothing outside of the running VM
+	}
+	return Ir_Unknown;
+}
+
+static const Ir_Op ir_vm_binary_ops[Op__Count] = {
+	[Op_Add] = Ir_Op_Add, [Op_Sub] = Ir_Op_Sub, [Op_Mul] = Ir_Op_Mul,
+	[Op_Div] = Ir_Op_Div, [Op_Mod] = Ir_Op_Mod,
+	[Op_Bit_And] = Ir_Op_Bit_And, [Op_Bit_Or] = Ir_Op_Bit_Or, [Op_Bit_Xor] = Ir_Op_Bit_Xor,
+	[Op_Eq] = Ir_Op_Eq, [Op_Lt] = Ir_Op_Lt, [Op_Lte] = Ir_Op_Lte,
+	[Op_Eq_Branch] = Ir_Op_Eq, [Op_Lt_Branch] = Ir_Op_Lt, [Op_Lte_Branch] = Ir_Op_Lte,
+};
+
+// Translate the instructions of one block, `cur` holds the current value of every register
+static
+bool ir_lower_block(Ir_Function* f, Vm_Program const* p, Vm_Function const* vf, u32 b, isize start, isize end, Ir_Ref* cur, Ir_Ref nil, u32 regs){
+	for(isize pc = start; pc < end; pc += 1){
+		Instruction ins = vf->code[pc];
+		Opcode op = vm_op(ins);
+		u8 a = vm_a(ins), rb = vm_b(ins), rc = vm_c(ins);
+		if(a >= regs || ((op == Op_Move || ir_vm_binary_ops[op] != Ir_Op_Nop) && rb >= regs)){ return false; }
+
+		Ir_Ref res = nil;
+		switch(op){
+			case Op_Nop: break;
+
+			case Op_Load_Const: {
+				if(vm_bx(ins) >= vf->constants_len){ return false; }
+				i64 bits = 0;
+				Ir_Type t = ir_type_of_value(vf->constants[vm_bx(ins)], &bits);
+				if(t == Ir_Unknown){ return false; }
+				res = cur[a] = ir_append(f, b, Ir_Op_Const, t, NULL, 0, bits);
+			} break;
+
+			case Op_Load_Nil:  cur[a] = nil; break;
+			case Op_Load_Bool: res = cur[a] = ir_append(f, b, Ir_Op_Const, Ir_Bool, NULL, 0, rb != 0); break;
+			case Op_Load_Int:  res = cur[a] = ir_append(f, b, Ir_Op_Const, Ir_Int, NULL, 0, vm_sbx(ins)); break;
+			case Op_Move:      cur[a] = cur[rb]; break;
+
+			case Op_Add: case Op_Sub: case Op_Mul: case Op_Div: case Op_Mod:
+			case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor:
+			case Op_Eq: case Op_Lt: case Op_Lte: {
+				if(rc >= regs){ return false; }
+				Ir_Ref args[2] = { cur[rb], cur[rc] };
+				res = cur[a] = ir_append(f, b, ir_vm_binary_ops[op], Ir_Unknown, args, 2, 0);
+			} break;
+
+			case Op_Neg:     res = cur[a] = ir_append(f, b, Ir_Op_Neg, Ir_Unknown, &cur[rb], 1, 0); break;
+			case Op_Bit_Not: res = cur[a] = ir_append(f, b, Ir_Op_Bit_Not, Ir_Unknown, &cur[rb], 1, 0); break;
+			case Op_Not:     res = cur[a] = ir_append(f, b, Ir_Op_Not, Ir_Bool, &cur[rb], 1, 0); break;
+			case Op_Add_Imm: res = cur[a] = ir_append(f, b, Ir_Op_Add_Imm, Ir_Unknown, &cur[rb], 1, (i8)rc); break;
+
+			// The successors of the block were set up by the caller, jump targets are successor 0
+			case Op_Jump: {
+				res = ir_append(f, b, Ir_Op_Jump, Ir_Unknown, NULL, 0, 0);
+			} break;
+
+			case Op_Jump_If: case Op_Jump_If_Not: {
+				Ir_Ref cond = cur[a];
+				if(op == Op_Jump_If_Not){ cond = ir_append(f, b, Ir_Op_Not, Ir_Bool, &cond, 1, 0); }
+				res = cond == IR_REF_NONE ? cond : ir_append(f, b, Ir_Op_Branch, Ir_Unknown, &cond, 1, 0);
+			} break;
+
+			case Op_Eq_Branch: case Op_Lt_Branch: case Op_Lte_Branch: {
+				Ir_Ref args[2] = { cur[a], cur[rb] };
+				Ir_Ref cond = ir_append(f, b, ir_vm_binary_ops[op], Ir_Bool, args, 2, 0);
+				if(cond != IR_REF_NONE && rc == 0){ cond = ir_append(f, b, Ir_Op_Not, Ir_Bool, &cond, 1, 0); }
+				res = cond == IR_REF_NONE ? cond : ir_append(f, b, Ir_Op_Branch, Ir_Unknown, &cond, 1, 0);
+				pc += 1; // The jump holding the offset
+			} break;
+
+			case Op_For_Loop: {
+				cur[a] = ir_append(f, b, Ir_Op_Add_Imm, Ir_Unknown, &cur[a], 1, 1);
+				Ir_Ref args[2] = { cur[a], cur[rb] };
+				Ir_Ref cond = cur[a] == IR_REF_NONE ? IR_REF_NONE : ir_append(f, b, Ir_Op_Lt, Ir_Bool, args, 2, 0);
+				res = cond == IR_REF_NONE ? cond : ir_append(f, b, Ir_Op_Branch, Ir_Unknown, &cond, 1, 0);
+				pc += 1;
+			} break;
+
+			case Op_Call: {
+				u16 callee = vm_bx(ins);
+				if(callee >= p->len){ return false; }
+				Vm_Function const* cf = &p->functions[callee];
+				if(a + cf->param_count > regs){ return false; }
+				res = cur[a] = ir_append(f, b, Ir_Op_Call, Ir_Unknown, &cur[a], cf->param_count, callee);
+				// The callee's frame overlaps the registers after the result
+				for(u32 r = a + 1; r < Min((u32)a + cf->register_count, regs); r += 1){ cur[r] = nil; }
+			} break;
+
+			case Op_Return: {
+				res = ir_append(f, b, Ir_Op_Return, Ir_Unknown, &cur[a], 1, 0);
+			} break;
+
+			default: return false;
+		}
+		if(res == IR_REF_NONE){ return false; }
+	}
+
+	// Fell through into the next block, or off the end of the function
+	Ir_Block const* blk = &f->blocks[b];
+	if(blk->last == IR_REF_NONE || !(ir_op_flags[f->insts[blk->last].op] & Ir_Flag_Terminator)){
+		Ir_Ref r = blk->succ_count == 0
+			? ir_append(f, b, Ir_Op_Return, Ir_Unknown, &nil, 1, 0)
+			: ir_append(f, b, Ir_Op_Jump, Ir_Unknown, NULL, 0, 0);
+		if(r == IR_REF_NONE){ return false; }
+	}
+	return true;
+}
+
+// Lower one function. Block 0 only defines the parameters and jumps to the
+// block of pc 0. Every register gets a phi in every join block, which leaves
+// minimal SSA once trivial phis are propagated away.
+static
+bool ir_lower_function(Ir_Module* m, Vm_Program const* p, isize fn, Mem_Allocator temp){
+	Vm_Function const* vf = &p->functions[fn];
+	Ir_Function* f = &m->functions[fn];
+	isize n = vf->code_len;
+	u32 regs = Max(vf->register_count, 1);
+
+	u8* leader = New(u8, n + 2, temp);
+	u32* block_of = New(u32, n + 1, temp); // Block starting at pc, or IR_BLOCK_NONE
+	isize* start_of = New(isize, n + 2, temp);
+	isize* work = New(isize, n + 2, temp);
+	Ir_Ref* cur = New(Ir_Ref, regs, temp);
+	Ir_Ref* exit_defs = NULL;
+	bool ok = leader != NULL && block_of != NULL && start_of != NULL && work != NULL && cur != NULL;
+
+	// Leaders are the first instruction, jump targets and instructions following a branch
+	if(ok){
+		leader[0] = 1;
+		for(isize pc = 0; pc < n && ok; pc += 1){
+			Opcode op = vm_op(vf->code[pc]);
+			isize target = -1;
+			if(ir_vm_is_super_branch(op)){
+				pc += 1;
+				if(pc >= n){ ok = false; break; }
+				target = ir_vm_jump_target(vf, pc);
+			}
+			else if(op == Op_Jump || op == Op_Jump_If || op == Op_Jump_If_Not){
+				target = ir_vm_jump_target(vf, pc);
+			}
+			else if(op != Op_Return){ continue; }
+
+			if(target > n){ ok = false; break; }
+			if(target >= 0){ leader[target] = 1; }
+			leader[pc + 1] = 1;
+		}
+	}
+
+	// Blocks are numbered in discovery order from pc 0, so a block with a single
+	// predecessor always comes after it
+	if(ok){
+		for(isize i = 0; i <= n; i += 1){ block_of[i] = IR_BLOCK_NONE; }
+		block_of[0] = ir_add_block(f);
+		start_of[block_of[0]] = 0;
+		ok = block_of[0] == 1;
+
+		isize top = 0;
+		work[top++] = 0;
+		while(top > 0 && ok){
+			isize start = work[--top];
+			isize succs[2], end;
+			int count = ir_vm_block_successors(vf, leader, start, succs, &end);
+			if(count < 0){ ok = false; break; }
+
+			Ir_Block* blk = &f->blocks[block_of[start]];
+			for(int i = 0; i < count && ok; i += 1){
+				if(block_of[succs[i]] == IR_BLOCK_NONE){
+					u32 nb = ir_add_block(f);
+					ok = nb != IR_BLOCK_NONE;
+					blk = &f->blocks[block_of[start]]; // Blocks may have moved
+					block_of[succs[i]] = nb;
+					start_of[nb] = succs[i];
+					work[top++] = succs[i];
+				}
+				blk->succs[i] = block_of[succs[i]];
+			}
+			blk->succ_count = count;
+		}
+		f->blocks[0].succs[0] = 1;
+		f->blocks[0].succ_count = 1;
+	}
+	ok = ok && ir_compute_predecessors(f);
+
+	if(ok){
+		exit_defs = New(Ir_Ref, f->block_count * regs, temp);
+		ok = exit_defs != NULL;
+	}
+
+	// Entry block: parameters and the nil every other register starts with
+	Ir_Ref nil = IR_REF_NONE;
+	if(ok){
+		for(u32 r = 0; r < vf->param_count && ok; r += 1){
+			exit_defs[r] = ir_append(f, 0, Ir_Op_Param, f->param_types[r], NULL, 0, r);
+			ok = exit_defs[r] != IR_REF_NONE;
+		}
+		nil = ir_append(f, 0, Ir_Op_Const, Ir_Nil, NULL, 0, 0);
+		ok = ok && nil != IR_REF_NONE && ir_append(f, 0, Ir_Op_Jump, Ir_Unknown, NULL, 0, 0) != IR_REF_NONE;
+		for(u32 r = vf->param_count; r < regs; r += 1){ exit_defs[r] = nil; }
+	}
+
+	for(isize b = 1; b < f->block_count && ok; b += 1){
+		Ir_Block const* blk = &f->blocks[b];
+		if(blk->pred_count == 1 && f->preds[blk->preds] < b){
+			mem_copy(cur, &exit_defs[f->preds[blk->preds] * regs], regs * sizeof(Ir_Ref));
+		}
+		else {
+			// imm holds the register until the operands are filled in
+			for(u32 r = 0; r < regs && ok; r += 1){
+				cur[r] = ir_append(f, b, Ir_Op_Phi, Ir_Unknown, NULL, blk->pred_count, r);
+				ok = cur[r] != IR_REF_NONE;
+			}
+		}
+
+		isize succs[2], end;
+		ok = ok && ir_vm_block_successors(vf, leader, start_of[b], succs, &end) >= 0;
+		ok = ok && ir_lower_block(f, p, vf, b, start_of[b], end, cur, nil, regs);
+		if(ok){ mem_copy(&exit_defs[b * regs], cur, regs * sizeof(Ir_Ref)); }
+	}
+
+	// Every block has its exit definitions now, fill in the phis
+	for(isize b = 1; b < f->block_count && ok; b += 1){
+		Ir_Block const* blk = &f->blocks[b];
+		for(Ir_Ref r = blk->first; r != IR_REF_NONE && f->insts[r].op == Ir_Op_Phi; r = f->insts[r].next){
+			Ir_Ref* ops = ir_operands(f, r);
+			for(u32 i = 0; i < blk->pred_count; i += 1){
+				ops[i] = exit_defs[f->preds[blk->preds + i] * regs + f->insts[r].imm];
+			}
+			f->insts[r].imm = 0;
+		}
+	}
+
+	mem_free(temp, leader);
+	mem_free(temp, block_of);
+	mem_free(temp, start_of);
+	mem_free(temp, work);
+	mem_free(temp, cur);
+	mem_free(temp, exit_defs);
+	return ok;
+}
+
+bool ir_lower_program(Ir_Module* m, Vm_Program const* p, isize entry, Ir_Type const* entry_params, Mem_Allocator temp){
+	for(isize i = 0; i < p->len; i += 1){
+		Vm_Function const* vf = &p->functions[i];
+		isize fi = ir_module_add_function(m, vf->name, vf->param_count);
+		if(fi < 0){ return false; }
+		if(i == entry){
+			for(u32 k = 0; k < vf->param_count; k += 1){
+				m->functions[fi].param_types[k] = entry_params != NULL ? entry_params[k] : Ir_Dynamic;
+			}
+		}
+	}
+
+	for(isize i = 0; i < p->len; i += 1){
+		if(!ir_lower_function(m, p, i, temp)){ return false; }
+		if(ir_propagate_copies(&m->functions[i], temp) < 0){ return false; }
+	}
+
+	ir_infer_types(m);
+	return true;
+}
+
+#undef IR_GROW
+#endif
@@ -0,0 +1,857 @@
+#pragma once
+
+#include "base.h"
+#include "vm.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Jit Jit;
+typedef struct Jit_Code Jit_Code;
+
+// Calls plus loop back edges before a function gets compiled
+#define JIT_DEFAULT_THRESHOLD 1000
+
+// Machine code of one function
+struct Jit_Code {
+	byte* memory;
+	isize size;
+};
+
+struct Jit {
+	Jit_Code* codes; // Per function of the program
+	isize len;
+	isize compiled;
+	isize failed;
+	Mem_Allocator allocator;
+};
+
+// Is the JIT available on this platform? (Linux x86-64 only)
+bool jit_available(void);
+
+// Enable the baseline JIT on vm, functions are compiled after being called or
+// looping `threshold` times. Returns false if unavailable or out of memory.
+bool jit_attach(Vm* vm, u32 threshold);
+
+// Disable the JIT and release compiled code, must be called before vm_destroy
+void jit_detach(Vm* vm);
+
+// Compile fn to machine code. Every instruction without a template, and every
+// failed type check, exits back to the interpreter at that instruction. Ints
+// checked once stay unchecked until something may change them, the interpreter
+// re-enters through stubs that check those.
+// Returns NULL on failure.
+Vm_Jit_Entry jit_compile(Vm* vm, isize fn);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#if defined(__x86_64__) && defined(__linux__)
+	#define JIT_X64 1
+	#include <sys/mman.h>
+	#include <unistd.h>
+#else
+	#define JIT_X64 0
+#endif
+
+bool jit_available(void){
+	return JIT_X64;
+}
+
+bool jit_attach(Vm* vm, u32 threshold){
+	if(!jit_available()){ return false; }
+
+	isize count = Max(vm->program->len, 1);
+	Jit* jit = New(Jit, 1, vm->allocator);
+	Jit_Code* codes = New(Jit_Code, count, vm->allocator);
+	Vm_Jit_Entry* entries = New(Vm_Jit_Entry, count, vm->allocator);
+	u32* counters = New(u32, count, vm->allocator);
+	if(jit == NULL || codes == NULL || entries == NULL || counters == NULL){
+		mem_free(vm->allocator, jit);
+		mem_free(vm->allocator, codes);
+		mem_free(vm->allocator, entries);
+		mem_free(vm->allocator, counters);
+		return false;
+	}
+
+	*jit = (Jit){
+		.codes = codes,
+		.len = vm->program->len,
+		.allocator = vm->allocator,
+	};
+	vm->jit = jit;
+	vm->jit_entries = entries;
+	vm->jit_counters = counters;
+	vm->jit_threshold = Max(threshold, 1);
+	vm->jit_compile = jit_compile;
+	return true;
+}
+
+void jit_detach(Vm* vm){
+	Jit* jit = vm->jit;
+	if(jit == NULL){ return; }
+
+	#if JIT_X64
+	for(isize i = 0; i < jit->len; i += 1){
+		if(jit->codes[i].memory != NULL){ munmap(jit->codes[i].memory, jit->codes[i].size); }
+	}
+	#endif
+
+	mem_free(vm->allocator, jit->codes);
+	mem_free(vm->allocator, vm->jit_entries);
+	mem_free(vm->allocator, vm->jit_counters);
+	mem_free(vm->allocator, jit);
+	vm->jit = NULL;
+	vm->jit_entries = NULL;
+	vm->jit_counters = NULL;
+	vm->jit_compile = NULL;
+}
+
+#if JIT_X64
+
+typedef struct Jit_Fixup Jit_Fixup;
+typedef struct Jit_Int_Set Jit_Int_Set;
+typedef struct Jit_Emitter Jit_Emitter;
+
+// A rel32 at `at` that must point to the code of instruction `pc`, or to its exit stub
+struct Jit_Fixup {
+	isize at;
+	isize pc;
+	bool to_exit;
+};
+
+// Registers known to hold inline ints, one bit each
+struct Jit_Int_Set {
+	u64 bits[4];
+};
+
+struct Jit_Emitter {
+	Jit_Int_Set const* known; // At the instruction being emitted, see jit_known_ints
+
+	byte* code;
+	isize len;
+	isize cap;
+
+	Jit_Fixup* fixups;
+	isize fixup_count;
+	isize fixup_cap;
+
+	bool ok;
+	Mem_Allocator allocator;
+};
+
+// Registers are one NaN-boxed word each (see value.h)
+#define JIT_VALUE_SIZE ((i32)sizeof(Value))
+_Static_assert(sizeof(Value) == 8, "Value layout changed, update JIT templates");
+
+// Registers as encoded in ModRM (plus REX for r8 and up). Compiled code keeps
+// the constants it checks tags against in r8 to r11, see jit_compile.
+enum {
+	JIT_RAX = 0, JIT_RCX = 1, JIT_RDX = 2, JIT_RDI = 7,
+	JIT_INT_TAG = 8,    // r8: VALUE_INT_BITS
+	JIT_BOOL_TAG = 9,   // r9: VALUE_FALSE_BITS
+	JIT_INT_LIMIT = 10, // r10: 1 << 48, bound of inline int bits once untagged
+	JIT_NIL = 11,       // r11: VALUE_NIL_BITS
+};
+
+// Condition codes for jcc/setcc
+enum {
+	Jit_Cond_O = 0x0, Jit_Cond_AE = 0x3, Jit_Cond_E = 0x4, Jit_Cond_NE = 0x5,
+	Jit_Cond_L = 0xc, Jit_Cond_GE = 0xd, Jit_Cond_LE = 0xe, Jit_Cond_G = 0xf,
+};
+
+static
+void jit_bytes(Jit_Emitter* e, byte const* data, isize len){
+	if(!e->ok){ return; }
+	while(e->len + len > e->cap){
+		if(!vm_array_grow((void**)&e->code, &e->cap, e->cap, 1, 1, e->allocator)){
+			e->ok = false;
+			return;
+		}
+	}
+	mem_copy(&e->code[e->len], data, len);
+	e->len += len;
+}
+
+static
+void jit_u8(Jit_Emitter* e, u8 v){
+	jit_bytes(e, &v, 1);
+}
+
+static
+void jit_u32(Jit_Emitter* e, u32 v){
+	byte b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	jit_bytes(e, b, 4);
+}
+
+static
+void jit_u64(Jit_Emitter* e, u64 v){
+	jit_u32(e, (u32)v);
+	jit_u32(e, (u32)(v >> 32));
+}
+
+// [rdi + disp32] operand with `reg` in the ModRM reg field
+static
+void jit_mem(Jit_Emitter* e, u8 reg, i32 disp){
+	jit_u8(e, 0x80 | (reg << 3) | JIT_RDI);
+	jit_u32(e, (u32)disp);
+}
+
+static inline
+i32 jit_reg(u8 r){
+	return r * JIT_VALUE_SIZE;
+}
+
+// <op> reg64, [rdi + disp]. `opcode` may be 2 bytes (0x0f prefixed)
+static
+void jit_op_reg_mem(Jit_Emitter* e, u16 opcode, u8 reg, i32 disp){
+	jit_u8(e, 0x48);
+	if(opcode > 0xff){ jit_u8(e, opcode >> 8); }
+	jit_u8(e, opcode & 0xff);
+	jit_mem(e, reg, disp);
+}
+
+// <op> reg64, rm64 with both operands registers
+static
+void jit_op_reg_reg(Jit_Emitter* e, u16 opcode, u8 reg, u8 rm){
+	jit_u8(e, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+	if(opcode > 0xff){ jit_u8(e, opcode >> 8); }
+	jit_u8(e, opcode & 0xff);
+	jit_u8(e, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// Shift group (C1 /ext) of reg64 by imm8: rol=0, ror=1, shl=4, shr=5, sar=7
+static
+void jit_shift(Jit_Emitter* e, u8 ext, u8 reg, u8 imm){
+	jit_u8(e, 0x48); jit_u8(e, 0xc1); jit_u8(e, 0xc0 | (ext << 3) | reg); jit_u8(e, imm);
+}
+
+static
+void jit_load(Jit_Emitter* e, u8 reg, i32 disp){
+	jit_op_reg_mem(e, 0x8b, reg, disp);
+}
+
+static
+void jit_store(Jit_Emitter* e, i32 disp, u8 reg){
+	jit_op_reg_mem(e, 0x89, reg, disp);
+}
+
+// mov reg64, imm64
+static
+void jit_load_imm(Jit_Emitter* e, u8 reg, u64 imm){
+	jit_u8(e, 0x48 | (reg >> 3)); jit_u8(e, 0xb8 + (reg & 7)); jit_u64(e, imm);
+}
+
+// R[r] = Value of the given bits
+static
+void jit_store_bits(Jit_Emitter* e, u8 r, u64 bits){
+	jit_load_imm(e, JIT_RAX, bits);
+	jit_store(e, jit_reg(r), JIT_RAX);
+}
+
+static
+void jit_fixup(Jit_Emitter* e, isize pc, bool to_exit){
+	if(!vm_array_grow((void**)&e->fixups, &e->fixup_cap, e->fixup_count, sizeof(Jit_Fixup), alignof(Jit_Fixup), e->allocator)){
+		e->ok = false;
+		return;
+	}
+	e->fixups[e->fixup_count] = (Jit_Fixup){ .at = e->len, .pc = pc, .to_exit = to_exit };
+	e->fixup_count += 1;
+	jit_u32(e, 0);
+}
+
+// jcc rel32 to the code of pc (or to its exit stub)
+static
+void jit_jcc(Jit_Emitter* e, u8 cond, isize pc, bool to_exit){
+	jit_u8(e, 0x0f);
+	jit_u8(e, 0x80 | cond);
+	jit_fixup(e, pc, to_exit);
+}
+
+static
+void jit_jmp(Jit_Emitter* e, isize pc, bool to_exit){
+	jit_u8(e, 0xe9);
+	jit_fixup(e, pc, to_exit);
+}
+
+// <op> reg64, imm32 of the 81 /ext group: add=0, or=1, xor=6
+static
+void jit_op_imm(Jit_Emitter* e, u8 ext, u8 reg, i32 imm){
+	jit_u8(e, 0x48); jit_u8(e, 0x81); jit_u8(e, 0xc0 | (ext << 3) | reg);
+	jit_u32(e, (u32)imm);
+}
+
+static inline
+bool jit_set_has(Jit_Int_Set const* s, u8 r){
+	return (s->bits[r / 64] >> (r % 64)) & 1;
+}
+
+static inline
+void jit_set_add(Jit_Int_Set* s, u8 r){
+	s->bits[r / 64] |= (u64)1 << (r % 64);
+}
+
+static inline
+void jit_set_remove(Jit_Int_Set* s, u8 r){
+	s->bits[r / 64] &= ~((u64)1 << (r % 64));
+}
+
+static inline
+bool jit_set_empty(Jit_Int_Set const* s){
+	return (s->bits[0] | s->bits[1] | s->bits[2] | s->bits[3]) == 0;
+}
+
+// Load R[r] into reg, leaving to the interpreter at pc unless it is an inline
+// int. Clobbers rcx.
+static
+void jit_load_checked_int(Jit_Emitter* e, u8 reg, u8 r, isize pc){
+	jit_load(e, reg, jit_reg(r));
+	jit_op_reg_reg(e, 0x8b, JIT_RCX, reg);           // mov rcx, reg
+	jit_op_reg_reg(e, 0x33, JIT_RCX, JIT_INT_TAG);   // xor rcx, r8
+	jit_op_reg_reg(e, 0x3b, JIT_RCX, JIT_INT_LIMIT); // cmp rcx, r10
+	jit_jcc(e, Jit_Cond_AE, pc, true);
+}
+
+// Load the inline integer of R[r] into reg (rax or rdx), rotated left by 16
+// so the payload sits above its tag. Rotated integers are compared, added to
+// clean ones and combined bitwise as they are, and the overflow flag of adds
+// tells whether results still fit inline. Leaves to the interpreter at pc if
+// R[r] is anything else, unless it is known not to be. Clobbers rcx.
+static
+void jit_load_int(Jit_Emitter* e, u8 reg, u8 r, isize pc){
+	if(jit_set_has(e->known, r)){ jit_load(e, reg, jit_reg(r)); }
+	else { jit_load_checked_int(e, reg, r, pc); }
+	jit_shift(e, 0, reg, 16);                        // rol reg, 16
+}
+
+// Same as jit_load_int, but the integer is clean: shifted left by 16, without tag
+static
+void jit_load_clean_int(Jit_Emitter* e, u8 reg, u8 r, isize pc){
+	jit_load(e, reg, jit_reg(r));
+	if(!jit_set_has(e->known, r)){
+		jit_op_reg_reg(e, 0x33, reg, JIT_INT_TAG);   // xor reg, r8
+		jit_op_reg_reg(e, 0x3b, reg, JIT_INT_LIMIT); // cmp reg, r10
+		jit_jcc(e, Jit_Cond_AE, pc, true);
+	}
+	jit_shift(e, 4, reg, 16);                        // shl reg, 16
+}
+
+// R[r] = rotated integer in src (see jit_load_int), clobbers src
+static
+void jit_store_int(Jit_Emitter* e, u8 r, u8 src){
+	jit_shift(e, 1, src, 16);                        // ror src, 16
+	jit_store(e, jit_reg(r), src);
+}
+
+// R[a] = R[b] <op> R[c] on integers, leaving to the interpreter (which boxes
+// the result) when it does not fit inline
+static
+void jit_int_binary(Jit_Emitter* e, u16 opcode, u8 a, u8 b, u8 c, isize pc){
+	switch(opcode){
+		case 0x03: case 0x2b: {
+			jit_load_int(e, JIT_RAX, b, pc);
+			jit_load_clean_int(e, JIT_RDX, c, pc);
+			jit_op_reg_reg(e, opcode, JIT_RAX, JIT_RDX);
+			jit_jcc(e, Jit_Cond_O, pc, true);
+		} break;
+		case 0x0faf: {
+			jit_load_clean_int(e, JIT_RAX, b, pc);
+			jit_load_clean_int(e, JIT_RDX, c, pc);
+			jit_shift(e, 7, JIT_RDX, 16);                // sar rdx, 16
+			jit_op_reg_reg(e, opcode, JIT_RAX, JIT_RDX);
+			jit_jcc(e, Jit_Cond_O, pc, true);
+			jit_op_imm(e, 1, JIT_RAX, VALUE_TAG_INT);    // or rax, tag
+		} break;
+		default: {
+			// Bitwise operations keep the tags, except xor which cancels them.
+			// Known ints are combined as they are stored.
+			if(jit_set_has(e->known, b) && jit_set_has(e->known, c)){
+				jit_load(e, JIT_RAX, jit_reg(b));
+				jit_op_reg_mem(e, opcode, JIT_RAX, jit_reg(c));
+				if(opcode == 0x33){ jit_op_reg_reg(e, 0x0b, JIT_RAX, JIT_INT_TAG); } // or rax, r8
+				jit_store(e, jit_reg(a), JIT_RAX);
+				return;
+			}
+			jit_load_int(e, JIT_RAX, b, pc);
+			jit_load_int(e, JIT_RDX, c, pc);
+			jit_op_reg_reg(e, opcode, JIT_RAX, JIT_RDX);
+			if(opcode == 0x33){ jit_op_imm(e, 1, JIT_RAX, VALUE_TAG_INT); }
+		} break;
+	}
+	jit_store_int(e, a, JIT_RAX);
+}
+
+// Compare integers R[x] and R[y], leaving the flags set
+static
+void jit_int_compare(Jit_Emitter* e, u8 x, u8 y, isize pc){
+	jit_load_int(e, JIT_RAX, x, pc);
+	jit_load_int(e, JIT_RDX, y, pc);
+	jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_RDX);   // cmp rax, rdx
+}
+
+// R[a] = bool of condition cond
+static
+void jit_store_cond(Jit_Emitter* e, u8 a, u8 cond){
+	jit_u8(e, 0x0f); jit_u8(e, 0x90 | cond); jit_u8(e, 0xc0); // setcc al
+	jit_u8(e, 0x0f); jit_u8(e, 0xb6); jit_u8(e, 0xc0);        // movzx eax, al
+	jit_op_reg_reg(e, 0x0b, JIT_RAX, JIT_BOOL_TAG);           // or rax, r9
+	jit_store(e, jit_reg(a), JIT_RAX);
+}
+
+// Jump to target if R[r] is truthy (or falsy when `if_true` is false), fall
+// through otherwise. Only nil and false are falsy.
+static
+void jit_branch_truthy(Jit_Emitter* e, u8 r, isize target, bool if_true){
+	jit_load(e, JIT_RAX, jit_reg(r));
+	jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_NIL);      // cmp rax, r11
+	if(if_true){
+		isize skip = e->len;
+		jit_u8(e, 0x74); jit_u8(e, 0);              // je <end>
+		jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_BOOL_TAG);
+		jit_jcc(e, Jit_Cond_NE, target, false);
+		if(e->ok){ e->code[skip + 1] = e->len - (skip + 2); }
+	} else {
+		jit_jcc(e, Jit_Cond_E, target, false);
+		jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_BOOL_TAG);
+		jit_jcc(e, Jit_Cond_E, target, false);
+	}
+}
+
+static
+void jit_exit(Jit_Emitter* e, i64 pc){
+	jit_u8(e, 0x48); jit_u8(e, 0xc7); jit_u8(e, 0xc0); // mov rax, imm32
+	jit_u32(e, (u32)pc);
+	jit_u8(e, 0xc3);                                   // ret
+}
+
+static inline
+isize jit_jump_target(Vm_Function const* fn, isize pc){
+	return pc + 1 + vm_sbx(fn->code[pc]);
+}
+
+// Emit the template of the instruction at pc, returns the number of instructions consumed
+static
+isize jit_emit_instruction(Jit_Emitter* e, Vm_Function const* fn, isize pc){
+	Instruction ins = fn->code[pc];
+	Opcode op = vm_op(ins);
+	u8 a = vm_a(ins), b = vm_b(ins), c = vm_c(ins);
+	u8 regs = fn->register_count;
+
+	// Registers are trusted by the interpreter, but not here
+	bool regs_ok = a < regs;
+	switch(op){
+		case Op_Move: case Op_Neg: case Op_Bit_Not: case Op_Not: case Op_Add_Imm:
+			regs_ok = regs_ok && b < regs; break;
+		case Op_Add: case Op_Sub: case Op_Mul: case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor:
+		case Op_Eq: case Op_Lt: case Op_Lte:
+			regs_ok = regs_ok && b < regs && c < regs; break;
+		case Op_Eq_Branch: case Op_Lt_Branch: case Op_Lte_Branch: case Op_For_Loop:
+			regs_ok = regs_ok && b < regs && pc + 1 < fn->code_len; break;
+		default: break;
+	}
+	if(!regs_ok){
+		jit_exit(e, pc);
+		return 1;
+	}
+
+	switch(op){
+		case Op_Nop: break;
+
+		case Op_Load_Nil: {
+			jit_store_bits(e, a, value_nil().bits);
+		} break;
+
+		case Op_Load_Bool: {
+			jit_store_bits(e, a, value_bool(b != 0).bits);
+		} break;
+
+		case Op_Load_Int: {
+			jit_store_bits(e, a, value_small_int(vm_sbx(ins)).bits);
+		} break;
+
+		case Op_Load_Const: {
+			// Boxed constants are owned by the program and never move
+			if(vm_bx(ins) >= fn->constants_len){ jit_exit(e, pc); break; }
+			jit_store_bits(e, a, fn->constants[vm_bx(ins)].bits);
+		} break;
+
+		case Op_Move: {
+			jit_load(e, JIT_RAX, jit_reg(b));
+			jit_store(e, jit_reg(a), JIT_RAX);
+		} break;
+
+		case Op_Add:     jit_int_binary(e, 0x03, a, b, c, pc); break;
+		case Op_Sub:     jit_int_binary(e, 0x2b, a, b, c, pc); break;
+		case Op_Mul:     jit_int_binary(e, 0x0faf, a, b, c, pc); break;
+		case Op_Bit_And: jit_int_binary(e, 0x23, a, b, c, pc); break;
+		case Op_Bit_Or:  jit_int_binary(e, 0x0b, a, b, c, pc); break;
+		case Op_Bit_Xor: jit_int_binary(e, 0x33, a, b, c, pc); break;
+
+		case Op_Add_Imm: {
+			jit_load_int(e, JIT_RAX, b, pc);
+			jit_op_imm(e, 0, JIT_RAX, (i32)(i8)c * 0x10000);
+			jit_jcc(e, Jit_Cond_O, pc, true);
+			jit_store_int(e, a, JIT_RAX);
+		} break;
+
+		case Op_Neg: {
+			jit_load_clean_int(e, JIT_RAX, b, pc);
+			jit_u8(e, 0x48); jit_u8(e, 0xf7); jit_u8(e, 0xd8); // neg rax
+			jit_jcc(e, Jit_Cond_O, pc, true);
+			jit_op_imm(e, 1, JIT_RAX, VALUE_TAG_INT);
+			jit_store_int(e, a, JIT_RAX);
+		} break;
+
+		case Op_Bit_Not: {
+			jit_load_int(e, JIT_RAX, b, pc);
+			jit_op_imm(e, 6, JIT_RAX, -0x10000);        // Flip every payload bit
+			jit_store_int(e, a, JIT_RAX);
+		} break;
+
+		case Op_Not: {
+			static const byte sete_dl[] = { 0x0f, 0x94, 0xc2 };
+			static const byte merge[] = {
+				0x0f, 0x94, 0xc0,       // sete al
+				0x08, 0xd0,             // or al, dl
+			};
+			jit_load(e, JIT_RAX, jit_reg(b));
+			jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_NIL);      // cmp rax, r11
+			jit_bytes(e, sete_dl, sizeof(sete_dl));
+			jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_BOOL_TAG); // cmp rax, r9
+			jit_bytes(e, merge, sizeof(merge));
+			jit_store_cond(e, a, Jit_Cond_NE); // Set when nil or false
+		} break;
+
+		case Op_Eq: case Op_Lt: case Op_Lte: {
+			// Only inline integers have a template, other kinds go to the interpreter
+			jit_int_compare(e, b, c, pc);
+			jit_store_cond(e, a, op == Op_Eq ? Jit_Cond_E : (op == Op_Lt ? Jit_Cond_L : Jit_Cond_LE));
+		} break;
+
+		case Op_Jump: {
+			jit_jmp(e, jit_jump_target(fn, pc), false);
+		} break;
+
+		case Op_Jump_If: case Op_Jump_If_Not: {
+			jit_branch_truthy(e, a, jit_jump_target(fn, pc), op == Op_Jump_If);
+		} break;
+
+		case Op_Eq_Branch: case Op_Lt_Branch: case Op_Lte_Branch: {
+			jit_int_compare(e, a, b, pc);
+			u8 cond = op == Op_Eq_Branch ? Jit_Cond_E : (op == Op_Lt_Branch ? Jit_Cond_L : Jit_Cond_LE);
+			if(c == 0){ cond ^= 1; } // Negated condition
+			jit_jcc(e, cond, jit_jump_target(fn, pc + 1), false);
+			jit_jmp(e, pc + 2, false);
+			return 2;
+		}
+
+		case Op_For_Loop: {
+			jit_load_int(e, JIT_RAX, a, pc);
+			jit_load_int(e, JIT_RDX, b, pc);
+			jit_op_imm(e, 0, JIT_RAX, 0x10000);         // Counter + 1
+			jit_jcc(e, Jit_Cond_O, pc, true);
+			jit_op_reg_reg(e, 0x8b, JIT_RCX, JIT_RAX);  // mov rcx, rax
+			jit_store_int(e, a, JIT_RCX);
+			jit_op_reg_reg(e, 0x3b, JIT_RAX, JIT_RDX);  // cmp rax, rdx
+			jit_jcc(e, Jit_Cond_L, jit_jump_target(fn, pc + 1), false);
+			jit_jmp(e, pc + 2, false);
+			return 2;
+		}
+
+		case Op_Return: {
+			jit_load(e, JIT_RAX, jit_reg(a));
+			jit_store(e, 0, JIT_RAX);
+			jit_exit(e, -1);
+		} break;
+
+		// Calls, division, reals and anything else run in the interpreter
+		default: {
+			jit_exit(e, pc);
+		} break;
+	}
+	return 1;
+}
+
+// Take `s` from the registers known to hold inline ints before the template
+// of the instruction at pc to those known after it: the ones it checked or
+// produced. Sets succ to where compiled code goes on from it, -1 where it
+// exits or returns instead. Returns the number of instructions consumed.
+static
+isize jit_known_step(Vm_Function const* fn, isize pc, Jit_Int_Set* s, isize succ[2]){
+	Instruction ins = fn->code[pc];
+	u8 a = vm_a(ins), b = vm_b(ins), c = vm_c(ins);
+	succ[0] = pc + 1;
+	succ[1] = -1;
+
+	switch(vm_op(ins)){
+		case Op_Nop: break;
+
+		case Op_Load_Nil: case Op_Load_Bool: case Op_Not: {
+			jit_set_remove(s, a);
+		} break;
+
+		case Op_Load_Int: {
+			jit_set_add(s, a);
+		} break;
+
+		case Op_Load_Const: {
+			if(vm_bx(ins) < fn->constants_len && value_is_small_int(fn->constants[vm_bx(ins)])){ jit_set_add(s, a); }
+			else { jit_set_remove(s, a); }
+		} break;
+
+		case Op_Move: {
+			if(jit_set_has(s, b)){ jit_set_add(s, a); }
+			else { jit_set_remove(s, a); }
+		} break;
+
+		case Op_Add: case Op_Sub: case Op_Mul: case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor: {
+			jit_set_add(s, b);
+			jit_set_add(s, c);
+			jit_set_add(s, a);
+		} break;
+
+		case Op_Add_Imm: case Op_Neg: case Op_Bit_Not: {
+			jit_set_add(s, b);
+			jit_set_add(s, a);
+		} break;
+
+		case Op_Eq: case Op_Lt: case Op_Lte: {
+			jit_set_add(s, b);
+			jit_set_add(s, c);
+			jit_set_remove(s, a);
+		} break;
+
+		case Op_Jump: {
+			succ[0] = jit_jump_target(fn, pc);
+		} break;
+
+		case Op_Jump_If: case Op_Jump_If_Not: {
+			succ[1] = jit_jump_target(fn, pc);
+		} break;
+
+		case Op_Eq_Branch: case Op_Lt_Branch: case Op_Lte_Branch: case Op_For_Loop: {
+			jit_set_add(s, a);
+			jit_set_add(s, b);
+			succ[0] = pc + 2;
+			succ[1] = jit_jump_target(fn, pc + 1);
+		} return 2;
+
+		default: {
+			succ[0] = -1;
+		} break;
+	}
+	return 1;
+}
+
+// Registers known to hold inline ints at each instruction, on every path of
+// compiled code to it. The interpreter enters at the start, at jump targets
+// and after calls (`entry`): those know nothing unless compiled code reaches
+// them too, then their entry stubs check what is known. Returns success status.
+static
+bool jit_known_ints(Vm_Function const* fn, bool const* entry, Jit_Int_Set* known, Mem_Allocator allocator){
+	isize n = fn->code_len;
+	isize* work = New(isize, n, allocator);
+	bool* reached = New(bool, n, allocator);
+	bool* queued = New(bool, n, allocator);
+	bool ok = work != NULL && reached != NULL && queued != NULL;
+
+	for(isize pc = 0; pc < n && ok; pc += 1){
+		known[pc] = (Jit_Int_Set){0};
+		reached[pc] = false;
+		queued[pc] = false;
+	}
+
+	// Start from the start and call returns, then from the entries that were
+	// not reached, e.g. loops after an instruction that always exits
+	for(isize round = 0; round < 2 && ok; round += 1){
+		isize top = 0;
+		for(isize pc = 0; pc < n; pc += 1){
+			bool root = round == 0 ? pc == 0 || (entry[pc] && vm_op(fn->code[pc - 1]) == Op_Call) : entry[pc];
+			if(root && !reached[pc]){
+				reached[pc] = true;
+				queued[pc] = true;
+				work[top++] = pc;
+			}
+		}
+
+		while(top > 0){
+			isize pc = work[--top];
+			queued[pc] = false;
+			Jit_Int_Set after = known[pc];
+			isize succ[2];
+			jit_known_step(fn, pc, &after, succ);
+
+			for(isize i = 0; i < 2; i += 1){
+				isize to = succ[i];
+				if(to < 0 || to >= n){ continue; }
+				bool changed = !reached[to];
+				if(changed){
+					reached[to] = true;
+					known[to] = after;
+				} else {
+					for(isize w = 0; w < 4; w += 1){
+						u64 bits = known[to].bits[w] & after.bits[w];
+						changed = changed || bits != known[to].bits[w];
+						known[to].bits[w] = bits;
+					}
+				}
+				if(changed && !queued[to]){
+					queued[to] = true;
+					work[top++] = to;
+				}
+			}
+		}
+	}
+
+	mem_free(allocator, work);
+	mem_free(allocator, reached);
+	mem_free(allocator, queued);
+	return ok;
+}
+
+Vm_Jit_Entry jit_compile(Vm* vm, isize fn_index){
+	Jit* jit = vm->jit;
+	Vm_Function const* fn = &vm->program->functions[fn_index];
+	isize n = fn->code_len;
+	if(n == 0 || fn_index >= jit->len || vm->verified != Vm_Ok){ return NULL; }
+
+	Jit_Emitter e = { .ok = true, .allocator = vm->allocator };
+	isize* labels = New(isize, n + 1, vm->allocator);
+	isize* exits = New(isize, n + 1, vm->allocator);
+	isize* stubs = New(isize, n + 1, vm->allocator);
+	bool* entries = New(bool, n + 1, vm->allocator);
+	Jit_Int_Set* known = New(Jit_Int_Set, n + 1, vm->allocator);
+	if(labels == NULL || exits == NULL || stubs == NULL || entries == NULL || known == NULL){ e.ok = false; }
+	for(isize i = 0; i <= n && e.ok; i += 1){
+		exits[i] = -1;
+		stubs[i] = -1;
+		entries[i] = i == 0;
+	}
+
+	// Where the interpreter enters (see vm_call): the start, loops on their
+	// back edges and the returns of calls
+	for(isize pc = 0; pc < n && e.ok; pc += 1){
+		Opcode op = vm_op(fn->code[pc]);
+		if(op == Op_Jump || op == Op_Jump_If || op == Op_Jump_If_Not){ entries[jit_jump_target(fn, pc)] = true; }
+		else if(op == Op_Call){ entries[pc + 1] = true; }
+	}
+	if(e.ok && !jit_known_ints(fn, entries, known, vm->allocator)){ e.ok = false; }
+	if(e.ok){ known[n] = (Jit_Int_Set){0}; }
+
+	// Prologue: rdi = base, rsi = pc. Load the tag constants, then jump through
+	// the table of instruction addresses.
+	jit_load_imm(&e, JIT_INT_TAG, VALUE_INT_BITS);
+	jit_load_imm(&e, JIT_BOOL_TAG, VALUE_FALSE_BITS);
+	jit_load_imm(&e, JIT_INT_LIMIT, (u64)1 << VALUE_TAG_SHIFT);
+	jit_load_imm(&e, JIT_NIL, VALUE_NIL_BITS);
+	isize table_lea = e.len;
+	static const byte prologue[] = {
+		0x48, 0x8d, 0x05, 0, 0, 0, 0, // lea rax, [rip + table]
+		0xff, 0x24, 0xf0,             // jmp [rax + rsi*8]
+	};
+	jit_bytes(&e, prologue, sizeof(prologue));
+
+	for(isize pc = 0; pc < n && e.ok;){
+		labels[pc] = e.len;
+		e.known = &known[pc];
+		isize used = jit_emit_instruction(&e, fn, pc);
+		// The jump carrying a branch offset is never a resume point of its own
+		for(isize i = 1; i < used; i += 1){ labels[pc + i] = -1; }
+		pc += used;
+	}
+	// Falling off the end of the code
+	if(e.ok){
+		labels[n] = e.len;
+		jit_exit(&e, n);
+	}
+
+	// Entry stubs check the ints the code they enter takes as known
+	for(isize pc = 0; pc < n && e.ok; pc += 1){
+		if(!entries[pc] || labels[pc] < 0 || jit_set_empty(&known[pc])){ continue; }
+		stubs[pc] = e.len;
+		for(isize r = 0; r < 256; r += 1){
+			if(jit_set_has(&known[pc], (u8)r)){ jit_load_checked_int(&e, JIT_RAX, (u8)r, pc); }
+		}
+		jit_jmp(&e, pc, false);
+	}
+
+	// Exit stubs, only for the instructions something leaves the compiled code at
+	for(isize i = 0; i < e.fixup_count && e.ok; i += 1){
+		Jit_Fixup* fx = &e.fixups[i];
+		if(fx->pc < 0 || fx->pc > n){ fx->pc = n; }
+		if(labels[fx->pc] < 0){ fx->to_exit = true; }
+		if(fx->to_exit && exits[fx->pc] < 0){
+			exits[fx->pc] = e.len;
+			jit_exit(&e, fx->pc);
+		}
+	}
+	for(isize pc = 0; pc <= n && e.ok; pc += 1){
+		if((labels[pc] < 0 || !entries[pc]) && exits[pc] < 0){
+			exits[pc] = e.len;
+			jit_exit(&e, pc);
+		}
+	}
+
+	// Patch jumps
+	for(isize i = 0; i < e.fixup_count && e.ok; i += 1){
+		Jit_Fixup const* fx = &e.fixups[i];
+		isize dest = fx->to_exit ? exits[fx->pc] : labels[fx->pc];
+		i32 rel = (i32)(dest - (fx->at + 4));
+		mem_copy(&e.code[fx->at], &rel, 4);
+	}
+
+	// Align the table and point the prologue's lea at it
+	while(e.ok && e.len % 8 != 0){ jit_u8(&e, 0xcc); }
+	isize table = e.len;
+	for(isize pc = 0; pc <= n && e.ok; pc += 1){ jit_u64(&e, 0); }
+
+	Vm_Jit_Entry entry = NULL;
+	if(e.ok){
+		i32 rel = (i32)(table - (table_lea + 7));
+		mem_copy(&e.code[table_lea + 3], &rel, 4);
+
+		isize page = sysconf(_SC_PAGESIZE);
+		isize size = (e.len + page - 1) / page * page;
+		byte* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(memory != MAP_FAILED){
+			mem_copy(memory, e.code, e.len);
+			u64* slots = (u64*)&memory[table];
+			for(isize pc = 0; pc <= n; pc += 1){
+				isize at = stubs[pc] >= 0 ? stubs[pc] : (entries[pc] && labels[pc] >= 0 ? labels[pc] : exits[pc]);
+				slots[pc] = (u64)(uintptr_t)&memory[at];
+			}
+
+			// Never writable and executable at the same time
+			if(mprotect(memory, size, PROT_READ | PROT_EXEC) == 0){
+				jit->codes[fn_index] = (Jit_Code){ .memory = memory, .size = size };
+				entry = (Vm_Jit_Entry)(uintptr_t)memory;
+			} else {
+				munmap(memory, size);
+			}
+		}
+	}
+
+	if(entry != NULL){ jit->compiled += 1; }
+	else { jit->failed += 1; }
+
+	mem_free(vm->allocator, labels);
+	mem_free(vm->allocator, exits);
+	mem_free(vm->allocator, stubs);
+	mem_free(vm->allocator, entries);
+	mem_free(vm->allocator, known);
+	mem_free(vm->allocator, e.code);
+	mem_free(vm->allocator, e.fixups);
+	return entry;
+}
+
+#undef JIT_VALUE_SIZE
+
+#else
+
+Vm_Jit_Entry jit_compile(Vm* vm, isize fn){
+	(void)vm; (void)fn;
+	return NULL;
+}
+
+#endif
+
+#undef JIT_X64
+#endif
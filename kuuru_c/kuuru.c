@@ -1,4 +1,25 @@
+#define _DEFAULT_SOURCE 1
 #define KUURU_IMPLEMENTATION 1
 #include "lexer.h"
+#include "number.h"
+#include "unicode_xid.h"
 #include "parser.h"
-#include "type_checker.h"
\ No newline at end of file
+#include "type_checker.h"
+#include "hash.h"
+#include "cache.h"
+#include "value.h"
+#include "gc.h"
+#include "vm.h"
+#include "optimizer.h"
+#include "formatter.h"
+#include "line_table.h"
+#include "source_manager.h"
+#include "text_buffer.h"
+#include "build_graph.h"
+#include "file_batch.h"
+#include "perf_counters.h"
+#include "server.h"
+#include "symbol_table.h"
+#include "ir.h"
+#include "codegen_c.h"
+#include "jit.h"
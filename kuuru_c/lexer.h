@@ -1,6 +1,8 @@
 #pragma once
 
 #include "base.h"
+#include "source_manager.h"
+#include "unicode_xid.h"
 
 ///- Interface -----------------------------------------------------------------
 typedef enum TokenKind TokenKind;
@@ -45,7 +47,7 @@ typedef struct Lexer Lexer;
 	X(Gt, ">") \
 	X(Gte, ">=") \
 	X(Lt, "<") \
-	X(Lte, ">=") \
+	X(Lte, "<=") \
 	X(Eq_Eq, "==") \
 	X(Not_Eq, "!=") \
 	X(Logic_And, "&&") \
@@ -76,19 +78,28 @@ enum TokenKind {
 	// _tk_enum_length,
 };
 
+// Text of a token is found through its location, see lexer_text and
+// source_manager_text
 struct Token {
 	TokenKind kind;
-	String lexeme;
-	isize source_offset;
+	u32 len;
+	Source_Loc loc;
 };
 
 struct Lexer {
 	String source;
 	UTF8_Iterator iter;
+	Source_Loc base; // Location of the first byte of source
 };
 
-// Create and initialize a lexer from a source
+// Create and initialize a lexer from a source, token locations are byte
+// offsets into it. Sources must be smaller than 4 GiB.
 Lexer lexer_make(String source);
+// Create a lexer whose token locations start at base, for a source added to a
+// Source_Manager
+Lexer lexer_make_at(String source, Source_Loc base);
+// Text of a token produced by lex
+String lexer_text(Lexer const* lex, Token tk);
 // Is lexer finished reading its source?
 bool lexer_done(Lexer const* lex);
 // Get next token. Returns an End_Of_File token when finished.
@@ -97,6 +108,8 @@ Token lexer_next(Lexer* lex);
 ///- Implementation ------------------------------------------------------------
 #ifdef KUURU_IMPLEMENTATION
 
+#include <pthread.h>
+
 static const struct{ cstring key; TokenKind val; } str_to_keyword[] = {
 	#define X(Name, Str) {Str, Tk_##Name},
 	KUURU_KEYWORD_TABLE
@@ -109,7 +122,56 @@ static const cstring operator_to_str[] = {
 	#undef X
 };
 
+// Operator recognizer tables, generated from KUURU_OPERATOR_TABLE by
+// lexer_operator_tables_init() the first time a lexer is made, once even when
+// lexers are first made on several threads. Operators are at most 2 bytes of
+// ASCII.
+#define LEXER_OPERATOR_ROWS 32
+
+_Static_assert(Tk_EOF < 256, "Token kinds must fit in a byte");
+
+static struct {
+	u8 single[128];                    // Kind of 1 byte operator
+	u8 row[128];                       // Row of `pair` for operators starting with byte, 0 if none
+	u8 pair[LEXER_OPERATOR_ROWS][128]; // Kind of 2 byte operator
+} lexer_operators;
+
+static pthread_once_t lexer_operators_once = PTHREAD_ONCE_INIT;
+
+static
+void lexer_operator_tables_init(void){
+	static const struct { cstring str; TokenKind kind; } operators[] = {
+		#define X(Name, Str) {Str, Tk_##Name},
+		KUURU_OPERATOR_TABLE
+		#undef X
+	};
+
+	isize rows = 1;
+	for(isize i = 0; i < (isize)(sizeof(operators) / sizeof(operators[0])); i += 1){
+		byte const* op = (byte const*)operators[i].str;
+		isize len = cstring_len(operators[i].str);
+		panic_assert(len >= 1 && len <= 2 && op[0] < 128 && op[len - 1] < 128, "Operators must be 1 or 2 ASCII bytes");
+
+		if(len == 1){
+			lexer_operators.single[op[0]] = operators[i].kind;
+			continue;
+		}
+		if(lexer_operators.row[op[0]] == 0){
+			panic_assert(rows < LEXER_OPERATOR_ROWS, "Too many operator prefixes");
+			lexer_operators.row[op[0]] = rows;
+			rows += 1;
+		}
+		lexer_operators.pair[lexer_operators.row[op[0]]][op[1]] = operators[i].kind;
+	}
+}
+
 Lexer lexer_make(String source){
+	return lexer_make_at(source, 0);
+}
+
+Lexer lexer_make_at(String source, Source_Loc base){
+	pthread_once(&lexer_operators_once, lexer_operator_tables_init);
+
 	UTF8_Iterator iterator = {
 		.current = 0,
 		.data = source.data,
@@ -118,114 +180,150 @@ Lexer lexer_make(String source){
 	return (Lexer){
 		.source = source,
 		.iter = iterator,
+		.base = base,
 	};
 }
 
+String lexer_text(Lexer const* lex, Token tk){
+	return str_from_bytes(&lex->source.data[tk.loc - lex->base], tk.len);
+}
+
 bool lexer_done(Lexer const* lex){
 	return lex->iter.current >= lex->iter.data_length;
 }
 
-static
-UTF8_Decode_Result lexer_advance(Lexer* lex){
-	UTF8_Decode_Result res = { 0, 0 };
-	Codepoint c; i8 len;
-	bool ok = utf8_iter_next(&lex->iter, &c, &len);
-
-	if(ok){
-		res.codepoint = c;
-		res.len = len;
-	}
-	return res;
+static inline
+bool lexer_is_ident_start(byte c){
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
-static
-UTF8_Decode_Result lexer_peek(Lexer* lex){
-	UTF8_Decode_Result res = lexer_advance(lex);
-	lex->iter.current -= res.len;
-	return res;
+static inline
+bool lexer_is_ident_continue(byte c){
+	return lexer_is_ident_start(c) || (c >= '0' && c <= '9');
 }
 
-static
-bool lexer_advance_on_match(Lexer* lex, Codepoint expect){
-	UTF8_Decode_Result res = lexer_peek(lex);
-	if(res.codepoint == expect){
-		lex->iter.current += res.len;
-		return true;
-	}
-	return false;
+// Length of the non ASCII identifier character at data[i], 0 if there is none
+static inline
+isize lexer_unicode_ident_len(byte const* data, isize i, isize len, bool start){
+	UTF8_Decode_Result res = utf8_decode(&data[i], len - i);
+	if(res.len <= 0){ return 0; }
+	bool ok = start ? unicode_is_xid_start(res.codepoint) : unicode_is_xid_continue(res.codepoint);
+	return ok ? res.len : 0;
 }
 
-#define TOKEN1(T_) \
-    { tk.kind = T_; } break
-
-#define TOKEN2(R_, T_, ALT_) \
-    if(lexer_advance_on_match(lexer, R_)){ \
-        tk.kind = T_; \
-    } else { \
-        tk.kind = ALT_; \
-    } break
-
-#define TOKEN3(R0_, T0_, R1_, T1_, ALT_) \
-    if(lexer_advance_on_match(lexer, R0_)){ \
-        tk.kind = T0_; \
-    } else if(lexer_advance_on_match(lexer, R1_)){ \
-        tk.kind = T1_; \
-    } else { \
-        tk.kind = ALT_; \
-    } break
+// Size of the identifier at data[i], whose first `size` bytes are known
+static inline
+isize lexer_ident_size(byte const* data, isize i, isize size, isize len){
+	for(;;){
+		while(i + size < len && lexer_is_ident_continue(data[i + size])){
+			size += 1;
+		}
+		if(i + size >= len || data[i + size] < 128){ return size; }
+		isize n = lexer_unicode_ident_len(data, i + size, len, false);
+		if(n == 0){ return size; }
+		size += n;
+	}
+}
 
+// Keyword kind of a word, or Tk_Identifier
+static
+TokenKind lexer_keyword_kind(String word){
+	for(isize i = 0; i < (isize)(sizeof(str_to_keyword) / sizeof(str_to_keyword[0])); i += 1){
+		cstring key = str_to_keyword[i].key;
+		if(key[0] == word.data[0] && str_eq(str_from(key), word)){
+			return str_to_keyword[i].val;
+		}
+	}
+	return Tk_Identifier;
+}
 
 Token lexer_next(Lexer* lexer){
 	Token tk = {0};
-	tk.source_offset = lexer->iter.current;
+	byte const* data = lexer->source.data;
+	isize len = lexer->source.len;
+	isize i = lexer->iter.current;
+
+	/* Ignore whitespace */
+	/* TODO: Auto EOS insertion on '\n' */
+	while(i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n')){
+		i += 1;
+	}
 
-	UTF8_Decode_Result res = lexer_advance(lexer);
-	if(res.codepoint == 0){
+	tk.loc = lexer->base + (Source_Loc)i;
+	if(i >= len || data[i] == 0){
+		lexer->iter.current = i;
 		tk.kind = Tk_EOF;
 		return tk;
 	}
 
-	switch(res.codepoint){
-		case '(': TOKEN1(Tk_Paren_Open);
-		case ')': TOKEN1(Tk_Paren_Close);
-		case '[': TOKEN1(Tk_Square_Open);
-		case ']': TOKEN1(Tk_Square_Close);
-		case '{': TOKEN1(Tk_Curly_Open);
-		case '}': TOKEN1(Tk_Curly_Close);
-
-		case '.': TOKEN1(Tk_Dot);
-		case ',': TOKEN1(Tk_Comma);
-		case ':': TOKEN1(Tk_Colon);
-		case ';': TOKEN1(Tk_Semicolon);
-		case '^': TOKEN1(Tk_Caret);
-
-		case '!': TOKEN2('=', Tk_Not_Eq, Tk_Logic_Not);
-
-        case '=': TOKEN2('=', Tk_Eq_Eq, Tk_Equal);
-        case '>': TOKEN2('=', Tk_Gte, Tk_Gt);
-        case '<': TOKEN2('=', Tk_Lte, Tk_Lt);
-
-        case '+': TOKEN2('=', Tk_Plus_Assign, Tk_Plus);
-        case '-': TOKEN2('=', Tk_Minus_Assign, Tk_Minus);
-        case '*': TOKEN2('=', Tk_Star_Assign, Tk_Star);
-        case '/': TOKEN2('=', Tk_Slash_Assign, Tk_Slash);
-        case '%': TOKEN2('=', Tk_Modulo_Assign, Tk_Modulo);
-         
-        case '&': TOKEN3('&', Tk_Logic_And, '=', Tk_And_Assign, Tk_And);
-        case '|': TOKEN3('|', Tk_Logic_Or, '=', Tk_Or_Assign, Tk_Or);
-        case '~': TOKEN2('=', Tk_Xor_Assign, Tk_Xor);
-
-		case '\t': case ' ': case '\r': break; /* Ignore whitespace */
-
-		case '\n': /* TODO: Auto EOS insertion */ break;
-		default: {} break;
+	byte c0 = data[i];
+	isize size = 1;
+
+	if(lexer_is_ident_start(c0)){
+		size = lexer_ident_size(data, i, 1, len);
+		tk.kind = lexer_keyword_kind(str_from_bytes(&data[i], size));
+	}
+	else if(c0 >= '0' && c0 <= '9'){
+		// Only the extent of the literal is found here, its digits are
+		// checked when its value is parsed (see number.h)
+		tk.kind = Tk_Int;
+		byte c1 = (i + 1 < len) ? (data[i + 1] | 0x20) : 0;
+		if(c0 == '0' && (c1 == 'x' || c1 == 'b' || c1 == 'o')){
+			size = 2;
+		}
+		else {
+			while(i + size < len && ((data[i + size] >= '0' && data[i + size] <= '9') || data[i + size] == '_')){
+				size += 1;
+			}
+			if(i + size + 1 < len && data[i + size] == '.' && data[i + size + 1] >= '0' && data[i + size + 1] <= '9'){
+				tk.kind = Tk_Real;
+				size += 1;
+				while(i + size < len && ((data[i + size] >= '0' && data[i + size] <= '9') || data[i + size] == '_')){
+					size += 1;
+				}
+			}
+			if(i + size < len && (data[i + size] | 0x20) == 'e'){
+				isize e = size + 1;
+				if(i + e < len && (data[i + e] == '+' || data[i + e] == '-')){ e += 1; }
+				if(i + e < len && data[i + e] >= '0' && data[i + e] <= '9'){
+					tk.kind = Tk_Real;
+					size = e;
+				}
+			}
+		}
+		// Stray letters stay part of the literal, so "12ab" is one bad
+		// number rather than a number and an identifier
+		size = lexer_ident_size(data, i, size, len);
+	}
+	else if(c0 < 128){
+		// Maximal munch: a 2 byte operator wins over its 1 byte prefix
+		u8 row = lexer_operators.row[c0];
+		byte c1 = (i + 1 < len) ? data[i + 1] : 0;
+		u8 pair = (row != 0 && c1 < 128) ? lexer_operators.pair[row][c1] : 0;
+		if(pair != 0){
+			tk.kind = pair;
+			size = 2;
+		} else {
+			tk.kind = lexer_operators.single[c0];
+		}
+	}
+	else {
+		size = lexer_unicode_ident_len(data, i, len, true);
+		if(size > 0){
+			// Keywords are all ASCII
+			size = lexer_ident_size(data, i, size, len);
+			tk.kind = Tk_Identifier;
+		} else {
+			UTF8_Decode_Result res = utf8_decode(&data[i], len - i);
+			size = res.len > 0 ? res.len : 1;
+		}
 	}
 
+	lexer->iter.current = i + size;
+	tk.len = (u32)size;
 	return tk;
 }
 
-#undef TOKEN1
-#undef TOKEN2
-#undef TOKEN3
+#undef LEXER_OPERATOR_ROWS
 #endif
 
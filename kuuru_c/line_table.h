@@ -0,0 +1,135 @@
+#pragma once
+
+#include "base.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Line_Table Line_Table;
+typedef struct Source_Position Source_Position;
+
+// Start offsets of every line of a source, built on first use
+struct Line_Table {
+	String source;
+	isize* line_starts;
+	isize line_count;
+	bool built;
+	Mem_Allocator allocator;
+};
+
+// 1-based line and column, columns are counted in codepoints
+struct Source_Position {
+	isize line;
+	isize column;
+};
+
+// Initialize table for source, this does not scan the source yet
+void line_table_init(Line_Table* t, String source, Mem_Allocator allocator);
+
+// Destroy table
+void line_table_destroy(Line_Table* t);
+
+// Build the line index now, returns success status. Called implicitly by line_table_position.
+bool line_table_build(Line_Table* t);
+
+// Map a byte offset into source to line and column, offsets are clamped to
+// the source. Returns {0, 0} if the table could not be built.
+Source_Position line_table_position(Line_Table* t, isize offset);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Count '\n' bytes in data
+static
+isize line_count_newlines(byte const* data, isize len){
+	isize count = 0;
+	isize i = 0;
+	#if defined(__SSE2__)
+	__m128i const nl = _mm_set1_epi8('\n');
+	for(; i + 16 <= len; i += 16){
+		__m128i chunk = _mm_loadu_si128((__m128i const*)&data[i]);
+		u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+		count += __builtin_popcount(mask);
+	}
+	#endif
+	for(; i < len; i += 1){
+		count += data[i] == '\n';
+	}
+	return count;
+}
+
+// Write the offset after every '\n' of data into starts
+static
+void line_collect_starts(byte const* data, isize len, isize* starts){
+	isize n = 0;
+	isize i = 0;
+	#if defined(__SSE2__)
+	__m128i const nl = _mm_set1_epi8('\n');
+	for(; i + 16 <= len; i += 16){
+		__m128i chunk = _mm_loadu_si128((__m128i const*)&data[i]);
+		u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+		while(mask != 0){
+			starts[n++] = i + __builtin_ctz(mask) + 1;
+			mask &= mask - 1;
+		}
+	}
+	#endif
+	for(; i < len; i += 1){
+		if(data[i] == '\n'){ starts[n++] = i + 1; }
+	}
+}
+
+void line_table_init(Line_Table* t, String source, Mem_Allocator allocator){
+	*t = (Line_Table){
+		.source = source,
+		.allocator = allocator,
+	};
+}
+
+void line_table_destroy(Line_Table* t){
+	mem_free(t->allocator, t->line_starts);
+	*t = (Line_Table){0};
+}
+
+bool line_table_build(Line_Table* t){
+	if(t->built){ return true; }
+
+	isize newlines = line_count_newlines(t->source.data, t->source.len);
+	isize* starts = New(isize, newlines + 1, t->allocator);
+	if(starts == NULL){ return false; }
+
+	starts[0] = 0;
+	line_collect_starts(t->source.data, t->source.len, &starts[1]);
+
+	t->line_starts = starts;
+	t->line_count = newlines + 1;
+	t->built = true;
+	return true;
+}
+
+Source_Position line_table_position(Line_Table* t, isize offset){
+	if(!line_table_build(t)){ return (Source_Position){0}; }
+	offset = Clamp(0, offset, t->source.len);
+
+	// Last line starting at or before offset
+	isize lo = 0, hi = t->line_count;
+	while(hi - lo > 1){
+		isize mid = lo + (hi - lo) / 2;
+		if(t->line_starts[mid] <= offset){ lo = mid; }
+		else { hi = mid; }
+	}
+
+	isize column = 1;
+	byte const* data = t->source.data;
+	for(isize i = t->line_starts[lo]; i < offset;){
+		UTF8_Decode_Result res = utf8_decode(&data[i], offset - i);
+		i += res.len > 0 ? res.len : 1;
+		column += 1;
+	}
+
+	return (Source_Position){ .line = lo + 1, .column = column };
+}
+
+#endif
@@ -0,0 +1,619 @@
+#pragma once
+
+#include "base.h"
+#include "vm.h"
+
+///- Interface -----------------------------------------------------------------
+
+// Fold constant arithmetic, logic and comparisons in function `fn`, propagate
+// registers holding constants, apply algebraic identities on integers and
+// remove branches whose condition is constant along with the code they make
+// unreachable. Instructions are rewritten in place and the function is
+// compacted, the constant pool only grows within its current capacity.
+// `temp` is used for scratch memory. Returns number of instructions removed,
+// or -1 on failure (the function is left unchanged).
+isize vm_fold_constants(Vm_Program* p, isize fn, Mem_Allocator temp);
+
+typedef struct Vm_Dce_Stats Vm_Dce_Stats;
+
+// What vm_eliminate_dead_functions removed
+struct Vm_Dce_Stats {
+	isize functions;
+	isize instructions; // Code of the removed functions
+	isize constants;    // Constant pool entries of the removed functions
+	isize boxes;        // Boxed ints no remaining constant refers to
+	isize fields;       // Field names no remaining instruction refers to
+};
+
+// Remove every function not reachable through calls from one of the
+// `entry_count` functions at `entries`, along with the boxed ints and field
+// names only they used. Remaining functions keep their order, calls and
+// `entries` are renumbered in place. Must run before a Vm is made for the
+// program. `stats` may be NULL. Returns number of functions removed, or -1 on
+// failure (the program is left unchanged).
+isize vm_eliminate_dead_functions(Vm_Program* p, isize* entries, isize entry_count, Vm_Dce_Stats* stats, Mem_Allocator temp);
+
+// Write what dead function elimination removed
+void vm_dce_stats_print(Vm_Dce_Stats const* st, IO_Writer out);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <stdlib.h>
+
+typedef enum {
+	Fold_Unknown = 0,
+	Fold_Int_Kind, // Value unknown, but known to be an Int
+	Fold_Constant,
+} Fold_Knowledge;
+
+typedef struct {
+	Fold_Knowledge knowledge;
+	Value value;
+} Fold_Register;
+
+static inline
+bool fold_is_jump(Opcode op){
+	return op == Op_Jump || op == Op_Jump_If || op == Op_Jump_If_Not;
+}
+
+static inline
+bool fold_is_branch(Opcode op){
+	return op == Op_Eq_Branch || op == Op_Lt_Branch || op == Op_Lte_Branch || op == Op_For_Loop;
+}
+
+#define FOLD_WRAP(a_, OP_, b_) ((i64)((u64)(a_) OP_ (u64)(b_)))
+
+// Int results that do not fit inline would need a box, those are not folded
+static inline
+bool fold_int(i64 i, Value* out){
+	if(!value_int_fits(i)){ return false; }
+	*out = value_small_int(i);
+	return true;
+}
+
+// Evaluate with the same semantics as the VM, returns false when the
+// instruction would fail at runtime (so it must not be folded)
+static
+bool fold_eval_binary(Opcode op, Value lhs, Value rhs, Value* out){
+	bool ints = value_kind(lhs) == Val_Int && value_kind(rhs) == Val_Int;
+	bool reals = value_is_real(lhs) && value_is_real(rhs);
+	i64 x = ints ? value_as_int(lhs) : 0, y = ints ? value_as_int(rhs) : 0;
+	f64 fx = value_as_real(lhs), fy = value_as_real(rhs);
+
+	switch(op){
+		case Op_Add: case Op_Sub: case Op_Mul: case Op_Div: {
+			if(ints){
+				if(op == Op_Add){ return fold_int(FOLD_WRAP(x, +, y), out); }
+				if(op == Op_Sub){ return fold_int(FOLD_WRAP(x, -, y), out); }
+				if(op == Op_Mul){ return fold_int(FOLD_WRAP(x, *, y), out); }
+				if(y == 0){ return false; }
+				return fold_int((y == -1) ? FOLD_WRAP(0, -, x) : x / y, out);
+			}
+			if(reals){
+				if(op == Op_Add){ *out = value_real(fx + fy); }
+				if(op == Op_Sub){ *out = value_real(fx - fy); }
+				if(op == Op_Mul){ *out = value_real(fx * fy); }
+				if(op == Op_Div){ *out = value_real(fx / fy); }
+				return true;
+			}
+			return false;
+		}
+
+		case Op_Mod: {
+			if(!ints || y == 0){ return false; }
+			return fold_int((y == -1) ? 0 : x % y, out);
+		}
+
+		case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor: {
+			if(!ints){ return false; }
+			if(op == Op_Bit_And){ return fold_int(x & y, out); }
+			if(op == Op_Bit_Or){ return fold_int(x | y, out); }
+			return fold_int(x ^ y, out);
+		}
+
+		case Op_Eq: {
+			*out = value_bool(value_eq(lhs, rhs));
+			return true;
+		}
+
+		case Op_Lt: case Op_Lte: {
+			bool lt = op == Op_Lt;
+			if(ints){
+				*out = value_bool(lt ? x < y : x <= y);
+				return true;
+			}
+			if(reals){
+				*out = value_bool(lt ? fx < fy : fx <= fy);
+				return true;
+			}
+			return false;
+		}
+
+		default: return false;
+	}
+}
+
+static
+bool fold_eval_unary(Opcode op, Value v, Value* out){
+	switch(op){
+		case Op_Neg: {
+			if(value_kind(v) == Val_Int){ return fold_int(FOLD_WRAP(0, -, value_as_int(v)), out); }
+			if(value_is_real(v)){ *out = value_real(-value_as_real(v)); return true; }
+			return false;
+		}
+		case Op_Bit_Not: {
+			if(value_kind(v) != Val_Int){ return false; }
+			return fold_int(~value_as_int(v), out);
+		}
+		case Op_Not: {
+			*out = value_bool(!value_truthy(v));
+			return true;
+		}
+		default: return false;
+	}
+}
+
+// Build an instruction loading v into register a, returns false if it cannot
+// be done without growing the constant pool
+static
+bool fold_load_instruction(Vm_Function* f, u8 a, Value v, Instruction* out){
+	switch(value_kind(v)){
+		case Val_Nil: {
+			*out = vm_encode_abc(Op_Load_Nil, a, 0, 0);
+			return true;
+		}
+		case Val_Bool: {
+			*out = vm_encode_abc(Op_Load_Bool, a, value_as_bool(v), 0);
+			return true;
+		}
+		case Val_Int: {
+			i64 i = value_as_int(v);
+			if(i >= INT16_MIN && i <= INT16_MAX){
+				*out = vm_encode_asbx(Op_Load_Int, a, (i16)i);
+				return true;
+			}
+		} break;
+		case Val_Real: case Val_Object: break;
+	}
+
+	for(isize i = 0; i < f->constants_len; i += 1){
+		Value k = f->constants[i];
+		// Compare bits, so -0.0 and 0.0 (or NaNs) are never merged
+		if(k.bits == v.bits){
+			*out = vm_encode_abx(Op_Load_Const, a, (u16)i);
+			return true;
+		}
+	}
+	if(f->constants_len < f->constants_cap && f->constants_len <= UINT16_MAX){
+		f->constants[f->constants_len] = v;
+		*out = vm_encode_abx(Op_Load_Const, a, (u16)f->constants_len);
+		f->constants_len += 1;
+		return true;
+	}
+	return false;
+}
+
+isize vm_fold_constants(Vm_Program* p, isize fn, Mem_Allocator temp){
+	Vm_Function* f = &p->functions[fn];
+	isize len = f->code_len;
+	if(len == 0){ return 0; }
+
+	// Scratch: block leaders, reachability and the old -> new position map
+	bool* leader = New(bool, len + 1, temp);
+	bool* reachable = New(bool, len + 1, temp);
+	isize* worklist = New(isize, len + 1, temp);
+	isize* new_pos = New(isize, len + 1, temp);
+	if(leader == NULL || reachable == NULL || worklist == NULL || new_pos == NULL){
+		mem_free(temp, leader);
+		mem_free(temp, reachable);
+		mem_free(temp, worklist);
+		mem_free(temp, new_pos);
+		return -1;
+	}
+
+	Instruction* code = f->code;
+
+	leader[0] = true;
+	for(isize i = 0; i < len; i += 1){
+		Opcode op = vm_op(code[i]);
+		if(fold_is_jump(op)){
+			isize target = i + 1 + vm_sbx(code[i]);
+			if(target >= 0 && target <= len){ leader[target] = true; }
+			leader[i + 1] = true;
+		}
+		else if(op == Op_Return){
+			leader[i + 1] = true;
+		}
+	}
+
+	Fold_Register regs[256];
+	mem_set(regs, 0, sizeof(regs));
+
+	for(isize i = 0; i < len; i += 1){
+		if(leader[i]){ mem_set(regs, 0, sizeof(regs)); }
+
+		Instruction ins = code[i];
+		Opcode op = vm_op(ins);
+		u8 a = vm_a(ins), b = vm_b(ins), c = vm_c(ins);
+		Fold_Register* dest = &regs[a];
+
+		switch(op){
+			case Op_Load_Const: {
+				*dest = (Fold_Register){ Fold_Constant, f->constants[vm_bx(ins)] };
+			} break;
+			case Op_Load_Nil: {
+				*dest = (Fold_Register){ Fold_Constant, value_nil() };
+			} break;
+			case Op_Load_Bool: {
+				*dest = (Fold_Register){ Fold_Constant, value_bool(b != 0) };
+			} break;
+			case Op_Load_Int: {
+				*dest = (Fold_Register){ Fold_Constant, value_small_int(vm_sbx(ins)) };
+			} break;
+
+			case Op_Move: {
+				Fold_Register src = regs[b];
+				Instruction load;
+				if(src.knowledge == Fold_Constant && fold_load_instruction(f, a, src.value, &load)){
+					code[i] = load;
+				}
+				*dest = src;
+			} break;
+
+			case Op_Add: case Op_Sub: case Op_Mul: case Op_Div: case Op_Mod:
+			case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor:
+			case Op_Eq: case Op_Lt: case Op_Lte: {
+				Fold_Register lhs = regs[b], rhs = regs[c];
+				Value result;
+				if(lhs.knowledge == Fold_Constant && rhs.knowledge == Fold_Constant && fold_eval_binary(op, lhs.value, rhs.value, &result)){
+					Instruction load;
+					if(fold_load_instruction(f, a, result, &load)){ code[i] = load; }
+					*dest = (Fold_Register){ Fold_Constant, result };
+					break;
+				}
+
+				bool lhs_int = lhs.knowledge != Fold_Unknown && (lhs.knowledge == Fold_Int_Kind || value_kind(lhs.value) == Val_Int);
+				bool rhs_int = rhs.knowledge != Fold_Unknown && (rhs.knowledge == Fold_Int_Kind || value_kind(rhs.value) == Val_Int);
+				bool lhs_zero = lhs.knowledge == Fold_Constant && lhs.value.bits == value_small_int(0).bits;
+				bool rhs_zero = rhs.knowledge == Fold_Constant && rhs.value.bits == value_small_int(0).bits;
+				bool lhs_one = lhs.knowledge == Fold_Constant && lhs.value.bits == value_small_int(1).bits;
+				bool rhs_one = rhs.knowledge == Fold_Constant && rhs.value.bits == value_small_int(1).bits;
+				bool rhs_ones = rhs.knowledge == Fold_Constant && rhs.value.bits == value_small_int(-1).bits;
+
+				// Identities are only valid when both sides are ints, otherwise
+				// the VM would raise a type error we must not hide
+				bool both_int = lhs_int && rhs_int;
+				isize keep = -1; // Register the result is a copy of
+				if(both_int){
+					if((op == Op_Add || op == Op_Bit_Or || op == Op_Bit_Xor) && lhs_zero){ keep = c; }
+					else if((op == Op_Add || op == Op_Sub || op == Op_Bit_Or || op == Op_Bit_Xor) && rhs_zero){ keep = b; }
+					else if(op == Op_Mul && lhs_one){ keep = c; }
+					else if((op == Op_Mul || op == Op_Div) && rhs_one){ keep = b; }
+					else if(op == Op_Bit_And && rhs_ones){ keep = b; }
+					else if((op == Op_Mul || op == Op_Bit_And) && (lhs_zero || rhs_zero)){
+						Value zero = value_small_int(0);
+						code[i] = vm_encode_asbx(Op_Load_Int, a, 0);
+						*dest = (Fold_Register){ Fold_Constant, zero };
+						break;
+					}
+				}
+
+				if(keep >= 0){
+					Fold_Register src = regs[keep];
+					code[i] = (keep == a) ? vm_encode_abc(Op_Nop, 0, 0, 0) : vm_encode_abc(Op_Move, a, (u8)keep, 0);
+					*dest = src;
+				}
+				else if(both_int && op != Op_Eq && op != Op_Lt && op != Op_Lte){
+					*dest = (Fold_Register){ .knowledge = Fold_Int_Kind };
+				}
+				else {
+					*dest = (Fold_Register){0};
+				}
+			} break;
+
+			case Op_Neg: case Op_Bit_Not: case Op_Not: {
+				Fold_Register src = regs[b];
+				Value result;
+				if(src.knowledge == Fold_Constant && fold_eval_unary(op, src.value, &result)){
+					Instruction load;
+					if(fold_load_instruction(f, a, result, &load)){ code[i] = load; }
+					*dest = (Fold_Register){ Fold_Constant, result };
+				}
+				else if(op != Op_Not && src.knowledge != Fold_Unknown && (src.knowledge == Fold_Int_Kind || value_kind(src.value) == Val_Int)){
+					*dest = (Fold_Register){ .knowledge = Fold_Int_Kind };
+				}
+				else {
+					*dest = (Fold_Register){0};
+				}
+			} break;
+
+			case Op_Add_Imm: {
+				Fold_Register src = regs[b];
+				Value imm = value_small_int((i8)c);
+				Value result;
+				if(src.knowledge == Fold_Constant && value_kind(src.value) == Val_Int && fold_eval_binary(Op_Add, src.value, imm, &result)){
+					Instruction load;
+					if(fold_load_instruction(f, a, result, &load)){ code[i] = load; }
+					*dest = (Fold_Register){ Fold_Constant, result };
+				}
+				else if(src.knowledge == Fold_Constant && value_is_real(src.value)){
+					result = value_real(value_as_real(src.value) + (f64)(i8)c);
+					Instruction load;
+					if(fold_load_instruction(f, a, result, &load)){ code[i] = load; }
+					*dest = (Fold_Register){ Fold_Constant, result };
+				}
+				else if(src.knowledge == Fold_Int_Kind || (src.knowledge == Fold_Constant && value_kind(src.value) == Val_Int)){
+					*dest = (Fold_Register){ .knowledge = Fold_Int_Kind };
+				}
+				else {
+					*dest = (Fold_Register){0};
+				}
+			} break;
+
+			case Op_Jump_If: case Op_Jump_If_Not: {
+				Fold_Register cond = regs[a];
+				if(cond.knowledge == Fold_Constant){
+					bool taken = value_truthy(cond.value) == (op == Op_Jump_If);
+					code[i] = taken ? vm_encode_asbx(Op_Jump, 0, vm_sbx(ins)) : vm_encode_abc(Op_Nop, 0, 0, 0);
+				}
+			} break;
+
+			case Op_Eq_Branch: case Op_Lt_Branch: case Op_Lte_Branch: {
+				Fold_Register lhs = regs[a], rhs = regs[b];
+				Opcode cmp = op == Op_Eq_Branch ? Op_Eq : (op == Op_Lt_Branch ? Op_Lt : Op_Lte);
+				Value result;
+				if(lhs.knowledge == Fold_Constant && rhs.knowledge == Fold_Constant && fold_eval_binary(cmp, lhs.value, rhs.value, &result)){
+					bool taken = value_as_bool(result) == (c != 0);
+					code[i] = vm_encode_abc(Op_Nop, 0, 0, 0);
+					if(!taken){ code[i + 1] = vm_encode_abc(Op_Nop, 0, 0, 0); }
+				}
+				// The paired jump is handled on the next iteration
+			} break;
+
+			case Op_For_Loop: case Op_New_Record: case Op_Get_Field: {
+				*dest = (Fold_Register){0};
+			} break;
+
+			// Writes a record, not a register
+			case Op_Set_Field: break;
+
+			case Op_Call: {
+				// Callee's frame overlaps the caller's registers from `a` up
+				for(isize r = a; r < 256; r += 1){ regs[r] = (Fold_Register){0}; }
+			} break;
+
+			case Op_Nop: case Op_Jump: case Op_Return: break;
+
+			case Op__Count: break;
+		}
+	}
+
+	// Drop code that can no longer be reached
+	isize top = 0;
+	worklist[top++] = 0;
+	reachable[0] = true;
+	while(top > 0){
+		isize i = worklist[--top];
+		Opcode op = vm_op(code[i]);
+
+		isize next[2] = { -1, -1 };
+		if(op == Op_Return){ /* No successors */ }
+		else if(op == Op_Jump){ next[0] = i + 1 + vm_sbx(code[i]); }
+		else if(op == Op_Jump_If || op == Op_Jump_If_Not){ next[0] = i + 1; next[1] = i + 1 + vm_sbx(code[i]); }
+		else if(fold_is_branch(op)){ next[0] = i + 1; next[1] = i + 2; }
+		else { next[0] = i + 1; }
+
+		for(int s = 0; s < 2; s += 1){
+			isize n = next[s];
+			if(n >= 0 && n < len && !reachable[n]){
+				reachable[n] = true;
+				worklist[top++] = n;
+			}
+		}
+	}
+
+	// Compact, the jump paired with a reachable branch is reachable too so they
+	// are always kept together
+	bool* keep = reachable;
+	isize count = 0;
+	for(isize i = 0; i < len; i += 1){
+		new_pos[i] = count;
+		keep[i] = reachable[i] && vm_op(code[i]) != Op_Nop;
+		count += keep[i];
+	}
+	new_pos[len] = count;
+
+	isize removed = len - count;
+	isize out = 0;
+	for(isize i = 0; i < len; i += 1){
+		if(!keep[i]){ continue; }
+		Instruction ins = code[i];
+		Opcode op = vm_op(ins);
+		if(fold_is_jump(op)){
+			isize target = i + 1 + vm_sbx(ins);
+			isize offset = new_pos[Clamp(0, target, len)] - (out + 1);
+			ins = vm_encode_asbx(op, vm_a(ins), (i16)offset);
+		}
+		code[out] = ins;
+		out += 1;
+	}
+	f->code_len = count;
+
+	mem_free(temp, leader);
+	mem_free(temp, reachable);
+	mem_free(temp, worklist);
+	mem_free(temp, new_pos);
+	return removed;
+}
+
+static
+int dce_pointer_cmp(void const* a, void const* b){
+	uintptr x = (uintptr)*(void* const*)a, y = (uintptr)*(void* const*)b;
+	return (x > y) - (x < y);
+}
+
+isize vm_eliminate_dead_functions(Vm_Program* p, isize* entries, isize entry_count, Vm_Dce_Stats* stats, Mem_Allocator temp){
+	isize len = p->len;
+	for(isize i = 0; i < entry_count; i += 1){
+		if(entries[i] < 0 || entries[i] >= len){ return -1; }
+	}
+
+	bool* live = New(bool, Max(len, 1), temp);
+	isize* worklist = New(isize, Max(len, 1), temp);
+	isize* new_index = New(isize, Max(len, 1), temp);
+	bool* box_live = New(bool, Max(p->boxes_len, 1), temp);
+	if(live == NULL || worklist == NULL || new_index == NULL || box_live == NULL){
+		mem_free(temp, live);
+		mem_free(temp, worklist);
+		mem_free(temp, new_index);
+		mem_free(temp, box_live);
+		return -1;
+	}
+
+	// Mark everything reachable from the entries over the call graph
+	isize top = 0;
+	for(isize i = 0; i < entry_count; i += 1){
+		if(!live[entries[i]]){
+			live[entries[i]] = true;
+			worklist[top] = entries[i];
+			top += 1;
+		}
+	}
+	bool ok = true;
+	while(top > 0 && ok){
+		top -= 1;
+		Vm_Function const* f = &p->functions[worklist[top]];
+		for(isize pc = 0; pc < f->code_len; pc += 1){
+			if(vm_op(f->code[pc]) != Op_Call){ continue; }
+			isize callee = vm_bx(f->code[pc]);
+			if(callee >= len){
+				// Could not be renumbered
+				ok = false;
+				break;
+			}
+			if(!live[callee]){
+				live[callee] = true;
+				worklist[top] = callee;
+				top += 1;
+			}
+		}
+	}
+	if(!ok){
+		mem_free(temp, live);
+		mem_free(temp, worklist);
+		mem_free(temp, new_index);
+		mem_free(temp, box_live);
+		return -1;
+	}
+
+	Vm_Dce_Stats st = {0};
+	isize count = 0;
+	for(isize i = 0; i < len; i += 1){
+		new_index[i] = count;
+		if(live[i]){ count += 1; }
+	}
+
+	// Boxes are only referred to by pointer, so their order is free: sort
+	// them to look up the ones the remaining constants use
+	if(p->boxes_len > 0){
+		qsort(p->boxes, p->boxes_len, sizeof(Gc_Int*), dce_pointer_cmp);
+	}
+	bool field_used[UINT8_MAX + 1] = {0};
+	for(isize i = 0; i < len; i += 1){
+		if(!live[i]){ continue; }
+		Vm_Function const* f = &p->functions[i];
+		for(isize k = 0; k < f->constants_len; k += 1){
+			if(p->boxes_len == 0 || value_tag(f->constants[k]) != VALUE_TAG_BIG_INT){ continue; }
+			void* box = value_ref(f->constants[k]);
+			void** found = bsearch(&box, p->boxes, p->boxes_len, sizeof(Gc_Int*), dce_pointer_cmp);
+			if(found != NULL){ box_live[found - (void**)p->boxes] = true; }
+		}
+		for(isize pc = 0; pc < f->code_len; pc += 1){
+			Instruction ins = f->code[pc];
+			if(vm_op(ins) == Op_Get_Field){ field_used[vm_c(ins)] = true; }
+			if(vm_op(ins) == Op_Set_Field){ field_used[vm_b(ins)] = true; }
+		}
+	}
+
+	u8 new_field[UINT8_MAX + 1] = {0};
+	isize fields_len = 0;
+	for(isize i = 0; i < p->fields_len; i += 1){
+		if(!field_used[i]){
+			st.fields += 1;
+			continue;
+		}
+		new_field[i] = (u8)fields_len;
+		p->fields[fields_len] = p->fields[i];
+		fields_len += 1;
+	}
+	p->fields_len = fields_len;
+
+	isize boxes_len = 0;
+	for(isize i = 0; i < p->boxes_len; i += 1){
+		if(!box_live[i]){
+			mem_free(p->allocator, p->boxes[i]);
+			st.boxes += 1;
+			continue;
+		}
+		p->boxes[boxes_len] = p->boxes[i];
+		boxes_len += 1;
+	}
+	p->boxes_len = boxes_len;
+
+	isize out = 0;
+	for(isize i = 0; i < len; i += 1){
+		Vm_Function* f = &p->functions[i];
+		if(!live[i]){
+			st.functions += 1;
+			st.instructions += f->code_len;
+			st.constants += f->constants_len;
+			mem_free(p->allocator, f->code);
+			mem_free(p->allocator, f->constants);
+			continue;
+		}
+		for(isize pc = 0; pc < f->code_len; pc += 1){
+			Instruction ins = f->code[pc];
+			switch(vm_op(ins)){
+				case Op_Call:
+					f->code[pc] = vm_encode_abx(Op_Call, vm_a(ins), (u16)new_index[vm_bx(ins)]);
+					break;
+				case Op_Get_Field:
+					f->code[pc] = vm_encode_abc(Op_Get_Field, vm_a(ins), vm_b(ins), new_field[vm_c(ins)]);
+					break;
+				case Op_Set_Field:
+					f->code[pc] = vm_encode_abc(Op_Set_Field, vm_a(ins), new_field[vm_b(ins)], vm_c(ins));
+					break;
+				default: break;
+			}
+		}
+		p->functions[out] = *f;
+		out += 1;
+	}
+	p->len = count;
+	for(isize i = 0; i < entry_count; i += 1){
+		entries[i] = new_index[entries[i]];
+	}
+
+	mem_free(temp, live);
+	mem_free(temp, worklist);
+	mem_free(temp, new_index);
+	mem_free(temp, box_live);
+	if(stats != NULL){ *stats = st; }
+	return st.functions;
+}
+
+void vm_dce_stats_print(Vm_Dce_Stats const* st, IO_Writer out){
+	isize const counts[] = { st->functions, st->instructions, st->constants, st->boxes, st->fields };
+	static const cstring labels[] = {
+		" functions (", " instructions, ", " constants), ", " boxed ints, ", " field names\n",
+	};
+	io_write(out, (byte const*)"dead code: removed ", 19);
+	for(isize i = 0; i < (isize)(sizeof(counts) / sizeof(counts[0])); i += 1){
+		io_write_i64(out, counts[i]);
+		io_write(out, (byte const*)labels[i], cstring_len(labels[i]));
+	}
+}
+
+#undef FOLD_WRAP
+#endif
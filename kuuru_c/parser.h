@@ -0,0 +1,300 @@
+#pragma once
+
+#include "base.h"
+#include "lexer.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Parse_Decl Parse_Decl;
+typedef struct Parse_Tree Parse_Tree;
+
+// Top level declaration: a `func` or `let` at brace depth 0 and everything up
+// to the next one. Tokens before the first declaration form a leading
+// declaration of kind Tk_Unknown, so the declarations tile the whole source.
+struct Parse_Decl {
+	u32 id;          // Stable while the declaration is not touched by an edit
+	TokenKind kind;  // Tk_Func, Tk_Let or Tk_Unknown
+	u32 start;       // Byte offset, the first one of the source for the leading declaration
+	u32 token_count;
+	Token* tokens;   // Locations are relative to start
+};
+
+// Top level of the tree of a source, reparsed one declaration at a time
+struct Parse_Tree {
+	Parse_Decl* decls; // Sorted by start
+	isize len;
+	isize cap;
+	String source;
+	Source_Loc base;   // Added to token locations, 0 unless set by the owner
+	u32 next_id;
+	Mem_Allocator allocator;
+};
+
+// Parse source, which must be smaller than 4 GiB. Returns success status.
+bool parse_tree_build(Parse_Tree* t, String source, Mem_Allocator allocator);
+
+// Destroy tree and everything it owns
+void parse_tree_destroy(Parse_Tree* t);
+
+// Catch up with an edit that turned the parsed source into new_source by
+// replacing `removed` bytes at offset start with `inserted` new ones. Only the
+// declarations around the edit are parsed again, the others keep their tokens
+// and ID. Returns the number of declarations parsed, or -1 on failure (the
+// tree is left unchanged then).
+isize parse_tree_edit(Parse_Tree* t, String new_source, isize start, isize removed, isize inserted);
+
+// Catch up with new_source, the edit is found by comparing it with the source
+// that was parsed, which must still be alive. Same result as parse_tree_edit.
+isize parse_tree_update(Parse_Tree* t, String new_source);
+
+// Index of the declaration containing byte offset, which must be in the source
+isize parse_tree_decl_at(Parse_Tree const* t, isize offset);
+
+// i-th token of a declaration
+static inline
+Token parse_decl_token(Parse_Tree const* t, Parse_Decl const* d, isize i){
+	Token tk = d->tokens[i];
+	tk.loc += t->base + d->start;
+	return tk;
+}
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+// Parse declarations into *decls, starting at byte offset `from` at brace
+// depth 0. Stops at the end of source, or before the first declaration that
+// starts where one of the `sync_len` old declarations at `sync` does once
+// moved by delta: the source is the same from there on, so are the
+// declarations parsed before. Returns the index in sync where it stopped
+// (sync_len at the end of source), -1 on failure and -2 if `from` is not 0 and
+// not the start of a declaration.
+static
+isize parse_decls(Parse_Tree* t, String source, isize from, Parse_Decl const* sync, isize sync_len, isize delta, Parse_Decl** decls, isize* decls_len){
+	Lexer lexer = lexer_make(source);
+	lexer.iter.current = from;
+	if(from > 0){
+		Lexer peek = lexer;
+		TokenKind kind = lexer_next(&peek).kind;
+		if(kind != Tk_Func && kind != Tk_Let){ return -2; }
+	}
+
+	isize cap = 4, len = 0;
+	Parse_Decl* out = New(Parse_Decl, cap, t->allocator);
+	if(out == NULL){ return -1; }
+
+	isize depth = 0;
+	isize synced = 0;
+	isize token_cap = 0;
+	Parse_Decl* d = NULL;
+
+	for(;;){
+		Token tk = lexer_next(&lexer);
+		bool boundary = depth == 0 && (tk.kind == Tk_Func || tk.kind == Tk_Let);
+
+		if(boundary && d != NULL){
+			while(synced < sync_len && sync[synced].start + delta < tk.loc){
+				synced += 1;
+			}
+			if(synced < sync_len && sync[synced].start + delta == tk.loc){ break; }
+		}
+		if(tk.kind == Tk_EOF){
+			synced = sync_len;
+			break;
+		}
+
+		if(d == NULL || boundary){
+			if(len >= cap){
+				Parse_Decl* grown = New(Parse_Decl, cap * 2, t->allocator);
+				if(grown == NULL){ goto error_exit; }
+				mem_copy(grown, out, len * sizeof(Parse_Decl));
+				mem_free(t->allocator, out);
+				out = grown;
+				cap *= 2;
+			}
+			d = &out[len];
+			len += 1;
+			*d = (Parse_Decl){
+				.kind = boundary ? tk.kind : Tk_Unknown,
+				.start = d == out ? (u32)from : tk.loc,
+			};
+			token_cap = 0;
+		}
+
+		if(d->token_count >= token_cap){
+			isize new_cap = Max(token_cap * 2, 16);
+			Token* grown = New(Token, new_cap, t->allocator);
+			if(grown == NULL){ goto error_exit; }
+			mem_copy(grown, d->tokens, d->token_count * sizeof(Token));
+			mem_free(t->allocator, d->tokens);
+			d->tokens = grown;
+			token_cap = new_cap;
+		}
+		tk.loc -= d->start;
+		d->tokens[d->token_count] = tk;
+		d->token_count += 1;
+
+		if(tk.kind == Tk_Curly_Open){ depth += 1; }
+		if(tk.kind == Tk_Curly_Close && depth > 0){ depth -= 1; }
+	}
+
+	if(len == 0){
+		// Nothing but whitespace
+		out[0] = (Parse_Decl){ .kind = Tk_Unknown, .start = (u32)from };
+		len = 1;
+	}
+	*decls = out;
+	*decls_len = len;
+	return synced;
+
+error_exit:
+	for(isize i = 0; i < len; i += 1){
+		mem_free(t->allocator, out[i].tokens);
+	}
+	mem_free(t->allocator, out);
+	return -1;
+}
+
+bool parse_tree_build(Parse_Tree* t, String source, Mem_Allocator allocator){
+	*t = (Parse_Tree){ .allocator = allocator, .next_id = 1 };
+	if(source.len >= (isize)UINT32_MAX){ return false; }
+
+	Parse_Decl* decls;
+	isize len;
+	if(parse_decls(t, source, 0, NULL, 0, 0, &decls, &len) < 0){ return false; }
+	for(isize i = 0; i < len; i += 1){
+		decls[i].id = t->next_id;
+		t->next_id += 1;
+	}
+	t->decls = decls;
+	t->len = len;
+	t->cap = len;
+	t->source = source;
+	return true;
+}
+
+void parse_tree_destroy(Parse_Tree* t){
+	for(isize i = 0; i < t->len; i += 1){
+		mem_free(t->allocator, t->decls[i].tokens);
+	}
+	mem_free(t->allocator, t->decls);
+	*t = (Parse_Tree){0};
+}
+
+isize parse_tree_decl_at(Parse_Tree const* t, isize offset){
+	// Last declaration starting at or before offset
+	isize lo = 0, hi = t->len;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(t->decls[mid].start <= offset){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+	return Max(lo - 1, 0);
+}
+
+isize parse_tree_edit(Parse_Tree* t, String new_source, isize start, isize removed, isize inserted){
+	if(new_source.len >= (isize)UINT32_MAX){ return -1; }
+	isize delta = inserted - removed;
+
+	// A token ending right before the edit may grow into it, so start one
+	// byte earlier
+	isize first = parse_tree_decl_at(t, Max(start - 1, 0));
+
+retry:;
+	// Later declarations starting at or after the end of the edit are reused
+	// once the new parse reaches one of them
+	isize reuse = first + 1;
+	while(reuse < t->len && t->decls[reuse].start < start + removed){
+		reuse += 1;
+	}
+
+	Parse_Decl* fresh;
+	isize fresh_len;
+	isize stop = parse_decls(t, new_source, t->decls[first].start, &t->decls[reuse], t->len - reuse, delta, &fresh, &fresh_len);
+	if(stop == -2){
+		// The edit removed the keyword of the first declaration, it belongs
+		// to the one before now
+		first -= 1;
+		goto retry;
+	}
+	if(stop < 0){ return -1; }
+	isize kept_from = reuse + stop; // First old declaration kept after the new ones
+
+	isize new_len = first + fresh_len + (t->len - kept_from);
+	if(new_len > t->cap){
+		isize new_cap = Max(new_len, t->cap * 2);
+		Parse_Decl* grown = New(Parse_Decl, new_cap, t->allocator);
+		if(grown == NULL){
+			for(isize i = 0; i < fresh_len; i += 1){
+				mem_free(t->allocator, fresh[i].tokens);
+			}
+			mem_free(t->allocator, fresh);
+			return -1;
+		}
+		mem_copy(grown, t->decls, t->len * sizeof(Parse_Decl));
+		mem_free(t->allocator, t->decls);
+		t->decls = grown;
+		t->cap = new_cap;
+	}
+
+	// A declaration parsed again keeps its ID if it still starts at the same
+	// place (outside of the edit) with the same keyword
+	isize old = first;
+	for(isize i = 0; i < fresh_len; i += 1){
+		Parse_Decl* d = &fresh[i];
+		isize old_start = -1;
+		for(; old < kept_from; old += 1){
+			isize s = t->decls[old].start;
+			old_start = s < start ? s : (s >= start + removed ? s + delta : -1);
+			if(old_start >= (isize)d->start){ break; }
+		}
+		if(old < kept_from && old_start == (isize)d->start && t->decls[old].kind == d->kind){
+			d->id = t->decls[old].id;
+			old += 1;
+		} else {
+			d->id = t->next_id;
+			t->next_id += 1;
+		}
+	}
+
+	for(isize i = first; i < kept_from; i += 1){
+		mem_free(t->allocator, t->decls[i].tokens);
+	}
+	mem_copy(&t->decls[first + fresh_len], &t->decls[kept_from], (t->len - kept_from) * sizeof(Parse_Decl));
+	mem_copy(&t->decls[first], fresh, fresh_len * sizeof(Parse_Decl));
+	mem_free(t->allocator, fresh);
+	for(isize i = first + fresh_len; i < new_len; i += 1){
+		t->decls[i].start += (u32)delta;
+	}
+	t->len = new_len;
+	t->source = new_source;
+	return fresh_len;
+}
+
+isize parse_tree_update(Parse_Tree* t, String new_source){
+	String old = t->source;
+	isize limit = Min(old.len, new_source.len);
+	isize prefix = 0;
+	while(prefix + 8 <= limit){
+		u64 a, b;
+		mem_copy(&a, &old.data[prefix], 8);
+		mem_copy(&b, &new_source.data[prefix], 8);
+		if(a != b){ break; }
+		prefix += 8;
+	}
+	while(prefix < limit && old.data[prefix] == new_source.data[prefix]){
+		prefix += 1;
+	}
+	isize suffix = 0;
+	while(suffix + 8 <= limit - prefix){
+		u64 a, b;
+		mem_copy(&a, &old.data[old.len - suffix - 8], 8);
+		mem_copy(&b, &new_source.data[new_source.len - suffix - 8], 8);
+		if(a != b){ break; }
+		suffix += 8;
+	}
+	while(suffix < limit - prefix && old.data[old.len - 1 - suffix] == new_source.data[new_source.len - 1 - suffix]){
+		suffix += 1;
+	}
+	return parse_tree_edit(t, new_source, prefix, old.len - prefix - suffix, new_source.len - prefix - suffix);
+}
+
+#endif
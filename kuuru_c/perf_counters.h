@@ -0,0 +1,303 @@
+#pragma once
+
+#include "base.h"
+
+///- Interface -----------------------------------------------------------------
+typedef enum Perf_Stage Perf_Stage;
+typedef enum Perf_Counter Perf_Counter;
+typedef struct Perf_Sample Perf_Sample;
+typedef struct Perf_Stage_Stats Perf_Stage_Stats;
+typedef struct Perf_Profile Perf_Profile;
+
+#define KUURU_PERF_STAGE_TABLE \
+	X(Load,  "load")  /* Reading source files */ \
+	X(Lex,   "lex")   /* Turning sources into tokens */ \
+	X(Check, "check") /* Diagnostics over tokens */
+
+enum Perf_Stage {
+	#define X(Name, Label) Perf_Stage_##Name,
+		KUURU_PERF_STAGE_TABLE
+	#undef X
+	Perf_Stage__Count,
+};
+
+#define KUURU_PERF_COUNTER_TABLE \
+	X(Cycles,       "cycles") \
+	X(Instructions, "instructions") \
+	X(Branch_Miss,  "branch_misses") \
+	X(L1d_Miss,     "l1d_misses")   /* Data reads */ \
+	X(Llc_Miss,     "llc_misses")   /* Data reads */
+
+enum Perf_Counter {
+	#define X(Name, Label) Perf_##Name,
+		KUURU_PERF_COUNTER_TABLE
+	#undef X
+	Perf_Counter__Count,
+};
+
+// Counter readings at the start of a stage
+struct Perf_Sample {
+	i64 ns;
+	u64 enabled;  // Time the counter group was enabled and running, for
+	u64 running;  // scaling when the kernel multiplexes it with other groups
+	u64 counts[Perf_Counter__Count];
+};
+
+struct Perf_Stage_Stats {
+	i64 calls;
+	i64 ns;
+	i64 counted;  // Calls during which the counters were running
+	u64 counts[Perf_Counter__Count];
+};
+
+// Wall time and, where the kernel allows it, hardware counters of the calling
+// thread (user space only) around each frontend stage. Counters that cannot
+// be opened, as in most containers and VMs, are left out and only time is
+// kept. Work done by other threads, like the file loading pool, is timed but
+// not counted. Stages may nest, a nested stage is then also part of the outer
+// one.
+struct Perf_Profile {
+	bool enabled;
+	int leader;                   // Counter group, -1 if no counter could be opened
+	int fd[Perf_Counter__Count];  // -1 if unavailable
+	i8 slot[Perf_Counter__Count]; // Position of each counter in the group
+	int counter_count;
+	Perf_Stage_Stats stages[Perf_Stage__Count];
+};
+
+// Start collecting, opening whatever hardware counters are available.
+// Returns true if at least one counter is, false for timing only.
+bool perf_profile_init(Perf_Profile* p);
+
+// Close the counters
+void perf_profile_destroy(Perf_Profile* p);
+
+// Take a sample at the start of a stage. p may be NULL or not enabled, the
+// stage is then not recorded.
+Perf_Sample perf_stage_begin(Perf_Profile* p);
+
+// Add everything since `start` to stage
+void perf_stage_end(Perf_Profile* p, Perf_Stage stage, Perf_Sample start);
+
+// Write the per stage summary as an aligned table
+void perf_profile_print_table(Perf_Profile const* p, IO_Writer out);
+
+// Write the per stage summary as a JSON object, unavailable counters are null
+void perf_profile_print_json(Perf_Profile const* p, IO_Writer out);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char* const perf_stage_names[Perf_Stage__Count] = {
+	#define X(Name, Label) [Perf_Stage_##Name] = Label,
+		KUURU_PERF_STAGE_TABLE
+	#undef X
+};
+
+static const char* const perf_counter_names[Perf_Counter__Count] = {
+	#define X(Name, Label) [Perf_##Name] = Label,
+		KUURU_PERF_COUNTER_TABLE
+	#undef X
+};
+
+#define PERF_CACHE_READ_MISS(cache_) \
+	((cache_) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct { u32 type; u64 config; } perf_counter_events[Perf_Counter__Count] = {
+	[Perf_Cycles]       = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[Perf_Instructions] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[Perf_Branch_Miss]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[Perf_L1d_Miss]     = { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	[Perf_Llc_Miss]     = { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+};
+
+static
+i64 perf_now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (i64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+bool perf_profile_init(Perf_Profile* p){
+	*p = (Perf_Profile){ .enabled = true, .leader = -1 };
+	for(int i = 0; i < Perf_Counter__Count; i += 1){
+		p->fd[i] = -1;
+	}
+
+	// One group, so a single read gets every counter and they are always
+	// scheduled together
+	for(int i = 0; i < Perf_Counter__Count; i += 1){
+		struct perf_event_attr attr = {
+			.size = sizeof(attr),
+			.type = perf_counter_events[i].type,
+			.config = perf_counter_events[i].config,
+			.disabled = p->leader < 0,
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+			.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+		};
+		long fd = syscall(SYS_perf_event_open, &attr, 0, -1, p->leader, 0);
+		if(fd < 0){ continue; }
+		if(p->leader < 0){ p->leader = (int)fd; }
+		p->fd[i] = (int)fd;
+		p->slot[i] = (i8)p->counter_count;
+		p->counter_count += 1;
+	}
+
+	if(p->leader >= 0 && ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0){
+		perf_profile_destroy(p);
+	}
+	return p->leader >= 0;
+}
+
+void perf_profile_destroy(Perf_Profile* p){
+	// Members first, closing the leader would leave them as lone events
+	for(int i = 0; i < Perf_Counter__Count; i += 1){
+		if(p->fd[i] >= 0 && p->fd[i] != p->leader){ close(p->fd[i]); }
+		p->fd[i] = -1;
+	}
+	if(p->leader >= 0){ close(p->leader); }
+	p->leader = -1;
+	p->counter_count = 0;
+}
+
+Perf_Sample perf_stage_begin(Perf_Profile* p){
+	Perf_Sample s = {0};
+	if(p == NULL || !p->enabled){ return s; }
+
+	if(p->leader >= 0){
+		u64 buf[3 + Perf_Counter__Count];
+		isize n = read(p->leader, buf, sizeof(buf));
+		if(n >= (isize)(3 * sizeof(u64)) && buf[0] == (u64)p->counter_count){
+			s.enabled = buf[1];
+			s.running = buf[2];
+			for(int i = 0; i < Perf_Counter__Count; i += 1){
+				if(p->fd[i] >= 0){ s.counts[i] = buf[3 + p->slot[i]]; }
+			}
+		}
+	}
+	// Last, so reading the counters is not part of the stage's time
+	s.ns = perf_now_ns();
+	return s;
+}
+
+void perf_stage_end(Perf_Profile* p, Perf_Stage stage, Perf_Sample start){
+	if(p == NULL || !p->enabled){ return; }
+	Perf_Sample end = perf_stage_begin(p);
+	Perf_Stage_Stats* st = &p->stages[stage];
+	st->calls += 1;
+	st->ns += end.ns - start.ns;
+
+	u64 enabled = end.enabled - start.enabled;
+	u64 running = end.running - start.running;
+	if(p->leader < 0 || running == 0){ return; }
+	st->counted += 1;
+	for(int i = 0; i < Perf_Counter__Count; i += 1){
+		u64 delta = end.counts[i] - start.counts[i];
+		// Multiplexed: extrapolate to the whole stage
+		if(running < enabled){ delta = (u64)((f64)delta * ((f64)enabled / (f64)running)); }
+		st->counts[i] += delta;
+	}
+}
+
+static
+void perf_write(IO_Writer out, cstring text){
+	io_write(out, (byte const*)text, cstring_len(text));
+}
+
+// Write text padded with spaces to width, on the right when left aligned
+static
+void perf_write_cell(IO_Writer out, byte const* text, isize len, isize width, bool left){
+	static const char spaces[] = "                        ";
+	isize pad = Clamp(0, width - len, (isize)sizeof(spaces) - 1);
+	if(!left){ io_write(out, (byte const*)spaces, pad); }
+	io_write(out, text, len);
+	if(left){ io_write(out, (byte const*)spaces, pad); }
+}
+
+static
+void perf_write_text_cell(IO_Writer out, cstring text, isize width, bool left){
+	perf_write(out, " ");
+	perf_write_cell(out, (byte const*)text, cstring_len(text), width, left);
+}
+
+static
+void perf_write_u64_cell(IO_Writer out, u64 v, isize width){
+	byte buf[FMT_INT_MAX_LEN];
+	perf_write(out, " ");
+	perf_write_cell(out, buf, fmt_u64(buf, v), width, false);
+}
+
+// num / den rounded to `decimals` places, so the cell stays narrow
+static
+void perf_write_f64_cell(IO_Writer out, u64 num, u64 den, u64 decimals, isize width){
+	u64 scale = 1;
+	for(u64 i = 0; i < decimals; i += 1){ scale *= 10; }
+	u64 scaled = (num * scale + den / 2) / den;
+	byte buf[FMT_F64_MAX_LEN];
+	perf_write(out, " ");
+	perf_write_cell(out, buf, fmt_f64(buf, (f64)scaled / (f64)scale), width, false);
+}
+
+void perf_profile_print_table(Perf_Profile const* p, IO_Writer out){
+	perf_write_cell(out, (byte const*)"stage", 5, 8, true);
+	perf_write_text_cell(out, "calls", 8, false);
+	perf_write_text_cell(out, "time_ms", 12, false);
+	for(int i = 0; i < Perf_Counter__Count; i += 1){
+		perf_write_text_cell(out, perf_counter_names[i], 14, false);
+	}
+	perf_write_text_cell(out, "ipc", 6, false);
+	perf_write(out, "\n");
+
+	for(int s = 0; s < Perf_Stage__Count; s += 1){
+		Perf_Stage_Stats const* st = &p->stages[s];
+		perf_write_cell(out, (byte const*)perf_stage_names[s], cstring_len(perf_stage_names[s]), 8, true);
+		perf_write_u64_cell(out, (u64)st->calls, 8);
+		perf_write_f64_cell(out, (u64)st->ns, 1000000, 3, 12);
+		for(int i = 0; i < Perf_Counter__Count; i += 1){
+			if(p->fd[i] >= 0 && st->counted > 0){ perf_write_u64_cell(out, st->counts[i], 14); }
+			else { perf_write_text_cell(out, "-", 14, false); }
+		}
+		bool has_ipc = p->fd[Perf_Cycles] >= 0 && p->fd[Perf_Instructions] >= 0 && st->counts[Perf_Cycles] > 0;
+		if(has_ipc){ perf_write_f64_cell(out, st->counts[Perf_Instructions], st->counts[Perf_Cycles], 2, 6); }
+		else { perf_write_text_cell(out, "-", 6, false); }
+		perf_write(out, "\n");
+	}
+	if(p->leader < 0){
+		perf_write(out, "hardware counters unavailable, timing only\n");
+	}
+}
+
+void perf_profile_print_json(Perf_Profile const* p, IO_Writer out){
+	perf_write(out, "{\"counters\":");
+	perf_write(out, p->leader >= 0 ? "true" : "false");
+	perf_write(out, ",\"stages\":{");
+	for(int s = 0; s < Perf_Stage__Count; s += 1){
+		Perf_Stage_Stats const* st = &p->stages[s];
+		if(s > 0){ perf_write(out, ","); }
+		perf_write(out, "\"");
+		perf_write(out, perf_stage_names[s]);
+		perf_write(out, "\":{\"calls\":");
+		io_write_i64(out, st->calls);
+		perf_write(out, ",\"ns\":");
+		io_write_i64(out, st->ns);
+		for(int i = 0; i < Perf_Counter__Count; i += 1){
+			perf_write(out, ",\"");
+			perf_write(out, perf_counter_names[i]);
+			perf_write(out, "\":");
+			if(p->fd[i] >= 0 && st->counted > 0){ io_write_u64(out, st->counts[i]); }
+			else { perf_write(out, "null"); }
+		}
+		perf_write(out, "}");
+	}
+	perf_write(out, "}}\n");
+}
+
+#undef PERF_CACHE_READ_MISS
+#endif
@@ -0,0 +1,404 @@
+#pragma once
+
+#include "base.h"
+#include "lexer.h"
+#include "hash.h"
+#include "cache.h"
+#include "source_manager.h"
+#include "perf_counters.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Server_Module Server_Module;
+typedef struct Server Server;
+
+// Resident state of one source file
+struct Server_Module {
+	String path;
+	u64 path_hash;
+	i64 mtime_ns;
+	i64 size;
+	Hash128 content_hash;
+
+	Bytes source;
+	Source_Loc base; // Of source, in the server's Source_Manager
+	Token_Stream tokens;
+	Bytes_Buffer diagnostics;
+	isize error_count;
+};
+
+struct Server {
+	int listen_fd;
+	Server_Module* modules;
+	isize module_count;
+	isize module_cap;
+	Source_Manager sources; // Ranges of the current version of each module
+	Perf_Profile* profile;  // NULL when not profiling
+
+	Mem_Allocator allocator;      // Long lived state
+	Mem_Allocator temp_allocator; // Reset after every request
+};
+
+// Listen on a Unix domain socket and answer requests until a shutdown
+// request arrives. Requests are a single line: "check <path>", "compile <path>"
+// or "shutdown". Responses are diagnostics, one per line, followed by
+// "done <error count>". Stages are recorded into profile unless it is NULL.
+// Returns success status.
+bool server_run(String socket_path, Perf_Profile* profile, Mem_Allocator allocator, Mem_Allocator temp_allocator);
+
+// Send a request to a running server and copy its response to out. Relative
+// paths are resolved against the client's working directory. Returns the
+// number of errors reported, or -1 if the request failed.
+isize server_client_request(String socket_path, String command, String path, IO_Writer out);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_REQUEST_MAX 8192
+#define SERVER_PATH_MAX 4096
+#define SERVER_RECV_TIMEOUT_SEC 5 // Requests are handled one at a time, an idle client must not stall the rest
+
+static
+bool server_socket_address(struct sockaddr_un* addr, String socket_path){
+	*addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+	if(socket_path.len >= (isize)sizeof(addr->sun_path)){ return false; }
+	mem_copy(addr->sun_path, socket_path.data, socket_path.len);
+	return true;
+}
+
+static
+bool server_send_all(int fd, byte const* data, isize len){
+	while(len > 0){
+		isize n = send(fd, data, len, MSG_NOSIGNAL);
+		if(n <= 0){ return false; }
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+static
+void server_module_release(Server* s, Server_Module* m){
+	if(m->tokens.tokens != NULL){ token_stream_destroy(&m->tokens); }
+	if(m->base != 0){ source_manager_remove(&s->sources, m->base); }
+	mem_free(s->allocator, m->source.data);
+	m->source = (Bytes){0};
+	m->base = 0;
+	m->tokens = (Token_Stream){0};
+	m->diagnostics.len = 0;
+	m->diagnostics.last_read = 0;
+	m->error_count = 0;
+}
+
+static
+void server_diagnostic(Server* s, Server_Module* m, Source_Loc loc, cstring message){
+	Source_File* f = source_manager_file(&s->sources, loc);
+	Source_Position pos = source_file_position(f, loc);
+	Bytes_Buffer* out = &m->diagnostics;
+
+	// path:line:column: error: message
+	buffer_write(out, f->path.data, f->path.len);
+	buffer_write(out, (byte const*)":", 1);
+	buffer_write_i64(out, pos.line);
+	buffer_write(out, (byte const*)":", 1);
+	buffer_write_i64(out, pos.column);
+	buffer_write(out, (byte const*)": error: ", 9);
+	buffer_write(out, (byte const*)message, cstring_len(message));
+	buffer_write(out, (byte const*)"\n", 1);
+	m->error_count += 1;
+}
+
+// Lex the module and collect its diagnostics
+static
+bool server_module_check(Server* s, Server_Module* m){
+	String source = str_from_bytes(m->source.data, m->source.len);
+	m->base = source_manager_add(&s->sources, m->path, source);
+	if(m->base == 0){ return false; }
+	Perf_Sample lex = perf_stage_begin(s->profile);
+	bool lexed = token_stream_lex(&m->tokens, (String){0}, source, s->allocator);
+	perf_stage_end(s->profile, Perf_Stage_Lex, lex);
+	if(!lexed){ return false; }
+	m->tokens.base = m->base;
+
+	Perf_Sample check = perf_stage_begin(s->profile);
+
+	enum { BRACKET_STACK_MAX = 256 };
+	isize stack[BRACKET_STACK_MAX];
+	isize depth = 0;
+
+	for(isize i = 0; i < m->tokens.len; i += 1){
+		Token tk = token_stream_at(&m->tokens, i);
+		switch(tk.kind){
+			case Tk_Unknown: {
+				server_diagnostic(s, m, tk.loc, "unexpected character");
+			} break;
+
+			case Tk_Paren_Open: case Tk_Square_Open: case Tk_Curly_Open: {
+				if(depth < BRACKET_STACK_MAX){ stack[depth] = i; }
+				depth += 1;
+			} break;
+
+			case Tk_Paren_Close: case Tk_Square_Close: case Tk_Curly_Close: {
+				TokenKind open = tk.kind == Tk_Paren_Close ? Tk_Paren_Open :
+					(tk.kind == Tk_Square_Close ? Tk_Square_Open : Tk_Curly_Open);
+				if(depth == 0){
+					server_diagnostic(s, m, tk.loc, "unmatched closing bracket");
+					break;
+				}
+				depth -= 1;
+				if(depth < BRACKET_STACK_MAX && m->tokens.tokens[stack[depth]].kind != (u32)open){
+					server_diagnostic(s, m, tk.loc, "mismatched closing bracket");
+				}
+			} break;
+
+			default: break;
+		}
+	}
+
+	for(isize i = Min(depth, BRACKET_STACK_MAX) - 1; i >= 0; i -= 1){
+		server_diagnostic(s, m, token_stream_at(&m->tokens, stack[i]).loc, "unclosed bracket");
+	}
+	perf_stage_end(s->profile, Perf_Stage_Check, check);
+	return true;
+}
+
+// Find or create the module for path and bring it up to date with the disk
+static
+Server_Module* server_module_get(Server* s, String path){
+	char path_buf[SERVER_PATH_MAX] = {0};
+	mem_copy(path_buf, path.data, Min(path.len, SERVER_PATH_MAX - 1));
+
+	struct stat st;
+	if(stat(path_buf, &st) != 0 || !S_ISREG(st.st_mode)){ return NULL; }
+	i64 mtime_ns = (i64)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+
+	u64 path_hash = hash128(path.data, path.len, 0).lo;
+	Server_Module* m = NULL;
+	for(isize i = 0; i < s->module_count; i += 1){
+		Server_Module* candidate = &s->modules[i];
+		if(candidate->path_hash == path_hash && str_eq(candidate->path, path)){
+			m = candidate;
+			break;
+		}
+	}
+
+	if(m == NULL){
+		if(s->module_count >= s->module_cap){
+			isize new_cap = Max(s->module_cap * 2, 16);
+			Server_Module* modules = New(Server_Module, new_cap, s->allocator);
+			if(modules == NULL){ return NULL; }
+			mem_copy(modules, s->modules, s->module_count * sizeof(Server_Module));
+			mem_free(s->allocator, s->modules);
+			s->modules = modules;
+			s->module_cap = new_cap;
+		}
+
+		byte* path_copy = New(byte, path.len, s->allocator);
+		if(path_copy == NULL){ return NULL; }
+		mem_copy(path_copy, path.data, path.len);
+
+		m = &s->modules[s->module_count];
+		*m = (Server_Module){
+			.path = { .data = path_copy, .len = path.len },
+			.path_hash = path_hash,
+			.mtime_ns = -1,
+		};
+		if(!buffer_init(&m->diagnostics, s->allocator, 256)){
+			mem_free(s->allocator, path_copy);
+			return NULL;
+		}
+		s->module_count += 1;
+	}
+
+	if(m->mtime_ns == mtime_ns && m->size == st.st_size){ return m; }
+
+	Perf_Sample load = perf_stage_begin(s->profile);
+	Bytes source = file_read_all(path, s->allocator);
+	perf_stage_end(s->profile, Perf_Stage_Load, load);
+	// Unreadable, keep the previous version and try again next time
+	if(source.data == NULL && st.st_size > 0){ return NULL; }
+	Hash128 content = hash128(source.data, source.len, 0);
+	m->mtime_ns = mtime_ns;
+	m->size = st.st_size;
+
+	// Touched but not modified, keep everything
+	if(m->source.data != NULL && hash128_eq(content, m->content_hash)){
+		mem_free(s->allocator, source.data);
+		return m;
+	}
+
+	server_module_release(s, m);
+	m->source = source;
+	m->content_hash = content;
+	if(!server_module_check(s, m)){
+		m->mtime_ns = -1;
+		return NULL;
+	}
+	return m;
+}
+
+static
+void server_handle(Server* s, int fd, bool* shutdown){
+	char request[SERVER_REQUEST_MAX];
+	isize len = 0;
+	while(len < SERVER_REQUEST_MAX){
+		isize n = recv(fd, &request[len], SERVER_REQUEST_MAX - len, 0);
+		if(n <= 0){ break; }
+		len += n;
+		if(memchr(request, '\n', len) != NULL){ break; }
+	}
+
+	String line = str_from_bytes((byte const*)request, len);
+	for(isize i = 0; i < len; i += 1){
+		if(request[i] == '\n'){ line.len = i; break; }
+	}
+
+	String command = line, path = {0};
+	for(isize i = 0; i < line.len; i += 1){
+		if(line.data[i] == ' '){
+			command = str_from_bytes(line.data, i);
+			path = str_from_bytes(&line.data[i + 1], line.len - i - 1);
+			break;
+		}
+	}
+
+	Server_Module* m = NULL;
+	cstring response = "error: bad request\n";
+	if(str_eq(command, str_from("shutdown"))){
+		*shutdown = true;
+		response = "done 0\n";
+	}
+	else if((str_eq(command, str_from("check")) || str_eq(command, str_from("compile"))) && path.len > 0){
+		m = server_module_get(s, path);
+		response = "error: could not load file\n";
+	}
+
+	if(m == NULL){
+		server_send_all(fd, (byte const*)response, cstring_len(response));
+		return;
+	}
+	server_send_all(fd, buffer_bytes(&m->diagnostics), m->diagnostics.len);
+	byte done[5 + FMT_INT_MAX_LEN + 1] = "done ";
+	isize n = 5 + fmt_i64(&done[5], m->error_count);
+	done[n++] = '\n';
+	server_send_all(fd, done, n);
+}
+
+bool server_run(String socket_path, Perf_Profile* profile, Mem_Allocator allocator, Mem_Allocator temp_allocator){
+	struct sockaddr_un addr;
+	if(!server_socket_address(&addr, socket_path)){ return false; }
+
+	Server s = {
+		.profile = profile,
+		.allocator = allocator,
+		.temp_allocator = temp_allocator,
+	};
+	s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(s.listen_fd < 0){ return false; }
+	source_manager_init(&s.sources, allocator);
+
+	unlink(addr.sun_path);
+	if(bind(s.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s.listen_fd, 64) != 0){
+		close(s.listen_fd);
+		source_manager_destroy(&s.sources);
+		return false;
+	}
+
+	bool shutdown = false;
+	while(!shutdown){
+		int fd = accept(s.listen_fd, NULL, NULL);
+		if(fd < 0){ continue; }
+		struct timeval timeout = { .tv_sec = SERVER_RECV_TIMEOUT_SEC };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		server_handle(&s, fd, &shutdown);
+		close(fd);
+		mem_free_all(s.temp_allocator);
+	}
+
+	close(s.listen_fd);
+	unlink(addr.sun_path);
+	for(isize i = 0; i < s.module_count; i += 1){
+		server_module_release(&s, &s.modules[i]);
+		buffer_destroy(&s.modules[i].diagnostics);
+		mem_free(allocator, (void*)s.modules[i].path.data);
+	}
+	mem_free(allocator, s.modules);
+	source_manager_destroy(&s.sources);
+	return true;
+}
+
+// The error count from a "done <n>" line, -1 for any other line
+static
+isize server_parse_done(String line){
+	if(line.len < 6 || !str_eq(str_from_bytes(line.data, 5), str_from("done "))){ return -1; }
+	isize count = 0;
+	for(isize i = 5; i < line.len; i += 1){
+		if(line.data[i] < '0' || line.data[i] > '9' || count > (PTRDIFF_MAX - 9) / 10){ return -1; }
+		count = count * 10 + (line.data[i] - '0');
+	}
+	return count;
+}
+
+isize server_client_request(String socket_path, String command, String path, IO_Writer out){
+	struct sockaddr_un addr;
+	if(!server_socket_address(&addr, socket_path)){ return -1; }
+
+	char request[SERVER_REQUEST_MAX];
+	char path_buf[SERVER_PATH_MAX] = {0};
+	char abs_path[SERVER_PATH_MAX] = {0};
+	mem_copy(path_buf, path.data, Min(path.len, SERVER_PATH_MAX - 1));
+
+	isize abs_len = 0;
+	if(path.len > 0){
+		if(realpath(path_buf, abs_path) == NULL){ return -1; }
+		abs_len = cstring_len(abs_path);
+	}
+	isize n = command.len + (path.len > 0 ? 1 + abs_len : 0) + 1;
+	if(n > SERVER_REQUEST_MAX){ return -1; }
+	mem_copy(request, command.data, command.len);
+	if(path.len > 0){
+		request[command.len] = ' ';
+		mem_copy(&request[command.len + 1], abs_path, abs_len);
+	}
+	request[n - 1] = '\n';
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0){ return -1; }
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || !server_send_all(fd, (byte const*)request, n)){
+		close(fd);
+		return -1;
+	}
+	shutdown(fd, SHUT_WR);
+
+	// Keep the last line around to read the error count from it
+	char buf[4096];
+	char last[64] = {0};
+	isize last_len = 0;
+	isize errors = -1;
+	for(;;){
+		isize got = recv(fd, buf, sizeof(buf), 0);
+		if(got <= 0){ break; }
+		io_write(out, (byte const*)buf, got);
+		for(isize i = 0; i < got; i += 1){
+			if(buf[i] == '\n'){
+				errors = server_parse_done(str_from_bytes((byte const*)last, last_len));
+				last_len = 0;
+			} else if(last_len < (isize)sizeof(last) - 1){
+				last[last_len++] = buf[i];
+			}
+		}
+	}
+	close(fd);
+	return errors;
+}
+
+#undef SERVER_REQUEST_MAX
+#undef SERVER_PATH_MAX
+#undef SERVER_RECV_TIMEOUT_SEC
+#endif
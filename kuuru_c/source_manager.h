@@ -0,0 +1,156 @@
+#pragma once
+
+#include "base.h"
+#include "line_table.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Source_File Source_File;
+typedef struct Source_Manager Source_Manager;
+
+// Location in the source space of a Source_Manager, or a byte offset for
+// sources lexed on their own. 0 is no location.
+typedef u32 Source_Loc;
+
+// A file and its range of locations, [base, base + size]. The last location
+// is the end of the file, where its EOF token points.
+struct Source_File {
+	String path;
+	String source;
+	Source_Loc base;
+	u32 size;
+	Line_Table lines;
+};
+
+// Gives each file a contiguous range of one 32-bit location space, so a
+// single u32 says which file, line and column something comes from. Ranges
+// are handed out past the last file while there is room, then in the gaps
+// left by removed files.
+struct Source_Manager {
+	Source_File* files; // Sorted by base
+	isize len;
+	isize cap;
+	Source_Loc next;    // End of the last file, plus one
+	Mem_Allocator allocator;
+};
+
+// Initialize an empty manager
+void source_manager_init(Source_Manager* sm, Mem_Allocator allocator);
+
+// Destroy manager and everything it owns
+void source_manager_destroy(Source_Manager* sm);
+
+// Add a file, path and source are not copied and must stay alive until the
+// file is removed. Returns the location of its first byte, or 0 when out of
+// memory or out of location space.
+Source_Loc source_manager_add(Source_Manager* sm, String path, String source);
+
+// Remove the file at base and give its range back. Locations in it must not be
+// used anymore, a later file may get them.
+void source_manager_remove(Source_Manager* sm, Source_Loc base);
+
+// File containing loc, NULL if none does
+Source_File* source_manager_file(Source_Manager const* sm, Source_Loc loc);
+
+// Line and column of loc, which must be in f
+Source_Position source_file_position(Source_File* f, Source_Loc loc);
+
+// len bytes of text starting at loc, empty if they are not all in one file
+String source_manager_text(Source_Manager const* sm, Source_Loc loc, isize len);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+void source_manager_init(Source_Manager* sm, Mem_Allocator allocator){
+	*sm = (Source_Manager){
+		.next = 1,
+		.allocator = allocator,
+	};
+}
+
+void source_manager_destroy(Source_Manager* sm){
+	for(isize i = 0; i < sm->len; i += 1){
+		line_table_destroy(&sm->files[i].lines);
+	}
+	mem_free(sm->allocator, sm->files);
+	*sm = (Source_Manager){0};
+}
+
+Source_Loc source_manager_add(Source_Manager* sm, String path, String source){
+	isize at = sm->len;
+	Source_Loc base = sm->next;
+	// The end location of the file must fit as well
+	if(source.len >= (isize)(UINT32_MAX - base)){
+		// First gap between files that fits
+		base = 1;
+		for(at = 0; at < sm->len; at += 1){
+			if((isize)(sm->files[at].base - base) > source.len){ break; }
+			base = sm->files[at].base + sm->files[at].size + 1;
+		}
+		if(at == sm->len){ return 0; }
+	}
+
+	if(sm->len >= sm->cap){
+		isize new_cap = Max(sm->cap * 2, 16);
+		Source_File* files = New(Source_File, new_cap, sm->allocator);
+		if(files == NULL){ return 0; }
+		mem_copy(files, sm->files, sm->len * sizeof(Source_File));
+		mem_free(sm->allocator, sm->files);
+		sm->files = files;
+		sm->cap = new_cap;
+	}
+
+	mem_copy(&sm->files[at + 1], &sm->files[at], (sm->len - at) * sizeof(Source_File));
+	Source_File* f = &sm->files[at];
+	*f = (Source_File){
+		.path = path,
+		.source = source,
+		.base = base,
+		.size = (u32)source.len,
+	};
+	line_table_init(&f->lines, source, sm->allocator);
+	sm->len += 1;
+	if(at == sm->len - 1){ sm->next = base + (u32)source.len + 1; }
+	return base;
+}
+
+void source_manager_remove(Source_Manager* sm, Source_Loc base){
+	Source_File* f = source_manager_file(sm, base);
+	if(f == NULL || f->base != base){ return; }
+	line_table_destroy(&f->lines);
+	isize at = f - sm->files;
+	mem_copy(f, f + 1, (sm->len - at - 1) * sizeof(Source_File));
+	sm->len -= 1;
+
+	// The range of the last file is free again for the next one
+	if(at == sm->len){
+		Source_File const* last = sm->len > 0 ? &sm->files[sm->len - 1] : NULL;
+		sm->next = last != NULL ? last->base + last->size + 1 : 1;
+	}
+}
+
+Source_File* source_manager_file(Source_Manager const* sm, Source_Loc loc){
+	// Last file starting at or before loc
+	isize lo = 0, hi = sm->len;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(sm->files[mid].base <= loc){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+	if(lo == 0){ return NULL; }
+	Source_File* f = &sm->files[lo - 1];
+	return loc - f->base <= f->size ? f : NULL;
+}
+
+Source_Position source_file_position(Source_File* f, Source_Loc loc){
+	return line_table_position(&f->lines, loc - f->base);
+}
+
+String source_manager_text(Source_Manager const* sm, Source_Loc loc, isize len){
+	Source_File const* f = source_manager_file(sm, loc);
+	if(f == NULL || len < 0 || (isize)(loc - f->base) + len > f->source.len){
+		return (String){0};
+	}
+	return str_from_bytes(&f->source.data[loc - f->base], len);
+}
+
+#endif
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "base.h"
+#include "hash.h"
+
+///- Interface -----------------------------------------------------------------
+typedef u32 Symbol;
+typedef struct Interner Interner;
+typedef struct Scope_Entry Scope_Entry;
+typedef struct Scope_Table Scope_Table;
+typedef enum Scope_Result Scope_Result;
+
+// Never returned by intern(), used for "no symbol"
+#define SYMBOL_NONE ((Symbol)0)
+
+// Maps strings to dense symbol IDs, starting at 1
+struct Interner {
+	u32* slots;      // Open addressing, 0 is empty, otherwise a symbol
+	isize slot_cap;  // Power of 2
+	String* strings; // Indexed by symbol
+	u32* hashes;     // Indexed by symbol
+	isize len;
+	isize cap;
+	Mem_Allocator allocator;
+};
+
+// One declaration, `shadowed` is the index of the entry with the same name
+// that was visible before this one (or SCOPE_ENTRY_NONE)
+struct Scope_Entry {
+	Symbol name;
+	u32 shadowed;
+	u32 depth;
+	u32 decl;
+};
+
+// Scope stack stored as one array of entries, with the innermost visible entry
+// of every symbol found by indexing `heads` with the symbol ID
+struct Scope_Table {
+	Scope_Entry* entries;
+	u32 len;
+	u32 cap;
+
+	u32* scope_starts; // Index into entries where each open scope begins
+	u32 depth;
+	u32 depth_cap;
+
+	u32* heads; // Indexed by symbol
+	isize heads_len;
+
+	Mem_Allocator allocator;
+};
+
+enum Scope_Result {
+	Scope_Ok = 0,
+	Scope_Redeclared,
+	Scope_Out_Of_Memory,
+};
+
+#define SCOPE_ENTRY_NONE ((u32)0xffffffff)
+
+// Initialize interner, returns success status
+bool interner_init(Interner* in, Mem_Allocator allocator);
+
+// Destroy interner
+void interner_destroy(Interner* in);
+
+// Get symbol of a string, adding it if it was not seen before. Returns SYMBOL_NONE on allocation failure.
+Symbol intern(Interner* in, String s);
+
+// Get the string of a symbol
+static inline
+String symbol_string(Interner const* in, Symbol sym){
+	return in->strings[sym];
+}
+
+// Initialize table with the global scope open, returns success status
+bool scope_table_init(Scope_Table* t, Mem_Allocator allocator);
+
+// Destroy table
+void scope_table_destroy(Scope_Table* t);
+
+// Open a new scope, returns success status
+bool scope_push(Scope_Table* t);
+
+// Close innermost scope, dropping its declarations. The global scope is never closed.
+void scope_pop(Scope_Table* t);
+
+// Declare name in the innermost scope, shadowing declarations of outer scopes
+Scope_Result scope_declare(Scope_Table* t, Symbol name, u32 decl);
+
+// Find innermost visible declaration of name, NULL if there is none
+static inline
+Scope_Entry const* scope_lookup(Scope_Table const* t, Symbol name){
+	if((isize)name >= t->heads_len){ return NULL; }
+	u32 i = t->heads[name];
+	return i == SCOPE_ENTRY_NONE ? NULL : &t->entries[i];
+}
+
+// Find declaration of name in the innermost scope only, NULL if there is none
+static inline
+Scope_Entry const* scope_lookup_local(Scope_Table const* t, Symbol name){
+	Scope_Entry const* e = scope_lookup(t, name);
+	return (e != NULL && e->depth == t->depth) ? e : NULL;
+}
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#define INTERNER_MIN_CAP 256
+
+bool interner_init(Interner* in, Mem_Allocator allocator){
+	*in = (Interner){
+		.slots = New(u32, INTERNER_MIN_CAP * 2, allocator),
+		.slot_cap = INTERNER_MIN_CAP * 2,
+		.strings = New(String, INTERNER_MIN_CAP, allocator),
+		.hashes = New(u32, INTERNER_MIN_CAP, allocator),
+		.len = 1, // Slot 0 is SYMBOL_NONE
+		.cap = INTERNER_MIN_CAP,
+		.allocator = allocator,
+	};
+	if(in->slots == NULL || in->strings == NULL || in->hashes == NULL){
+		interner_destroy(in);
+		return false;
+	}
+	return true;
+}
+
+void interner_destroy(Interner* in){
+	for(isize i = 1; i < in->len; i += 1){
+		mem_free(in->allocator, (void*)in->strings[i].data);
+	}
+	mem_free(in->allocator, in->slots);
+	mem_free(in->allocator, in->strings);
+	mem_free(in->allocator, in->hashes);
+	*in = (Interner){0};
+}
+
+// Double the symbol arrays and the slot table, keeping load factor at or under 1/2
+static
+bool interner_grow(Interner* in){
+	isize new_cap = in->cap * 2;
+	isize new_slot_cap = new_cap * 2;
+
+	String* strings = New(String, new_cap, in->allocator);
+	u32* hashes = New(u32, new_cap, in->allocator);
+	u32* slots = New(u32, new_slot_cap, in->allocator);
+	if(strings == NULL || hashes == NULL || slots == NULL){
+		mem_free(in->allocator, strings);
+		mem_free(in->allocator, hashes);
+		mem_free(in->allocator, slots);
+		return false;
+	}
+
+	mem_copy(strings, in->strings, in->len * sizeof(String));
+	mem_copy(hashes, in->hashes, in->len * sizeof(u32));
+	for(isize sym = 1; sym < in->len; sym += 1){
+		isize i = hashes[sym] & (new_slot_cap - 1);
+		while(slots[i] != SYMBOL_NONE){ i = (i + 1) & (new_slot_cap - 1); }
+		slots[i] = sym;
+	}
+
+	mem_free(in->allocator, in->strings);
+	mem_free(in->allocator, in->hashes);
+	mem_free(in->allocator, in->slots);
+	in->strings = strings;
+	in->hashes = hashes;
+	in->slots = slots;
+	in->cap = new_cap;
+	in->slot_cap = new_slot_cap;
+	return true;
+}
+
+Symbol intern(Interner* in, String s){
+	u32 hash = (u32)hash128(s.data, s.len, 0).lo;
+	isize mask = in->slot_cap - 1;
+
+	isize i = hash & mask;
+	for(;;){
+		Symbol sym = in->slots[i];
+		if(sym == SYMBOL_NONE){ break; }
+		if(in->hashes[sym] == hash && str_eq(in->strings[sym], s)){ return sym; }
+		i = (i + 1) & mask;
+	}
+
+	if(in->len >= in->cap){
+		if(!interner_grow(in)){ return SYMBOL_NONE; }
+		mask = in->slot_cap - 1;
+		i = hash & mask;
+		while(in->slots[i] != SYMBOL_NONE){ i = (i + 1) & mask; }
+	}
+
+	byte* data = New(byte, Max(s.len, 1), in->allocator);
+	if(data == NULL){ return SYMBOL_NONE; }
+	mem_copy(data, s.data, s.len);
+
+	Symbol sym = in->len;
+	in->strings[sym] = (String){ .data = data, .len = s.len };
+	in->hashes[sym] = hash;
+	in->slots[i] = sym;
+	in->len += 1;
+	return sym;
+}
+
+#undef INTERNER_MIN_CAP
+
+#define SCOPE_TABLE_MIN_CAP 256
+#define SCOPE_TABLE_MIN_DEPTH 32
+
+bool scope_table_init(Scope_Table* t, Mem_Allocator allocator){
+	*t = (Scope_Table){
+		.entries = New(Scope_Entry, SCOPE_TABLE_MIN_CAP, allocator),
+		.cap = SCOPE_TABLE_MIN_CAP,
+		.scope_starts = New(u32, SCOPE_TABLE_MIN_DEPTH, allocator),
+		.depth_cap = SCOPE_TABLE_MIN_DEPTH,
+		.allocator = allocator,
+	};
+	if(t->entries == NULL || t->scope_starts == NULL){
+		scope_table_destroy(t);
+		return false;
+	}
+	return true;
+}
+
+void scope_table_destroy(Scope_Table* t){
+	mem_free(t->allocator, t->entries);
+	mem_free(t->allocator, t->scope_starts);
+	mem_free(t->allocator, t->heads);
+	*t = (Scope_Table){0};
+}
+
+bool scope_push(Scope_Table* t){
+	if(t->depth + 1 >= t->depth_cap){
+		u32 new_cap = t->depth_cap * 2;
+		u32* starts = New(u32, new_cap, t->allocator);
+		if(starts == NULL){ return false; }
+		mem_copy(starts, t->scope_starts, (t->depth + 1) * sizeof(u32));
+		mem_free(t->allocator, t->scope_starts);
+		t->scope_starts = starts;
+		t->depth_cap = new_cap;
+	}
+	t->depth += 1;
+	t->scope_starts[t->depth] = t->len;
+	return true;
+}
+
+void scope_pop(Scope_Table* t){
+	if(t->depth == 0){ return; }
+	u32 start = t->scope_starts[t->depth];
+
+	// Entries of a scope are contiguous, so unwinding touches only the popped
+	// tail and the heads it shadowed
+	for(u32 i = t->len; i > start; i -= 1){
+		Scope_Entry const* e = &t->entries[i - 1];
+		t->heads[e->name] = e->shadowed;
+	}
+	t->len = start;
+	t->depth -= 1;
+}
+
+// Make heads large enough to be indexed by name
+static
+bool scope_reserve_heads(Scope_Table* t, Symbol name){
+	if((isize)name < t->heads_len){ return true; }
+
+	isize new_len = Max(t->heads_len * 2, Max((isize)name + 1, SCOPE_TABLE_MIN_CAP));
+	u32* heads = New(u32, new_len, t->allocator);
+	if(heads == NULL){ return false; }
+	mem_copy(heads, t->heads, t->heads_len * sizeof(u32));
+	mem_set(&heads[t->heads_len], 0xff, (new_len - t->heads_len) * sizeof(u32));
+
+	mem_free(t->allocator, t->heads);
+	t->heads = heads;
+	t->heads_len = new_len;
+	return true;
+}
+
+Scope_Result scope_declare(Scope_Table* t, Symbol name, u32 decl){
+	if(!scope_reserve_heads(t, name)){ return Scope_Out_Of_Memory; }
+
+	u32 head = t->heads[name];
+	if(head != SCOPE_ENTRY_NONE && t->entries[head].depth == t->depth){
+		return Scope_Redeclared;
+	}
+
+	if(t->len >= t->cap){
+		u32 new_cap = t->cap * 2;
+		Scope_Entry* entries = New(Scope_Entry, new_cap, t->allocator);
+		if(entries == NULL){ return Scope_Out_Of_Memory; }
+		mem_copy(entries, t->entries, t->len * sizeof(Scope_Entry));
+		mem_free(t->allocator, t->entries);
+		t->entries = entries;
+		t->cap = new_cap;
+	}
+
+	t->entries[t->len] = (Scope_Entry){
+		.name = name,
+		.shadowed = head,
+		.depth = t->depth,
+		.decl = decl,
+	};
+	t->heads[name] = t->len;
+	t->len += 1;
+	return Scope_Ok;
+}
+
+#undef SCOPE_TABLE_MIN_CAP
+#undef SCOPE_TABLE_MIN_DEPTH
+#endif
@@ -0,0 +1,533 @@
+#pragma once
+
+#include "base.h"
+#include "lexer.h"
+
+///- Interface -----------------------------------------------------------------
+typedef struct Text_Node Text_Node;
+typedef struct Text_Buffer Text_Buffer;
+typedef struct Text_Snapshot Text_Snapshot;
+typedef struct Text_Lexer Text_Lexer;
+
+// Piece of the text, a run of bytes of the original source or of inserted
+// text. Pieces are the nodes of a treap ordered by position in the text. A
+// node shared with a snapshot is never changed again, edits copy the path to
+// it instead.
+struct Text_Node {
+	Text_Node* left;
+	Text_Node* right;
+	byte const* data;
+	isize len;    // Of the piece
+	isize total;  // Of the subtree
+	u32 priority;
+	u32 refs;     // Updated atomically, snapshots may be released by other threads
+};
+
+// Version of a buffer's text that edits do not affect
+struct Text_Snapshot {
+	Text_Node* root;
+	isize len;
+	Mem_Allocator allocator;
+};
+
+// Editable text as a piece table: pieces of the original source and of an
+// append only store of inserted bytes. Inserts and deletes are O(log n) and
+// keep at most 2 more pieces, so memory grows with the bytes inserted rather
+// than with the size of the text. Consecutive inserts (typing) extend a
+// single piece.
+struct Text_Buffer {
+	Text_Node* root;
+	isize len;
+
+	byte** blocks;      // Store of inserted bytes, blocks never move
+	isize blocks_len;
+	isize blocks_cap;
+	isize block_used;   // Of the last block
+	isize block_size;
+
+	Text_Node* reserve; // Free nodes taken by edits, linked through `right`
+	isize reserve_len;
+	u64 seed;
+	Mem_Allocator allocator;
+};
+
+// Tokens of a snapshot, lexed chunk by chunk without flattening the text
+struct Text_Lexer {
+	Text_Snapshot const* text;
+	Lexer lexer;        // Over the current chunk
+	isize chunk_start;
+	Source_Loc base;
+	Source_Loc eof;     // Location of the EOF token, once done
+	bool done;
+	bool failed;        // Ran out of memory, the EOF token came early
+	byte* scratch;      // Tokens straddling chunks are lexed from a copy
+	isize scratch_cap;
+	Mem_Allocator allocator;
+};
+
+// Initialize buffer holding source, which is not copied and must outlive the
+// buffer and its snapshots. Returns success status.
+bool text_buffer_init(Text_Buffer* b, String source, Mem_Allocator allocator);
+
+// Destroy buffer, its snapshots must have been released
+void text_buffer_destroy(Text_Buffer* b);
+
+// Insert text at byte offset pos. Returns success status, the buffer is
+// unchanged on failure.
+bool text_buffer_insert(Text_Buffer* b, isize pos, String text);
+
+// Delete len bytes at offset pos. Returns success status, the buffer is
+// unchanged on failure.
+bool text_buffer_delete(Text_Buffer* b, isize pos, isize len);
+
+// Current text in O(1). Snapshots can be read and released by other threads
+// while the buffer is edited, as long as the allocator is thread safe.
+Text_Snapshot text_buffer_snapshot(Text_Buffer* b);
+
+// Release a snapshot
+void text_snapshot_release(Text_Snapshot* s);
+
+// Contiguous bytes of the text from offset to the end of their piece, false
+// at the end of the text. Chunks are visited with
+//   for(isize at = 0; text_snapshot_chunk(&s, at, &chunk); at += chunk.len)
+bool text_snapshot_chunk(Text_Snapshot const* s, isize offset, String* chunk);
+
+// Copy len bytes at offset into out, returns number of bytes copied (fewer
+// at the end of the text)
+isize text_snapshot_copy(Text_Snapshot const* s, isize offset, isize len, byte* out);
+
+// Lex text, which must be smaller than 4 GiB and stay alive, with token
+// locations starting at base. Returns success status.
+bool text_lexer_init(Text_Lexer* tl, Text_Snapshot const* text, Source_Loc base, Mem_Allocator allocator);
+
+// Destroy lexer
+void text_lexer_destroy(Text_Lexer* tl);
+
+// Next token, the same lexer_next gives on the whole text at once
+Token text_lexer_next(Text_Lexer* tl);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#define TEXT_BLOCK_SIZE (64 * 1024)
+
+// Bytes after a token lexer_next may look at to decide where it ends
+#define TEXT_LEXER_LOOKAHEAD 4
+#define TEXT_LEXER_STITCH 64
+
+static inline
+isize text_total(Text_Node const* n){
+	return n != NULL ? n->total : 0;
+}
+
+static inline
+void text_update(Text_Node* n){
+	n->total = text_total(n->left) + n->len + text_total(n->right);
+}
+
+static inline
+void text_node_retain(Text_Node* n){
+	if(n != NULL){ __atomic_add_fetch(&n->refs, 1, __ATOMIC_RELAXED); }
+}
+
+static
+void text_node_release(Text_Node* n, Mem_Allocator allocator){
+	while(n != NULL){
+		if(__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) != 0){ return; }
+		Text_Node* right = n->right;
+		text_node_release(n->left, allocator);
+		mem_free(allocator, n);
+		n = right;
+	}
+}
+
+// Make sure the next `count` nodes can be taken without allocating, so an
+// edit cannot fail halfway
+static
+bool text_reserve(Text_Buffer* b, isize count){
+	while(b->reserve_len < count){
+		Text_Node* n = New(Text_Node, 1, b->allocator);
+		if(n == NULL){ return false; }
+		n->right = b->reserve;
+		b->reserve = n;
+		b->reserve_len += 1;
+	}
+	return true;
+}
+
+static
+Text_Node* text_node_take(Text_Buffer* b){
+	panic_assert(b->reserve != NULL, "Text buffer edit took more nodes than reserved");
+	Text_Node* n = b->reserve;
+	b->reserve = n->right;
+	b->reserve_len -= 1;
+	*n = (Text_Node){ .refs = 1 };
+	return n;
+}
+
+static
+u32 text_priority(Text_Buffer* b){
+	b->seed ^= b->seed << 13;
+	b->seed ^= b->seed >> 7;
+	b->seed ^= b->seed << 17;
+	return (u32)(b->seed >> 32);
+}
+
+// Node that only the caller holds: n itself, or a copy of it if it is shared
+static
+Text_Node* text_own(Text_Buffer* b, Text_Node* n){
+	if(__atomic_load_n(&n->refs, __ATOMIC_ACQUIRE) == 1){ return n; }
+	// Field by field, refs may be changing under another thread
+	Text_Node* copy = text_node_take(b);
+	copy->left = n->left;
+	copy->right = n->right;
+	copy->data = n->data;
+	copy->len = n->len;
+	copy->total = n->total;
+	copy->priority = n->priority;
+	text_node_retain(copy->left);
+	text_node_retain(copy->right);
+	text_node_release(n, b->allocator);
+	return copy;
+}
+
+// Nodes on the path text_split takes to pos
+static
+isize text_depth(Text_Node const* n, isize pos){
+	isize depth = 0;
+	while(n != NULL){
+		depth += 1;
+		isize left = text_total(n->left);
+		if(pos <= left){
+			n = n->left;
+		}
+		else if(pos >= left + n->len){
+			pos -= left + n->len;
+			n = n->right;
+		}
+		else {
+			break;
+		}
+	}
+	return depth;
+}
+
+// Split t into the text before pos and the text after it. Takes over the
+// reference to t, every node on the path is owned afterwards. Takes a node
+// for each shared node on the path, plus one if pos falls inside a piece.
+static
+void text_split(Text_Buffer* b, Text_Node* t, isize pos, Text_Node** l, Text_Node** r){
+	if(t == NULL){
+		*l = NULL;
+		*r = NULL;
+		return;
+	}
+	t = text_own(b, t);
+	isize left = text_total(t->left);
+	if(pos <= left){
+		text_split(b, t->left, pos, l, &t->left);
+		text_update(t);
+		*r = t;
+	}
+	else if(pos >= left + t->len){
+		text_split(b, t->right, pos - left - t->len, &t->right, r);
+		text_update(t);
+		*l = t;
+	}
+	else {
+		// Same priority, the tail takes the place of t in r
+		isize head = pos - left;
+		Text_Node* tail = text_node_take(b);
+		tail->data = t->data + head;
+		tail->len = t->len - head;
+		tail->priority = t->priority;
+		tail->right = t->right;
+		t->len = head;
+		t->right = NULL;
+		text_update(tail);
+		text_update(t);
+		*l = t;
+		*r = tail;
+	}
+}
+
+// Concatenate l and r, taking over both references. Only walks the right
+// spine of l and the left spine of r, which are owned after a split.
+static
+Text_Node* text_merge(Text_Buffer* b, Text_Node* l, Text_Node* r){
+	if(l == NULL){ return r; }
+	if(r == NULL){ return l; }
+	if(l->priority > r->priority){
+		l = text_own(b, l);
+		l->right = text_merge(b, l->right, r);
+		text_update(l);
+		return l;
+	}
+	r = text_own(b, r);
+	r->left = text_merge(b, l, r->left);
+	text_update(r);
+	return r;
+}
+
+// Copy text to the store, returns where it went or NULL when out of memory
+static
+byte const* text_store(Text_Buffer* b, String text){
+	if(b->blocks_len == 0 || b->block_size - b->block_used < text.len){
+		if(b->blocks_len >= b->blocks_cap){
+			isize new_cap = Max(b->blocks_cap * 2, 16);
+			byte** blocks = New(byte*, new_cap, b->allocator);
+			if(blocks == NULL){ return NULL; }
+			mem_copy(blocks, b->blocks, b->blocks_len * sizeof(byte*));
+			mem_free(b->allocator, b->blocks);
+			b->blocks = blocks;
+			b->blocks_cap = new_cap;
+		}
+		isize size = Max(TEXT_BLOCK_SIZE, text.len);
+		byte* block = New(byte, size, b->allocator);
+		if(block == NULL){ return NULL; }
+		b->blocks[b->blocks_len] = block;
+		b->blocks_len += 1;
+		b->block_used = 0;
+		b->block_size = size;
+	}
+	byte* dst = &b->blocks[b->blocks_len - 1][b->block_used];
+	mem_copy(dst, text.data, text.len);
+	b->block_used += text.len;
+	return dst;
+}
+
+// Grow the last piece of l over the len bytes at data if they directly follow
+// it in the store. Returns false if they do not.
+static
+bool text_extend_last(Text_Buffer* b, Text_Node* l, byte const* data, isize len){
+	// The start of a block follows nothing of the store
+	if(l == NULL || data == b->blocks[b->blocks_len - 1]){ return false; }
+	Text_Node* last = l;
+	while(last->right != NULL){
+		last = last->right;
+	}
+	if(last->data + last->len != data){ return false; }
+
+	last->len += len;
+	for(Text_Node* n = l; n != NULL; n = n->right){
+		n->total += len;
+	}
+	return true;
+}
+
+bool text_buffer_init(Text_Buffer* b, String source, Mem_Allocator allocator){
+	*b = (Text_Buffer){
+		.seed = 0x9e3779b97f4a7c15ull,
+		.allocator = allocator,
+	};
+	if(source.len == 0){ return true; }
+	if(!text_reserve(b, 1)){ return false; }
+
+	Text_Node* n = text_node_take(b);
+	n->data = source.data;
+	n->len = source.len;
+	n->priority = text_priority(b);
+	text_update(n);
+	b->root = n;
+	b->len = source.len;
+	return true;
+}
+
+void text_buffer_destroy(Text_Buffer* b){
+	text_node_release(b->root, b->allocator);
+	while(b->reserve != NULL){
+		Text_Node* next = b->reserve->right;
+		mem_free(b->allocator, b->reserve);
+		b->reserve = next;
+	}
+	for(isize i = 0; i < b->blocks_len; i += 1){
+		mem_free(b->allocator, b->blocks[i]);
+	}
+	mem_free(b->allocator, b->blocks);
+	*b = (Text_Buffer){0};
+}
+
+bool text_buffer_insert(Text_Buffer* b, isize pos, String text){
+	if(pos < 0 || pos > b->len){ return false; }
+	if(text.len == 0){ return true; }
+
+	if(!text_reserve(b, text_depth(b->root, pos) + 2)){ return false; }
+	byte const* data = text_store(b, text);
+	if(data == NULL){ return false; }
+
+	Text_Node *l, *r;
+	text_split(b, b->root, pos, &l, &r);
+	if(!text_extend_last(b, l, data, text.len)){
+		Text_Node* n = text_node_take(b);
+		n->data = data;
+		n->len = text.len;
+		n->priority = text_priority(b);
+		text_update(n);
+		l = text_merge(b, l, n);
+	}
+	b->root = text_merge(b, l, r);
+	b->len += text.len;
+	return true;
+}
+
+bool text_buffer_delete(Text_Buffer* b, isize pos, isize len){
+	if(pos < 0 || len < 0 || pos + len > b->len){ return false; }
+	if(len == 0){ return true; }
+
+	// The second split runs on what the first left, whose paths are no
+	// longer than the ones they come from
+	isize depth = text_depth(b->root, pos) + text_depth(b->root, pos + len);
+	if(!text_reserve(b, depth + 4)){ return false; }
+
+	Text_Node *l, *m, *r;
+	text_split(b, b->root, pos, &l, &r);
+	text_split(b, r, len, &m, &r);
+	text_node_release(m, b->allocator);
+	b->root = text_merge(b, l, r);
+	b->len -= len;
+	return true;
+}
+
+Text_Snapshot text_buffer_snapshot(Text_Buffer* b){
+	text_node_retain(b->root);
+	return (Text_Snapshot){
+		.root = b->root,
+		.len = b->len,
+		.allocator = b->allocator,
+	};
+}
+
+void text_snapshot_release(Text_Snapshot* s){
+	text_node_release(s->root, s->allocator);
+	*s = (Text_Snapshot){0};
+}
+
+bool text_snapshot_chunk(Text_Snapshot const* s, isize offset, String* chunk){
+	*chunk = (String){0};
+	if(offset < 0 || offset >= s->len){ return false; }
+
+	Text_Node const* n = s->root;
+	while(n != NULL){
+		isize left = text_total(n->left);
+		if(offset < left){
+			n = n->left;
+		}
+		else if(offset < left + n->len){
+			offset -= left;
+			*chunk = str_from_bytes(n->data + offset, n->len - offset);
+			return true;
+		}
+		else {
+			offset -= left + n->len;
+			n = n->right;
+		}
+	}
+	return false;
+}
+
+isize text_snapshot_copy(Text_Snapshot const* s, isize offset, isize len, byte* out){
+	isize copied = 0;
+	String chunk;
+	while(copied < len && text_snapshot_chunk(s, offset + copied, &chunk)){
+		isize n = Min(chunk.len, len - copied);
+		mem_copy(&out[copied], chunk.data, n);
+		copied += n;
+	}
+	return copied;
+}
+
+// Continue lexing at offset, returns false at the end of the text
+static
+bool text_lexer_load(Text_Lexer* tl, isize offset){
+	String chunk;
+	if(!text_snapshot_chunk(tl->text, offset, &chunk)){
+		tl->done = true;
+		tl->eof = tl->base + (Source_Loc)tl->text->len;
+		return false;
+	}
+	tl->lexer = lexer_make_at(chunk, tl->base + (Source_Loc)offset);
+	tl->chunk_start = offset;
+	return true;
+}
+
+bool text_lexer_init(Text_Lexer* tl, Text_Snapshot const* text, Source_Loc base, Mem_Allocator allocator){
+	if(text->len >= (isize)UINT32_MAX){ return false; }
+	*tl = (Text_Lexer){
+		.text = text,
+		.base = base,
+		.allocator = allocator,
+	};
+	text_lexer_load(tl, 0);
+	return true;
+}
+
+void text_lexer_destroy(Text_Lexer* tl){
+	mem_free(tl->allocator, tl->scratch);
+	*tl = (Text_Lexer){0};
+}
+
+// Lex the token starting at offset `start` from a copy of the text, taking
+// in more of it until the token ends far enough from the end of the copy
+static
+Token text_lexer_straddling(Text_Lexer* tl, isize start, isize chunk_end){
+	isize want = chunk_end - start + TEXT_LEXER_STITCH;
+	for(;;){
+		want = Min(want, tl->text->len - start);
+		if(want > tl->scratch_cap){
+			isize new_cap = Max(want, tl->scratch_cap * 2);
+			byte* scratch = New(byte, new_cap, tl->allocator);
+			if(scratch == NULL){
+				tl->done = true;
+				tl->failed = true;
+				tl->eof = tl->base + (Source_Loc)start;
+				return (Token){ .kind = Tk_EOF, .loc = tl->eof };
+			}
+			mem_free(tl->allocator, tl->scratch);
+			tl->scratch = scratch;
+			tl->scratch_cap = new_cap;
+		}
+		text_snapshot_copy(tl->text, start, want, tl->scratch);
+
+		Lexer lex = lexer_make_at(str_from_bytes(tl->scratch, want), tl->base + (Source_Loc)start);
+		Token tk = lexer_next(&lex);
+		if(want - (isize)tk.len >= TEXT_LEXER_LOOKAHEAD || start + want == tl->text->len){
+			text_lexer_load(tl, start + tk.len);
+			return tk;
+		}
+		want *= 2;
+	}
+}
+
+Token text_lexer_next(Text_Lexer* tl){
+	for(;;){
+		if(tl->done){
+			return (Token){ .kind = Tk_EOF, .loc = tl->eof };
+		}
+
+		Token tk = lexer_next(&tl->lexer);
+		isize chunk_end = tl->chunk_start + tl->lexer.source.len;
+		if(tk.kind == Tk_EOF){
+			if(tl->lexer.iter.current < tl->lexer.source.len){
+				// A NUL byte ends the text, like it does for lexer_next
+				tl->done = true;
+				tl->eof = tk.loc;
+				return tk;
+			}
+			text_lexer_load(tl, chunk_end);
+			continue;
+		}
+
+		// The lexer did not look past the chunk, the token is the same as
+		// in the whole text
+		isize end = (isize)(tk.loc - tl->base) + tk.len;
+		if(chunk_end - end >= TEXT_LEXER_LOOKAHEAD || chunk_end == tl->text->len){
+			return tk;
+		}
+		return text_lexer_straddling(tl, tk.loc - tl->base, chunk_end);
+	}
+}
+
+#undef TEXT_BLOCK_SIZE
+#undef TEXT_LEXER_LOOKAHEAD
+#undef TEXT_LEXER_STITCH
+#endif
@@ -3,57 +3,99 @@
 #include "base.h"
 #include "lexer.h"
 
-static bool token_is_literal(TokenKind k){
-	static const TokenKind literals[] = {
-		Tk_Int, Tk_Real, Tk_Rune, Tk_String, Tk_Nil, Tk_True, Tk_False,
-	};
-	for(isize i = 0; i < (sizeof(literals) / sizeof(TokenKind)); i += 1){
-		if(k == literals[i]){ return true; }
-	}
-	return false;
+enum Token_Class {
+	Token_Class_Keyword  = 1 << 0,
+	Token_Class_Operator = 1 << 1,
+	Token_Class_Literal  = 1 << 2,
+
+	// Formatting hints
+	Token_Class_No_Space_After  = 1 << 3,
+	Token_Class_No_Space_Before = 1 << 4,
+};
+
+#define TOKEN_CLASS_KEYWORD(Name) (Token_Class_Keyword | \
+	((Tk_##Name == Tk_True || Tk_##Name == Tk_False || Tk_##Name == Tk_Nil) ? Token_Class_Literal : 0))
+
+#define TOKEN_CLASS_OPERATOR(Name) (Token_Class_Operator | \
+	((Tk_##Name == Tk_Paren_Open || Tk_##Name == Tk_Square_Open) ? Token_Class_No_Space_After : 0) | \
+	((Tk_##Name == Tk_Paren_Close || Tk_##Name == Tk_Square_Close || Tk_##Name == Tk_Comma || \
+	  Tk_##Name == Tk_Semicolon) ? Token_Class_No_Space_Before : 0))
+
+// Classification of every token kind, as a set of Token_Class flags
+static const u8 token_class_table[Tk_EOF + 1] = {
+	#define X(Name, Str) [Tk_##Name] = TOKEN_CLASS_KEYWORD(Name),
+	KUURU_KEYWORD_TABLE
+	#undef X
+	#define X(Name, Str) [Tk_##Name] = TOKEN_CLASS_OPERATOR(Name),
+	KUURU_OPERATOR_TABLE
+	#undef X
+	[Tk_Int] = Token_Class_Literal,
+	[Tk_Real] = Token_Class_Literal,
+	[Tk_String] = Token_Class_Literal,
+	[Tk_Rune] = Token_Class_Literal,
+};
+
+#undef TOKEN_CLASS_KEYWORD
+#undef TOKEN_CLASS_OPERATOR
+
+// Text of keywords and operators
+static const String token_text_table[Tk_EOF + 1] = {
+	#define X(Name, Str) [Tk_##Name] = { .len = sizeof(Str) - 1, .data = (byte const*)Str },
+	KUURU_KEYWORD_TABLE
+	KUURU_OPERATOR_TABLE
+	#undef X
+};
+
+static inline
+u8 token_class(TokenKind k){
+	return ((u32)k <= Tk_EOF) ? token_class_table[k] : 0;
 }
 
-static bool token_is_keyword(TokenKind k){
-	static const TokenKind keywords[] = {
-		#define X(Name, Str) Tk_##Name,
-		KUURU_KEYWORD_TABLE
-		#undef X
-	};
-	for(isize i = 0; i < (sizeof(keywords) / sizeof(TokenKind)); i += 1){
-		if(k == keywords[i]){ return true; }
-	}
-	return false;
+static inline
+bool token_is_literal(TokenKind k){
+	return (token_class(k) & Token_Class_Literal) != 0;
 }
 
-static void format_token_list(Bytes_Buffer* bb, Token* tokens, isize count){
-	static const cstring keyword_to_str[] = {
-		#define X(Name, Str) [Tk_##Name] = Str,
-		KUURU_KEYWORD_TABLE
-		#undef X
-	};
+static inline
+bool token_is_keyword(TokenKind k){
+	return (token_class(k) & Token_Class_Keyword) != 0;
+}
 
-	static const cstring lit_to_str[] = {
-		[Tk_Int] = "Int:",
-		[Tk_Real] = "Real:",
-		[Tk_String] = "String:",
-		[Tk_Rune] = "Rune:",
+static inline
+bool token_is_operator(TokenKind k){
+	return (token_class(k) & Token_Class_Operator) != 0;
+}
+
+// Write tokens out, their locations are offsets into source
+static inline
+void format_token_list(Bytes_Buffer* bb, String source, Token* tokens, isize count){
+	static const String lit_to_str[] = {
+		[Tk_Int]    = { .len = 4, .data = (byte const*)"Int:" },
+		[Tk_Real]   = { .len = 5, .data = (byte const*)"Real:" },
+		[Tk_String] = { .len = 7, .data = (byte const*)"String:" },
+		[Tk_Rune]   = { .len = 5, .data = (byte const*)"Rune:" },
 	};
 
 	for(isize i = 0; i < count; i += 1){
 		Token tk = tokens[i];
-		if(tk.kind == Tk_Identifier){
-			buffer_write(bb, tk.lexeme.data, tk.lexeme.len);
-		}
-		else if(token_is_keyword(tk.kind)){
-			cstring kw = keyword_to_str[tk.kind];
-			buffer_write(bb, (byte*)(kw), cstring_len(kw));
+		u8 class = token_class(tk.kind);
+
+		String prefix = {0};
+		String text = str_from_bytes(&source.data[tk.loc], tk.len);
+		if(class & (Token_Class_Keyword | Token_Class_Operator)){
+			text = token_text_table[tk.kind];
 		}
-		else if(token_is_literal(tk.kind)){
-			cstring prefix = lit_to_str[tk.kind];
-			buffer_write(bb, (byte*)(prefix), cstring_len(prefix));
-			buffer_write(bb, tk.lexeme.data, tk.lexeme.len);
+		else if(class & Token_Class_Literal){
+			prefix = lit_to_str[tk.kind];
 		}
-		buffer_write(bb, (byte*)(" "), 1);
+
+		// One reservation per token: prefix, text and the separator
+		byte* out = buffer_reserve(bb, prefix.len + text.len + 1);
+		if(out == NULL){ return; }
+		mem_copy(out, prefix.data, prefix.len);
+		mem_copy(&out[prefix.len], text.data, text.len);
+		out[prefix.len + text.len] = ' ';
+		buffer_commit(bb, prefix.len + text.len + 1);
 	}
 }
 
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "base.h"
+
+///- Interface -----------------------------------------------------------------
+typedef enum Value_Kind Value_Kind;
+typedef struct Value Value;
+typedef struct Gc_Object Gc_Object;
+typedef struct Gc_Int Gc_Int;
+
+enum Value_Kind {
+	Val_Nil = 0,
+	Val_Bool,
+	Val_Int,
+	Val_Real,
+	Val_Object, // Managed by the runtime heap, see gc.h
+};
+
+// Runtime values are a single 64-bit word. Reals are stored as they are, with
+// every NaN turned into one canonical quiet NaN, which leaves the negative
+// quiet NaN space free for the other kinds, tagged by the top 16 bits:
+//   0xfff9  nil
+//   0xfffa  bool, payload is 0 or 1
+//   0xfffb  int in [VALUE_INT_MIN, VALUE_INT_MAX], payload is its low 48 bits
+//   0xfffc  pointer to a heap object
+//   0xfffd  pointer to a boxed int (Gc_Int), for the ints that do not fit inline
+// Integers keep their 64-bit wrapping semantics, only their storage differs.
+struct Value {
+	u64 bits;
+};
+
+#define VALUE_TAG_SHIFT    48
+#define VALUE_PAYLOAD_MASK ((u64)0x0000ffffffffffff)
+
+#define VALUE_TAG_NIL     ((u64)0xfff9)
+#define VALUE_TAG_BOOL    ((u64)0xfffa)
+#define VALUE_TAG_INT     ((u64)0xfffb)
+#define VALUE_TAG_OBJECT  ((u64)0xfffc)
+#define VALUE_TAG_BIG_INT ((u64)0xfffd)
+
+#define VALUE_NIL_BITS   (VALUE_TAG_NIL << VALUE_TAG_SHIFT)
+#define VALUE_FALSE_BITS (VALUE_TAG_BOOL << VALUE_TAG_SHIFT)
+#define VALUE_TRUE_BITS  (VALUE_FALSE_BITS | 1)
+#define VALUE_INT_BITS   (VALUE_TAG_INT << VALUE_TAG_SHIFT)
+#define VALUE_NAN_BITS   ((u64)0x7ff8000000000000)
+
+#define VALUE_INT_MIN (-((i64)1 << 47))
+#define VALUE_INT_MAX (((i64)1 << 47) - 1)
+
+// Header of every heap object
+struct Gc_Object {
+	u8 kind;
+	u8 flags;
+	u32 size; // In bytes, header included
+	// Old objects: next object of the old generation.
+	// Forwarded nursery objects: the promoted copy.
+	Gc_Object* link;
+};
+
+// Integer out of the inline range
+struct Gc_Int {
+	Gc_Object header;
+	i64 value;
+};
+
+static inline
+u64 value_tag(Value v){
+	return v.bits >> VALUE_TAG_SHIFT;
+}
+
+static inline
+bool value_is_real(Value v){
+	return value_tag(v) <= 0xfff8;
+}
+
+static inline
+Value_Kind value_kind(Value v){
+	static const u8 kinds[8] = {
+		[VALUE_TAG_NIL - 0xfff8] = Val_Nil,
+		[VALUE_TAG_BOOL - 0xfff8] = Val_Bool,
+		[VALUE_TAG_INT - 0xfff8] = Val_Int,
+		[VALUE_TAG_OBJECT - 0xfff8] = Val_Object,
+		[VALUE_TAG_BIG_INT - 0xfff8] = Val_Int,
+	};
+	u64 tag = value_tag(v);
+	return value_is_real(v) ? Val_Real : (Value_Kind)kinds[tag - 0xfff8];
+}
+
+static inline
+Value value_nil(void){
+	return (Value){ VALUE_NIL_BITS };
+}
+
+static inline
+Value value_bool(bool b){
+	return (Value){ VALUE_FALSE_BITS | (u64)(b != 0) };
+}
+
+static inline
+Value value_real(f64 x){
+	Value v;
+	if(x != x){ return (Value){ VALUE_NAN_BITS }; }
+	mem_copy(&v.bits, &x, sizeof(x));
+	return v;
+}
+
+// Can i be stored inline?
+static inline
+bool value_int_fits(i64 i){
+	return i >= VALUE_INT_MIN && i <= VALUE_INT_MAX;
+}
+
+// Inline int, i must fit (see value_int_fits)
+static inline
+Value value_small_int(i64 i){
+	return (Value){ VALUE_INT_BITS | ((u64)i & VALUE_PAYLOAD_MASK) };
+}
+
+static inline
+Value value_object(Gc_Object* o){
+	return (Value){ (VALUE_TAG_OBJECT << VALUE_TAG_SHIFT) | (u64)(uintptr)o };
+}
+
+static inline
+Value value_big_int(Gc_Int* o){
+	return (Value){ (VALUE_TAG_BIG_INT << VALUE_TAG_SHIFT) | (u64)(uintptr)o };
+}
+
+static inline
+bool value_is_small_int(Value v){
+	return value_tag(v) == VALUE_TAG_INT;
+}
+
+// Are a and b both inline ints? (one branch for the pair)
+static inline
+bool value_both_small_ints(Value a, Value b){
+	return (((a.bits ^ VALUE_INT_BITS) | (b.bits ^ VALUE_INT_BITS)) >> VALUE_TAG_SHIFT) == 0;
+}
+
+// Does v point to a heap object (including boxed ints)?
+static inline
+bool value_is_ref(Value v){
+	u64 tag = value_tag(v);
+	return tag == VALUE_TAG_OBJECT || tag == VALUE_TAG_BIG_INT;
+}
+
+// Heap object of a reference
+static inline
+Gc_Object* value_ref(Value v){
+	return (Gc_Object*)(uintptr)(v.bits & VALUE_PAYLOAD_MASK);
+}
+
+// Same reference kind as v, pointing to o instead
+static inline
+Value value_with_ref(Value v, Gc_Object* o){
+	return (Value){ (v.bits & ~VALUE_PAYLOAD_MASK) | (u64)(uintptr)o };
+}
+
+static inline
+bool value_as_bool(Value v){
+	return (v.bits & 1) != 0;
+}
+
+static inline
+i64 value_as_small_int(Value v){
+	return (i64)(v.bits << 16) >> 16;
+}
+
+// Inline int shifted left by 16, its tag shifted out. Adding or subtracting
+// two of them overflows exactly when the result does not fit inline.
+static inline
+i64 value_shifted_int(Value v){
+	return (i64)(v.bits << 16);
+}
+
+static inline
+i64 value_as_int(Value v){
+	if(value_is_small_int(v)){ return value_as_small_int(v); }
+	return ((Gc_Int const*)value_ref(v))->value;
+}
+
+static inline
+f64 value_as_real(Value v){
+	f64 x;
+	mem_copy(&x, &v.bits, sizeof(x));
+	return x;
+}
+
+static inline
+Gc_Object* value_as_object(Value v){
+	return value_ref(v);
+}
+
+static inline
+bool value_truthy(Value v){
+	return v.bits != VALUE_NIL_BITS && v.bits != VALUE_FALSE_BITS;
+}
+
+// Equality as in the language: reals compare as reals, ints by value
+// (whether stored inline or not), everything else by identity
+static inline
+bool value_eq(Value a, Value b){
+	if(a.bits == b.bits){ return a.bits != VALUE_NAN_BITS; }
+	// Otherwise only reals (0.0 and -0.0) and boxed ints can still be equal,
+	// ints are only boxed when they do not fit inline
+	if(value_is_real(a) && value_is_real(b)){ return value_as_real(a) == value_as_real(b); }
+	if(value_tag(a) == VALUE_TAG_BIG_INT && value_tag(b) == VALUE_TAG_BIG_INT){
+		return value_as_int(a) == value_as_int(b);
+	}
+	return false;
+}
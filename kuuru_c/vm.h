@@ -0,0 +1,1045 @@
+#pragma once
+
+#include "base.h"
+#include "value.h"
+#include "gc.h"
+
+///- Interface -----------------------------------------------------------------
+typedef u32 Instruction;
+typedef enum Opcode Opcode;
+typedef enum Vm_Result Vm_Result;
+typedef struct Vm_Function Vm_Function;
+typedef struct Vm_Program Vm_Program;
+typedef struct Vm_Frame Vm_Frame;
+typedef struct Vm_Field_Cache Vm_Field_Cache;
+typedef struct Vm_Cache_Stats Vm_Cache_Stats;
+typedef struct Vm Vm;
+
+// Compiled code of a function, runs on the frame's registers starting at pc.
+// Returns -1 after returning (with the result in base[0]), otherwise the pc
+// where the interpreter has to resume.
+typedef i64 (*Vm_Jit_Entry)(Value* base, i64 pc);
+
+// Instructions are 32 bits wide, in one of these layouts:
+//   ABC:  [ op:8 | a:8 | b:8 | c:8 ]
+//   ABx:  [ op:8 | a:8 | bx:16 ]   (sbx is bx reinterpreted as signed)
+// Branching superinstructions (*_Branch, For_Loop) take their offset from the
+// Jump that must follow them, the offset of jumps is relative to the
+// instruction after the jump. N is the program's table of field names.
+#define KUURU_OPCODE_TABLE \
+	X(Nop)           /* */ \
+	X(Load_Const)    /* R[a] = K[bx] */ \
+	X(Load_Nil)      /* R[a] = nil */ \
+	X(Load_Bool)     /* R[a] = bool(b) */ \
+	X(Load_Int)      /* R[a] = sbx */ \
+	X(Move)          /* R[a] = R[b] */ \
+	X(Add)           /* R[a] = R[b] + R[c] */ \
+	X(Sub)           /* R[a] = R[b] - R[c] */ \
+	X(Mul)           /* R[a] = R[b] * R[c] */ \
+	X(Div)           /* R[a] = R[b] / R[c] */ \
+	X(Mod)           /* R[a] = R[b] % R[c] */ \
+	X(Bit_And)       /* R[a] = R[b] & R[c] */ \
+	X(Bit_Or)        /* R[a] = R[b] | R[c] */ \
+	X(Bit_Xor)       /* R[a] = R[b] ~ R[c] */ \
+	X(Neg)           /* R[a] = -R[b] */ \
+	X(Bit_Not)       /* R[a] = ~R[b] */ \
+	X(Not)           /* R[a] = !R[b] */ \
+	X(Eq)            /* R[a] = R[b] == R[c] */ \
+	X(Lt)            /* R[a] = R[b] < R[c] */ \
+	X(Lte)           /* R[a] = R[b] <= R[c] */ \
+	X(Jump)          /* pc += sbx */ \
+	X(Jump_If)       /* if R[a] then pc += sbx */ \
+	X(Jump_If_Not)   /* if not R[a] then pc += sbx */ \
+	X(Add_Imm)       /* R[a] = R[b] + (i8)c */ \
+	X(Eq_Branch)     /* if (R[a] == R[b]) == c then jump */ \
+	X(Lt_Branch)     /* if (R[a] < R[b]) == c then jump */ \
+	X(Lte_Branch)    /* if (R[a] <= R[b]) == c then jump */ \
+	X(For_Loop)      /* R[a] += 1; if R[a] < R[b] then jump */ \
+	X(New_Record)    /* R[a] = record with room for b fields inline */ \
+	X(Get_Field)     /* R[a] = R[b].N[c] */ \
+	X(Set_Field)     /* R[a].N[b] = R[c] */ \
+	X(Call)          /* R[a] = F[bx](R[a], R[a+1], ...) */ \
+	X(Return)        /* return R[a] */
+
+enum Opcode {
+	#define X(Name) Op_##Name,
+		KUURU_OPCODE_TABLE
+	#undef X
+	Op__Count,
+};
+
+enum Vm_Result {
+	Vm_Ok = 0,
+	Vm_Err_Type,
+	Vm_Err_Division_By_Zero,
+	Vm_Err_Stack_Overflow,
+	Vm_Err_Bad_Instruction,
+	Vm_Err_Out_Of_Memory,
+	Vm_Err_Missing_Field,
+};
+
+struct Vm_Function {
+	String name;
+
+	Instruction* code;
+	isize code_len;
+	isize code_cap;
+
+	Value* constants;
+	isize constants_len;
+	isize constants_cap;
+
+	u8 register_count;
+	u8 param_count;
+};
+
+struct Vm_Program {
+	Vm_Function* functions;
+	isize len;
+	isize cap;
+
+	Gc_Int** boxes; // Constant ints too big to be stored inline
+	isize boxes_len;
+	isize boxes_cap;
+
+	String* fields; // Field names, field instructions refer to them by index
+	isize fields_len;
+	isize fields_cap;
+
+	Mem_Allocator allocator;
+};
+
+struct Vm_Frame {
+	Vm_Function const* fn;
+	Instruction const* pc;
+	Value* base;
+};
+
+// Shapes a field cache can hold before its instruction turns megamorphic
+#define VM_FIELD_CACHE_WAYS 4
+
+// Inline cache of a field instruction: the record shapes it has seen and the
+// index of the field in each. A hit costs a shape comparison and an indexed
+// load. Misses add the shape, until VM_FIELD_CACHE_WAYS of them are cached;
+// past that the instruction is megamorphic and misses look the field up.
+struct Vm_Field_Cache {
+	Gc_Shape* shapes[VM_FIELD_CACHE_WAYS];
+	Gc_Shape* added[VM_FIELD_CACHE_WAYS]; // Set_Field adding the field: shape of the record after it, NULL otherwise
+	u32 index[VM_FIELD_CACHE_WAYS];
+	u32 count;
+};
+
+struct Vm_Cache_Stats {
+	i64 hits[VM_FIELD_CACHE_WAYS]; // By number of shapes in the cache, hits[0] are monomorphic
+	i64 misses;
+	i64 megamorphic; // Misses of full caches, which are not updated
+};
+
+struct Vm {
+	Vm_Program const* program;
+
+	Value* stack;
+	isize stack_cap;
+
+	Vm_Frame* frames;
+	isize frame_count;
+	isize frame_cap;
+
+	// Baseline JIT (see jit.h), functions are counted and compiled only while jit_compile is set
+	Vm_Jit_Entry (*jit_compile)(Vm* vm, isize fn);
+	Vm_Jit_Entry* jit_entries; // Per function, NULL until compiled
+	u32* jit_counters;         // Per function, calls and loop back edges
+	u32 jit_threshold;
+	void* jit;
+
+	Gc_Heap heap; // Registers of running frames are its roots
+
+	Vm_Field_Cache** field_caches; // Per function, one per instruction, NULL until one of its field instructions ran
+	Vm_Cache_Stats cache_stats;
+
+	Vm_Result verified; // vm_verify of the program, which is not run unless Vm_Ok
+
+	Mem_Allocator allocator;
+};
+
+static inline
+Instruction vm_encode_abc(Opcode op, u8 a, u8 b, u8 c){
+	return (Instruction)op | ((Instruction)a << 8) | ((Instruction)b << 16) | ((Instruction)c << 24);
+}
+
+static inline
+Instruction vm_encode_abx(Opcode op, u8 a, u16 bx){
+	return (Instruction)op | ((Instruction)a << 8) | ((Instruction)bx << 16);
+}
+
+static inline
+Instruction vm_encode_asbx(Opcode op, u8 a, i16 sbx){
+	return vm_encode_abx(op, a, (u16)sbx);
+}
+
+static inline Opcode vm_op(Instruction i){ return (Opcode)(i & 0xff); }
+static inline u8     vm_a(Instruction i){ return (i >> 8) & 0xff; }
+static inline u8     vm_b(Instruction i){ return (i >> 16) & 0xff; }
+static inline u8     vm_c(Instruction i){ return (i >> 24) & 0xff; }
+static inline u16    vm_bx(Instruction i){ return (i >> 16) & 0xffff; }
+static inline i16    vm_sbx(Instruction i){ return (i16)vm_bx(i); }
+
+// Initialize an empty program
+void vm_program_init(Vm_Program* p, Mem_Allocator allocator);
+
+// Destroy program and all of its functions
+void vm_program_destroy(Vm_Program* p);
+
+// Add a function to program, returns its index or -1 on failure
+isize vm_program_add_function(Vm_Program* p, String name, u8 param_count, u8 register_count);
+
+// Append instruction to function, returns its position or -1 on failure
+isize vm_emit(Vm_Program* p, isize fn, Instruction ins);
+
+// Add a constant to function's pool, returns its index or -1 on failure
+isize vm_add_constant(Vm_Program* p, isize fn, Value v);
+
+// Make an int constant, boxing it (in memory owned by the program) when it
+// does not fit inline. Returns false on allocation failure.
+bool vm_program_int(Vm_Program* p, i64 i, Value* out);
+
+// Index of a field name in the program's name table (added if missing), -1 on failure
+isize vm_program_field(Vm_Program* p, String name);
+
+// Point the jump at position `at` to position `target`, returns false if out of range
+bool vm_patch_jump(Vm_Program* p, isize fn, isize at, isize target);
+
+// Check that every instruction of program stays within its function: registers
+// below register_count, constants, field names and functions that exist, jumps
+// landing on an instruction, and no falling off the end of the code. The
+// interpreter and the JIT trust all of these. Returns Vm_Ok or
+// Vm_Err_Bad_Instruction.
+Vm_Result vm_verify(Vm_Program const* p);
+
+// Initialize a virtual machine able to run program, returns success status.
+// The program is verified once here, vm_call fails if it is not valid.
+bool vm_init(Vm* vm, Vm_Program const* program, Mem_Allocator allocator, isize stack_size, isize max_frames);
+
+// Destroy virtual machine
+void vm_destroy(Vm* vm);
+
+// Call function fn of the program with arguments, result is put in `result`.
+// Results pointing into the VM's heap stay valid only while rooted (see gc_push_root).
+Vm_Result vm_call(Vm* vm, isize fn, Value const* args, isize arg_count, Value* result);
+
+// Write field cache hit rates
+void vm_cache_stats_print(Vm const* vm, IO_Writer out);
+
+///- Implementation ------------------------------------------------------------
+#ifdef KUURU_IMPLEMENTATION
+
+#if defined(__GNUC__) && !defined(KUURU_VM_NO_COMPUTED_GOTO)
+	#define VM_COMPUTED_GOTO 1
+#else
+	#define VM_COMPUTED_GOTO 0
+#endif
+
+// Grow array to hold at least one more element, returns success status
+static
+bool vm_array_grow(void** data, isize* cap, isize len, isize elem_size, isize align, Mem_Allocator allocator){
+	if(len < *cap){ return true; }
+
+	isize new_cap = Max(*cap * 2, 8);
+	void* new_data = mem_alloc(allocator, new_cap * elem_size, align);
+	if(new_data == NULL){ return false; }
+
+	if(*data != NULL){
+		mem_copy(new_data, *data, len * elem_size);
+		mem_free(allocator, *data);
+	}
+	*data = new_data;
+	*cap = new_cap;
+	return true;
+}
+
+void vm_program_init(Vm_Program* p, Mem_Allocator allocator){
+	*p = (Vm_Program){ .allocator = allocator };
+}
+
+void vm_program_destroy(Vm_Program* p){
+	for(isize i = 0; i < p->len; i += 1){
+		mem_free(p->allocator, p->functions[i].code);
+		mem_free(p->allocator, p->functions[i].constants);
+	}
+	for(isize i = 0; i < p->boxes_len; i += 1){
+		mem_free(p->allocator, p->boxes[i]);
+	}
+	mem_free(p->allocator, p->boxes);
+	mem_free(p->allocator, p->fields);
+	mem_free(p->allocator, p->functions);
+	*p = (Vm_Program){0};
+}
+
+isize vm_program_add_function(Vm_Program* p, String name, u8 param_count, u8 register_count){
+	if(param_count > register_count){ return -1; }
+	if(!vm_array_grow((void**)&p->functions, &p->cap, p->len, sizeof(Vm_Function), alignof(Vm_Function), p->allocator)){
+		return -1;
+	}
+	p->functions[p->len] = (Vm_Function){
+		.name = name,
+		.param_count = param_count,
+		.register_count = register_count,
+	};
+	p->len += 1;
+	return p->len - 1;
+}
+
+isize vm_emit(Vm_Program* p, isize fn, Instruction ins){
+	Vm_Function* f = &p->functions[fn];
+	// The dispatch loop trusts opcodes, so they are checked here instead
+	if(vm_op(ins) >= Op__Count){ return -1; }
+	if(!vm_array_grow((void**)&f->code, &f->code_cap, f->code_len, sizeof(Instruction), alignof(Instruction), p->allocator)){
+		return -1;
+	}
+	f->code[f->code_len] = ins;
+	f->code_len += 1;
+	return f->code_len - 1;
+}
+
+isize vm_add_constant(Vm_Program* p, isize fn, Value v){
+	Vm_Function* f = &p->functions[fn];
+	if(f->constants_len > UINT16_MAX){ return -1; }
+	if(!vm_array_grow((void**)&f->constants, &f->constants_cap, f->constants_len, sizeof(Value), alignof(Value), p->allocator)){
+		return -1;
+	}
+	f->constants[f->constants_len] = v;
+	f->constants_len += 1;
+	return f->constants_len - 1;
+}
+
+bool vm_program_int(Vm_Program* p, i64 i, Value* out){
+	if(value_int_fits(i)){
+		*out = value_small_int(i);
+		return true;
+	}
+	if(!vm_array_grow((void**)&p->boxes, &p->boxes_cap, p->boxes_len, sizeof(Gc_Int*), alignof(Gc_Int*), p->allocator)){
+		return false;
+	}
+	Gc_Int* box = New(Gc_Int, 1, p->allocator);
+	if(box == NULL){ return false; }
+
+	// Never collected: already old and marked, so no collection touches it
+	*box = (Gc_Int){
+		.header = { .kind = Gc_Kind_Int, .flags = Gc_Flag_Old | Gc_Flag_Marked, .size = sizeof(Gc_Int) },
+		.value = i,
+	};
+	p->boxes[p->boxes_len] = box;
+	p->boxes_len += 1;
+	*out = value_big_int(box);
+	return true;
+}
+
+isize vm_program_field(Vm_Program* p, String name){
+	for(isize i = 0; i < p->fields_len; i += 1){
+		if(str_eq(p->fields[i], name)){ return i; }
+	}
+	// Names are 8-bit operands
+	if(p->fields_len > UINT8_MAX){ return -1; }
+	if(!vm_array_grow((void**)&p->fields, &p->fields_cap, p->fields_len, sizeof(String), alignof(String), p->allocator)){
+		return -1;
+	}
+	p->fields[p->fields_len] = name;
+	p->fields_len += 1;
+	return p->fields_len - 1;
+}
+
+bool vm_patch_jump(Vm_Program* p, isize fn, isize at, isize target){
+	Vm_Function* f = &p->functions[fn];
+	isize offset = target - (at + 1);
+	if(offset < INT16_MIN || offset > INT16_MAX){ return false; }
+
+	Instruction ins = f->code[at];
+	f->code[at] = vm_encode_asbx(vm_op(ins), vm_a(ins), (i16)offset);
+	return true;
+}
+
+// Is the jump at position `at` of f landing on one of its instructions?
+static
+bool vm_verify_jump(Vm_Function const* f, isize at){
+	Instruction ins = f->code[at];
+	if(vm_op(ins) != Op_Jump){ return false; }
+	isize target = at + 1 + vm_sbx(ins);
+	return target >= 0 && target < f->code_len;
+}
+
+Vm_Result vm_verify(Vm_Program const* p){
+	for(isize fi = 0; fi < p->len; fi += 1){
+		Vm_Function const* f = &p->functions[fi];
+		isize regs = f->register_count;
+		isize n = f->code_len;
+
+		for(isize i = 0; i < n; i += 1){
+			Instruction ins = f->code[i];
+			u8 a = vm_a(ins), b = vm_b(ins), c = vm_c(ins);
+			bool ok = true;
+			bool falls_through = true;
+
+			switch(vm_op(ins)){
+			case Op_Nop: break;
+
+			case Op_Load_Const: ok = a < regs && vm_bx(ins) < f->constants_len; break;
+
+			case Op_Load_Nil:
+			case Op_Load_Bool:
+			case Op_Load_Int:
+			case Op_New_Record: ok = a < regs; break;
+
+			case Op_Move:
+			case Op_Neg:
+			case Op_Bit_Not:
+			case Op_Not:
+			case Op_Add_Imm: ok = a < regs && b < regs; break;
+
+			case Op_Add: case Op_Sub: case Op_Mul: case Op_Div: case Op_Mod:
+			case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor:
+			case Op_Eq: case Op_Lt: case Op_Lte:
+				ok = a < regs && b < regs && c < regs;
+				break;
+
+			case Op_Jump:
+				ok = vm_verify_jump(f, i);
+				falls_through = false;
+				break;
+
+			case Op_Jump_If:
+			case Op_Jump_If_Not: {
+				isize target = i + 1 + vm_sbx(ins);
+				ok = a < regs && target >= 0 && target < n;
+			} break;
+
+			// Taking the following jump or skipping it
+			case Op_Eq_Branch:
+			case Op_Lt_Branch:
+			case Op_Lte_Branch:
+			case Op_For_Loop:
+				ok = a < regs && b < regs && i + 2 < n && vm_verify_jump(f, i + 1);
+				break;
+
+			case Op_Get_Field: ok = a < regs && b < regs && c < p->fields_len; break;
+			case Op_Set_Field: ok = a < regs && c < regs && b < p->fields_len; break;
+
+			// Arguments are the caller's registers from a on, the result goes to R[a]
+			case Op_Call: {
+				isize callee = vm_bx(ins);
+				ok = a < regs && callee < p->len && a + p->functions[callee].param_count <= regs;
+			} break;
+
+			case Op_Return:
+				ok = a < regs;
+				falls_through = false;
+				break;
+
+			default: ok = false; break;
+			}
+
+			if(!ok || (falls_through && i + 1 >= n)){ return Vm_Err_Bad_Instruction; }
+		}
+	}
+	return Vm_Ok;
+}
+
+// Registers of every running frame, callee frames overlap the registers of their caller
+static
+void vm_scan_roots(Gc_Heap* h, void* data, void (*visit)(Gc_Heap* h, Value* slot)){
+	Vm* vm = data;
+	Value* top = vm->stack;
+	for(isize i = 0; i < vm->frame_count; i += 1){
+		Vm_Frame const* f = &vm->frames[i];
+		top = Max(top, f->base + f->fn->register_count);
+	}
+	for(Value* slot = vm->stack; slot < top; slot += 1){ visit(h, slot); }
+}
+
+bool vm_init(Vm* vm, Vm_Program const* program, Mem_Allocator allocator, isize stack_size, isize max_frames){
+	*vm = (Vm){
+		.program = program,
+		.allocator = allocator,
+	};
+	vm->stack = New(Value, stack_size, allocator);
+	vm->frames = New(Vm_Frame, max_frames, allocator);
+	vm->field_caches = New(Vm_Field_Cache*, Max(program->len, 1), allocator);
+	if(vm->stack == NULL || vm->frames == NULL || vm->field_caches == NULL || !gc_init(&vm->heap, GC_DEFAULT_NURSERY_SIZE, allocator)){
+		vm_destroy(vm);
+		return false;
+	}
+	vm->heap.scan_roots = vm_scan_roots;
+	vm->heap.scan_data = vm;
+	vm->stack_cap = stack_size;
+	vm->frame_cap = max_frames;
+	vm->verified = vm_verify(program);
+	return true;
+}
+
+void vm_destroy(Vm* vm){
+	mem_free(vm->allocator, vm->stack);
+	mem_free(vm->allocator, vm->frames);
+	if(vm->field_caches != NULL){
+		for(isize i = 0; i < vm->program->len; i += 1){ mem_free(vm->allocator, vm->field_caches[i]); }
+		mem_free(vm->allocator, vm->field_caches);
+	}
+	if(vm->heap.nursery.data != NULL){ gc_destroy(&vm->heap); }
+	vm->stack = NULL;
+	vm->frames = NULL;
+	vm->field_caches = NULL;
+}
+
+// Caches of the running function's instructions, allocated on first use
+static
+Vm_Field_Cache* vm_function_caches(Vm* vm){
+	Vm_Function const* fn = vm->frames[vm->frame_count - 1].fn;
+	isize index = fn - vm->program->functions;
+	if(vm->field_caches[index] == NULL){
+		vm->field_caches[index] = New(Vm_Field_Cache, fn->code_len, vm->allocator);
+	}
+	return vm->field_caches[index];
+}
+
+// Count a cache miss on a record of shape, and remember the index of the field
+// in such records (if they have it) while the cache has room
+static
+void vm_field_cache_add(Vm* vm, Vm_Field_Cache* cache, Gc_Shape* shape, Gc_Shape* added, isize index){
+	vm->cache_stats.misses += 1;
+	if(cache->count == VM_FIELD_CACHE_WAYS){
+		vm->cache_stats.megamorphic += 1;
+		return;
+	}
+	if(index < 0){ return; }
+	cache->shapes[cache->count] = shape;
+	cache->added[cache->count] = added;
+	cache->index[cache->count] = (u32)index;
+	cache->count += 1;
+}
+
+// Integer arithmetic wraps around on overflow
+#define VM_WRAP(a_, OP_, b_) ((i64)((u64)(a_) OP_ (u64)(b_)))
+
+// Inline int fast paths, laid out as the fall through of the handler
+#define VM_LIKELY(x_) __builtin_expect(!!(x_), 1)
+
+// Address of register i, hidden from the optimizer so loads and stores use it
+// as a plain pointer rather than base + i * 8. x86 forwards a store to a later
+// load of the same register without the usual latency only when neither has
+// an index register, and chains of arithmetic go through memory here.
+static inline
+Value* vm_register(Value* base, isize i){
+	Value* r = &base[i];
+	__asm__("" : "+r"(r));
+	return r;
+}
+
+Vm_Result vm_call(Vm* vm, isize fn_index, Value const* args, isize arg_count, Value* result){
+	Vm_Program const* program = vm->program;
+	if(vm->verified != Vm_Ok){ return vm->verified; }
+	if(fn_index < 0 || fn_index >= program->len){ return Vm_Err_Bad_Instruction; }
+	Vm_Function const* fn = &program->functions[fn_index];
+
+	if(arg_count != fn->param_count){ return Vm_Err_Type; }
+	if(fn->register_count > vm->stack_cap || vm->frame_count >= vm->frame_cap){
+		return Vm_Err_Stack_Overflow;
+	}
+
+	isize entry_depth = vm->frame_count;
+	Value* base = vm->stack;
+	if(entry_depth > 0){
+		Vm_Frame const* top = &vm->frames[entry_depth - 1];
+		base = top->base + top->fn->register_count;
+	}
+	Value* const stack_end = vm->stack + vm->stack_cap;
+	if(base + fn->register_count > stack_end){ return Vm_Err_Stack_Overflow; }
+
+	for(isize i = 0; i < fn->register_count; i += 1){
+		base[i] = i < arg_count ? args[i] : value_nil();
+	}
+
+	vm->frames[vm->frame_count] = (Vm_Frame){ .fn = fn, .pc = NULL, .base = base };
+	vm->frame_count += 1;
+
+	Instruction const* pc = fn->code;
+	Instruction const* code = fn->code;
+	Value const* k = fn->constants;
+	Vm_Field_Cache* caches = vm->field_caches[fn_index];
+	Instruction ins;
+	Value ret;
+	Vm_Result status = Vm_Ok;
+
+	#define R(i_) (*vm_register(base, (i_)))
+
+	#define IS_INT(v_) (value_kind(v_) == Val_Int)
+
+	// Store int result in register, boxing it when it does not fit inline.
+	// Boxing may collect, so nothing read from the heap before is used after.
+	#define SET_INT(r_, i_) { \
+		i64 int_ = (i_); \
+		if(value_int_fits(int_)){ R(r_) = value_small_int(int_); } \
+		else if(!gc_int(&vm->heap, int_, &R(r_))){ status = Vm_Err_Out_Of_Memory; goto finish; } \
+	}
+
+	// Add or subtract inline ints on the tagged word of lhs, one op away from
+	// the result. It is the word of the result unless the sign bit of the
+	// payload (bit 47) flipped, which is how both leaving the inline range and
+	// crossing zero (a carry into the tag) show up, those take the slow path.
+	// A single branch checks the sign and both tags.
+	#define INLINE_ARITH(OP_) { \
+		Value lhs = R(vm_b(ins)), rhs = R(vm_c(ins)); \
+		Value result = { lhs.bits OP_ (u64)value_as_small_int(rhs) }; \
+		u64 tags = (lhs.bits ^ VALUE_INT_BITS) | (rhs.bits ^ VALUE_INT_BITS); \
+		if(VM_LIKELY((((tags >> 1) | (result.bits ^ lhs.bits)) >> 47) == 0)){ \
+			R(vm_a(ins)) = result; \
+			VM_NEXT(); \
+		} \
+	}
+
+	// Inline ints first, they never need to touch the heap
+	#define ARITH(INT_EXPR_, REAL_EXPR_) { \
+		Value lhs = R(vm_b(ins)), rhs = R(vm_c(ins)); \
+		if(value_both_small_ints(lhs, rhs)){ \
+			i64 x = value_as_small_int(lhs), y = value_as_small_int(rhs); \
+			SET_INT(vm_a(ins), INT_EXPR_); \
+		} else if(value_is_real(lhs) && value_is_real(rhs)){ \
+			f64 x = value_as_real(lhs), y = value_as_real(rhs); \
+			R(vm_a(ins)) = value_real(REAL_EXPR_); \
+		} else if(IS_INT(lhs) && IS_INT(rhs)){ \
+			i64 x = value_as_int(lhs), y = value_as_int(rhs); \
+			SET_INT(vm_a(ins), INT_EXPR_); \
+		} else { status = Vm_Err_Type; goto finish; } \
+	}
+
+	// Works on the tagged words. The tag survives & and |, ^ needs the tag
+	// of rhs cleared first (TAG_), which keeps lhs one op from the result.
+	#define BITWISE(OP_, TAG_) { \
+		Value lhs = R(vm_b(ins)), rhs = R(vm_c(ins)); \
+		if(VM_LIKELY(value_both_small_ints(lhs, rhs))){ \
+			R(vm_a(ins)) = (Value){ lhs.bits OP_ (rhs.bits ^ (TAG_)) }; \
+		} \
+		else if(!IS_INT(lhs) || !IS_INT(rhs)){ status = Vm_Err_Type; goto finish; } \
+		else { SET_INT(vm_a(ins), value_as_int(lhs) OP_ value_as_int(rhs)); } \
+	}
+
+	// Sets `cond` to the result of comparing lhs and rhs
+	#define COMPARE(lhs_, rhs_, OP_) \
+		Value lhs = (lhs_), rhs = (rhs_); bool cond; \
+		if(VM_LIKELY(value_both_small_ints(lhs, rhs))){ cond = value_shifted_int(lhs) OP_ value_shifted_int(rhs); } \
+		else if(value_is_real(lhs) && value_is_real(rhs)){ cond = value_as_real(lhs) OP_ value_as_real(rhs); } \
+		else if(IS_INT(lhs) && IS_INT(rhs)){ cond = value_as_int(lhs) OP_ value_as_int(rhs); } \
+		else { status = Vm_Err_Type; goto finish; }
+
+	// Sets `way` to the entry of the current instruction's cache for the shape
+	// of record rec (counting the hit), or to -1
+	#define FIELD_CACHE_LOOKUP(rec_) \
+		if(caches == NULL && (caches = vm_function_caches(vm)) == NULL){ status = Vm_Err_Out_Of_Memory; goto finish; } \
+		Vm_Field_Cache* cache = &caches[pc - 1 - code]; \
+		isize way = -1; \
+		for(u32 i_ = 0; i_ < cache->count; i_ += 1){ \
+			if(cache->shapes[i_] == (rec_)->shape){ \
+				way = i_; \
+				vm->cache_stats.hits[cache->count - 1] += 1; \
+				break; \
+			} \
+		}
+
+	// Take the jump following the current instruction if cond is true, skip it otherwise
+	#define BRANCH(cond_) { \
+		if(cond_){ pc += vm_sbx(*pc) + 1; } \
+		else { pc += 1; } \
+	}
+
+	#if VM_COMPUTED_GOTO
+		static void* const dispatch_table[] = {
+			#define X(Name) &&op_##Name,
+				KUURU_OPCODE_TABLE
+			#undef X
+		};
+		_Static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) == Op__Count, "Bad dispatch table");
+
+		#define VM_CASE(Name) op_##Name:
+		#define VM_NEXT() do { \
+			ins = *pc++; \
+			goto *dispatch_table[vm_op(ins)]; \
+		} while(0)
+
+		if(vm->jit_compile != NULL){ goto jit_enter; }
+		VM_NEXT();
+	#else
+		#define VM_CASE(Name) case Op_##Name:
+		#define VM_NEXT() goto dispatch
+
+		if(vm->jit_compile != NULL){ goto jit_enter; }
+		dispatch:
+		ins = *pc++;
+		switch(vm_op(ins)){
+	#endif
+
+	VM_CASE(Nop){
+		VM_NEXT();
+	}
+
+	VM_CASE(Load_Const){
+		R(vm_a(ins)) = k[vm_bx(ins)];
+		VM_NEXT();
+	}
+
+	VM_CASE(Load_Nil){
+		R(vm_a(ins)) = value_nil();
+		VM_NEXT();
+	}
+
+	VM_CASE(Load_Bool){
+		R(vm_a(ins)) = value_bool(vm_b(ins) != 0);
+		VM_NEXT();
+	}
+
+	VM_CASE(Load_Int){
+		R(vm_a(ins)) = value_small_int(vm_sbx(ins));
+		VM_NEXT();
+	}
+
+	VM_CASE(Move){
+		R(vm_a(ins)) = R(vm_b(ins));
+		VM_NEXT();
+	}
+
+	VM_CASE(Add){
+		INLINE_ARITH(+);
+		ARITH(VM_WRAP(x, +, y), x + y);
+		VM_NEXT();
+	}
+
+	VM_CASE(Sub){
+		INLINE_ARITH(-);
+		ARITH(VM_WRAP(x, -, y), x - y);
+		VM_NEXT();
+	}
+
+	VM_CASE(Mul){
+		ARITH(VM_WRAP(x, *, y), x * y);
+		VM_NEXT();
+	}
+
+	VM_CASE(Div){
+		if(R(vm_c(ins)).bits == value_small_int(0).bits){ status = Vm_Err_Division_By_Zero; goto finish; }
+		ARITH((y == -1) ? VM_WRAP(0, -, x) : x / y, x / y);
+		VM_NEXT();
+	}
+
+	VM_CASE(Mod){
+		Value lhs = R(vm_b(ins)), rhs = R(vm_c(ins));
+		if(!IS_INT(lhs) || !IS_INT(rhs)){ status = Vm_Err_Type; goto finish; }
+		i64 x = value_as_int(lhs), y = value_as_int(rhs);
+		if(y == 0){ status = Vm_Err_Division_By_Zero; goto finish; }
+		SET_INT(vm_a(ins), y == -1 ? 0 : x % y);
+		VM_NEXT();
+	}
+
+	VM_CASE(Bit_And){
+		BITWISE(&, 0);
+		VM_NEXT();
+	}
+
+	VM_CASE(Bit_Or){
+		BITWISE(|, 0);
+		VM_NEXT();
+	}
+
+	VM_CASE(Bit_Xor){
+		BITWISE(^, VALUE_INT_BITS);
+		VM_NEXT();
+	}
+
+	VM_CASE(Neg){
+		Value v = R(vm_b(ins));
+		if(IS_INT(v)){ SET_INT(vm_a(ins), VM_WRAP(0, -, value_as_int(v))); }
+		else if(value_is_real(v)){ R(vm_a(ins)) = value_real(-value_as_real(v)); }
+		else { status = Vm_Err_Type; goto finish; }
+		VM_NEXT();
+	}
+
+	VM_CASE(Bit_Not){
+		Value v = R(vm_b(ins));
+		if(!IS_INT(v)){ status = Vm_Err_Type; goto finish; }
+		SET_INT(vm_a(ins), ~value_as_int(v));
+		VM_NEXT();
+	}
+
+	VM_CASE(Not){
+		R(vm_a(ins)) = value_bool(!value_truthy(R(vm_b(ins))));
+		VM_NEXT();
+	}
+
+	VM_CASE(Eq){
+		R(vm_a(ins)) = value_bool(value_eq(R(vm_b(ins)), R(vm_c(ins))));
+		VM_NEXT();
+	}
+
+	VM_CASE(Lt){
+		COMPARE(R(vm_b(ins)), R(vm_c(ins)), <);
+		R(vm_a(ins)) = value_bool(cond);
+		VM_NEXT();
+	}
+
+	VM_CASE(Lte){
+		COMPARE(R(vm_b(ins)), R(vm_c(ins)), <=);
+		R(vm_a(ins)) = value_bool(cond);
+		VM_NEXT();
+	}
+
+	VM_CASE(Jump){
+		pc += vm_sbx(ins);
+		if(vm_sbx(ins) < 0 && vm->jit_compile != NULL){ goto jit_enter; }
+		VM_NEXT();
+	}
+
+	VM_CASE(Jump_If){
+		if(value_truthy(R(vm_a(ins)))){ pc += vm_sbx(ins); }
+		VM_NEXT();
+	}
+
+	VM_CASE(Jump_If_Not){
+		if(!value_truthy(R(vm_a(ins)))){ pc += vm_sbx(ins); }
+		VM_NEXT();
+	}
+
+	VM_CASE(Add_Imm){
+		Value v = R(vm_b(ins));
+		i64 imm = (i8)vm_c(ins);
+		Value result = { v.bits + (u64)imm }; // As in INLINE_ARITH
+		if(VM_LIKELY(((((v.bits ^ VALUE_INT_BITS) >> 1) | (result.bits ^ v.bits)) >> 47) == 0)){
+			R(vm_a(ins)) = result;
+		}
+		else if(IS_INT(v)){ SET_INT(vm_a(ins), VM_WRAP(value_as_int(v), +, imm)); }
+		else if(value_is_real(v)){ R(vm_a(ins)) = value_real(value_as_real(v) + (f64)imm); }
+		else { status = Vm_Err_Type; goto finish; }
+		VM_NEXT();
+	}
+
+	VM_CASE(Eq_Branch){
+		bool cond = value_eq(R(vm_a(ins)), R(vm_b(ins)));
+		BRANCH(cond == (vm_c(ins) != 0));
+		VM_NEXT();
+	}
+
+	VM_CASE(Lt_Branch){
+		COMPARE(R(vm_a(ins)), R(vm_b(ins)), <);
+		BRANCH(cond == (vm_c(ins) != 0));
+		VM_NEXT();
+	}
+
+	VM_CASE(Lte_Branch){
+		COMPARE(R(vm_a(ins)), R(vm_b(ins)), <=);
+		BRANCH(cond == (vm_c(ins) != 0));
+		VM_NEXT();
+	}
+
+	VM_CASE(For_Loop){
+		Value counter = R(vm_a(ins)), limit = R(vm_b(ins));
+		i64 next, last;
+		Value result = { counter.bits + 1 }; // As in INLINE_ARITH
+		u64 tags = (counter.bits ^ VALUE_INT_BITS) | (limit.bits ^ VALUE_INT_BITS);
+		if(VM_LIKELY((((tags >> 1) | (result.bits ^ counter.bits)) >> 47) == 0)){
+			R(vm_a(ins)) = result;
+			next = value_shifted_int(result);
+			last = value_shifted_int(limit);
+		} else if(IS_INT(counter) && IS_INT(limit)){
+			next = VM_WRAP(value_as_int(counter), +, 1);
+			last = value_as_int(limit);
+			SET_INT(vm_a(ins), next);
+		} else { status = Vm_Err_Type; goto finish; }
+		if(next < last){
+			i16 offset = vm_sbx(*pc);
+			pc += offset + 1;
+			if(offset < 0 && vm->jit_compile != NULL){ goto jit_enter; }
+		} else {
+			pc += 1;
+		}
+		VM_NEXT();
+	}
+
+	VM_CASE(New_Record){
+		Gc_Record* rec = gc_new_record(&vm->heap, vm_b(ins));
+		if(rec == NULL){ status = Vm_Err_Out_Of_Memory; goto finish; }
+		R(vm_a(ins)) = value_object(&rec->header);
+		VM_NEXT();
+	}
+
+	VM_CASE(Get_Field){
+		Value obj = R(vm_b(ins));
+		if(!gc_is_kind(obj, Gc_Kind_Record)){ status = Vm_Err_Type; goto finish; }
+		Gc_Record* rec = (Gc_Record*)value_ref(obj);
+		FIELD_CACHE_LOOKUP(rec);
+		isize index;
+		if(way >= 0){
+			index = cache->index[way];
+		} else {
+			index = gc_shape_find(rec->shape, vm_c(ins));
+			vm_field_cache_add(vm, cache, rec->shape, NULL, index);
+			if(index < 0){ status = Vm_Err_Missing_Field; goto finish; }
+		}
+		R(vm_a(ins)) = *gc_record_slot(rec, index);
+		VM_NEXT();
+	}
+
+	VM_CASE(Set_Field){
+		Value obj = R(vm_a(ins));
+		Value v = R(vm_c(ins));
+		if(!gc_is_kind(obj, Gc_Kind_Record)){ status = Vm_Err_Type; goto finish; }
+		Gc_Record* rec = (Gc_Record*)value_ref(obj);
+		FIELD_CACHE_LOOKUP(rec);
+		if(way >= 0 && cache->added[way] == NULL){
+			gc_store(&vm->heap, &rec->header, gc_record_slot(rec, cache->index[way]), v);
+			VM_NEXT();
+		}
+		if(way >= 0 && cache->index[way] < rec->capacity){
+			// Adding the field, it is stored inline so nothing has to be allocated
+			rec->shape = cache->added[way];
+			gc_store(&vm->heap, &rec->header, &rec->slots[cache->index[way]], v);
+			VM_NEXT();
+		}
+
+		Gc_Shape* before = rec->shape;
+		if(!gc_record_set(&vm->heap, obj, vm_b(ins), v)){ status = Vm_Err_Out_Of_Memory; goto finish; }
+		if(way < 0){
+			// The record may have moved, its register still points to it
+			Gc_Shape* after = ((Gc_Record*)value_ref(R(vm_a(ins))))->shape;
+			if(after == before){
+				vm_field_cache_add(vm, cache, before, NULL, gc_shape_find(before, vm_b(ins)));
+			} else {
+				vm_field_cache_add(vm, cache, before, after, (isize)after->count - 1);
+			}
+		}
+		VM_NEXT();
+	}
+
+	VM_CASE(Call){
+		Vm_Function const* callee = &program->functions[vm_bx(ins)];
+		Value* callee_base = base + vm_a(ins);
+		if(vm->frame_count >= vm->frame_cap || callee_base + callee->register_count > stack_end){
+			status = Vm_Err_Stack_Overflow;
+			goto finish;
+		}
+		for(isize i = callee->param_count; i < callee->register_count; i += 1){
+			callee_base[i] = value_nil();
+		}
+
+		vm->frames[vm->frame_count - 1].pc = pc;
+		vm->frames[vm->frame_count] = (Vm_Frame){ .fn = callee, .pc = NULL, .base = callee_base };
+		vm->frame_count += 1;
+
+		base = callee_base;
+		pc = callee->code;
+		code = callee->code;
+		k = callee->constants;
+		caches = vm->field_caches[vm_bx(ins)];
+		if(vm->jit_compile != NULL){ goto jit_enter; }
+		VM_NEXT();
+	}
+
+	VM_CASE(Return){
+		ret = R(vm_a(ins));
+		goto return_value;
+	}
+
+	#if !VM_COMPUTED_GOTO
+		default: {
+			status = Vm_Err_Bad_Instruction;
+			goto finish;
+		}
+		}
+	#endif
+
+return_value: {
+		vm->frame_count -= 1;
+		if(vm->frame_count == entry_depth){
+			*result = ret;
+			goto finish;
+		}
+
+		// Callee's base is the caller's call register
+		base[0] = ret;
+		Vm_Frame const* caller = &vm->frames[vm->frame_count - 1];
+		base = caller->base;
+		pc = caller->pc;
+		code = caller->fn->code;
+		k = caller->fn->constants;
+		caches = vm->field_caches[caller->fn - program->functions];
+		if(vm->jit_compile != NULL && vm->jit_entries[caller->fn - program->functions] != NULL){ goto jit_enter; }
+		VM_NEXT();
+	}
+
+	// Run compiled code of the current function from pc, after counting towards
+	// its compilation. Compiled code hands unsupported instructions and failed
+	// type checks back to the interpreter.
+jit_enter: {
+		Vm_Function const* current = vm->frames[vm->frame_count - 1].fn;
+		isize index = current - program->functions;
+		Vm_Jit_Entry code = vm->jit_entries[index];
+		if(code == NULL){
+			vm->jit_counters[index] += 1;
+			if(vm->jit_counters[index] != vm->jit_threshold){ VM_NEXT(); }
+			code = vm->jit_entries[index] = vm->jit_compile(vm, index);
+			if(code == NULL){ VM_NEXT(); }
+		}
+
+		i64 resume = code(base, pc - current->code);
+		if(resume < 0){
+			ret = base[0];
+			goto return_value;
+		}
+		pc = current->code + resume;
+		VM_NEXT();
+	}
+
+finish:
+	vm->frame_count = entry_depth;
+	return status;
+
+	#undef R
+	#undef ARITH
+	#undef INLINE_ARITH
+	#undef BITWISE
+	#undef FIELD_CACHE_LOOKUP
+	#undef COMPARE
+	#undef SET_INT
+	#undef IS_INT
+	#undef BRANCH
+	#undef VM_CASE
+	#undef VM_NEXT
+}
+
+static
+void vm_write(IO_Writer out, cstring text){
+	io_write(out, (byte const*)text, cstring_len(text));
+}
+
+// Write 100 * count / total rounded to two decimals
+static
+void vm_write_percent(IO_Writer out, u64 count, u64 total){
+	io_write_f64(out, (f64)((count * 10000 + total / 2) / total) / 100.0);
+}
+
+void vm_cache_stats_print(Vm const* vm, IO_Writer out){
+	Vm_Cache_Stats const* st = &vm->cache_stats;
+	i64 polymorphic = 0;
+	for(int i = 1; i < VM_FIELD_CACHE_WAYS; i += 1){ polymorphic += st->hits[i]; }
+	i64 lookups = Max(st->hits[0] + polymorphic + st->misses, 1);
+
+	vm_write(out, "field caches: ");
+	io_write_i64(out, st->hits[0] + polymorphic + st->misses);
+	vm_write(out, " lookups, ");
+	vm_write_percent(out, st->hits[0], lookups);
+	vm_write(out, "% monomorphic hits, ");
+	vm_write_percent(out, polymorphic, lookups);
+	vm_write(out, "% polymorphic hits, ");
+	vm_write_percent(out, st->misses, lookups);
+	vm_write(out, "% misses (");
+	io_write_i64(out, st->megamorphic);
+	vm_write(out, " megamorphic)\n");
+}
+
+#undef VM_WRAP
+#undef VM_LIKELY
+#undef VM_COMPUTED_GOTO
+#endif
@@ -3,6 +3,15 @@
 #include "kuuru_c/lexer.h"
 
 #include "kuuru_c/utilities.h"
+#include "kuuru_c/cache.h"
+#include "kuuru_c/formatter.h"
+#include "kuuru_c/build_graph.h"
+#include "kuuru_c/server.h"
+#include "kuuru_c/file_batch.h"
+#include "kuuru_c/perf_counters.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
 
 #define MEBIBYTE (1024ll * 1024ll)
 static void init_allocators(Mem_Allocator* allocator, Mem_Allocator* temp_allocator){
@@ -29,10 +38,240 @@ struct Token_List {
 	isize cap;
 };
 
-int main(){
+#define CACHE_DIR ".kuuru_cache"
+
+// Stage counters, collected when KUURU_PERF is set
+static Perf_Profile perf_profile;
+static Perf_Profile* perf = NULL;
+
+// Table on stderr, JSON to the file named by KUURU_PERF ("-" for stderr)
+static void perf_report(void){
+	IO_Writer err = io_to_writer(file_stream(stderr));
+	perf_profile_print_table(perf, err);
+
+	cstring path = getenv("KUURU_PERF");
+	bool to_stderr = str_eq(str_from(path), str_from("-"));
+	FILE* f = to_stderr ? stderr : fopen(path, "wb");
+	if(f == NULL){
+		fprintf(stderr, "Could not write %s\n", path);
+	} else {
+		perf_profile_print_json(perf, io_to_writer(file_stream(f)));
+		if(!to_stderr){ fclose(f); }
+	}
+	perf_profile_destroy(perf);
+}
+
+// Lex each file as soon as it is loaded, reusing cached token streams of
+// unchanged sources
+static int lex_files(cstring* paths, int count, Mem_Allocator allocator){
+	String* names = New(String, count, allocator);
+	if(names == NULL){ return 1; }
+	for(int i = 0; i < count; i += 1){
+		names[i] = str_from(paths[i]);
+	}
+
+	Perf_Sample load = perf_stage_begin(perf);
+	File_Batch batch;
+	if(!file_batch_init(&batch, names, count, allocator)){
+		mem_free(allocator, names);
+		return 1;
+	}
+
+	int status = 0;
+	File_Batch_Result file;
+	for(; file_batch_next(&batch, &file); load = perf_stage_begin(perf)){
+		perf_stage_end(perf, Perf_Stage_Load, load);
+		cstring path = paths[file.index];
+		if(file.error != 0){
+			fprintf(stderr, "Could not read %s\n", path);
+			status = 1;
+			continue;
+		}
+
+		Token_Stream ts;
+		Perf_Sample lex = perf_stage_begin(perf);
+		bool lexed = token_stream_lex(&ts, str_from(CACHE_DIR), str_from_bytes(file.data.data, file.data.len), allocator);
+		perf_stage_end(perf, Perf_Stage_Lex, lex);
+		if(!lexed){
+			fprintf(stderr, "Could not lex %s\n", path);
+			status = 1;
+		} else {
+			printf("%s: %td tokens%s\n", path, ts.len, ts.mapped ? " (cached)" : "");
+			token_stream_destroy(&ts);
+		}
+		mem_free(allocator, file.data.data);
+	}
+
+	file_batch_destroy(&batch);
+	mem_free(allocator, names);
+	return status;
+}
+
+// Reformat each file in place, output goes to a temporary that replaces the file
+static int fmt_files(cstring* paths, int count, Mem_Allocator allocator){
+	int status = 0;
+	for(int i = 0; i < count; i += 1){
+		char tmp_path[4096];
+		if(snprintf(tmp_path, sizeof(tmp_path), "%s.fmt.tmp", paths[i]) >= (int)sizeof(tmp_path)){
+			fprintf(stderr, "Path too long: %s\n", paths[i]);
+			status = 1;
+			continue;
+		}
+
+		Bytes source = file_read_all(str_from(paths[i]), allocator);
+		if(source.data == NULL){
+			fprintf(stderr, "Could not read %s\n", paths[i]);
+			status = 1;
+			continue;
+		}
+
+		// The original is kept unless the whole of it was formatted
+		struct stat st;
+		FILE* f = stat(paths[i], &st) == 0 ? fopen(tmp_path, "wb") : NULL;
+		bool ok = f != NULL;
+		if(ok){
+			fchmod(fileno(f), st.st_mode & 07777);
+			IO_Writer w = io_to_writer(file_stream(f));
+			ok = format_source(str_from_bytes(source.data, source.len), w, allocator);
+			ok = (fclose(f) == 0) && ok;
+			ok = ok && rename(tmp_path, paths[i]) == 0;
+			if(!ok){ remove(tmp_path); }
+		}
+		if(!ok){
+			fprintf(stderr, "Could not format %s\n", paths[i]);
+			status = 1;
+		}
+		mem_free(allocator, source.data);
+	}
+	return status;
+}
+
+// Rebuild only the files that changed, or that use an interface that changed
+static int build_files(cstring* paths, int count, Mem_Allocator allocator){
+	static const char graph_path[] = CACHE_DIR "/build_graph.bin";
+
+	String* sources = New(String, count, allocator);
+	if(sources == NULL){ return 1; }
+	for(int i = 0; i < count; i += 1){
+		sources[i] = str_from(paths[i]);
+	}
+
+	Build_Graph graph;
+	build_graph_init(&graph, allocator);
+	build_graph_load(&graph, str_from(graph_path));
+
+	isize dirty = build_graph_update(&graph, sources, count);
+	int status = dirty < 0;
+
+	// Load all dirty files together, building each as soon as it arrives.
+	// Until built, a dirty file counts as failed, so a file that did not build
+	// is not taken as up to date by the next build.
+	String* dirty_paths = dirty > 0 ? New(String, dirty, allocator) : NULL;
+	isize* dirty_files = dirty > 0 ? New(isize, dirty, allocator) : NULL;
+	isize dirty_len = 0;
+	for(isize i = 0; i < graph.len; i += 1){
+		if(!graph.files[i].dirty){ continue; }
+		graph.files[i].failed = true;
+		if(dirty_paths != NULL && dirty_files != NULL){
+			dirty_paths[dirty_len] = graph.files[i].path;
+			dirty_files[dirty_len] = i;
+			dirty_len += 1;
+		}
+	}
+
+	Perf_Sample load = perf_stage_begin(perf);
+	File_Batch batch;
+	if(dirty > 0 && (dirty_paths == NULL || dirty_files == NULL || !file_batch_init(&batch, dirty_paths, dirty_len, allocator))){
+		fprintf(stderr, "Out of memory\n");
+		status = 1;
+	}
+	else if(dirty > 0){
+		File_Batch_Result file;
+		for(; file_batch_next(&batch, &file); load = perf_stage_begin(perf)){
+			perf_stage_end(perf, Perf_Stage_Load, load);
+			String source = str_from_bytes(file.data.data, file.data.len);
+
+			Token_Stream ts;
+			Perf_Sample lex = perf_stage_begin(perf);
+			bool ok = file.error == 0 && token_stream_lex(&ts, str_from(CACHE_DIR), source, allocator);
+			perf_stage_end(perf, Perf_Stage_Lex, lex);
+			if(ok){
+				token_stream_destroy(&ts);
+				graph.files[dirty_files[file.index]].failed = false;
+			} else {
+				fprintf(stderr, "Could not build %.*s\n", FMT_STRING(dirty_paths[file.index]));
+				status = 1;
+			}
+			mem_free(allocator, file.data.data);
+		}
+		file_batch_destroy(&batch);
+	}
+	mem_free(allocator, dirty_paths);
+	mem_free(allocator, dirty_files);
+
+	if(dirty >= 0){
+		printf("%td of %td files rebuilt\n", dirty, graph.len);
+		mkdir(CACHE_DIR, 0755);
+		if(!build_graph_save(&graph, str_from(graph_path))){
+			fprintf(stderr, "Could not save build graph\n");
+			status = 1;
+		}
+	}
+
+	build_graph_destroy(&graph);
+	mem_free(allocator, sources);
+	return status;
+}
+
+// Send each file to a running compile server, printing its diagnostics
+static int client_files(cstring socket_path, cstring command, cstring* paths, int count){
+	IO_Writer w = io_to_writer(file_stream(stdout));
+	int status = 0;
+	for(int i = 0; i < count; i += 1){
+		isize errors = server_client_request(str_from(socket_path), str_from(command), str_from(paths[i]), w);
+		if(errors < 0){
+			fprintf(stderr, "Request for %s failed\n", paths[i]);
+			status = 2;
+		}
+		else if(errors > 0 && status == 0){
+			status = 1;
+		}
+	}
+	fflush(stdout);
+	return status;
+}
+
+int main(int argc, cstring* argv){
     Mem_Allocator allocator, temp_allocator;
     init_allocators(&allocator, &temp_allocator);
 
+	cstring perf_env = getenv("KUURU_PERF");
+	if(perf_env != NULL && perf_env[0] != 0){
+		perf_profile_init(&perf_profile);
+		perf = &perf_profile;
+		atexit(perf_report);
+	}
+
+	if(argc > 2 && str_eq(str_from(argv[1]), str_from("lex"))){
+		return lex_files(&argv[2], argc - 2, allocator);
+	}
+	if(argc > 2 && str_eq(str_from(argv[1]), str_from("fmt"))){
+		return fmt_files(&argv[2], argc - 2, allocator);
+	}
+	if(argc > 2 && str_eq(str_from(argv[1]), str_from("build"))){
+		return build_files(&argv[2], argc - 2, allocator);
+	}
+	if(argc == 3 && str_eq(str_from(argv[1]), str_from("serve"))){
+		return server_run(str_from(argv[2]), perf, allocator, temp_allocator) ? 0 : 1;
+	}
+	if(argc == 3 && str_eq(str_from(argv[1]), str_from("shutdown"))){
+		isize res = server_client_request(str_from(argv[2]), str_from("shutdown"), (String){0}, io_to_writer(file_stream(stdout)));
+		return res < 0;
+	}
+	if(argc > 3 && (str_eq(str_from(argv[1]), str_from("check")) || str_eq(str_from(argv[1]), str_from("compile")))){
+		return client_files(argv[2], argv[1], &argv[3], argc - 3);
+	}
+
 	Lexer lexer = lexer_make(str_from("+-*/%"));
 	while(1){
 		Token tk = lexer_next(&lexer);
@@ -45,8 +284,8 @@ int main(){
 	}
 
 
-	Token tokens[] = {{.lexeme = str_from("Hello"), .kind = Tk_Identifier}};
-	format_token_list(&bb, tokens, 1);
+	Token tokens[] = {{.kind = Tk_Identifier, .len = 5, .loc = 0}};
+	format_token_list(&bb, str_from("Hello"), tokens, 1);
 	byte* b = buffer_bytes(&bb);
 	printf("%s\n", b);
 
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# Generates kuuru_c/unicode_xid.h, the XID_Start/XID_Continue lookup tables.
+#
+#   ./unicode_xid.py [DerivedCoreProperties.txt] > kuuru_c/unicode_xid.h
+#
+# Without a file the properties come from Python's own Unicode database.
+
+import sys
+import unicodedata
+
+CODEPOINTS = 0x110000
+TABLE_END = 0x40000                # Tables cover planes 0 to 3
+HIGH_CONTINUE = (0xE0100, 0xE01EF) # Only XID characters past them: variation selectors
+LEAF_SHIFT = 6                     # 64 codepoints per leaf, one u64 per property
+
+def from_ucd(path):
+    start, cont = bytearray(CODEPOINTS), bytearray(CODEPOINTS)
+    version = 'unknown'
+    with open(path, encoding='utf-8') as f:
+        for line in f:
+            if line.startswith('# DerivedCoreProperties-'):
+                version = line[len('# DerivedCoreProperties-'):].split('.txt')[0]
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            cps, prop = [s.strip() for s in line.split(';')]
+            if prop not in ('XID_Start', 'XID_Continue'):
+                continue
+            lo, _, hi = cps.partition('..')
+            target = start if prop == 'XID_Start' else cont
+            for c in range(int(lo, 16), int(hi or lo, 16) + 1):
+                target[c] = 1
+    return start, cont, version
+
+def from_python():
+    # str.isidentifier() is XID_Start (plus '_') followed by XID_Continue
+    start, cont = bytearray(CODEPOINTS), bytearray(CODEPOINTS)
+    for c in range(CODEPOINTS):
+        if 0xD800 <= c <= 0xDFFF:
+            continue
+        ch = chr(c)
+        start[c] = ch != '_' and ch.isidentifier()
+        cont[c] = ('a' + ch).isidentifier()
+    return start, cont, unicodedata.unidata_version
+
+def leaf_bits(prop, block):
+    bits = 0
+    for i in range(1 << LEAF_SHIFT):
+        if prop[(block << LEAF_SHIFT) + i]:
+            bits |= 1 << i
+    return bits
+
+def build(start, cont, root_shift):
+    leaves, leaf_of_block = {}, []
+    for block in range(TABLE_END >> LEAF_SHIFT):
+        key = (leaf_bits(start, block), leaf_bits(cont, block))
+        leaf_of_block.append(leaves.setdefault(key, len(leaves)))
+
+    per_mid = 1 << (root_shift - LEAF_SHIFT)
+    mids, root = {}, []
+    for r in range(TABLE_END >> root_shift):
+        key = tuple(leaf_of_block[r * per_mid:(r + 1) * per_mid])
+        root.append(mids.setdefault(key, len(mids)))
+    return list(leaves), list(mids), root
+
+def int_type(count):
+    return 'u8' if count <= 256 else 'u16'
+
+def table_size(leaves, mids, root):
+    mid_bytes = 1 if len(leaves) <= 256 else 2
+    root_bytes = 1 if len(mids) <= 256 else 2
+    return len(leaves) * 16 + len(mids) * len(mids[0]) * mid_bytes + len(root) * root_bytes
+
+def main():
+    start, cont, version = from_ucd(sys.argv[1]) if len(sys.argv) > 1 else from_python()
+
+    lo, hi = HIGH_CONTINUE
+    for c in range(TABLE_END, CODEPOINTS):
+        assert not start[c] and cont[c] == (lo <= c <= hi), 'XID characters moved past the tables'
+
+    best = min((table_size(*build(start, cont, s)), s) for s in range(LEAF_SHIFT + 2, LEAF_SHIFT + 9))
+    size, root_shift = best
+    leaves, mids, root = build(start, cont, root_shift)
+
+    out = []
+    w = out.append
+    w('#pragma once')
+    w('// Generated by unicode_xid.py from Unicode %s, do not edit' % version)
+    w('')
+    w('#include "base.h"')
+    w('')
+    w('///- Interface -----------------------------------------------------------------')
+    w('')
+    w('// Tell if c is an XID_Start / XID_Continue character (UAX #31), with three')
+    w('// dependent loads for codepoints below 0x%X and a range check above.' % TABLE_END)
+    w('// Tables take %d bytes.' % size)
+    w('bool unicode_is_xid_start(Codepoint c);')
+    w('bool unicode_is_xid_continue(Codepoint c);')
+    w('')
+    w('///- Implementation ------------------------------------------------------------')
+    w('#ifdef KUURU_IMPLEMENTATION')
+    w('')
+    w('#define UNICODE_XID_ROOT_SHIFT %d' % root_shift)
+    w('#define UNICODE_XID_LEAF_SHIFT %d' % LEAF_SHIFT)
+    w('#define UNICODE_XID_TABLE_END 0x%X' % TABLE_END)
+    w('')
+    w('// Codepoint >> ROOT_SHIFT to a row of unicode_xid_mid')
+    w('static const %s unicode_xid_root[%d] = {' % (int_type(len(mids)), len(root)))
+    for i in range(0, len(root), 16):
+        w('\t' + ' '.join('%d,' % x for x in root[i:i + 16]))
+    w('};')
+    w('')
+    w('// Next bits of the codepoint to a leaf')
+    w('static const %s unicode_xid_mid[%d][%d] = {' % (int_type(len(leaves)), len(mids), len(mids[0])))
+    for m in mids:
+        w('\t{' + ', '.join('%d' % x for x in m) + '},')
+    w('};')
+    w('')
+    w('// XID_Start and XID_Continue bits of 64 codepoints')
+    w('static const u64 unicode_xid_leaves[%d][2] = {' % len(leaves))
+    for s, c in leaves:
+        w('\t{0x%016xull, 0x%016xull},' % (s, c))
+    w('};')
+    w('')
+    w('static inline')
+    w('u64 unicode_xid_leaf(u32 c, int property){')
+    w('\tu32 mid = unicode_xid_root[c >> UNICODE_XID_ROOT_SHIFT];')
+    w('\tu32 leaf = unicode_xid_mid[mid][(c >> UNICODE_XID_LEAF_SHIFT) & ((1u << (UNICODE_XID_ROOT_SHIFT - UNICODE_XID_LEAF_SHIFT)) - 1)];')
+    w('\treturn unicode_xid_leaves[leaf][property] >> (c & 63);')
+    w('}')
+    w('')
+    w('bool unicode_is_xid_start(Codepoint c){')
+    w('\tif((u32)c >= UNICODE_XID_TABLE_END){ return false; }')
+    w('\treturn unicode_xid_leaf((u32)c, 0) & 1;')
+    w('}')
+    w('')
+    w('bool unicode_is_xid_continue(Codepoint c){')
+    w('\tif((u32)c >= UNICODE_XID_TABLE_END){ return c >= 0x%X && c <= 0x%X; }' % HIGH_CONTINUE)
+    w('\treturn unicode_xid_leaf((u32)c, 1) & 1;')
+    w('}')
+    w('')
+    w('#undef UNICODE_XID_ROOT_SHIFT')
+    w('#undef UNICODE_XID_LEAF_SHIFT')
+    w('#undef UNICODE_XID_TABLE_END')
+    w('#endif')
+    print('\n'.join(out))
+
+if __name__ == '__main__':
+    main()